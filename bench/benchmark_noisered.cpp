@@ -0,0 +1,389 @@
+// Timings of the stages of the noise reduction pipeline, on synthetic audio.
+//
+//   benchmark_noisered [--seconds=N] [--channels=N] [benchmark options]
+//
+// The signal is --seconds (default 10) of a tone in noise at 44.1 kHz, with
+// --channels (default 1) channels, each its own noise.  The Worker's stages
+// are private, so they are timed through the entry points that reach them,
+// each doing one stage more than the last:
+//
+//   Profile        FillFirstHistoryWindow, summing the noise statistics
+//   Analyze        and Classify, without synthesis (from a file)
+//   Reduce/0       and ReduceNoise: attack, release, the inverse FFT and
+//                  overlap-add, without frequency smoothing
+//   Reduce/3       and ApplyFreqSmoothing over 3 bands
+//
+// so the time of each is the difference from the one before.  Their
+// step_time counters are per step of one channel.
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "DirManager.h"
+#include "ExportPCM.h"
+#include "FFTBackend.h"
+#include "ImportPCM.h"
+#include "NoiseReduction.h"
+#include "RealFFTf.h"
+#include "Sequence.h"
+#include "WaveTrack.h"
+#include "sndfile.h"
+
+namespace {
+
+double gSeconds = 10.0;
+unsigned gChannels = 1;
+const double gRate = 44100.0;
+const char *const gInputPath = "bench_input.wav";
+const char *const gOutputPath = "bench_output.wav";
+
+// The default advanced settings, of which Reduce and Analyze take steps
+const size_t gStepSize = 2048 / 4;
+
+size_t Frames() { return (size_t) (gSeconds * gRate); }
+
+// A 440 Hz tone in white noise, channels interleaved; the noise alone when
+// toneLevel is 0
+std::vector<float> MakeSignal(size_t frames, float toneLevel) {
+    std::vector<float> samples(frames * gChannels);
+    unsigned seed = 1;
+    for (size_t ii = 0; ii < frames; ++ii) {
+        const float tone = toneLevel * (float) sin(2 * M_PI * 440.0 * ii / gRate);
+        for (unsigned cc = 0; cc < gChannels; ++cc) {
+            seed = seed * 1103515245u + 12345u;
+            const float noise = 0.01f * ((float) ((seed >> 8) & 0xffff) / 0x8000 - 1.0f);
+            samples[ii * gChannels + cc] = tone + noise;
+        }
+    }
+    return samples;
+}
+
+const std::vector<float> &Noise() {
+    static const auto noise = MakeSignal((size_t) gRate, 0.0f);
+    return noise;
+}
+
+const std::vector<float> &Signal() {
+    static const auto signal = MakeSignal(Frames(), 0.2f);
+    return signal;
+}
+
+// The signal as a 16 bit file, for the stages that read one
+void WriteInputFile() {
+    SF_INFO info = {};
+    info.samplerate = (int) gRate;
+    info.channels = (int) gChannels;
+    info.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+    auto file = sf_open(gInputPath, SFM_WRITE, &info);
+    if (file == nullptr) {
+        fprintf(stderr, "Cannot write %s\n", gInputPath);
+        exit(1);
+    }
+    sf_writef_float(file, Signal().data(), Frames());
+    sf_close(file);
+}
+
+void SetStepCounter(benchmark::State &state, size_t frames) {
+    state.counters["step_time"] = benchmark::Counter(
+            (double) ((frames + gStepSize - 1) / gStepSize),
+            benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+}
+
+void SetBytes(benchmark::State &state, size_t bytes) {
+    state.SetBytesProcessed((int64_t) (state.iterations() * bytes));
+}
+
+//----------------------------------------------------------------------------
+// Transforms, one window at a time
+//----------------------------------------------------------------------------
+
+void BM_RealFFTf(benchmark::State &state) {
+    const auto size = (size_t) state.range(0);
+    const auto hFFT = GetFFT(size);
+    std::vector<fft_type> buffer(Signal().begin(), Signal().begin() + size);
+    for (auto _ : state) {
+        RealFFTf(buffer.data(), hFFT.get());
+        benchmark::DoNotOptimize(buffer.data());
+        benchmark::ClobberMemory();
+    }
+    SetBytes(state, size * sizeof(fft_type));
+}
+BENCHMARK(BM_RealFFTf)->ArgName("size")->RangeMultiplier(2)->Range(8, 16384);
+
+void BM_InverseRealFFTf(benchmark::State &state) {
+    const auto size = (size_t) state.range(0);
+    const auto hFFT = GetFFT(size);
+    std::vector<fft_type> buffer(Signal().begin(), Signal().begin() + size);
+    RealFFTf(buffer.data(), hFFT.get());
+    for (auto _ : state) {
+        InverseRealFFTf(buffer.data(), hFFT.get());
+        benchmark::DoNotOptimize(buffer.data());
+        benchmark::ClobberMemory();
+    }
+    SetBytes(state, size * sizeof(fft_type));
+}
+BENCHMARK(BM_InverseRealFFTf)->ArgName("size")->RangeMultiplier(2)->Range(8, 16384);
+
+// Both through the plan of the current backend, as the Worker does them
+void BM_FFTPlan(benchmark::State &state) {
+    const auto size = (size_t) state.range(0);
+    const auto plan = MakeFFTPlan(size);
+    std::vector<float> buffer(Signal().begin(), Signal().begin() + size);
+    for (auto _ : state) {
+        plan->Forward(buffer.data());
+        plan->Inverse(buffer.data());
+        benchmark::DoNotOptimize(buffer.data());
+        benchmark::ClobberMemory();
+    }
+    SetBytes(state, 2 * size * sizeof(float));
+    state.SetLabel(GetFFTBackend().GetName());
+}
+BENCHMARK(BM_FFTPlan)->ArgName("size")->RangeMultiplier(2)->Range(8, 16384);
+
+// A batch of forward transforms at once (Arg 1) or one at a time (Arg 0)
+void BM_FFTBatch(benchmark::State &state) {
+    const auto size = (size_t) state.range(0);
+    const bool batched = state.range(1) != 0;
+    const auto plan = MakeFFTPlan(size);
+    std::vector<std::vector<float>> buffers(FFTBatchFrames,
+        std::vector<float>(Signal().begin(), Signal().begin() + size));
+    std::vector<float *> frames;
+    for (auto &buffer : buffers)
+        frames.push_back(buffer.data());
+    for (auto _ : state) {
+        for (auto &buffer : buffers)
+            std::copy(Signal().begin(), Signal().begin() + size, buffer.begin());
+        if (batched)
+            plan->ForwardBatch(frames.data(), frames.size());
+        else
+            for (auto frame : frames)
+                plan->Forward(frame);
+        benchmark::DoNotOptimize(frames.data());
+        benchmark::ClobberMemory();
+    }
+    SetBytes(state, FFTBatchFrames * size * sizeof(float));
+    state.SetLabel(GetFFTBackend().GetName());
+}
+BENCHMARK(BM_FFTBatch)->ArgNames({"size", "batched"})->Args({256, 0})->Args({256, 1})
+    ->Args({2048, 0})->Args({2048, 1})->Args({8192, 0})->Args({8192, 1});
+
+//----------------------------------------------------------------------------
+// The Worker, over the whole signal
+//----------------------------------------------------------------------------
+
+void BM_Profile(benchmark::State &state) {
+    EffectNoiseReduction effect;
+    const auto &signal = Signal();
+    for (auto _ : state) {
+        if (!effect.GetProfileBuffer(signal.data(), gChannels, Frames(), gRate, 12.0, 6.0, 3.0))
+            state.SkipWithError("profiling failed");
+    }
+    SetStepCounter(state, Frames());
+}
+BENCHMARK(BM_Profile)->Unit(benchmark::kMillisecond);
+
+void BM_Analyze(benchmark::State &state) {
+    EffectNoiseReduction effect;
+    const auto &noise = Noise();
+    effect.GetProfileBuffer(noise.data(), gChannels, noise.size() / gChannels, gRate, 12.0, 6.0, 3.0);
+    EffectNoiseReduction::NoisePreview preview;
+    for (auto _ : state) {
+        if (!effect.PreviewNoise(gInputPath, 1, 6.0, preview))
+            state.SkipWithError("analysis failed");
+    }
+    SetStepCounter(state, Frames());
+}
+BENCHMARK(BM_Analyze)->Unit(benchmark::kMillisecond);
+
+void BM_Reduce(benchmark::State &state) {
+    const auto smoothing = (double) state.range(0);
+    EffectNoiseReduction effect;
+    const auto &noise = Noise();
+    effect.GetProfileBuffer(noise.data(), gChannels, noise.size() / gChannels, gRate, 12.0, 6.0, smoothing);
+    const auto &signal = Signal();
+    std::vector<float> out(signal.size());
+    for (auto _ : state) {
+        if (!effect.ReduceNoiseBuffer(signal.data(), out.data(), gChannels, Frames(), gRate,
+                                      12.0, 6.0, smoothing))
+            state.SkipWithError("reduction failed");
+    }
+    SetStepCounter(state, Frames());
+    SetBytes(state, signal.size() * sizeof(float));
+}
+BENCHMARK(BM_Reduce)->ArgName("smoothing")->Arg(0)->Arg(3)->Unit(benchmark::kMillisecond);
+
+//----------------------------------------------------------------------------
+// Tracks and files
+//----------------------------------------------------------------------------
+
+// The whole track path, import to reduction, for blocks of kB kilobytes
+void BM_ReduceTrack(benchmark::State &state) {
+    EffectNoiseReduction effect;
+    const auto &noise = Noise();
+    effect.GetProfileBuffer(noise.data(), gChannels, noise.size() / gChannels, gRate, 12.0, 6.0, 3.0);
+    for (auto _ : state) {
+        const auto dirManager = std::make_shared<DirManager>();
+        dirManager->SetMaxBlockBytes((size_t) state.range(0) << 10);
+        TrackFactory factory(dirManager);
+        auto handle = PCMImportFileHandle::Open(gInputPath);
+        TrackHolders holders{};
+        if (!handle || handle->Import(&factory, holders) != ProgressResult::Success) {
+            state.SkipWithError("import failed");
+            break;
+        }
+        std::vector<WaveTrack *> tracks;
+        for (const auto &holder : holders)
+            tracks.push_back(holder.get());
+        if (!effect.ReduceNoise(tracks, 12.0, 6.0, 3.0, &factory))
+            state.SkipWithError("reduction failed");
+    }
+    SetBytes(state, Frames() * gChannels * sizeof(float));
+}
+BENCHMARK(BM_ReduceTrack)->ArgName("kB")->RangeMultiplier(4)->Range(64, 16384)
+        ->Unit(benchmark::kMillisecond);
+
+// Reductions of the input file with several settings, as one sweep that
+// classifies once or as that many separate reductions
+void BM_Sweep(benchmark::State &state) {
+    const bool sweep = state.range(0) != 0;
+    const auto count = (size_t) state.range(1);
+    EffectNoiseReduction effect;
+    const auto &noise = Noise();
+    effect.GetProfileBuffer(noise.data(), gChannels, noise.size() / gChannels, gRate, 12.0, 6.0, 3.0);
+    std::vector<EffectNoiseReduction::SweepSetting> settings;
+    for (size_t ii = 0; ii < count; ++ii)
+        settings.push_back({6.0 + 6.0 * ii, (double) ii, gOutputPath});
+    for (auto _ : state) {
+        bool result = true;
+        if (sweep)
+            result = effect.ReduceNoiseSweep(gInputPath, 6.0, settings);
+        else
+            for (const auto &setting : settings)
+                result = result && effect.ReduceNoiseStreaming(gInputPath, gOutputPath, setting.noiseGain, 6.0,
+                                                               setting.freqSmoothingBands);
+        if (!result)
+            state.SkipWithError("reduction failed");
+    }
+    SetBytes(state, count * Frames() * gChannels * sizeof(float));
+    remove(gOutputPath);
+}
+BENCHMARK(BM_Sweep)->ArgNames({"sweep", "settings"})->Args({0, 1})->Args({1, 1})->Args({0, 4})
+        ->Args({1, 4})->Unit(benchmark::kMillisecond);
+
+void BM_Import(benchmark::State &state) {
+    for (auto _ : state) {
+        const auto dirManager = std::make_shared<DirManager>();
+        TrackFactory factory(dirManager);
+        auto handle = PCMImportFileHandle::Open(gInputPath);
+        TrackHolders holders{};
+        if (!handle || handle->Import(&factory, holders) != ProgressResult::Success)
+            state.SkipWithError("import failed");
+    }
+    SetBytes(state, Frames() * gChannels * sizeof(short));
+}
+BENCHMARK(BM_Import)->Unit(benchmark::kMillisecond);
+
+// One channel of floats, in the pieces WaveTrack would append (piece 0),
+// or in pieces of that many samples
+void BM_SequenceAppend(benchmark::State &state) {
+    std::vector<float> channel(Frames());
+    for (size_t ii = 0; ii < channel.size(); ++ii)
+        channel[ii] = Signal()[ii * gChannels];
+    for (auto _ : state) {
+        const auto dirManager = std::make_shared<DirManager>();
+        Sequence sequence(dirManager, floatSample);
+        for (size_t pos = 0; pos < channel.size();) {
+            const auto chunk = state.range(0) ? (size_t) state.range(0) : sequence.GetIdealAppendLen();
+            const auto len = std::min(chunk, channel.size() - pos);
+            sequence.Append((samplePtr) &channel[pos], floatSample, len);
+            pos += len;
+        }
+        benchmark::DoNotOptimize(sequence.GetNumSamples());
+    }
+    SetBytes(state, channel.size() * sizeof(float));
+}
+BENCHMARK(BM_SequenceAppend)->ArgName("piece")->Arg(0)->Arg(65536)->Arg(4096)
+        ->Unit(benchmark::kMillisecond);
+
+// Reading it back forward a step at a time, as the Worker and Mixer do
+void BM_SequenceGet(benchmark::State &state) {
+    std::vector<float> channel(Frames());
+    for (size_t ii = 0; ii < channel.size(); ++ii)
+        channel[ii] = Signal()[ii * gChannels];
+    const auto dirManager = std::make_shared<DirManager>();
+    Sequence sequence(dirManager, floatSample);
+    sequence.Append((samplePtr) channel.data(), floatSample, channel.size());
+    std::vector<float> buffer(gStepSize);
+    for (auto _ : state) {
+        for (size_t pos = 0; pos < channel.size(); pos += gStepSize)
+            sequence.Get((samplePtr) buffer.data(), floatSample, pos,
+                         std::min(gStepSize, channel.size() - pos), true);
+        benchmark::DoNotOptimize(buffer.data());
+    }
+    SetBytes(state, channel.size() * sizeof(float));
+}
+BENCHMARK(BM_SequenceGet)->Unit(benchmark::kMillisecond);
+
+void BM_Export(benchmark::State &state) {
+    const auto dirManager = std::make_shared<DirManager>();
+    TrackFactory factory(dirManager);
+    auto handle = PCMImportFileHandle::Open(gInputPath);
+    TrackHolders holders{};
+    if (!handle || handle->Import(&factory, holders) != ProgressResult::Success) {
+        state.SkipWithError("import failed");
+        return;
+    }
+    auto tracks = WaveTrackConstArray();
+    for (auto &holder : holders)
+        tracks.emplace_back(std::move(holder));
+    for (auto _ : state) {
+        ExportPCM exporter;
+        if (exporter.Export(tracks, gOutputPath) != ProgressResult::Success)
+            state.SkipWithError("export failed");
+    }
+    SetBytes(state, Frames() * gChannels * sizeof(short));
+    remove(gOutputPath);
+}
+BENCHMARK(BM_Export)->Unit(benchmark::kMillisecond);
+
+// Takes this program's options out of argv, leaving those of the library
+void ParseOptions(int &argc, char **argv) {
+    int kept = 1;
+    for (int ii = 1; ii < argc; ++ii) {
+        if (strncmp(argv[ii], "--seconds=", 10) == 0)
+            gSeconds = atof(argv[ii] + 10);
+        else if (strncmp(argv[ii], "--channels=", 11) == 0)
+            gChannels = (unsigned) atoi(argv[ii] + 11);
+        else
+            argv[kept++] = argv[ii];
+    }
+    argc = kept;
+    if (!(gSeconds > 0) || gChannels == 0) {
+        fprintf(stderr, "--seconds and --channels must be positive\n");
+        exit(1);
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    ParseOptions(argc, argv);
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::AddCustomContext("seconds", std::to_string(gSeconds));
+    benchmark::AddCustomContext("channels", std::to_string(gChannels));
+
+    WriteInputFile();
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    remove(gInputPath);
+    return 0;
+}
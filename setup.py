@@ -29,15 +29,40 @@ sources += ['src/pyaudacity/noiseredmodule.cpp']
 # additional CFLAGS
 extra_compile_args = ['-std=c++14', '-Wextra', '-pedantic',
                       '-Wno-unused-parameter', '-Wno-unused-variable',
-                      '-Wno-implicit-fallthrough']
+                      '-Wno-implicit-fallthrough', '-pthread']
+
+# optional FFTW transforms: USE_FFTW=1 python setup.py build
+define_macros = []
+libraries = ['stdc++', 'sndfile', 'soxr']
+if os.environ.get('USE_FFTW'):
+    define_macros += [('USE_FFTW', None)]
+    libraries += ['fftw3f']
+
+# optional cuFFT transforms: USE_CUFFT=1 python setup.py build, with CUDA under CUDA_HOME (default /usr/local/cuda)
+include_dirs = ['src/audacity']
+library_dirs = []
+if os.environ.get('USE_CUFFT'):
+    cuda_home = os.environ.get('CUDA_HOME', '/usr/local/cuda')
+    # the default, since hosts without a device fall back to the built-in transforms
+    define_macros += [('USE_CUFFT', None), ('DEFAULT_FFT_BACKEND', '"cufft"')]
+    libraries += ['cufft', 'cudart']
+    include_dirs += [os.path.join(cuda_home, 'include')]
+    library_dirs += [os.path.join(cuda_home, 'lib64')]
+
+# optional per-stage timings and counters: USE_INSTRUMENTATION=1 python setup.py build
+if os.environ.get('USE_INSTRUMENTATION'):
+    define_macros += [('USE_INSTRUMENTATION', None)]
 
 # create build module
 module = Extension(name='cmodule',
                    # define_macros=[('MAJOR_VERSION', '2'), ('MINOR_VERSION', '1')],
-                   libraries=['stdc++', 'sndfile', 'soxr'],
+                   define_macros=define_macros,
+                   libraries=libraries,
                    language='c++14',
                    extra_compile_args=extra_compile_args,
-                   include_dirs=['src/audacity'],
+                   extra_link_args=['-pthread'],
+                   include_dirs=include_dirs,
+                   library_dirs=library_dirs,
                    sources=sources,
                    )
 
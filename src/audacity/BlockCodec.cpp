@@ -0,0 +1,347 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  BlockCodec.cpp
+
+  A coded block is a header of four bytes (the mode, the predictor order,
+  the partition size as a shift and one unused) and then a stream of bits,
+  most significant first.  The first order samples are written whole, in
+  32 bits.  Each partition of residuals starts with its Rice parameter k
+  in 6 bits; each residual, zigzagged, is then its quotient by 2^k in
+  unary and its k low bits, or for a quotient of 32 or more, 32 ones and
+  the value in 40 bits.
+
+**********************************************************************/
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "BlockCodec.h"
+
+namespace {
+
+enum Mode : uint8_t {
+    Raw,       // the samples as they are
+    Integers,  // int16Sample or int24Sample samples
+    Scaled16,  // floats that are 16 bit integers over 2^15
+    Scaled24,  // floats that are 24 bit integers over 2^23
+    FloatBits, // other floats: sign and exponent predicted, mantissa as it is
+};
+
+const size_t headerBytes = 4;
+const unsigned maxOrder = 4;
+const unsigned wholeBits = 32;
+const unsigned parameterBits = 6;
+const unsigned maxParameter = 40;
+const unsigned escapeQuotient = 32;
+const unsigned escapeBits = 40;
+const unsigned mantissaBits = 23;
+
+struct LevelSettings {
+    unsigned minOrder, maxOrder;
+    unsigned partitionShift;
+};
+
+const LevelSettings levelSettings[] = {
+        {2, 2, 12},
+        {0, 3, 8},
+        {0, 4, 6},
+};
+
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<char> &out) : mOut(out) {}
+
+    // bits up to 40
+    void Put(uint64_t value, unsigned bits) {
+        mBits = (mBits << bits) | value;
+        mCount += bits;
+        while (mCount >= 8) {
+            mCount -= 8;
+            mOut.push_back((char) (mBits >> mCount));
+        }
+    }
+
+    void PutRice(uint64_t value, unsigned k) {
+        const auto quotient = value >> k;
+        if (quotient >= escapeQuotient) {
+            Put((1ull << escapeQuotient) - 1, escapeQuotient);
+            Put(value, escapeBits);
+        } else {
+            // quotient ones and a zero
+            Put(((1ull << quotient) - 1) << 1, (unsigned) quotient + 1);
+            Put(value & ((1ull << k) - 1), k);
+        }
+    }
+
+    void Flush() {
+        if (mCount > 0)
+            mOut.push_back((char) (mBits << (8 - mCount)));
+        mCount = 0;
+    }
+
+private:
+    std::vector<char> &mOut;
+    uint64_t mBits{0};
+    unsigned mCount{0};
+};
+
+class BitReader {
+public:
+    BitReader(const char *data, size_t bytes) : mData(data), mEnd(data + bytes) {}
+
+    uint64_t Get(unsigned bits) {
+        while (mCount < bits) {
+            if (mData == mEnd) {
+                mOverrun = true;
+                return 0;
+            }
+            mBits = (mBits << 8) | (uint8_t) *mData++;
+            mCount += 8;
+        }
+        mCount -= bits;
+        return (mBits >> mCount) & ((1ull << bits) - 1);
+    }
+
+    uint64_t GetRice(unsigned k) {
+        unsigned quotient = 0;
+        while (quotient < escapeQuotient && Get(1) == 1 && !mOverrun)
+            ++quotient;
+        if (quotient == escapeQuotient)
+            return Get(escapeBits);
+        return ((uint64_t) quotient << k) | Get(k);
+    }
+
+    bool Overrun() const { return mOverrun; }
+
+private:
+    const char *mData;
+    const char *const mEnd;
+    uint64_t mBits{0};
+    unsigned mCount{0};
+    bool mOverrun{false};
+};
+
+inline uint64_t Zigzag(int64_t value) {
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+inline int64_t Unzigzag(uint64_t value) {
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+// FLAC's fixed polynomial of order over the samples before x[i]
+inline int64_t Predict(const int32_t *x, size_t i, unsigned order) {
+    switch (order) {
+        case 0:
+            return 0;
+        case 1:
+            return x[i - 1];
+        case 2:
+            return 2 * (int64_t) x[i - 1] - x[i - 2];
+        case 3:
+            return 3 * ((int64_t) x[i - 1] - x[i - 2]) + x[i - 3];
+        default:
+            return 4 * ((int64_t) x[i - 1] + x[i - 3]) - 6 * (int64_t) x[i - 2] - x[i - 4];
+    }
+}
+
+unsigned BestOrder(const std::vector<int32_t> &ints, const LevelSettings &settings) {
+    unsigned best = settings.minOrder;
+    uint64_t bestSum = UINT64_MAX;
+    for (unsigned order = settings.minOrder; order <= settings.maxOrder; ++order) {
+        uint64_t sum = 0;
+        for (size_t i = order; i < ints.size(); ++i)
+            sum += Zigzag(ints[i] - Predict(ints.data(), i, order));
+        if (sum < bestSum)
+            bestSum = sum, best = order;
+    }
+    return best;
+}
+
+unsigned RiceParameter(const uint64_t *values, size_t count) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count; ++i)
+        sum += values[i];
+    // About log2 of the mean
+    unsigned k = 0;
+    while (k < maxParameter && (count << (k + 1)) <= sum)
+        ++k;
+    return k;
+}
+
+// The samples of the modes coded as integers, or false if they are not
+bool ToIntegers(constSamplePtr samples, sampleFormat format, size_t len,
+                Mode mode, std::vector<int32_t> &ints) {
+    ints.resize(len);
+    if (mode == Integers) {
+        if (format == int16Sample)
+            std::copy((const int16_t *) samples, (const int16_t *) samples + len, ints.begin());
+        else
+            memcpy(ints.data(), samples, len * sizeof(int32_t));
+        return true;
+    }
+
+    const float scale = mode == Scaled16 ? 32768.0f : 8388608.0f;
+    const auto floats = (const float *) samples;
+    for (size_t i = 0; i < len; ++i) {
+        const double value = floats[i] * (double) scale;
+        if (!(value >= -scale && value < scale) || value != (double) (int32_t) value)
+            return false;
+        ints[i] = (int32_t) value;
+        // Bit for bit, so that -0 is not taken for 0
+        const float back = ints[i] / scale;
+        if (memcmp(&back, &floats[i], sizeof back) != 0)
+            return false;
+    }
+    return true;
+}
+
+void EncodeIntegers(const std::vector<int32_t> &ints, Mode mode,
+                    const LevelSettings &settings, std::vector<char> &coded) {
+    const auto len = ints.size();
+    const auto order = (unsigned) std::min<size_t>(BestOrder(ints, settings), len);
+    coded.assign({(char) mode, (char) order, (char) settings.partitionShift, 0});
+
+    BitWriter writer(coded);
+    for (size_t i = 0; i < order; ++i)
+        writer.Put((uint32_t) ints[i], wholeBits);
+
+    std::vector<uint64_t> residuals(len - order);
+    for (size_t i = order; i < len; ++i)
+        residuals[i - order] = Zigzag(ints[i] - Predict(ints.data(), i, order));
+
+    const size_t partition = (size_t) 1 << settings.partitionShift;
+    for (size_t start = 0; start < residuals.size(); start += partition) {
+        const auto count = std::min(partition, residuals.size() - start);
+        const auto k = RiceParameter(&residuals[start], count);
+        writer.Put(k, parameterBits);
+        for (size_t i = start; i < start + count; ++i)
+            writer.PutRice(residuals[i], k);
+    }
+    writer.Flush();
+}
+
+void EncodeFloats(const float *floats, size_t len, const LevelSettings &settings,
+                  std::vector<char> &coded) {
+    coded.assign({(char) FloatBits, 1, (char) settings.partitionShift, 0});
+    std::vector<uint32_t> bits(len);
+    memcpy(bits.data(), floats, len * sizeof(float));
+
+    BitWriter writer(coded);
+    if (len == 0)
+        return;
+    writer.Put(bits[0], wholeBits);
+
+    std::vector<uint64_t> residuals(len - 1);
+    for (size_t i = 1; i < len; ++i)
+        residuals[i - 1] = Zigzag((int64_t) (bits[i] >> mantissaBits) - (bits[i - 1] >> mantissaBits));
+
+    const size_t partition = (size_t) 1 << settings.partitionShift;
+    for (size_t start = 0; start < residuals.size(); start += partition) {
+        const auto count = std::min(partition, residuals.size() - start);
+        const auto k = RiceParameter(&residuals[start], count);
+        writer.Put(k, parameterBits);
+        for (size_t i = start; i < start + count; ++i) {
+            writer.PutRice(residuals[i], k);
+            writer.Put(bits[i + 1] & ((1u << mantissaBits) - 1), mantissaBits);
+        }
+    }
+    writer.Flush();
+}
+
+} // namespace
+
+namespace BlockCodec {
+
+void Encode(constSamplePtr samples, sampleFormat format, size_t len,
+            int level, std::vector<char> &coded) {
+    const auto &settings = levelSettings[std::max(MinLevel, std::min(MaxLevel, level)) - MinLevel];
+    const auto bytes = len * SAMPLE_SIZE(format);
+
+    std::vector<int32_t> ints;
+    if (format != floatSample) {
+        ToIntegers(samples, format, len, Integers, ints);
+        EncodeIntegers(ints, Integers, settings, coded);
+    } else if (ToIntegers(samples, format, len, Scaled16, ints))
+        EncodeIntegers(ints, Scaled16, settings, coded);
+    else if (ToIntegers(samples, format, len, Scaled24, ints))
+        EncodeIntegers(ints, Scaled24, settings, coded);
+    else
+        EncodeFloats((const float *) samples, len, settings, coded);
+
+    if (coded.size() >= headerBytes + bytes) {
+        coded.assign({(char) Raw, 0, 0, 0});
+        coded.insert(coded.end(), samples, samples + bytes);
+    }
+}
+
+bool Decode(const char *coded, size_t bytes, sampleFormat format,
+            size_t len, samplePtr samples) {
+    if (bytes < headerBytes)
+        return false;
+    const auto mode = (Mode) coded[0];
+    const unsigned order = (uint8_t) coded[1];
+    const unsigned partitionShift = (uint8_t) coded[2];
+    if (order > maxOrder || order > len || partitionShift > 16)
+        return false;
+
+    if (mode == Raw) {
+        if (bytes != headerBytes + len * SAMPLE_SIZE(format))
+            return false;
+        memcpy(samples, coded + headerBytes, len * SAMPLE_SIZE(format));
+        return true;
+    }
+    if ((mode == Integers) != (format != floatSample) || mode > FloatBits)
+        return false;
+
+    BitReader reader(coded + headerBytes, bytes - headerBytes);
+    const size_t partition = (size_t) 1 << partitionShift;
+
+    if (mode == FloatBits) {
+        if (len == 0)
+            return true;
+        std::vector<uint32_t> bits(len);
+        bits[0] = (uint32_t) reader.Get(wholeBits);
+        for (size_t start = 1; start < len; start += partition) {
+            const auto k = (unsigned) reader.Get(parameterBits);
+            if (k > maxParameter)
+                return false;
+            for (size_t i = start; i < std::min(len, start + partition); ++i) {
+                const auto top = (bits[i - 1] >> mantissaBits) + Unzigzag(reader.GetRice(k));
+                bits[i] = (uint32_t) (top << mantissaBits) | (uint32_t) reader.Get(mantissaBits);
+            }
+        }
+        memcpy(samples, bits.data(), len * sizeof(float));
+        return !reader.Overrun();
+    }
+
+    std::vector<int32_t> ints(len);
+    for (size_t i = 0; i < order; ++i)
+        ints[i] = (int32_t) (uint32_t) reader.Get(wholeBits);
+    for (size_t start = order; start < len; start += partition) {
+        const auto k = (unsigned) reader.Get(parameterBits);
+        if (k > maxParameter)
+            return false;
+        for (size_t i = start; i < std::min(len, start + partition); ++i)
+            ints[i] = (int32_t) (Predict(ints.data(), i, order) + Unzigzag(reader.GetRice(k)));
+    }
+    if (reader.Overrun())
+        return false;
+
+    if (format == int16Sample)
+        std::copy(ints.begin(), ints.end(), (int16_t *) samples);
+    else if (format == int24Sample)
+        memcpy(samples, ints.data(), len * sizeof(int32_t));
+    else {
+        const float scale = mode == Scaled16 ? 32768.0f : 8388608.0f;
+        const auto floats = (float *) samples;
+        for (size_t i = 0; i < len; ++i)
+            floats[i] = ints[i] / scale;
+    }
+    return true;
+}
+
+}
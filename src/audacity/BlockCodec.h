@@ -0,0 +1,45 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  BlockCodec.h
+
+  Lossless coding of the samples of one block, for CompressedBlockFile.
+
+  Integer samples, and floats that are exactly 16 or 24 bit integers
+  scaled as libsndfile reads them (so most imported audio), are predicted
+  from the samples before them with FLAC's fixed polynomials, and the
+  residuals Rice coded in partitions, each with a parameter of its own.
+  Other floats, such as the noise reduction's output, keep their mantissa
+  bits as they are and Rice code the changes of sign and exponent, which
+  saves much less.  A block that would not get smaller is kept as it is.
+
+**********************************************************************/
+
+#ifndef __AUDACITY_BLOCK_CODEC__
+#define __AUDACITY_BLOCK_CODEC__
+
+#include <cstddef>
+#include <vector>
+
+#include "SampleFormat.h"
+
+namespace BlockCodec {
+
+// Speed against size: 1 tries one predictor over coarse partitions, 3
+// every predictor over fine ones
+const int MinLevel = 1;
+const int MaxLevel = 3;
+
+// Replaces the contents of coded with len samples of format, coded
+void Encode(constSamplePtr samples, sampleFormat format, size_t len,
+            int level, std::vector<char> &coded);
+
+// Decodes bytes of coded into len samples of format, as they were given
+// to Encode(); false if coded is not such a block
+bool Decode(const char *coded, size_t bytes, sampleFormat format,
+            size_t len, samplePtr samples);
+
+}
+
+#endif
@@ -39,6 +39,7 @@ out.
 
 *//*******************************************************************/
 
+#include <algorithm>
 #include <float.h>
 #include <cmath>
 #include <cstring>
@@ -82,7 +83,7 @@ SummaryInfo::SummaryInfo(size_t samples) {
     totalSummaryBytes = offset256 + (frames256 * bytesPerFrame);
 }
 
-ArrayOf<char> BlockFile::fullSummary;
+thread_local ArrayOf<char> BlockFile::fullSummary;
 
 /// Initializes the base BlockFile data.  The block is initially
 /// unlocked and its reference count is 1.
@@ -98,7 +99,8 @@ BlockFile::BlockFile(wxFileNameWrapper &&fileName, size_t samples) :
         mLockCount(0),
         mFileName(std::move(fileName)),
         mLen(samples),
-        mSummaryInfo(SummaryInfo(samples)) {
+        mSummaryInfo(SummaryInfo(samples)),
+        mHaveMinMaxRMS(false) {
     mSilentLog = false;
 }
 
@@ -112,7 +114,7 @@ BlockFile::~BlockFile()
 }
 
 // static
-unsigned long BlockFile::gBlockFileDestructionCount{0};
+std::atomic<unsigned long> BlockFile::gBlockFileDestructionCount{0};
 
 /// Returns true if the block is locked.
 bool BlockFile::IsLocked() {
@@ -120,15 +122,15 @@ bool BlockFile::IsLocked() {
 }
 
 /// Get a buffer containing a summary block describing this sample
-/// data.  This must be called by derived classes when they
-/// are constructed, to allow them to construct their summary data,
-/// after which they should write that data to their disk file.
+/// data.  Derived classes that store summaries call this when they
+/// are constructed, after which they should write that data to their
+/// disk file; others may call it only when the summary is read.
 ///
 /// This method also has the side effect of setting the mMin, mMax,
 /// and mRMS members of this class.
 ///
 /// You must not DELETE the returned buffer; it is static to this
-/// method.
+/// method and the calling thread.
 ///
 /// @param buffer A buffer containing the sample data to be analyzed
 /// @param len    The length of the sample data
@@ -145,8 +147,7 @@ void *BlockFile::CalcSummary(samplePtr buffer, size_t len,
     float *summary64K = (float *) (fullSummary.get() + mSummaryInfo.offset64K);
     float *summary256 = (float *) (fullSummary.get() + mSummaryInfo.offset256);
 
-    float *fbuffer = new float[len];
-    memset(fbuffer, 0, len);
+    ArrayOf<float> fbuffer{len};
     CopySamples(buffer, format,
                 (samplePtr) &fbuffer[0], floatSample, len);
 
@@ -251,6 +252,45 @@ void BlockFile::CalcSummaryFromBuffer(const float *fbuffer, size_t len,
 
     mMin = min;
     mMax = max;
+    mHaveMinMaxRMS = true;
+}
+
+auto BlockFile::GetMinMaxRMS(bool mayThrow) const -> MinMaxRMS {
+    std::lock_guard<std::mutex> lock(mMinMaxRMSMutex);
+
+    if (!mHaveMinMaxRMS) {
+        ArrayOf<float> samples{mLen};
+        ReadData((samplePtr) samples.get(), floatSample, 0, mLen, mayThrow);
+
+        float min = mLen > 0 ? samples[0] : 0.0f, max = min;
+        double sumsq = 0.0;
+        for (size_t i = 0; i < mLen; i++) {
+            const float sample = samples[i];
+            min = std::min(min, sample);
+            max = std::max(max, sample);
+            sumsq += sample * sample;
+        }
+
+        mMin = min;
+        mMax = max;
+        mRMS = mLen > 0 ? sqrt(sumsq / mLen) : 0.0f;
+        mHaveMinMaxRMS = true;
+    }
+
+    return {mMin, mMax, mRMS};
+}
+
+bool BlockFile::ReadSummaryOfSamples(ArrayOf<char> &data, samplePtr samples,
+                                     sampleFormat format, bool enabled) {
+    if (!enabled)
+        return false;
+
+    std::lock_guard<std::mutex> lock(mMinMaxRMSMutex);
+    ArrayOf<char> cleanup;
+    const void *summary = CalcSummary(samples, mLen, format, cleanup);
+    data.reinit(mSummaryInfo.totalSummaryBytes);
+    memcpy(data.get(), summary, mSummaryInfo.totalSummaryBytes);
+    return true;
 }
 
 /// Returns the file name of the disk file associated with this
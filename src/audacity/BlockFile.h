@@ -12,6 +12,8 @@
 #ifndef __AUDACITY_BLOCKFILE__
 #define __AUDACITY_BLOCKFILE__
 
+#include <atomic>
+#include <mutex>
 #include <string>
 
 #include "MemoryX.h"
@@ -57,7 +59,7 @@ public:
 
     virtual ~BlockFile();
 
-    static unsigned long gBlockFileDestructionCount;
+    static std::atomic<unsigned long> gBlockFileDestructionCount;
 
     // Reading
 
@@ -68,6 +70,14 @@ public:
 
     virtual bool IsLocked();
 
+    struct MinMaxRMS {
+        float min, max, RMS;
+    };
+
+    /// Extremes and RMS of the whole block.  Blocks don't work these out
+    /// until the first call, or until their summary is read.
+    MinMaxRMS GetMinMaxRMS(bool mayThrow = true) const;
+
     /// Read the summary section of the file.  Derived classes implement.
     virtual bool ReadSummary(ArrayOf<char> &data) = 0;
 
@@ -116,6 +126,11 @@ public:
                             size_t start, size_t len, bool mayThrow = true)
     const = 0;
 
+    /// The samples, in the block's own format, if it keeps them all in
+    /// memory; else null.  They must not be written, and stay valid for as
+    /// long as this BlockFile does.
+    virtual samplePtr GetSampleData(sampleFormat &format) const { return nullptr; }
+
     static size_t CommonReadData(
             bool mayThrow,
             const wxFileName &fileName, bool &mSilentLog,
@@ -141,13 +156,22 @@ public:
 private:
     int mLockCount;
 
-    static ArrayOf<char> fullSummary;
+    // Per thread, since blocks are made on several
+    static thread_local ArrayOf<char> fullSummary;
 
 protected:
+    /// For blocks holding all their samples: the summary of them in data,
+    /// or false if summaries are disabled
+    bool ReadSummaryOfSamples(ArrayOf<char> &data, samplePtr samples,
+                              sampleFormat format, bool enabled);
+
     wxFileNameWrapper mFileName;
     size_t mLen;
     SummaryInfo mSummaryInfo;
-    float mMin, mMax, mRMS;
+    // Guards the next four, which GetMinMaxRMS() may fill in lazily
+    mutable std::mutex mMinMaxRMSMutex;
+    mutable bool mHaveMinMaxRMS;
+    mutable float mMin, mMax, mRMS;
     mutable bool mSilentLog;
 };
 
@@ -0,0 +1,99 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  BlockStore.cpp
+
+**********************************************************************/
+
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "BlockStore.h"
+#include "FileException.h"
+
+namespace {
+
+// Each mapping of the file covers this much of it, or one extent if larger
+const size_t segmentBytes = 64 << 20;
+const size_t extentAlignment = 64;
+
+// A released extent is reused for a block that fills at least half of it
+const size_t reuseRatio = 2;
+
+wxFileName FileNameOf(const std::string &path) {
+    wxFileName fileName;
+    fileName.Assign(path);
+    return fileName;
+}
+
+}
+
+BlockStore::BlockStore(const std::string &path)
+        : mPath(path), mUsed(0), mFileSize(0) {
+    mFd = open(mPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (mFd < 0)
+        throw FileException{FileException::Cause::Open, FileNameOf(mPath)};
+}
+
+BlockStore::~BlockStore() {
+    for (const auto &segment : mSegments)
+        munmap(segment.base, segment.bytes);
+    close(mFd);
+    unlink(mPath.c_str());
+}
+
+auto BlockStore::Allocate(size_t bytes) -> Extent {
+    bytes = (bytes + extentAlignment - 1) / extentAlignment * extentAlignment;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    const auto reused = mFree.lower_bound(bytes);
+    if (reused != mFree.end() && reused->first <= reuseRatio * bytes) {
+        const Extent extent = reused->second;
+        mFree.erase(reused);
+        return extent;
+    }
+
+    if (mSegments.empty() || mUsed + bytes > mSegments.back().bytes)
+        AddSegment(bytes);
+
+    const auto &segment = mSegments.back();
+    const Extent extent{segment.offset + mUsed, bytes, segment.base + mUsed};
+    // Reserve the space now, so that a full disk or tmpfs is an exception
+    // here and not a SIGBUS on writing through the mapping
+    if (posix_fallocate(mFd, extent.offset, extent.bytes) != 0)
+        throw FileException{FileException::Cause::Write, FileNameOf(mPath)};
+    mUsed += bytes;
+    return extent;
+}
+
+void BlockStore::Release(const Extent &extent) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mFree.emplace(extent.bytes, extent);
+}
+
+size_t BlockStore::GetFileSize() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mFileSize;
+}
+
+void BlockStore::AddSegment(size_t bytes) {
+    // Mappings start on page boundaries of the file
+    const size_t page = sysconf(_SC_PAGESIZE);
+    bytes = std::max(segmentBytes, (bytes + page - 1) / page * page);
+
+    // What is left of the last segment goes unused.  The file is sparse
+    // until extents are allocated.
+    if (ftruncate(mFd, mFileSize + bytes) != 0)
+        throw FileException{FileException::Cause::Write, FileNameOf(mPath)};
+    void *base = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, mFileSize);
+    if (base == MAP_FAILED)
+        throw FileException{FileException::Cause::Write, FileNameOf(mPath)};
+
+    mSegments.push_back(Segment{mFileSize, bytes, static_cast<char *>(base)});
+    mFileSize += bytes;
+    mUsed = 0;
+}
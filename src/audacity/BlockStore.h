@@ -0,0 +1,79 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  BlockStore.h
+
+*******************************************************************//**
+
+\class BlockStore
+\brief One memory mapped file holding the samples of many blocks.
+
+  Space is handed out as extents of the file, which is mapped in large
+  segments that never move, so an extent's address stays good for as
+  long as the store lives.  The file only grows; released extents are
+  kept for reuse by later blocks of about their size.
+
+*//*******************************************************************/
+
+#ifndef __AUDACITY_BLOCK_STORE__
+#define __AUDACITY_BLOCK_STORE__
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Types.h"
+
+class BlockStore {
+public:
+    struct Extent {
+        size_t offset; // in the file
+        size_t bytes;
+        samplePtr data;
+    };
+
+    // Creates the file at path, replacing any there; throws FileException
+    // if it can't
+    explicit BlockStore(const std::string &path);
+
+    BlockStore(const BlockStore &) = delete;
+
+    BlockStore &operator=(const BlockStore &) = delete;
+
+    // Removes the file
+    ~BlockStore();
+
+    // Space for at least bytes, aligned to a cache line.  Safe to call
+    // from any thread; throws FileException if the file can't grow.
+    Extent Allocate(size_t bytes);
+
+    // Gives back an extent from Allocate(); safe to call from any thread
+    void Release(const Extent &extent);
+
+    // The length of the file, in bytes
+    size_t GetFileSize() const;
+
+private:
+    void AddSegment(size_t bytes);
+
+    const std::string mPath;
+    int mFd;
+
+    mutable std::mutex mMutex;
+
+    struct Segment {
+        size_t offset;
+        size_t bytes;
+        char *base;
+    };
+    std::vector<Segment> mSegments;
+    size_t mUsed; // bytes handed out from the last segment
+    size_t mFileSize;
+
+    // Released extents, by size
+    std::multimap<size_t, Extent> mFree;
+};
+
+#endif
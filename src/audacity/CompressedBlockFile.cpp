@@ -0,0 +1,78 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  CompressedBlockFile.cpp
+
+**********************************************************************/
+
+#include <algorithm>
+#include <cstring>
+
+#include "CompressedBlockFile.h"
+#include "BlockCodec.h"
+#include "FileException.h"
+#include "SampleFormat.h"
+
+auto CompressedBlockFile::MakeBuffer(const std::shared_ptr<BlockStore> &store,
+                                     const std::vector<char> &coded) -> Buffer {
+    const auto extent = store->Allocate(coded.size());
+    memcpy(extent.data, coded.data(), coded.size());
+    return Buffer{extent.data, [store, extent](const char *) {
+        store->Release(extent);
+    }};
+}
+
+CompressedBlockFile::CompressedBlockFile(Buffer buffer, size_t bytes, size_t sampleLen,
+                                         sampleFormat format, bool summaries)
+        : BlockFile{wxFileNameWrapper{}, sampleLen},
+          mBuffer{std::move(buffer)},
+          mBytes{bytes},
+          mFormat{format},
+          mSummaries{summaries} {
+}
+
+CompressedBlockFile::~CompressedBlockFile() {
+}
+
+bool CompressedBlockFile::Decode(samplePtr samples) const {
+    return BlockCodec::Decode(mBuffer.get(), mBytes, mFormat, mLen, samples);
+}
+
+bool CompressedBlockFile::ReadSummary(ArrayOf<char> &data) {
+    SampleBuffer samples(mLen, mFormat);
+    if (!Decode(samples.ptr()))
+        return false;
+    return ReadSummaryOfSamples(data, samples.ptr(), mFormat, mSummaries);
+}
+
+size_t CompressedBlockFile::ReadData(samplePtr data, sampleFormat format,
+                                     size_t start, size_t len, bool mayThrow) const {
+    auto framesRead = std::min(len, std::max(start, mLen) - start);
+
+    bool decoded;
+    if (start == 0 && framesRead == mLen && format == mFormat)
+        // The whole block, as it is: no copy
+        decoded = Decode(data);
+    else {
+        SampleBuffer samples(mLen, mFormat);
+        decoded = Decode(samples.ptr());
+        if (decoded)
+            CopySamples(samples.ptr() + start * SAMPLE_SIZE(mFormat), mFormat,
+                        data, format, framesRead);
+    }
+    if (!decoded)
+        framesRead = 0;
+
+    if (framesRead < len) {
+        if (mayThrow)
+            throw FileException{FileException::Cause::Read, mFileName};
+        ClearSamples(data, format, framesRead, len - framesRead);
+    }
+
+    return framesRead;
+}
+
+BlockFilePtr CompressedBlockFile::Copy(wxFileNameWrapper &&) {
+    return make_blockfile<CompressedBlockFile>(mBuffer, mBytes, mLen, mFormat, mSummaries);
+}
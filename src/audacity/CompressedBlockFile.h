@@ -0,0 +1,69 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  CompressedBlockFile.h
+
+*******************************************************************//**
+
+\class CompressedBlockFile
+\brief A BlockFile whose samples are kept coded by BlockCodec.
+
+  The coded bytes are an immutable, reference counted buffer, in memory
+  or in an extent of a BlockStore, so copies of the block share them.
+  Each read decodes the whole block; it is given back exactly as it was
+  made.
+
+*//*******************************************************************/
+
+#ifndef __AUDACITY_COMPRESSED_BLOCKFILE__
+#define __AUDACITY_COMPRESSED_BLOCKFILE__
+
+#include <vector>
+
+#include "BlockFile.h"
+#include "BlockStore.h"
+
+class CompressedBlockFile final : public BlockFile {
+public:
+    using Buffer = std::shared_ptr<const char>;
+
+    /// A copy of bytes of coded in an extent of store, given back when
+    /// the last block using it goes; throws FileException if the store
+    /// can't grow
+    static Buffer MakeBuffer(const std::shared_ptr<BlockStore> &store,
+                             const std::vector<char> &coded);
+
+    /// buffer holds bytes of BlockCodec::Encode() of sampleLen samples of
+    /// format.  Without summaries, ReadSummary() fails.
+    CompressedBlockFile(Buffer buffer, size_t bytes, size_t sampleLen,
+                        sampleFormat format, bool summaries = true);
+
+    virtual ~CompressedBlockFile();
+
+    /// Summaries aren't kept; they are calculated from the samples
+    /// on each call
+    bool ReadSummary(ArrayOf<char> &data) override;
+
+    size_t ReadData(samplePtr data, sampleFormat format,
+                    size_t start, size_t len, bool mayThrow) const override;
+
+    /// Create a NEW block file sharing this one's coded samples
+    BlockFilePtr Copy(wxFileNameWrapper &&newFileName) override;
+
+    /// The coded bytes
+    DiskByteCount GetSpaceUsage() const override { return mBytes; }
+
+    void Recover() override {};
+
+private:
+    // The whole block into samples of mFormat; false if it can't be decoded
+    bool Decode(samplePtr samples) const;
+
+    const Buffer mBuffer;
+    const size_t mBytes;
+    const sampleFormat mFormat;
+    const bool mSummaries;
+};
+
+#endif
@@ -43,40 +43,41 @@
   when reading a project from disk, multiple copies of the
   same block still get mapped to the same BlockFile object.
 
-  The blockfile/directory scheme is rather complicated with two different schemes.
-  The current scheme uses two levels of subdirectories - up to 256 'eXX' and up to
-  256 'dYY' directories within each of the 'eXX' dirs, where XX and YY are hex chars.
-  In each of the dXX directories there are up to 256 audio files (e.g. .au or .auf).
-  They have a filename scheme of 'eXXYYZZZZ', where XX and YY refers to the
-  subdirectories as above.  The 'ZZZZ' component is generated randomly for some reason.
-  The XX and YY components are sequential.
-  DirManager fills up the current dYY subdir until 256 are created, and moves on to the next one.
-
-  So for example, the first blockfile created may be 'e00/d00/e0000a23b.au' and the next
-  'e00/d00/e000015e8.au', and the 257th may be 'e00/d01/e0001f02a.au'.
-  On close the blockfiles that are no longer referenced by the project (edited or deleted) are removed,
-  along with the consequent empty directories.
+  Most blocks keep their samples in the project's block store or in
+  memory and have no file of their own.  Those that do are named for the
+  project and a count, e.g. 'project1234-0-b0000002a', and go straight in
+  the project's directory.  The names never collide, so making one needs
+  neither a search of the directory nor subdirectories to balance; the
+  directory goes, files and all, with the project.
 
 
 *//*******************************************************************/
 
 
+#include <algorithm>
 #include <string>
 #include <iostream>
 #include <dirent.h>
 #include <sys/stat.h> // stat
+#include <sys/statvfs.h> // statvfs
 #include <errno.h>    // errno, ENOENT, EEXIST
 #include <fstream>
 #include <zconf.h>
+#include <unistd.h>   // getpid, rmdir
 #include <cstring>
 
 #include "Audacity.h"
 #include "DirManager.h"
 #include "MemoryX.h"
+#include "BlockCodec.h"
+#include "CompressedBlockFile.h"
+#include "MappedBlockFile.h"
 #include "SimpleBlockFile.h"
+#include "SilentBlockFile.h"
 #include "Utils.h"
 #include "InconsistencyException.h"
 #include "FileException.h"
+#include "Instrumentation.h"
 
 static
 int remove_directory(const char *path) {
@@ -141,28 +142,22 @@ static bool isDirExist(const std::string &path) {
 }
 
 std::string DirManager::globaltemp("/dev/shm/audacity-noisered");
-int DirManager::numDirManagers = 0;
+std::mutex DirManager::globaltempMutex;
+std::atomic<unsigned> DirManager::numProjects{0};
 
 DirManager::DirManager() {
     mLastBlockFileDestructionCount = BlockFile::gBlockFileDestructionCount;
 
-    // Seed the random number generator.
-    // this need not be strictly uniform or random, but it should give
-    // unclustered numbers
-    srand(time(nullptr));
-
-    // Set up local temp subdir
-    // Previously, Audacity just named project temp directories "project0",
-    // "project1" and so on. But with the advent of recovery code, we need a
-    // unique name even after a crash. So we create a random project index
-    // and make sure it is not used already. This will not pose any performance
-    // penalties as long as the number of open Audacity projects is much
-    // lower than RAND_MAX.
+    // Set up local temp subdir, named for this process and the count of
+    // DirManagers it has made, so that no two live ones, in this or another
+    // process, share it.  A directory left by a crashed process of the same
+    // id is passed over.
+    const std::string temp{GetTempDir()};
     do {
-        mytemp = globaltemp + "/" + string_format("project%d", (int) rand());
+        mProjectName = string_format("project%d-%u", (int) getpid(), numProjects++);
+        mytemp = temp + "/" + mProjectName;
     } while (isDirExist(mytemp));
-
-    numDirManagers++;
+    mStorageRoots.push_back(temp);
 
     projPath = "";
     projName = "";
@@ -170,27 +165,36 @@ DirManager::DirManager() {
     mLoadingTarget = nullptr;
     mLoadingTargetIdx = 0;
     mMaxSamples = ~size_t(0);
+    mMaxBlockBytes = 1 << 20;
 
-    // toplevel pool hash is fully populated to begin
-    {
-        // We can bypass the accessor function while initializing
-        auto &balanceInfo = mBalanceInfo;
-        auto &dirTopPool = balanceInfo.dirTopPool;
-        for (int i = 0; i < 256; ++i)
-            dirTopPool[i] = 0;
-    }
 }
 
 DirManager::~DirManager() {
-    numDirManagers--;
-    if (numDirManagers == 0) {
-        CleanTempDir();
-        //::wxRmdir(temp);
-    } else if (projFull.empty() && !mytemp.empty()) {
-        CleanDir(mytemp);
+    // Only this project's directory: others may still be using theirs.  The
+    // temp dir itself goes with the last of them, rmdir failing while it
+    // holds any; the storage roots the caller gave stay, being theirs and
+    // perhaps about to be used by another process.
+    if (projFull.empty()) {
+        for (const auto &dir : mProjectDirs) {
+            CleanDir(dir);
+            const auto root = dir.substr(0, dir.find_last_of('/'));
+            std::lock_guard<std::mutex> lock(globaltempMutex);
+            if (root == globaltemp)
+                rmdir(root.c_str());
+        }
     }
 }
 
+void DirManager::SetTempDir(const std::string &temp) {
+    std::lock_guard<std::mutex> lock(globaltempMutex);
+    globaltemp = temp;
+}
+
+std::string DirManager::GetTempDir() {
+    std::lock_guard<std::mutex> lock(globaltempMutex);
+    return globaltemp;
+}
+
 // static
 // This is quite a dangerous function.  In the temp dir it will DELETE every directory
 // recursively, that has 'project*' as the name - EVEN if it happens not to be an Audacity
@@ -198,7 +202,7 @@ DirManager::~DirManager() {
 void DirManager::CleanTempDir() {
     // with default flags (none) this does not clean the top directory, and may remove non-empty
     // directories.
-    CleanDir(globaltemp);
+    CleanDir(GetTempDir());
 }
 
 // static
@@ -207,226 +211,131 @@ void DirManager::CleanDir(const std::string &path) {
 }
 
 
-BlockFilePtr DirManager::NewSimpleBlockFile(
-        samplePtr sampleData, size_t sampleLen,
-        sampleFormat format,
-        bool allowDeferredWrite) {
-    wxFileNameWrapper filePath{MakeBlockFileName()};
-    const std::string fileName{filePath.GetName()};
-
-    auto newBlockFile = std::make_shared<SimpleBlockFile>
-            (std::move(filePath), sampleData, sampleLen, format, allowDeferredWrite, false);
-
-    mBlockFileHash[fileName] = newBlockFile;
-
-    return newBlockFile;
-}
-
-// only determines appropriate filename and subdir balance; does not
-// perform maintainence
-wxFileNameWrapper DirManager::MakeBlockFileName() {
-    auto &balanceInfo = GetBalanceInfo();
-    auto &dirMidPool = balanceInfo.dirMidPool;
-    auto &dirTopPool = balanceInfo.dirTopPool;
-    auto &dirTopFull = balanceInfo.dirTopFull;
-
-    wxFileNameWrapper ret;
-    std::string baseFileName;
-
-    unsigned int filenum, midnum, topnum, midkey;
-
-    while (1) {
-
-        /* blockfiles are divided up into heirarchical directories.
-           Each toplevel directory is represented by "e" + two unique
-           hexadecimal digits, for a total possible number of 256
-           toplevels.  Each toplevel contains up to 256 subdirs named
-           "d" + two hex digits.  Each subdir contains 'a number' of
-           files.  */
-
-        filenum = 0;
-        midnum = 0;
-        topnum = 0;
-
-        // first action: if there is no available two-level directory in
-        // the available pool, try to make one
-
-        if (dirMidPool.empty()) {
-
-            // is there a toplevel directory with space for a NEW subdir?
-
-            if (!dirTopPool.empty()) {
-
-                // there's still a toplevel with room for a subdir
-
-                DirHash::iterator iter = dirTopPool.begin();
-                int newcount = 0;
-                topnum = iter->first;
-
-
-                // search for unused midlevels; linear search adequate
-                // add 32 NEW topnum/midnum dirs full of  prospective filenames to midpool
-                for (midnum = 0; midnum < 256; midnum++) {
-                    midkey = (topnum << 8) + midnum;
-                    if (BalanceMidAdd(topnum, midkey)) {
-                        newcount++;
-                        if (newcount >= 32)break;
-                    }
-                }
-
-                if (dirMidPool.empty()) {
-                    // all the midlevels in this toplevel are in use yet the
-                    // toplevel claims some are free; this implies multiple
-                    // internal logic faults, but simply giving up and going
-                    // into an infinite loop isn't acceptible.  Just in case,
-                    // for some reason, we get here, dynamite this toplevel so
-                    // we don't just fail.
-
-                    // this is 'wrong', but the best we can do given that
-                    // something else is also wrong.  It will contain the
-                    // problem so we can keep going without worry.
-                    dirTopPool.erase(topnum);
-                    dirTopFull[topnum] = 256;
-                }
-                continue;
-            }
+bool DirManager::SetStorageRoots(const std::vector<std::string> &roots, size_t expectedBytes) {
+    if (roots.empty()) {
+        std::cerr << "No storage roots given" << std::endl;
+        return false;
+    }
+    for (const auto &root : roots)
+        if (root.empty() || root[0] != '/') {
+            std::cerr << "Storage root " << root << " is not an absolute path" << std::endl;
+            return false;
         }
 
-        if (dirMidPool.empty()) {
-            // still empty, thus an absurdly large project; all dirs are
-            // full to 256/256/256; keep working, but fall back to 'big
-            // filenames' and randomized placement
-
-            filenum = rand();
-            midnum = (int) (256. * rand() / (RAND_MAX + 1.));
-            topnum = (int) (256. * rand() / (RAND_MAX + 1.));
-            midkey = (topnum << 8) + midnum;
-
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStorageRoots = roots;
+    mExpectedBytes = expectedBytes;
+    mRootIndex = 0;
+    mytemp = roots[0] + "/" + mProjectName;
+    return true;
+}
 
-        } else {
+std::string DirManager::GetStorageRoot() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return std::atomic_load(&mBlockStore) ? mStorageRoots[mRootIndex] : std::string{};
+}
 
-            DirHash::iterator iter = dirMidPool.begin();
-            midkey = iter->first;
+void DirManager::SetMemoryBlocks(bool enable, size_t limit) {
+    // Blocks already made keep charging the old budget
+    mMemoryBudget = enable ? std::make_shared<MemoryBlockBudget>(limit) : nullptr;
+}
 
-            // split the retrieved 16 bit directory key into two 8 bit numbers
-            topnum = midkey >> 8;
-            midnum = midkey & 0xff;
-            filenum = (int) (4096. * rand() / (RAND_MAX + 1.));
+bool DirManager::SetCompression(int level) {
+    if (level != 0 && (level < BlockCodec::MinLevel || level > BlockCodec::MaxLevel)) {
+        std::cerr << "Compression level must be 0 or from " << BlockCodec::MinLevel
+                  << " to " << BlockCodec::MaxLevel << std::endl;
+        return false;
+    }
+    mCompression = level;
+    return true;
+}
 
-        }
+const size_t DirManager::MinBlockBytes;
+const size_t DirManager::MaxBlockBytes;
 
-        baseFileName = string_format("e%02x%02x%03x", topnum, midnum, filenum);
-
-        if (!ContainsBlockFile(baseFileName)) {
-            // not in the hash, good.
-            if (!this->AssignFile(ret, baseFileName, true)) {
-                // this indicates an on-disk collision, likely due to an
-                // orphan blockfile.  We should try again, but first
-                // alert the balancing info there's a phantom file here;
-                // if the directory is nearly full of orphans we neither
-                // want performance to suffer nor potentially get into an
-                // infinite loop if all possible filenames are taken by
-                // orphans (unlikely but possible)
-                BalanceFileAdd(midkey);
-
-            } else break;
-        }
+bool DirManager::SetMaxBlockBytes(size_t bytes) {
+    if (bytes < MinBlockBytes || bytes > MaxBlockBytes) {
+        std::cerr << "Block size must be from " << MinBlockBytes << " to "
+                  << MaxBlockBytes << " bytes" << std::endl;
+        return false;
     }
-    // FIXME: Might we get here without midkey having been set?
-    //    Seemed like a possible problem in these changes in .aup directory hierarchy.
-    BalanceFileAdd(midkey);
-    return ret;
+    mMaxBlockBytes = bytes;
+    return true;
 }
 
-int DirManager::BalanceMidAdd(int topnum, int midkey) {
-    // enter the midlevel directory if it doesn't exist
-
-    auto &balanceInfo = GetBalanceInfo();
-    auto &dirMidPool = balanceInfo.dirMidPool;
-    auto &dirMidFull = balanceInfo.dirMidFull;
-    auto &dirTopPool = balanceInfo.dirTopPool;
-    auto &dirTopFull = balanceInfo.dirTopFull;
-
-    if (dirMidPool.find(midkey) == dirMidPool.end() &&
-        dirMidFull.find(midkey) == dirMidFull.end()) {
-        dirMidPool[midkey] = 0;
-
-        // increment toplevel directory fill
-        dirTopPool[topnum]++;
-        if (dirTopPool[topnum] >= 256) {
-            // this toplevel is now full; move it to the full hash
-            dirTopPool.erase(topnum);
-            dirTopFull[topnum] = 256;
-        }
-        return 1;
-    }
-    return 0;
+size_t DirManager::GetMemoryBlockUsage() const {
+    return mMemoryBudget ? mMemoryBudget->GetUsed() : 0;
 }
 
-void DirManager::BalanceFileAdd(int midkey) {
-    auto &balanceInfo = GetBalanceInfo();
-    auto &dirMidPool = balanceInfo.dirMidPool;
-    auto &dirMidFull = balanceInfo.dirMidFull;
-
-    // increment the midlevel directory usage information
-    if (dirMidPool.find(midkey) != dirMidPool.end()) {
-        dirMidPool[midkey]++;
-        if (dirMidPool[midkey] >= 256) {
-            // this middir is now full; move it to the full hash
-            dirMidPool.erase(midkey);
-            dirMidFull[midkey] = 256;
-        }
-    } else {
-        // this case only triggers in absurdly large projects; we still
-        // need to track directory fill even if we're over 256/256/256
-        dirMidPool[midkey]++;
+BlockFilePtr DirManager::NewSimpleBlockFile(
+        samplePtr sampleData, size_t sampleLen,
+        sampleFormat format,
+        bool allowDeferredWrite) {
+    const auto bytes = sampleLen * SAMPLE_SIZE(format);
+    NR_COUNT(BlockFiles, 1);
+    NR_COUNT(BlockFileBytes, bytes);
+    // Digital silence takes no storage at all.  Zero bytes are a zero
+    // sample in every format, so this loses nothing.
+    if (bytes && !sampleData[0] && !memcmp(sampleData, sampleData + 1, bytes - 1)) {
+        NR_COUNT(SilentBlockFiles, 1);
+        return make_blockfile<SilentBlockFile>(sampleLen);
+    }
+
+    if (mCompression)
+        return NewCompressedBlockFile(sampleData, sampleLen, format);
+
+    if (mMemoryBudget) {
+        auto buffer = MemoryBlockFile::MakeBuffer(
+                mMemoryBudget, sampleData, bytes);
+        if (buffer)
+            return make_blockfile<MemoryBlockFile>(
+                    std::move(buffer), sampleLen, format, mSummaries);
     }
+
+    // The samples go to the shared store, not to a file of their own, and
+    // the block needs no name in the hash
+    return WithBlockStore(bytes, [&](const std::shared_ptr<BlockStore> &store) {
+        return make_blockfile<MappedBlockFile>
+                (store, sampleData, sampleLen, format, mSummaries);
+    });
 }
 
-bool DirManager::ContainsBlockFile(const std::string &filepath) const {
-    // check what the hash returns in case the blockfile is from a different project
-    BlockHash::const_iterator it = mBlockFileHash.find(filepath);
-    return it != mBlockFileHash.end() &&
-           BlockFilePtr{it->second.lock()};
+BlockFilePtr DirManager::NewCompressedBlockFile(
+        samplePtr sampleData, size_t sampleLen, sampleFormat format) {
+    std::vector<char> coded;
+    BlockCodec::Encode(sampleData, format, sampleLen, mCompression, coded);
+    NR_COUNT(CompressedBytes, coded.size());
+
+    CompressedBlockFile::Buffer buffer;
+    if (mMemoryBudget)
+        buffer = MemoryBlockFile::MakeBuffer(mMemoryBudget, coded.data(), coded.size());
+    if (!buffer)
+        buffer = WithBlockStore(coded.size(), [&](const std::shared_ptr<BlockStore> &store) {
+            return CompressedBlockFile::MakeBuffer(store, coded);
+        });
+    return make_blockfile<CompressedBlockFile>(
+            std::move(buffer), coded.size(), sampleLen, format, mSummaries);
 }
 
-bool DirManager::AssignFile(wxFileNameWrapper &fileName,
-                            const std::string &value,
-                            bool diskcheck) {
-    wxFileNameWrapper dir{MakeBlockFilePath(value)};
-
-    if (diskcheck) {
-        // verify that there's no possible collision on disk.  If there
-        // is, log the problem and return FALSE so that MakeBlockFileName
-        // can try again
-        DIR *dp = opendir(dir.GetFullPath().c_str());
-        if (dp == nullptr) {
-            return false;
+template<typename Function>
+auto DirManager::WithBlockStore(size_t bytes, const Function &function)
+-> decltype(function(std::shared_ptr<BlockStore>{})) {
+    auto store = GetBlockStore();
+    while (true) {
+        try {
+            return function(store);
         }
-        // this code is only valid if 'value' has no extention; that
-        // means, effectively, AssignFile may be called with 'diskcheck'
-        // set to true only if called from MakeFileBlockName().
-
-        std::string filespec = string_format("%s.*", value);
-        struct dirent *dirp;
-        if ((dirp = readdir(dp)) != nullptr) {
-            std::string filename = std::string(dirp->d_name);
-            if (filename.length() >= value.length() + 1 &&
-                filename.substr(0, value.length() + 1) == (value + ".")) {
-
-                // collision with on-disk state!
-                std::string msg = string_format(
-                        "Audacity found an orphan block file: %s. \nPlease consider saving and reloading the project to perform a complete project check.",
-                        filename);
-                std::cerr << msg << std::endl;
-                closedir(dp);
-                return false;
-            }
+        catch (const FileException &) {
+            // Full: on to the next root with room, unless another thread
+            // got there first
+            std::lock_guard<std::mutex> lock(mMutex);
+            const auto current = std::atomic_load(&mBlockStore);
+            if (current != store)
+                store = current;
+            else if (!(store = OpenBlockStore(mRootIndex + 1, bytes)))
+                throw;
         }
-        closedir(dp);
     }
-    fileName.Assign(dir.GetFullPath(), value);
-    return fileName.IsOk();
 }
 
 static bool makePath(const std::string &path) {
@@ -448,12 +357,8 @@ static bool makePath(const std::string &path) {
                 return false;
             }
 
-            // now, try to create again
-            if (isDirExist(path)) {
-                return true;
-            } else {
-                return 0 == mkdir(path.c_str(), mode);
-            }
+            // now, try to create again; another thread may have meanwhile
+            return 0 == mkdir(path.c_str(), mode) || isDirExist(path);
         }
         case EEXIST:
             // done!
@@ -464,35 +369,83 @@ static bool makePath(const std::string &path) {
     }
 }
 
-wxFileNameWrapper DirManager::MakeBlockFilePath(const std::string &value) {
-
-    wxFileNameWrapper dir;
-    dir.AssignDir(GetDataFilesDir());
-
-    if (value.at(0) == 'd') {
-        // this file is located in a subdirectory tree
-        std::size_t location = value.find('b');
-        std::string subdir = value.substr(0, location);
-        dir.AppendDir(subdir);
-
-        if (!isDirExist(dir.GetFullPath()))
-            makePath(dir.GetFullPath());
+std::shared_ptr<BlockStore> DirManager::GetBlockStore() {
+    // Made by the first block; after that, threads making blocks at once
+    // meet only in BlockStore::Allocate()
+    if (auto store = std::atomic_load(&mBlockStore))
+        return store;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (auto store = std::atomic_load(&mBlockStore))
+        return store;
+    // Failing a root with the room expected, the first that can be written
+    auto store = OpenBlockStore(0, mExpectedBytes);
+    if (!store && mExpectedBytes)
+        store = OpenBlockStore(0, 0);
+    if (!store) {
+        wxFileName fileName;
+        fileName.AssignDir(mytemp);
+        throw FileException{FileException::Cause::Open, fileName};
     }
+    return store;
+}
 
-    if (value.at(0) == 'e') {
-        // this file is located in a NEW style two-deep subdirectory tree
-        std::string topdir = value.substr(0, 3);
-        std::string middir = "d";
-        middir += value.substr(3, 2);
+// Bytes that can be written to the file system of path, which may not
+// exist yet; 0 if that can't be found
+static size_t availableBytes(std::string path) {
+    struct statvfs info;
+    while (statvfs(path.c_str(), &info) != 0) {
+        const auto pos = path.find_last_of('/');
+        if (errno != ENOENT || pos == std::string::npos)
+            return 0;
+        path.erase(std::max<size_t>(pos, 1));
+    }
+    return (size_t) info.f_bavail * info.f_frsize;
+}
 
-        dir.AppendDir(topdir);
-        dir.AppendDir(middir);
+std::shared_ptr<BlockStore> DirManager::OpenBlockStore(size_t first, size_t needed) {
+    for (size_t ii = first; ii < mStorageRoots.size(); ++ii) {
+        if (needed && availableBytes(mStorageRoots[ii]) < needed)
+            continue;
 
-        if (!isDirExist(dir.GetFullPath()) && !makePath(dir.GetFullPath())) {
-            std::cerr << "mkdir in DirManager::MakeBlockFilePath failed." << std::endl;
+        const std::string dir{mStorageRoots[ii] + "/" + mProjectName};
+        std::shared_ptr<BlockStore> store;
+        {
+            // Not while another DirManager removes the root it would go in
+            std::lock_guard<std::mutex> lock(globaltempMutex);
+            if (!isDirExist(dir) && !makePath(dir)) {
+                std::cerr << "mkdir in DirManager::OpenBlockStore failed for " << dir << std::endl;
+                continue;
+            }
+            if (std::find(mProjectDirs.begin(), mProjectDirs.end(), dir) == mProjectDirs.end())
+                mProjectDirs.push_back(dir);
+            try {
+                store = std::make_shared<BlockStore>(dir + "/blocks.dat");
+            }
+            catch (const FileException &) {
+                continue;
+            }
         }
+
+        mRootIndex = ii;
+        mytemp = dir;
+        std::atomic_store(&mBlockStore, store);
+        return store;
     }
-    return dir;
+    return nullptr;
+}
+
+wxFileNameWrapper DirManager::MakeBlockFileName() {
+    const auto dir = DataFilesDir();
+    if (dir != mBlockFileDir) {
+        if (!isDirExist(dir) && !makePath(dir))
+            std::cerr << "mkdir in DirManager::MakeBlockFileName failed for " << dir << std::endl;
+        mBlockFileDir = dir;
+    }
+
+    wxFileNameWrapper fileName;
+    fileName.Assign(dir, string_format("%s-b%08llx", mProjectName.c_str(), mBlockFileCount++));
+    return fileName;
 }
 
 bool DirManager::CopyFile(
@@ -511,6 +464,8 @@ BlockFilePtr DirManager::CopyBlockFile(const BlockFilePtr &b) {
     if (!b)
         THROW_INCONSISTENCY_EXCEPTION;
 
+    std::lock_guard<std::mutex> lock(mMutex);
+
     auto result = b->GetFileName();
     const auto &fn = result.name;
 
@@ -532,6 +487,7 @@ BlockFilePtr DirManager::CopyBlockFile(const BlockFilePtr &b) {
         // just need an in-memory copy.
         b2 = b->Copy(wxFileNameWrapper{});
     else {
+        PruneBlockFileHash();
         wxFileNameWrapper newFile{MakeBlockFileName()};
         const std::string newName{newFile.GetName()};
         const std::string newPath{newFile.GetFullPath()};
@@ -563,108 +519,26 @@ BlockFilePtr DirManager::CopyBlockFile(const BlockFilePtr &b) {
 }
 
 std::string DirManager::GetDataFilesDir() const {
-    return projFull != "" ? projFull : mytemp;
+    // mytemp moves to the next root as one fills up
+    std::lock_guard<std::mutex> lock(mMutex);
+    return DataFilesDir();
 }
 
-auto DirManager::GetBalanceInfo() -> BalanceInfo & {
-    // Before returning the map,
-    // see whether any block files have disappeared,
-    // and if so update
-
-    auto count = BlockFile::gBlockFileDestructionCount;
-    if (mLastBlockFileDestructionCount != count) {
-        auto it = mBlockFileHash.begin(), end = mBlockFileHash.end();
-        while (it != end) {
-            BlockFilePtr ptr{it->second.lock()};
-            if (!ptr) {
-                auto name = it->first;
-                mBlockFileHash.erase(it++);
-                BalanceInfoDel(name);
-            } else
-                ++it;
-        }
-    }
-
-    mLastBlockFileDestructionCount = count;
-
-    return mBalanceInfo;
+std::string DirManager::DataFilesDir() const {
+    return projFull != "" ? projFull : mytemp;
 }
 
-static inline unsigned int hexchar_to_int(unsigned int x) {
-    if (x < 48U)return 0;
-    if (x < 58U)return x - 48U;
-    if (x < 65U)return 10U;
-    if (x < 71U)return x - 55U;
-    if (x < 97U)return 10U;
-    if (x < 103U)return x - 87U;
-    return 15U;
-}
+void DirManager::PruneBlockFileHash() {
+    // Only when some block file was destroyed since the last time
+    const unsigned long count = BlockFile::gBlockFileDestructionCount;
+    if (mLastBlockFileDestructionCount == count)
+        return;
+    mLastBlockFileDestructionCount = count;
 
-// Note that this will try to clean up directories out from under even
-// locked blockfiles; this is actually harmless as the rmdir will fail
-// on non-empty directories.
-void DirManager::BalanceInfoDel(const std::string &file) {
-    // do not use GetBalanceInfo(),
-    // rather this function will be called from there.
-    auto &balanceInfo = mBalanceInfo;
-    auto &dirMidPool = balanceInfo.dirMidPool;
-    auto &dirMidFull = balanceInfo.dirMidFull;
-    auto &dirTopPool = balanceInfo.dirTopPool;
-    auto &dirTopFull = balanceInfo.dirTopFull;
-
-    const char *s = file.c_str();
-    if (s[0] == 'e') {
-        // this is one of the modern two-deep managed files
-
-        unsigned int topnum = (hexchar_to_int(s[1]) << 4) |
-                              hexchar_to_int(s[2]);
-        unsigned int midnum = (hexchar_to_int(s[3]) << 4) |
-                              hexchar_to_int(s[4]);
-        unsigned int midkey = topnum << 8 | midnum;
-
-        // look for midkey in the mid pool
-        if (dirMidFull.find(midkey) != dirMidFull.end()) {
-            // in the full pool
-
-            if (--dirMidFull[midkey] < 256) {
-                // move out of full into available
-                dirMidPool[midkey] = dirMidFull[midkey];
-                dirMidFull.erase(midkey);
-            }
-        } else {
-            if (--dirMidPool[midkey] < 1) {
-                // erasing the key here is OK; we have provision to add it
-                // back if its needed (unlike the dirTopPool hash)
-                dirMidPool.erase(midkey);
-
-                // DELETE the actual directory
-                std::string dir = (projFull != "" ? projFull : mytemp);
-                dir += "/";
-                dir += file.substr(0, 3);
-                dir += "/";
-                dir += "d";
-                dir += file.substr(3, 2);
-                remove_directory(dir.c_str());
-
-                // also need to remove from toplevel
-                if (dirTopFull.find(topnum) != dirTopFull.end()) {
-                    // in the full pool
-                    if (--dirTopFull[topnum] < 256) {
-                        // move out of full into available
-                        dirTopPool[topnum] = dirTopFull[topnum];
-                        dirTopFull.erase(topnum);
-                    }
-                } else {
-                    if (--dirTopPool[topnum] < 1) {
-                        // do *not* erase the hash entry from dirTopPool
-                        // *do* DELETE the actual directory
-                        std::string dir = (projFull != "" ? projFull : mytemp);
-                        dir += "/";
-                        dir += file.substr(0, 3);
-                        remove_directory(dir.c_str());
-                    }
-                }
-            }
-        }
+    for (auto it = mBlockFileHash.begin(); it != mBlockFileHash.end();) {
+        if (it->second.expired())
+            it = mBlockFileHash.erase(it);
+        else
+            ++it;
     }
 }
@@ -11,24 +11,33 @@
 #ifndef _DIRMANAGER_
 #define _DIRMANAGER_
 
+#include <atomic>
+#include <mutex>
 #include <unordered_map>
+#include <vector>
 
 #include "MemoryX.h"
 #include "wxFileNameWrapper.h"
 #include "Sequence.h"
 #include "BlockFile.h"
+#include "BlockStore.h"
+#include "MemoryBlockFile.h"
 
 
 
 using BlockHash = std::unordered_map<std::string, std::weak_ptr<BlockFile>>;
 
-using DirHash = std::unordered_map<int, int>;
 class BlockArray;
 
 class DirManager {
 public:
 
-    static void SetTempDir(const std::string &_temp) { globaltemp = _temp; }
+    // Where the DirManagers made from now on put their projects' directories.
+    // Each has one of its own, named to be unique among all live DirManagers
+    // of all processes, and removes only that.
+    static void SetTempDir(const std::string &temp);
+
+    static std::string GetTempDir();
 
     // MM: Construct DirManager
     DirManager();
@@ -36,34 +45,58 @@ public:
     virtual ~DirManager();
 
 
-    BlockFilePtr
-    NewSimpleBlockFile(samplePtr sampleData,
-                       size_t sampleLen,
-                       sampleFormat format,
-                       bool allowDeferredWrite = false);
+    // The directories, in the order tried, for the samples of this project
+    // that are not in memory; by default just the temp dir.  Blocks go to
+    // the first root whose file system has expectedBytes free, and once it
+    // fills up, to the next with room for them, so a small tmpfs can come
+    // before a disk.  Each root used gets a directory of this project's
+    // own.  Call before blocks are made; returns false, changing nothing,
+    // if there are no roots or one is not an absolute path.
+    bool SetStorageRoots(const std::vector<std::string> &roots, size_t expectedBytes = 0);
+
+    // The root blocks are going to, or empty before the first of them
+    std::string GetStorageRoot() const;
+
+    // Keep the samples of blocks made from now on in memory only, up to
+    // limit bytes in all (0 for no limit); blocks past the limit go to the
+    // data files directory as usual.  Call before blocks are made on other
+    // threads.
+    void SetMemoryBlocks(bool enable, size_t limit = 0);
 
-    // Hashes for management of the sub-directory tree of _data
-    struct BalanceInfo {
-        DirHash dirTopPool;    // available toplevel dirs
-        DirHash dirTopFull;    // full toplevel dirs
-        DirHash dirMidPool;    // available two-level dirs
-        DirHash dirMidFull;    // full two-level dirs
-    } mBalanceInfo;
+    // Bytes held by memory blocks
+    size_t GetMemoryBlockUsage() const;
 
-    // Accessor for the balance info, may need to do a delayed update for
-    // deletion in case other threads DELETE block files
-    BalanceInfo &GetBalanceInfo();
+    // Keep the samples of blocks made from now on losslessly compressed,
+    // in memory or in storage as above, at BlockCodec level 1 (fastest)
+    // to 3 (smallest); 0, as until set, for off.  Each read then decodes
+    // the whole block.  Returns false, changing nothing, for other levels.
+    bool SetCompression(int level);
 
-    int BalanceMidAdd(int, int);
+    int GetCompression() const { return mCompression; }
 
-    void BalanceFileAdd(int);
+    // Whether blocks made from now on can give 256 and 64K sample
+    // summaries.  They are worked out only when read in any case; the
+    // block's own extremes and RMS are always available.
+    void SetSummaries(bool enable) { mSummaries = enable; }
 
-    /// Check for existing using filename using complete filename
-    bool ContainsBlockFile(const std::string &filepath) const;
+    // The largest blocks, in bytes, of the sequences made from now on; they
+    // hold at least half that but for the last and those edited.  Larger
+    // blocks mean fewer block files and lookups over long batch jobs,
+    // smaller ones less copying when short pieces are pasted or deleted.
+    // From MinBlockBytes to MaxBlockBytes, 1 MB until set; returns false,
+    // changing nothing, for others.
+    bool SetMaxBlockBytes(size_t bytes);
 
-    bool AssignFile(wxFileNameWrapper &filename, const std::string &value, bool check);
+    size_t GetMaxBlockBytes() const { return mMaxBlockBytes; }
 
-    wxFileNameWrapper MakeBlockFilePath(const std::string &value);
+    static const size_t MinBlockBytes = 1 << 10;
+    static const size_t MaxBlockBytes = 64 << 20;
+
+    BlockFilePtr
+    NewSimpleBlockFile(samplePtr sampleData,
+                       size_t sampleLen,
+                       sampleFormat format,
+                       bool allowDeferredWrite = false);
 
     // Adds one to the reference count of the block file,
     // UNLESS it is "locked", then it makes a NEW copy of
@@ -79,20 +112,71 @@ public:
 
     bool CopyFile(const std::string &file1, const std::string &file2);
 
-    void BalanceInfoDel(const std::string &);
-
     static void CleanTempDir();
 
     static void CleanDir(const std::string &path);
 
 private:
     static std::string globaltemp;
-    static int numDirManagers;
+    static std::mutex globaltempMutex;
+    // DirManagers made by this process, for the names of their directories
+    static std::atomic<unsigned> numProjects;
 
+    // With mMutex held: a name for a NEW block file, in the data files
+    // directory, made the first time.  Names are the project's and a count,
+    // so they never collide and making one touches nothing on disk.
     wxFileNameWrapper MakeBlockFileName();
 
+    // With mMutex held: forgets the names of block files that are gone
+    void PruneBlockFileHash();
+
+    // With mMutex held: GetDataFilesDir()
+    std::string DataFilesDir() const;
+
+    std::shared_ptr<BlockStore> GetBlockStore();
+
+    BlockFilePtr NewCompressedBlockFile(samplePtr sampleData, size_t sampleLen,
+                                        sampleFormat format);
+
+    // function(store) with the current store, and again with the next
+    // that has bytes free each time it throws FileException for a full one
+    template<typename Function>
+    auto WithBlockStore(size_t bytes, const Function &function)
+    -> decltype(function(std::shared_ptr<BlockStore>{}));
+
+    // With mMutex held: a store in the first root from mRootIndex on with
+    // needed bytes free, made current; null if none can be made
+    std::shared_ptr<BlockStore> OpenBlockStore(size_t first, size_t needed);
+
     std::vector<std::string> aliasList;
 
+    // Serializes the copying of block files, the name hash and changes of
+    // block store, so that channels may be processed by several threads
+    // against one project
+    mutable std::mutex mMutex;
+
+    // Holds the samples of new blocks; created with the first of them in
+    // mStorageRoots[mRootIndex], and replaced when that fills up.  Read
+    // and written with std::atomic_load() and std::atomic_store(), so that
+    // making blocks needs no lock.
+    std::shared_ptr<BlockStore> mBlockStore;
+
+    std::vector<std::string> mStorageRoots;
+    size_t mExpectedBytes{0};
+    size_t mRootIndex{0};
+    // This project's directory in each root, and those made so far
+    std::string mProjectName;
+    std::vector<std::string> mProjectDirs;
+
+    // Set in memory block mode
+    std::shared_ptr<MemoryBlockBudget> mMemoryBudget;
+
+    bool mSummaries{true};
+
+    int mCompression{0};
+
+    size_t mMaxBlockBytes;
+
     BlockHash mBlockFileHash; // repository for blockfiles
     std::string projFull;
     std::string projName;
@@ -106,6 +190,10 @@ private:
 
     unsigned long mLastBlockFileDestructionCount{0};
 
+    // Block files named so far, and the directory they went in
+    unsigned long long mBlockFileCount{0};
+    std::string mBlockFileDir;
+
 };
 
 
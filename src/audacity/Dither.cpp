@@ -43,12 +43,19 @@ and get deterministic behaviour.
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <algorithm>
 //#include <sys/types.h>
 //#include <memory.h>
 //#include <assert.h>
 
 #include "Dither.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 //////////////////////////////////////////////////////////////////////////
 
 // Constants for the noise shaping buffer
@@ -202,6 +209,225 @@ const float Dither::SHAPED_BS[] = { 2.033f, -2.165f, 1.959f, -1.590f, 0.6149f };
     } while (0)
 
 
+// Contiguous buffers are converted in blocks of this many samples.  The
+// noise of a block is made first, in the order the per-sample dithers
+// would make it, so the results are the same.
+static const unsigned int BLOCK_SIZE = 256;
+
+namespace {
+
+// Samples of int16 or int24 format as floats, as FROM_INT16 and FROM_INT24
+void IntToFloat(const short *s, float *d, unsigned int len)
+{
+    unsigned int i = 0;
+#if defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(1.0f / CONVERT_DIV16);
+    for (; i + 8 <= len; i += 8) {
+        const __m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+        const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+        const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+        _mm_storeu_ps(d + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(d + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const float32x4_t scale = vdupq_n_f32(1.0f / CONVERT_DIV16);
+    for (; i + 8 <= len; i += 8) {
+        const int16x8_t x = vld1q_s16(s + i);
+        vst1q_f32(d + i, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), scale));
+        vst1q_f32(d + i + 4, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), scale));
+    }
+#endif
+    for (; i < len; i++)
+        d[i] = FROM_INT16(s + i);
+}
+
+void IntToFloat(const int *s, float *d, unsigned int len)
+{
+    unsigned int i = 0;
+#if defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(1.0f / CONVERT_DIV24);
+    for (; i + 4 <= len; i += 4)
+        _mm_storeu_ps(d + i, _mm_mul_ps(
+            _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(s + i))), scale));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const float32x4_t scale = vdupq_n_f32(1.0f / CONVERT_DIV24);
+    for (; i + 4 <= len; i += 4)
+        vst1q_f32(d + i, vmulq_f32(vcvtq_f32_s32(vld1q_s32(s + i)), scale));
+#endif
+    for (; i < len; i++)
+        d[i] = FROM_INT24(s + i);
+}
+
+// Stores clip(s[i]) promoted to Dest's range, plus add[i] less sub[i] where
+// those are used, rounded and clipped as the STORE_ macros do, NaN
+// included: that is the lower bound on x86 and 0 on ARM.
+template<typename Dest, bool Add, bool Sub>
+void FloatToInt(const float *s, const float *add, const float *sub,
+                Dest *d, unsigned int len)
+{
+    const bool is16 = sizeof(Dest) == sizeof(short);
+    const float promote = is16 ? CONVERT_DIV16 : CONVERT_DIV24;
+    const float maxBound = is16 ? 32767.0f : 8388607.0f;
+    const float minBound = is16 ? -32768.0f : -8388608.0f;
+
+    unsigned int i = 0;
+#if defined(__SSE2__)
+    const __m128 one = _mm_set1_ps(1.0f), minusOne = _mm_set1_ps(-1.0f);
+    auto convert = [&](unsigned int j) {
+        const __m128 x = _mm_loadu_ps(s + j);
+        const __m128 nan = _mm_cmpunord_ps(x, x);
+        __m128 v = _mm_mul_ps(_mm_max_ps(_mm_min_ps(x, one), minusOne), _mm_set1_ps(promote));
+        if (Add)
+            v = _mm_add_ps(v, _mm_loadu_ps(add + j));
+        if (Sub)
+            v = _mm_sub_ps(v, _mm_loadu_ps(sub + j));
+        // Clipping before rounding rounds to the bound, as clipping after
+        // would
+        v = _mm_max_ps(_mm_min_ps(v, _mm_set1_ps(maxBound)), _mm_set1_ps(minBound));
+        v = _mm_or_ps(_mm_and_ps(nan, _mm_set1_ps(minBound)), _mm_andnot_ps(nan, v));
+        return _mm_cvtps_epi32(v);
+    };
+    if (is16)
+        for (; i + 8 <= len; i += 8)
+            _mm_storeu_si128((__m128i *)(d + i), _mm_packs_epi32(convert(i), convert(i + 4)));
+    else
+        for (; i + 4 <= len; i += 4)
+            _mm_storeu_si128((__m128i *)(d + i), convert(i));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    // NaN goes through min, max and the conversion to 0
+    auto convert = [&](unsigned int j) {
+        float32x4_t v = vmulq_n_f32(
+            vmaxq_f32(vminq_f32(vld1q_f32(s + j), vdupq_n_f32(1.0f)), vdupq_n_f32(-1.0f)), promote);
+        if (Add)
+            v = vaddq_f32(v, vld1q_f32(add + j));
+        if (Sub)
+            v = vsubq_f32(v, vld1q_f32(sub + j));
+        v = vmaxq_f32(vminq_f32(v, vdupq_n_f32(maxBound)), vdupq_n_f32(minBound));
+        return vcvtnq_s32_f32(v);
+    };
+    if (is16)
+        for (; i + 8 <= len; i += 8)
+            vst1q_s16((short *)(d + i), vcombine_s16(vqmovn_s32(convert(i)), vqmovn_s32(convert(i + 4))));
+    else
+        for (; i + 4 <= len; i += 4)
+            vst1q_s32((int *)(d + i), convert(i));
+#endif
+    for (int x; i < len; i++) {
+        float sample = FROM_FLOAT(s + i) * promote;
+        if (Add)
+            sample = sample + add[i];
+        if (Sub)
+            sample = sample - sub[i];
+        if (is16)
+            STORE_INT16(d + i, sample);
+        else
+            STORE_INT24(d + i, sample);
+    }
+}
+
+template<bool Add, bool Sub>
+void FloatToInt(const float *s, const float *add, const float *sub,
+                samplePtr d, sampleFormat destFormat, unsigned int len)
+{
+    if (destFormat == int16Sample)
+        FloatToInt<short, Add, Sub>(s, add, sub, (short *)d, len);
+    else
+        FloatToInt<int, Add, Sub>(s, add, sub, (int *)d, len);
+}
+
+}
+
+// The dithering conversions of Apply() for unstrided buffers, a block at a
+// time
+void Dither::ApplyBlocks(DitherType ditherType,
+                         const samplePtr source, sampleFormat sourceFormat,
+                         samplePtr dest, sampleFormat destFormat,
+                         unsigned int len)
+{
+    float floats[BLOCK_SIZE], noise[BLOCK_SIZE + 1];
+    const auto sourceSize = SAMPLE_SIZE(sourceFormat);
+    const auto destSize = SAMPLE_SIZE(destFormat);
+
+    for (unsigned int done = 0; done < len; done += BLOCK_SIZE) {
+        const auto block = std::min(BLOCK_SIZE, len - done);
+        const samplePtr s = source + done * sourceSize;
+        const samplePtr d = dest + done * destSize;
+
+        // int24 samples are within [-1, 1) as floats, so clipping them
+        // later changes nothing
+        const float *f = (const float *)s;
+        if (sourceFormat == int24Sample) {
+            IntToFloat((const int *)s, floats, block);
+            f = floats;
+        }
+
+        switch (ditherType)
+        {
+        case DitherType::none:
+            FloatToInt<false, false>(f, nullptr, nullptr, d, destFormat, block);
+            break;
+        case DitherType::rectangle:
+            for (unsigned int i = 0; i < block; i++)
+                noise[i] = DITHER_NOISE;
+            FloatToInt<false, true>(f, nullptr, noise, d, destFormat, block);
+            break;
+        case DitherType::triangle:
+            // sample + r - the previous r
+            noise[0] = mTriangleState;
+            for (unsigned int i = 1; i <= block; i++)
+                noise[i] = DITHER_NOISE;
+            mTriangleState = noise[block];
+            FloatToInt<true, true>(f, noise + 1, noise, d, destFormat, block);
+            break;
+        case DitherType::shaped:
+            for (unsigned int i = 0; i < block; i++)
+                noise[i] = DITHER_NOISE + DITHER_NOISE;
+            ShapedBlock(f, noise, d, destFormat, block);
+            break;
+        default:
+            assert(false); // unknown dither algorithm
+        }
+    }
+}
+
+// ShapedDither() over a block, with the noise made beforehand and the
+// filter state kept in locals
+void Dither::ShapedBlock(const float *source, const float *noise,
+                         samplePtr dest, sampleFormat destFormat,
+                         unsigned int len)
+{
+    float buffer[BUF_SIZE];
+    memcpy(buffer, mBuffer, sizeof(buffer));
+    int phase = mPhase;
+
+    for (unsigned int i = 0; i < len; i++) {
+        float sample = destFormat == int16Sample
+            ? PROMOTE_TO_INT16(FROM_FLOAT(source + i))
+            : PROMOTE_TO_INT24(FROM_FLOAT(source + i));
+        if(sample != sample)  // test for NaN
+           sample = 0; // and do the best we can with it
+
+        float xe = sample + buffer[phase] * SHAPED_BS[0]
+            + buffer[(phase - 1) & BUF_MASK] * SHAPED_BS[1]
+            + buffer[(phase - 2) & BUF_MASK] * SHAPED_BS[2]
+            + buffer[(phase - 3) & BUF_MASK] * SHAPED_BS[3]
+            + buffer[(phase - 4) & BUF_MASK] * SHAPED_BS[4];
+        float result = xe + noise[i];
+
+        phase = (phase + 1) & BUF_MASK;
+        buffer[phase] = xe - lrintf(result);
+
+        int x;
+        if (destFormat == int16Sample)
+            STORE_INT16((short *)dest + i, result);
+        else
+            STORE_INT24((int *)dest + i, result);
+    }
+
+    memcpy(mBuffer, buffer, sizeof(buffer));
+    mPhase = phase;
+}
+
 Dither::Dither()
 {
     // On startup, initialize dither by resetting values
@@ -295,6 +521,12 @@ void Dither::Apply(enum DitherType ditherType,
         // No clipping should be necessary.
         float* d = (float*)dest;
 
+        if (sourceFormat == int16Sample && destStride == 1 && sourceStride == 1)
+            IntToFloat((const short*)source, d, len);
+        else
+        if (sourceFormat == int24Sample && destStride == 1 && sourceStride == 1)
+            IntToFloat((const int*)source, d, len);
+        else
         if (sourceFormat == int16Sample)
         {
             short* s = (short*)source;
@@ -318,6 +550,13 @@ void Dither::Apply(enum DitherType ditherType,
         for (i = 0; i < len; i++, d += destStride, s += sourceStride)
             *d = ((int)*s) << 8;
     } else
+    if (destStride == 1 && sourceStride == 1)
+    {
+        // We must do dithering, and can do it in blocks
+        if (ditherType == DitherType::triangle || ditherType == DitherType::shaped)
+            Reset(); // reset dither filter for this NEW conversion
+        ApplyBlocks(ditherType, source, sourceFormat, dest, destFormat, len);
+    } else
     {
         // We must do dithering
         switch (ditherType)
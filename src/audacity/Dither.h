@@ -44,6 +44,14 @@ private:
     float TriangleDither(float sample);
     float ShapedDither(float sample);
 
+    void ApplyBlocks(DitherType ditherType,
+                     const samplePtr source, sampleFormat sourceFormat,
+                     samplePtr dest, sampleFormat destFormat,
+                     unsigned int len);
+    void ShapedBlock(const float *source, const float *noise,
+                     samplePtr dest, sampleFormat destFormat,
+                     unsigned int len);
+
     // Dither constants
     static const int BUF_SIZE; /* = 8 */
     static const int BUF_MASK; /* = 7 */
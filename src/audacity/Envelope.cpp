@@ -357,6 +357,116 @@ double Envelope::GetInterpolationStartValueAtPoint(int iPoint) const {
         return log10(v);
 }
 
+int EnvelopeCursor::Seek(double t) {
+    const auto &env = mEnvelope->mEnv;
+    const int len = env.size();
+    // Reading forward, t is nearly always in the last segment or the next
+    for (int lo = mLo; lo <= mLo + 1; ++lo)
+        if (lo >= 0 && lo + 1 < len && env[lo].GetT() <= t && t < env[lo + 1].GetT())
+            return mLo = lo;
+
+    const auto after = std::upper_bound(env.begin(), env.end(), t,
+                                        [](double when, const EnvPoint &point) {
+                                            return when < point.GetT();
+                                        });
+    mLo = (int) (after - env.begin()) - 1;
+    assert(mLo >= 0 && mLo + 1 < len);
+    return mLo;
+}
+
+void EnvelopeCursor::GetValues(double *buffer, size_t len, double t0, double tstep) {
+    const auto &envelope = *mEnvelope;
+    const auto &env = envelope.mEnv;
+    const int count = env.size();
+    if (count == 0) {
+        std::fill(buffer, buffer + len, envelope.mDefaultValue);
+        return;
+    }
+
+    // The steps of Envelope::GetValuesRelative() without a left limit, and
+    // so its values, but a segment is entered once per read and its values
+    // then stepped without the tests of every sample
+    const auto epsilon = tstep / 2;
+    const double first = env[0].GetT();
+    const double last = env[count - 1].GetT();
+    double t = t0 - envelope.mOffset;
+    double increment = 0;
+    if (count > 1 && t <= first && first == env[1].GetT())
+        increment = epsilon;
+
+    size_t b = 0;
+    while (b < len) {
+        const auto tplus = t + increment;
+        if (tplus < first || tplus >= last) {
+            buffer[b++] = tplus < first ? env[0].GetVal() : env[count - 1].GetVal();
+            t += tstep;
+            continue;
+        }
+
+        const int lo = Seek(tplus);
+        const int hi = lo + 1;
+        const double tprev = env[lo].GetT();
+        const double tnext = env[hi].GetT();
+        // Right limits at a discontinuity after the segment, as there
+        increment = hi + 1 < count && tnext == env[hi + 1].GetT() ? epsilon : 0;
+
+        const double vprev = envelope.GetInterpolationStartValueAtPoint(lo);
+        const double vnext = envelope.GetInterpolationStartValueAtPoint(hi);
+        const double dt = tnext - tprev;
+        const double to = t - tprev;
+        double v, vstep;
+        if (dt > 0.0) {
+            v = (vprev * (dt - to) + vnext * to) / dt;
+            vstep = (vnext - vprev) * tstep / dt;
+        } else {
+            v = vnext;
+            vstep = 0.0;
+        }
+        if (envelope.mDB) {
+            v = pow(10.0, v);
+            vstep = pow(10.0, vstep);
+        }
+        buffer[b++] = v;
+        t += tstep;
+
+        if (envelope.mDB)
+            for (; b < len && t + increment < tnext; ++b, t += tstep)
+                buffer[b] = buffer[b - 1] * vstep;
+        else
+            for (; b < len && t + increment < tnext; ++b, t += tstep)
+                buffer[b] = buffer[b - 1] + vstep;
+    }
+}
+
+bool EnvelopeCursor::IsConstant(double t0, double t1, double &value) {
+    const auto &env = mEnvelope->mEnv;
+    const int count = env.size();
+    if (count == 0) {
+        value = mEnvelope->mDefaultValue;
+        return true;
+    }
+
+    t0 -= mEnvelope->mOffset;
+    t1 -= mEnvelope->mOffset;
+    if (t1 < env[0].GetT()) {
+        value = env[0].GetVal();
+        return true;
+    }
+    if (t0 >= env[count - 1].GetT()) {
+        value = env[count - 1].GetVal();
+        return true;
+    }
+    if (t0 < env[0].GetT())
+        return false;
+
+    const int lo = Seek(t0);
+    if (t1 < env[lo + 1].GetT() && env[lo].GetVal() == env[lo + 1].GetVal()) {
+        value = env[lo].GetVal();
+        return true;
+    }
+    return false;
+}
+
 void Envelope::CollapseRegion(double t0, double t1, double sampleDur)
 // NOFAIL-GUARANTEE
 {
@@ -140,6 +140,56 @@ private:
    // and repaired
    bool ConsistencyCheck();
 
+    friend class EnvelopeCursor;
+};
+
+// Reads an Envelope forward in time, as mixing and export do, chunk after
+// chunk.  The cursor keeps the segment between two points that it was last
+// in, so the next read starts there without a search.  Within a segment,
+// values step linearly, or exponentially for a dB envelope, in tight
+// loops.  Each cursor has its own position, so threads can read one
+// envelope through cursors of their own.  The envelope must not change
+// while a cursor is in use.
+class EnvelopeCursor {
+public:
+    explicit EnvelopeCursor(const Envelope &envelope) : mEnvelope(&envelope) {}
+
+    const Envelope &GetEnvelope() const { return *mEnvelope; }
+
+    // The same values as Envelope::GetValues()
+    void GetValues(double *buffer, size_t len, double t0, double tstep);
+
+    // True if the envelope has a single value, into value, from absolute
+    // time t0 up to t1: before its first point, past its last one, or
+    // between two points of the same value.  Then the values need not be
+    // fetched at all.  In the last case, GetValues() can differ from
+    // value by rounding.
+    bool IsConstant(double t0, double t1, double &value);
+
+private:
+    // The index of the last point at or before relative time t, which is
+    // from the first point to before the last
+    int Seek(double t);
+
+    const Envelope *mEnvelope;
+    int mLo{0};
+};
+
+// A cursor for each envelope read, such as those of a track's clips
+class EnvelopeCursors {
+public:
+    EnvelopeCursor &For(const Envelope &envelope) {
+        for (auto &cursor : mCursors)
+            if (&cursor.GetEnvelope() == &envelope)
+                return cursor;
+        mCursors.emplace_back(envelope);
+        return mCursors.back();
+    }
+
+    void Clear() { mCursors.clear(); }
+
+private:
+    std::vector<EnvelopeCursor> mCursors;
 };
 
 #endif
@@ -15,6 +15,7 @@
 #include <vector>
 #include "Mix.h"
 #include "ImportPlugin.h"
+#include "Progress.h"
 
 class FormatInfo {
 public:
@@ -59,6 +60,11 @@ public:
 
     void SetExtensions(const std::vector<std::string> &extensions, int index);
 
+    // Export() counts the frames it writes against progress, if any, and
+    // returns ProgressResult::Cancelled, leaving the file unfinished, once it
+    // is cancelled
+    void SetProgress(Progress *progress) { mProgress = progress; }
+
     /** \brief called to export audio into a file.
      *
      * @param pDialog To be initialized with pointer to a NEW ProgressDialog if
@@ -93,6 +99,7 @@ protected:
                                        double outRate, sampleFormat outFormat,
                                        bool highQuality = true, MixerSpec *mixerSpec = nullptr);
 
+    Progress *mProgress{nullptr};
 
 private:
     std::vector<FormatInfo> mFormatInfos;
@@ -8,13 +8,35 @@
 
 **********************************************************************/
 
+#include <algorithm>
+#include <future>
 #include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
 #include "ExportPCM.h"
 
 #include "sndfile.h"
 #include "Utils.h"
 #include "FileFormats.h"
+#include "Instrumentation.h"
 #include "Mix.h"
+#include "WaveClip.h"
+
+namespace {
+
+void ReportWriteError(SNDFILE *sf, const std::string &formatStr) {
+    char buffer2[1000];
+    sf_error_str(sf, buffer2, 1000);
+    std::cerr << string_format(
+            /* i18n-hint: %s will be the error message from libsndfile, which
+             * is usually something unhelpful (and untranslated) like "system
+             * error" */
+            "Error while writing %s file (disk full?).\nLibsndfile says \"%s\"",
+            formatStr.c_str(),
+            buffer2);
+}
+
+}
 
 struct {
     int format;
@@ -71,6 +93,76 @@ ExportPCM::ExportPCM() {
     SetMaxChannels(255, format);
 }
 
+SFFile ExportPCM::OpenFile(const std::string &fName, double rate,
+                           unsigned numChannels, sf_count_t frames,
+                           int subformat, SF_INFO &info, sampleFormat &format) {
+    return Open(fName, rate, numChannels, frames, subformat, info, format,
+                [&](SF_INFO &info) -> SNDFILE * {
+                    const int fd = open(fName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+                    if (fd < 0)
+                        return nullptr;
+                    // libsndfile owns the descriptor and closes it with the file
+                    return SFCall<SNDFILE *>(sf_open_fd, fd, SFM_WRITE, &info, true);
+                });
+}
+
+SFFile ExportPCM::OpenMemory(SFMemory &memory, double rate,
+                             unsigned numChannels, sf_count_t frames,
+                             int subformat, SF_INFO &info, sampleFormat &format) {
+    return Open("memory", rate, numChannels, frames, subformat, info, format,
+                [&](SF_INFO &info) { return memory.Open(info).release(); });
+}
+
+SFFile ExportPCM::Open(const std::string &name, double rate,
+                       unsigned numChannels, sf_count_t frames, int subformat,
+                       SF_INFO &info, sampleFormat &format,
+                       const std::function<SNDFILE *(SF_INFO &info)> &open) {
+    int sf_format;
+    if (subformat < 0 || static_cast<unsigned int>(subformat) >= (sizeof(kFormats) / sizeof(kFormats[0]))) {
+        sf_format = SF_FORMAT_WAV;
+    } else {
+        sf_format = kFormats[subformat].format;
+    }
+
+    SFFile sf; // wraps f
+
+    // Use libsndfile to export file
+
+    info.samplerate = (unsigned int) (rate + 0.5);
+    info.frames = frames;
+    info.channels = numChannels;
+    info.format = sf_format;
+    info.sections = 1;
+    info.seekable = 0;
+
+    // If we can't export exactly the format they requested,
+    // try the default format for that header type...
+    if (!sf_format_check(&info))
+        info.format = (info.format & SF_FORMAT_TYPEMASK);
+    if (!sf_format_check(&info)) {
+        std::cerr << "Cannot export audio in this format." << std::endl;
+        return sf;
+    }
+
+    sf.reset(open(info));
+    if (sf) {
+        //add clipping for integer formats.  We allow floats to clip.
+        sf_command(sf.get(), SFC_SET_CLIPPING, nullptr, sf_subtype_is_integer(sf_format) ? SF_TRUE : SF_FALSE);
+    }
+
+    if (!sf) {
+        std::cerr << string_format("Cannot export audio to %s", name.c_str()) << std::endl;
+        return sf;
+    }
+
+    if (sf_subtype_more_than_16_bits(info.format))
+        format = floatSample;
+    else
+        format = int16Sample;
+
+    return sf;
+}
+
 /**
  *
  * @param subformat Control whether we are doing a "preset" export to a popular
@@ -81,79 +173,88 @@ ProgressResult ExportPCM::Export(
         const std::string &fName,
         MixerSpec *mixerSpec,
         int subformat) {
-    assert(waveTracks.size() == 1);
+    return ExportTo(waveTracks,
+                    [&](double rate, unsigned numChannels, sf_count_t frames,
+                        SF_INFO &info, sampleFormat &format) {
+                        return OpenFile(fName, rate, numChannels, frames, subformat, info, format);
+                    },
+                    mixerSpec);
+}
+
+ProgressResult ExportPCM::Export(
+        WaveTrackConstArray& waveTracks,
+        std::vector<char> &out,
+        MixerSpec *mixerSpec,
+        int subformat) {
+    SFMemory memory(out);
+    return ExportTo(waveTracks,
+                    [&](double rate, unsigned numChannels, sf_count_t frames,
+                        SF_INFO &info, sampleFormat &format) {
+                        return OpenMemory(memory, rate, numChannels, frames, subformat, info, format);
+                    },
+                    mixerSpec);
+}
+
+ProgressResult ExportPCM::ExportTo(WaveTrackConstArray &waveTracks, const Opener &open,
+                                   MixerSpec *mixerSpec) {
+    NR_TIME_SCOPE(Instrumentation::Stage::Export);
+    assert(!waveTracks.empty());
     double rate = waveTracks.at(0)->GetRate();
     double t0 = waveTracks.at(0)->GetStartTime();
     double t1 = waveTracks.at(0)->GetEndTime();
-    unsigned numChannels = waveTracks.at(0)->GetChannel() == WaveTrack::MonoChannel ? 1 : 2;
+    for (const auto &track : waveTracks) {
+        t0 = std::min(t0, track->GetStartTime());
+        t1 = std::max(t1, track->GetEndTime());
+    }
 
-    int sf_format;
-    if (subformat < 0 || static_cast<unsigned int>(subformat) >= (sizeof(kFormats) / sizeof(kFormats[0]))) {
-        sf_format = SF_FORMAT_WAV;
-    } else {
-        sf_format = kFormats[subformat].format;
+    unsigned numChannels;
+    std::unique_ptr<MixerSpec> identitySpec;
+    if (waveTracks.size() == 1)
+        numChannels = waveTracks.at(0)->GetChannel() == WaveTrack::MonoChannel ? 1 : 2;
+    else {
+        // One file channel per track, in track order, unless told otherwise
+        numChannels = waveTracks.size();
+        if (!mixerSpec) {
+            identitySpec = std::make_unique<MixerSpec>(numChannels, numChannels);
+            mixerSpec = identitySpec.get();
+        }
     }
 
     auto updateResult = ProgressResult::Success;
     {
-        SFFile sf; // wraps f
-
-        std::string formatStr;
         SF_INFO info;
-        //int          err;
+        sampleFormat format;
+        SFFile sf = open(rate, numChannels, (sf_count_t) ((t1 - t0) * rate + 0.5),
+                         info, format);
+        if (!sf)
+            return ProgressResult::Cancelled;
 
         //This whole operation should not occur while a file is being loaded on OD,
         //(we are worried about reading from a file being written to,) so we block.
         //Furthermore, we need to do this because libsndfile is not threadsafe.
-        formatStr = SFCall<std::string>(sf_header_name, sf_format & SF_FORMAT_TYPEMASK);
-
-        // Use libsndfile to export file
-
-        info.samplerate = (unsigned int) (rate + 0.5);
-        info.frames = (unsigned int) ((t1 - t0) * rate + 0.5);
-        info.channels = numChannels;
-        info.format = sf_format;
-        info.sections = 1;
-        info.seekable = 0;
-
-        // If we can't export exactly the format they requested,
-        // try the default format for that header type...
-        if (!sf_format_check(&info))
-            info.format = (info.format & SF_FORMAT_TYPEMASK);
-        if (!sf_format_check(&info)) {
-            std::cerr << "Cannot export audio in this format." << std::endl;
-            return ProgressResult::Cancelled;
-        }
-
-        if (FILE* f = fopen(fName.c_str(), "wb")) {
-            int fd = fileno(f);
-            // Even though there is an sf_open() that takes a filename, use the one that
-            // takes a file descriptor since wxWidgets can open a file with a Unicode name and
-            // libsndfile can't (under Windows).
-            sf.reset(SFCall<SNDFILE *>(sf_open_fd, fd, SFM_WRITE, &info, false));
-            //add clipping for integer formats.  We allow floats to clip.
-            sf_command(sf.get(), SFC_SET_CLIPPING, nullptr, sf_subtype_is_integer(sf_format) ? SF_TRUE : SF_FALSE);
-        }
-
-        if (!sf) {
-            std::cerr << string_format("Cannot export audio to %s", fName) << std::endl;
-            return ProgressResult::Cancelled;
-        }
-
-        sampleFormat format;
-        if (sf_subtype_more_than_16_bits(info.format))
-            format = floatSample;
-        else
-            format = int16Sample;
+        std::string formatStr = SFCall<std::string>(sf_header_name, info.format & SF_FORMAT_TYPEMASK);
 
         size_t maxBlockLen = 44100 * 5;
 
-        {
+        if (mProgress)
+            mProgress->Begin(info.frames);
+
+        if (CanWriteDirectly(waveTracks, numChannels, mixerSpec)) {
+            const auto &track = *waveTracks.at(0);
+            // 24 bit samples go to a 24 bit file as they are
+            if (track.GetSampleFormat() == int24Sample &&
+                (info.format & SF_FORMAT_SUBMASK) == SF_FORMAT_PCM_24)
+                format = int24Sample;
+            if (!WriteDirectly(sf.get(), track, track.TimeToLongSamples(t0),
+                               info.frames, format, formatStr))
+                updateResult = ProgressResult::Cancelled;
+        } else {
             assert(info.channels >= 0);
             auto mixer = CreateMixer(waveTracks,
                                      t0, t1,
                                      info.channels, maxBlockLen, true,
                                      rate, format, true, mixerSpec);
+            mixer->SetReadAhead(mReadAhead);
 
 
             while (updateResult == ProgressResult::Success) {
@@ -169,23 +270,20 @@ ProgressResult ExportPCM::Export(
                     samplesWritten = SFCall<sf_count_t>(sf_writef_short, sf.get(), (short *) mixed, numSamples);
                 else
                     samplesWritten = SFCall<sf_count_t>(sf_writef_float, sf.get(), (float *) mixed, numSamples);
+                NR_COUNT(BytesWritten, numSamples * info.channels * SAMPLE_SIZE(format));
 
                 if (static_cast<size_t>(samplesWritten) != numSamples) {
-                    char buffer2[1000];
-                    sf_error_str(sf.get(), buffer2, 1000);
-                    std::cerr << string_format(
-                            /* i18n-hint: %s will be the error message from libsndfile, which
-                             * is usually something unhelpful (and untranslated) like "system
-                             * error" */
-                            "Error while writing %s file (disk full?).\nLibsndfile says \"%s\"",
-                            formatStr,
-                            buffer2);
+                    ReportWriteError(sf.get(), formatStr);
                     updateResult = ProgressResult::Cancelled;
                     break;
                 }
 
+                if (mProgress && !mProgress->Advance(numSamples))
+                    break;
             }
         }
+        if (mProgress && mProgress->IsCancelled())
+            updateResult = ProgressResult::Cancelled;
 
         // Install the WAV metata in a "LIST" chunk at the end of the file
         if (updateResult == ProgressResult::Success ||
@@ -201,3 +299,90 @@ ProgressResult ExportPCM::Export(
 
     return updateResult;
 }
+
+bool ExportPCM::CanWriteDirectly(const WaveTrackConstArray &tracks,
+                                 unsigned numChannels, const MixerSpec *mixerSpec) {
+    if (tracks.size() != 1 || numChannels != 1 || mixerSpec)
+        return false;
+
+    // Else the Mixer would scale the samples
+    const auto &track = *tracks.at(0);
+    if (track.GetChannelGain(0) != 1.0f)
+        return false;
+    for (const auto &clip : track.GetClips()) {
+        const auto envelope = clip->GetEnvelope();
+        if (envelope->GetNumberOfPoints() != 0 || envelope->GetValue(clip->GetStartTime()) != 1.0)
+            return false;
+    }
+    return true;
+}
+
+bool ExportPCM::WriteDirectly(SNDFILE *sf, const WaveTrack &track,
+                              sampleCount start, sampleCount len,
+                              sampleFormat format, const std::string &formatStr) const {
+    auto write = [sf, format](constSamplePtr samples, size_t frames) {
+        sf_count_t written;
+        if (format == int16Sample)
+            written = SFCall<sf_count_t>(sf_writef_short, sf, (const short *) samples, frames);
+        else if (format == int24Sample)
+            written = SFCall<sf_count_t>(sf_writef_int, sf, (const int *) samples, frames);
+        else
+            written = SFCall<sf_count_t>(sf_writef_float, sf, (const float *) samples, frames);
+        NR_COUNT(BytesWritten, frames * SAMPLE_SIZE(format));
+        return static_cast<size_t>(written) == frames;
+    };
+
+    // Two of each, so that one can be filled while the other is written
+    const auto maxBlockSize = track.GetMaxBlockSize();
+    SampleBuffer floats[2], converted[2];
+    for (int ii = 0; ii < 2; ii++) {
+        if (format != int24Sample)
+            floats[ii].Allocate(maxBlockSize, floatSample);
+        if (format != floatSample)
+            converted[ii].Allocate(maxBlockSize, format);
+    }
+    std::future<bool> pending;
+    int which = 0;
+
+    bool result = true;
+    for (auto pos = start; result && pos < start + len; which = 1 - which) {
+        const auto frames = limitSampleBufferSize(track.GetBestBlockSize(pos), start + len - pos);
+
+        auto samples = format == floatSample ? track.GetSpan(floatSample, pos, frames) : nullptr;
+        if (format == int24Sample) {
+            // libsndfile wants the 3 bytes in the 3 most significant
+            const auto ints = (int *) converted[which].ptr();
+            track.Get((samplePtr) ints, int24Sample, pos, frames);
+            for (size_t i = 0; i < frames; i++)
+                ints[i] = (int) ((unsigned) ints[i] << 8);
+            samples = (samplePtr) ints;
+        } else if (!samples) {
+            track.Get(floats[which].ptr(), floatSample, pos, frames);
+            samples = floats[which].ptr();
+            if (format != floatSample) {
+                CopySamples(floats[which].ptr(), floatSample, converted[which].ptr(), format, frames);
+                samples = converted[which].ptr();
+            }
+        }
+        pos += frames;
+
+        if (pending.valid())
+            result = pending.get();
+        if (!result)
+            break;
+        if (mWriteBehind)
+            pending = std::async(std::launch::async, write, samples, frames);
+        else
+            result = write(samples, frames);
+
+        // Cancelled, the rest is not written, which is not a write error
+        if (mProgress && !mProgress->Advance(frames))
+            break;
+    }
+    if (pending.valid())
+        result = pending.get() && result;
+
+    if (!result)
+        ReportWriteError(sf, formatStr);
+    return result;
+}
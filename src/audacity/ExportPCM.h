@@ -11,10 +11,14 @@
 #ifndef __AUDACITY_EXPORTPCM__
 #define __AUDACITY_EXPORTPCM__
 
+#include "sndfile.h"
 #include "ImportPlugin.h"
 #include "Export.h"
+#include "FileFormats.h"
 #include "Mix.h"
 
+#include <functional>
+
 class ExportPCM final : ExportPlugin {
 public:
 
@@ -28,6 +32,64 @@ public:
             MixerSpec *mixerSpec = nullptr,
             int subformat = 0) override;
 
+    // The same into the bytes of a file in memory, replacing out
+    ProgressResult Export(
+            WaveTrackConstArray& tracks,
+            std::vector<char> &out,
+            MixerSpec *mixerSpec = nullptr,
+            int subformat = 0);
+
+    // Open fName for writing with one of the kFormats subformats, falling back
+    // to the default format of the header type.  On success info describes the
+    // file and format tells which sample format to hand to libsndfile.
+    static SFFile OpenFile(const std::string &fName, double rate,
+                           unsigned numChannels, sf_count_t frames,
+                           int subformat, SF_INFO &info, sampleFormat &format);
+
+    // The same for writing through memory
+    static SFFile OpenMemory(SFMemory &memory, double rate,
+                             unsigned numChannels, sf_count_t frames,
+                             int subformat, SF_INFO &info, sampleFormat &format);
+
+    // When exporting one track straight to the file, write each block on
+    // another thread while the next is read
+    void SetWriteBehind(bool writeBehind) { mWriteBehind = writeBehind; }
+
+    // When mixing, read this many blocks of each track ahead on other
+    // threads, for tracks whose blocks are not in memory
+    void SetReadAhead(size_t depth) { mReadAhead = depth; }
+
+    // Counts the frames written, a block at a time; see ExportPlugin
+    using ExportPlugin::SetProgress;
+
+private:
+    // Opens the file for numChannels of frames at rate, as OpenFile() does
+    using Opener = std::function<SFFile(double rate, unsigned numChannels, sf_count_t frames,
+                                        SF_INFO &info, sampleFormat &format)>;
+
+    // Checks info for the subformat, then opens through open(info), which
+    // returns nullptr on failure; name is for the messages
+    static SFFile Open(const std::string &name, double rate,
+                       unsigned numChannels, sf_count_t frames, int subformat,
+                       SF_INFO &info, sampleFormat &format,
+                       const std::function<SNDFILE *(SF_INFO &info)> &open);
+
+    ProgressResult ExportTo(WaveTrackConstArray &tracks, const Opener &open,
+                            MixerSpec *mixerSpec);
+
+    // One mono track with unity gain and flat envelopes needs no Mixer
+    static bool CanWriteDirectly(const WaveTrackConstArray &tracks,
+                                 unsigned numChannels, const MixerSpec *mixerSpec);
+
+    // Writes len samples of track from start, a block at a time, read in
+    // place when they are floats already.  An int24Sample format writes the
+    // track's 24 bit samples as integers.
+    bool WriteDirectly(SNDFILE *sf, const WaveTrack &track,
+                       sampleCount start, sampleCount len,
+                       sampleFormat format, const std::string &formatStr) const;
+
+    bool mWriteBehind{false};
+    size_t mReadAhead{0};
 };
 
 
@@ -0,0 +1,365 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  FFTBackend.cpp
+
+**********************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+#include "FFTBackend.h"
+#include "RealFFTf.h"
+
+#ifdef USE_FFTW
+#include <fftw3.h>
+#endif
+
+#ifdef USE_CUFFT
+#include <cuda_runtime.h>
+#include <cufft.h>
+#endif
+
+#ifndef DEFAULT_FFT_BACKEND
+#define DEFAULT_FFT_BACKEND "builtin"
+#endif
+
+namespace {
+
+class BuiltinFFTPlan final : public FFTPlan {
+public:
+    explicit BuiltinFFTPlan(size_t size)
+            : FFTPlan(size), hFFT(GetFFT(size)), mScratch(size), mBatchScratch(size * FFTBatchFrames) {
+    }
+
+    void Forward(float *buffer) override {
+        RealFFTfNatural(buffer, &mScratch[0], hFFT.get());
+    }
+
+    void Inverse(float *buffer) override {
+        InverseRealFFTfNatural(buffer, &mScratch[0], hFFT.get());
+    }
+
+    void ForwardBatch(float *const *buffers, size_t count) override {
+        if (count < 2) {
+            FFTPlan::ForwardBatch(buffers, count);
+            return;
+        }
+        RealFFTfNaturalBatch(buffers, count, &mBatchScratch[0], hFFT.get());
+    }
+
+private:
+    HFFT hFFT;
+    std::vector<float> mScratch;
+    std::vector<float> mBatchScratch;
+};
+
+class BuiltinFFTBackend final : public FFTBackend {
+public:
+    std::string GetName() const override { return "builtin"; }
+
+    std::unique_ptr<FFTPlan> MakePlan(size_t size) override {
+        // RealFFTf takes powers of two of at least four points
+        if (size < 4 || (size & (size - 1)))
+            return nullptr;
+        return std::make_unique<BuiltinFFTPlan>(size);
+    }
+};
+
+#ifdef USE_FFTW
+
+// The FFTW planner is not thread safe, though executing plans is
+std::mutex fftwMutex;
+std::string fftwWisdomFile;
+bool fftwWisdomLoaded = false;
+
+class FFTWPlan final : public FFTPlan {
+public:
+    FFTWPlan(size_t size, float *time, fftwf_complex *freq,
+             fftwf_plan forward, fftwf_plan inverse)
+            : FFTPlan(size), mTime(time), mFreq(freq), mForward(forward), mInverse(inverse) {
+    }
+
+    ~FFTWPlan() override {
+        std::lock_guard<std::mutex> lock(fftwMutex);
+        fftwf_destroy_plan(mForward);
+        fftwf_destroy_plan(mInverse);
+        fftwf_free(mTime);
+        fftwf_free(mFreq);
+    }
+
+    void Forward(float *buffer) override {
+        const size_t half = Size() / 2;
+        memcpy(mTime, buffer, Size() * sizeof(float));
+        fftwf_execute(mForward);
+        buffer[0] = mFreq[0][0];
+        buffer[1] = mFreq[half][0];
+        for (size_t ii = 1; ii < half; ++ii) {
+            buffer[2 * ii] = mFreq[ii][0];
+            buffer[2 * ii + 1] = mFreq[ii][1];
+        }
+    }
+
+    void Inverse(float *buffer) override {
+        const size_t half = Size() / 2;
+        mFreq[0][0] = buffer[0];
+        mFreq[0][1] = 0;
+        mFreq[half][0] = buffer[1];
+        mFreq[half][1] = 0;
+        for (size_t ii = 1; ii < half; ++ii) {
+            mFreq[ii][0] = buffer[2 * ii];
+            mFreq[ii][1] = buffer[2 * ii + 1];
+        }
+        fftwf_execute(mInverse);
+        const float scale = 1.0f / Size();
+        for (size_t ii = 0; ii < Size(); ++ii)
+            buffer[ii] = mTime[ii] * scale;
+    }
+
+private:
+    float *const mTime;
+    fftwf_complex *const mFreq;
+    const fftwf_plan mForward;
+    const fftwf_plan mInverse;
+};
+
+class FFTWBackend final : public FFTBackend {
+public:
+    std::string GetName() const override { return "fftw"; }
+
+    std::unique_ptr<FFTPlan> MakePlan(size_t size) override {
+        if (size < 2 || size % 2)
+            return nullptr;
+
+        std::lock_guard<std::mutex> lock(fftwMutex);
+        if (!fftwWisdomLoaded && !fftwWisdomFile.empty())
+            fftwf_import_wisdom_from_filename(fftwWisdomFile.c_str());
+        fftwWisdomLoaded = true;
+
+        auto time = fftwf_alloc_real(size);
+        auto freq = fftwf_alloc_complex(size / 2 + 1);
+        const unsigned flags = fftwWisdomFile.empty() ? FFTW_ESTIMATE : FFTW_MEASURE;
+        auto forward = time && freq ? fftwf_plan_dft_r2c_1d((int) size, time, freq, flags) : nullptr;
+        auto inverse = time && freq ? fftwf_plan_dft_c2r_1d((int) size, freq, time, flags) : nullptr;
+        if (!forward || !inverse) {
+            if (forward)
+                fftwf_destroy_plan(forward);
+            if (inverse)
+                fftwf_destroy_plan(inverse);
+            fftwf_free(time);
+            fftwf_free(freq);
+            return nullptr;
+        }
+        if (!fftwWisdomFile.empty())
+            fftwf_export_wisdom_to_filename(fftwWisdomFile.c_str());
+        return std::make_unique<FFTWPlan>(size, time, freq, forward, inverse);
+    }
+};
+
+#endif
+
+#ifdef USE_CUFFT
+
+// The most transforms of one launch; the Workers ask for FFTBatchFrames
+const size_t cufftMaxBatch = 64;
+
+// Transforms on the first CUDA device.  Each plan has its own stream and
+// buffers, pinned on the host for the copies, so plans run independently.
+// cuFFT plans for each number of transforms at once are made as they are
+// first asked for; should one fail, those transforms are done built in.
+class CUFFTPlan final : public FFTPlan {
+public:
+    CUFFTPlan(size_t size, cudaStream_t stream, float *host, float *time, cufftComplex *freq)
+            : FFTPlan(size), mStream(stream), mHost(host), mTime(time), mFreq(freq),
+              mBuiltin(size) {
+    }
+
+    ~CUFFTPlan() override {
+        for (const auto &plan : mForward)
+            cufftDestroy(plan.second);
+        if (mInverse)
+            cufftDestroy(mInverse);
+        cudaFreeHost(mHost);
+        cudaFree(mTime);
+        cudaFree(mFreq);
+        cudaStreamDestroy(mStream);
+    }
+
+    void Forward(float *buffer) override {
+        ForwardBatch(&buffer, 1);
+    }
+
+    void Inverse(float *buffer) override {
+        const size_t half = Size() / 2;
+        if (!mInverse && !MakePlan(mInverse, CUFFT_C2R, 1)) {
+            mBuiltin.Inverse(buffer);
+            return;
+        }
+        auto freq = (cufftComplex *) mHost;
+        freq[0] = {buffer[0], 0};
+        freq[half] = {buffer[1], 0};
+        for (size_t ii = 1; ii < half; ++ii)
+            freq[ii] = {buffer[2 * ii], buffer[2 * ii + 1]};
+        cudaMemcpyAsync(mFreq, freq, (half + 1) * sizeof(cufftComplex), cudaMemcpyHostToDevice, mStream);
+        cufftExecC2R(mInverse, mFreq, mTime);
+        cudaMemcpyAsync(mHost, mTime, Size() * sizeof(float), cudaMemcpyDeviceToHost, mStream);
+        cudaStreamSynchronize(mStream);
+        const float scale = 1.0f / Size();
+        for (size_t ii = 0; ii < Size(); ++ii)
+            buffer[ii] = mHost[ii] * scale;
+    }
+
+    void ForwardBatch(float *const *buffers, size_t count) override {
+        const size_t size = Size(), half = size / 2;
+        for (size_t first = 0; first < count; first += cufftMaxBatch) {
+            const auto batch = std::min(cufftMaxBatch, count - first);
+            auto &plan = mForward[batch];
+            if (!plan && !MakePlan(plan, CUFFT_R2C, batch)) {
+                mForward.erase(batch);
+                mBuiltin.ForwardBatch(buffers + first, batch);
+                continue;
+            }
+
+            for (size_t ii = 0; ii < batch; ++ii)
+                memcpy(mHost + ii * size, buffers[first + ii], size * sizeof(float));
+            cudaMemcpyAsync(mTime, mHost, batch * size * sizeof(float), cudaMemcpyHostToDevice, mStream);
+            cufftExecR2C(plan, mTime, mFreq);
+            cudaMemcpyAsync(mHost, mFreq, batch * (half + 1) * sizeof(cufftComplex),
+                            cudaMemcpyDeviceToHost, mStream);
+            cudaStreamSynchronize(mStream);
+
+            const auto freqs = (const cufftComplex *) mHost;
+            for (size_t ii = 0; ii < batch; ++ii) {
+                const auto freq = freqs + ii * (half + 1);
+                float *const buffer = buffers[first + ii];
+                buffer[0] = freq[0].x;
+                buffer[1] = freq[half].x;
+                for (size_t jj = 1; jj < half; ++jj) {
+                    buffer[2 * jj] = freq[jj].x;
+                    buffer[2 * jj + 1] = freq[jj].y;
+                }
+            }
+        }
+    }
+
+private:
+    bool MakePlan(cufftHandle &plan, cufftType type, size_t batch) {
+        int n = (int) Size();
+        const int half = n / 2;
+        const bool forward = type == CUFFT_R2C;
+        if (cufftPlanMany(&plan, 1, &n, nullptr, 1, forward ? n : half + 1,
+                          nullptr, 1, forward ? half + 1 : n, type, (int) batch) != CUFFT_SUCCESS) {
+            plan = 0;
+            return false;
+        }
+        cufftSetStream(plan, mStream);
+        return true;
+    }
+
+    const cudaStream_t mStream;
+    // By the number of transforms
+    std::map<size_t, cufftHandle> mForward;
+    cufftHandle mInverse{0};
+    // cufftMaxBatch frames, or as many spectra, on the host and the device
+    float *const mHost;
+    float *const mTime;
+    cufftComplex *const mFreq;
+    BuiltinFFTPlan mBuiltin;
+};
+
+class CUFFTBackend final : public FFTBackend {
+public:
+    std::string GetName() const override { return "cufft"; }
+
+    // Null, so that the built-in backend is used, without a device
+    std::unique_ptr<FFTPlan> MakePlan(size_t size) override {
+        int devices = 0;
+        if (size < 4 || (size & (size - 1)) ||
+            cudaGetDeviceCount(&devices) != cudaSuccess || devices == 0)
+            return nullptr;
+
+        // (size / 2 + 1) complex values take more room than size floats
+        const size_t spectraBytes = cufftMaxBatch * (size / 2 + 1) * sizeof(cufftComplex);
+        cudaStream_t stream = nullptr;
+        float *host = nullptr, *time = nullptr;
+        cufftComplex *freq = nullptr;
+        if (cudaStreamCreate(&stream) != cudaSuccess)
+            return nullptr;
+        if (cudaMallocHost((void **) &host, spectraBytes) != cudaSuccess ||
+            cudaMalloc((void **) &time, cufftMaxBatch * size * sizeof(float)) != cudaSuccess ||
+            cudaMalloc((void **) &freq, spectraBytes) != cudaSuccess) {
+            cudaFreeHost(host);
+            cudaFree(time);
+            cudaFree(freq);
+            cudaStreamDestroy(stream);
+            return nullptr;
+        }
+        return std::make_unique<CUFFTPlan>(size, stream, host, time, freq);
+    }
+};
+
+#endif
+
+std::atomic<FFTBackend *> &CurrentBackend() {
+    static std::atomic<FFTBackend *> current{[] {
+        for (auto backend : FFTBackends())
+            if (backend->GetName() == DEFAULT_FFT_BACKEND)
+                return backend;
+        return FFTBackends()[0];
+    }()};
+    return current;
+}
+
+}
+
+const std::vector<FFTBackend *> &FFTBackends() {
+    static BuiltinFFTBackend builtin;
+#ifdef USE_FFTW
+    static FFTWBackend fftw;
+#endif
+#ifdef USE_CUFFT
+    static CUFFTBackend cufft;
+#endif
+    static const std::vector<FFTBackend *> backends{
+            &builtin,
+#ifdef USE_FFTW
+            &fftw,
+#endif
+#ifdef USE_CUFFT
+            &cufft,
+#endif
+    };
+    return backends;
+}
+
+FFTBackend &GetFFTBackend() {
+    return *CurrentBackend().load();
+}
+
+bool SetFFTBackend(const std::string &name) {
+    for (auto backend : FFTBackends())
+        if (backend->GetName() == name) {
+            CurrentBackend().store(backend);
+            return true;
+        }
+    return false;
+}
+
+std::unique_ptr<FFTPlan> MakeFFTPlan(size_t size) {
+    auto plan = GetFFTBackend().MakePlan(size);
+    if (!plan)
+        plan = FFTBackends()[0]->MakePlan(size);
+    return plan;
+}
+
+void SetFFTWisdomFile(const std::string &path) {
+#ifdef USE_FFTW
+    std::lock_guard<std::mutex> lock(fftwMutex);
+    fftwWisdomFile = path;
+    fftwWisdomLoaded = false;
+#endif
+}
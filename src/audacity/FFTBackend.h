@@ -0,0 +1,81 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  FFTBackend.h
+
+*******************************************************************//**
+
+\class FFTBackend
+\brief Makes FFTPlans.  The built-in backend wraps RealFFTf; others
+(FFTW, when built with USE_FFTW, and cuFFT on a CUDA device, when built
+with USE_CUFFT) wrap external libraries.
+
+*//****************************************************************//**
+
+\class FFTPlan
+\brief Real forward and inverse transforms of one size, in place.
+
+  Spectra are packed in natural order: buffer[0] is the DC bin and
+  buffer[1] the Fs/2 bin, both real, then come the (real, imaginary)
+  pairs of bins 1 to size/2 - 1.  Forward is unscaled, and Inverse
+  scales by 1/size so that it undoes Forward.
+
+*//*******************************************************************/
+
+#ifndef __AUDACITY_FFT_BACKEND__
+#define __AUDACITY_FFT_BACKEND__
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class FFTPlan /* not final */ {
+public:
+    explicit FFTPlan(size_t size) : mSize(size) {}
+
+    virtual ~FFTPlan() {}
+
+    size_t Size() const { return mSize; }
+
+    // buffer holds Size() floats
+    virtual void Forward(float *buffer) = 0;
+    virtual void Inverse(float *buffer) = 0;
+
+    // Forward() of each of count buffers; a backend may do several at once
+    virtual void ForwardBatch(float *const *buffers, size_t count) {
+        for (size_t ii = 0; ii < count; ++ii)
+            Forward(buffers[ii]);
+    }
+
+private:
+    const size_t mSize;
+};
+
+class FFTBackend /* not final */ {
+public:
+    virtual ~FFTBackend() {}
+
+    virtual std::string GetName() const = 0;
+
+    // The plan may then be used by one thread at a time.
+    // Returns nullptr if the size can't be planned.
+    virtual std::unique_ptr<FFTPlan> MakePlan(size_t size) = 0;
+};
+
+// The backends compiled in, the built-in one first
+const std::vector<FFTBackend *> &FFTBackends();
+
+// Plans are made by DEFAULT_FFT_BACKEND unless another is chosen by name;
+// returns false, changing nothing, if there is no such backend
+FFTBackend &GetFFTBackend();
+bool SetFFTBackend(const std::string &name);
+
+// A plan from the current backend, or from the built-in one if that fails
+std::unique_ptr<FFTPlan> MakeFFTPlan(size_t size);
+
+// Where FFTW keeps its planner wisdom.  With a file, plans are measured
+// once and the results reused by later runs; without, they are estimated.
+void SetFFTWisdomFile(const std::string &path);
+
+#endif
@@ -0,0 +1,181 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  FastMath.cpp
+
+  The log reduces x to m * 2^e with m in [sqrt(1/2), sqrt(2)), and sums
+  the series log(m) = 2 (t + t^3/3 + ... + t^9/9) with t = (m-1)/(m+1),
+  |t| < 0.172.  The exp reduces x to r + n log(2) with |r| <= log(2)/2,
+  takes the Taylor polynomial of degree 7 for exp(r), and scales by 2^n
+  through the exponent bits.  The vector and scalar code do the same
+  steps.
+
+**********************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "FastMath.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+const float sqrt2 = 1.41421356f;
+const float ln2 = 0.693147181f;
+const float log2e = 1.44269504f;
+// log(2) split so that n * ln2Hi is exact for the n in range
+const float ln2Hi = 0.693359375f;
+const float ln2Lo = -2.12194440e-4f;
+const float expMin = -87.0f;
+const float expMax = 88.0f;
+
+inline float LogSeries(float t) {
+    const float t2 = t * t;
+    return t * (2.0f + t2 * (2.0f / 3 + t2 * (2.0f / 5 + t2 * (2.0f / 7 + t2 * (2.0f / 9)))));
+}
+
+inline float ExpPolynomial(float r) {
+    return 1.0f + r * (1.0f + r * (1.0f / 2 + r * (1.0f / 6 + r * (1.0f / 24 +
+           r * (1.0f / 120 + r * (1.0f / 720 + r * (1.0f / 5040)))))));
+}
+
+inline float ScalarLog(float x) {
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof bits);
+    int exponent = (int) (bits >> 23) - 127;
+    bits = (bits & 0x007fffff) | 0x3f800000;
+    float m;
+    memcpy(&m, &bits, sizeof m);
+    if (m > sqrt2)
+        m *= 0.5f, ++exponent;
+    return exponent * ln2 + LogSeries((m - 1.0f) / (m + 1.0f));
+}
+
+inline float ScalarExp(float x) {
+    x = std::min(expMax, std::max(expMin, x));
+    const float n = std::nearbyint(x * log2e);
+    const float r = (x - n * ln2Hi) - n * ln2Lo;
+    const uint32_t bits = (uint32_t) ((int) n + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof scale);
+    return ExpPolynomial(r) * scale;
+}
+
+#if defined(__SSE2__)
+
+inline __m128 VectorLog(__m128 x) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128i bits = _mm_castps_si128(x);
+    __m128i exponent = _mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127));
+    __m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)),
+                                             _mm_set1_epi32(0x3f800000)));
+    const __m128 big = _mm_cmpgt_ps(m, _mm_set1_ps(sqrt2));
+    m = _mm_mul_ps(m, _mm_or_ps(_mm_and_ps(big, _mm_set1_ps(0.5f)), _mm_andnot_ps(big, one)));
+    // The mask is -1 where big
+    exponent = _mm_sub_epi32(exponent, _mm_castps_si128(big));
+
+    const __m128 t = _mm_div_ps(_mm_sub_ps(m, one), _mm_add_ps(m, one));
+    const __m128 t2 = _mm_mul_ps(t, t);
+    __m128 series = _mm_set1_ps(2.0f / 9);
+    series = _mm_add_ps(_mm_set1_ps(2.0f / 7), _mm_mul_ps(t2, series));
+    series = _mm_add_ps(_mm_set1_ps(2.0f / 5), _mm_mul_ps(t2, series));
+    series = _mm_add_ps(_mm_set1_ps(2.0f / 3), _mm_mul_ps(t2, series));
+    series = _mm_add_ps(_mm_set1_ps(2.0f), _mm_mul_ps(t2, series));
+    return _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(exponent), _mm_set1_ps(ln2)), _mm_mul_ps(t, series));
+}
+
+inline __m128 VectorExp(__m128 x) {
+    x = _mm_min_ps(_mm_set1_ps(expMax), _mm_max_ps(_mm_set1_ps(expMin), x));
+    // Rounds to nearest, as nearbyint does in the default mode
+    const __m128i n = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(log2e)));
+    const __m128 nf = _mm_cvtepi32_ps(n);
+    const __m128 r = _mm_sub_ps(_mm_sub_ps(x, _mm_mul_ps(nf, _mm_set1_ps(ln2Hi))),
+                                _mm_mul_ps(nf, _mm_set1_ps(ln2Lo)));
+    __m128 p = _mm_set1_ps(1.0f / 5040);
+    for (float coefficient : {1.0f / 720, 1.0f / 120, 1.0f / 24, 1.0f / 6, 1.0f / 2, 1.0f, 1.0f})
+        p = _mm_add_ps(_mm_set1_ps(coefficient), _mm_mul_ps(r, p));
+    const __m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23));
+    return _mm_mul_ps(p, scale);
+}
+
+#elif defined(__ARM_NEON)
+
+inline float32x4_t VectorLog(float32x4_t x) {
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    const uint32x4_t bits = vreinterpretq_u32_f32(x);
+    int32x4_t exponent = vsubq_s32(vreinterpretq_s32_u32(vshrq_n_u32(bits, 23)), vdupq_n_s32(127));
+    float32x4_t m = vreinterpretq_f32_u32(vorrq_u32(vandq_u32(bits, vdupq_n_u32(0x007fffff)),
+                                                    vdupq_n_u32(0x3f800000)));
+    const uint32x4_t big = vcgtq_f32(m, vdupq_n_f32(sqrt2));
+    m = vmulq_f32(m, vbslq_f32(big, vdupq_n_f32(0.5f), one));
+    exponent = vsubq_s32(exponent, vreinterpretq_s32_u32(big));
+
+    const float32x4_t numerator = vsubq_f32(m, one), denominator = vaddq_f32(m, one);
+    // Two Newton steps on the reciprocal estimate give full precision
+    float32x4_t reciprocal = vrecpeq_f32(denominator);
+    reciprocal = vmulq_f32(reciprocal, vrecpsq_f32(denominator, reciprocal));
+    reciprocal = vmulq_f32(reciprocal, vrecpsq_f32(denominator, reciprocal));
+    const float32x4_t t = vmulq_f32(numerator, reciprocal);
+    const float32x4_t t2 = vmulq_f32(t, t);
+    float32x4_t series = vdupq_n_f32(2.0f / 9);
+    series = vaddq_f32(vdupq_n_f32(2.0f / 7), vmulq_f32(t2, series));
+    series = vaddq_f32(vdupq_n_f32(2.0f / 5), vmulq_f32(t2, series));
+    series = vaddq_f32(vdupq_n_f32(2.0f / 3), vmulq_f32(t2, series));
+    series = vaddq_f32(vdupq_n_f32(2.0f), vmulq_f32(t2, series));
+    return vaddq_f32(vmulq_f32(vcvtq_f32_s32(exponent), vdupq_n_f32(ln2)), vmulq_f32(t, series));
+}
+
+inline float32x4_t VectorExp(float32x4_t x) {
+    x = vminq_f32(vdupq_n_f32(expMax), vmaxq_f32(vdupq_n_f32(expMin), x));
+    // Round to nearest: add a signed half and truncate
+    const float32x4_t scaled = vmulq_f32(x, vdupq_n_f32(log2e));
+    const uint32x4_t negative = vcltq_f32(scaled, vdupq_n_f32(0.0f));
+    const float32x4_t half = vbslq_f32(negative, vdupq_n_f32(-0.5f), vdupq_n_f32(0.5f));
+    const int32x4_t n = vcvtq_s32_f32(vaddq_f32(scaled, half));
+    const float32x4_t nf = vcvtq_f32_s32(n);
+    const float32x4_t r = vsubq_f32(vsubq_f32(x, vmulq_f32(nf, vdupq_n_f32(ln2Hi))),
+                                    vmulq_f32(nf, vdupq_n_f32(ln2Lo)));
+    float32x4_t p = vdupq_n_f32(1.0f / 5040);
+    for (float coefficient : {1.0f / 720, 1.0f / 120, 1.0f / 24, 1.0f / 6, 1.0f / 2, 1.0f, 1.0f})
+        p = vaddq_f32(vdupq_n_f32(coefficient), vmulq_f32(r, p));
+    const float32x4_t scale = vreinterpretq_f32_s32(vshlq_n_s32(vaddq_s32(n, vdupq_n_s32(127)), 23));
+    return vmulq_f32(p, scale);
+}
+
+#endif
+
+}
+
+void FastLog(const float *in, float *out, size_t len) {
+    size_t ii = 0;
+#if defined(__SSE2__)
+    for (; ii + 4 <= len; ii += 4)
+        _mm_storeu_ps(out + ii, VectorLog(_mm_loadu_ps(in + ii)));
+#elif defined(__ARM_NEON)
+    for (; ii + 4 <= len; ii += 4)
+        vst1q_f32(out + ii, VectorLog(vld1q_f32(in + ii)));
+#endif
+    for (; ii < len; ++ii)
+        out[ii] = ScalarLog(in[ii]);
+}
+
+void FastExp(const float *in, float *out, size_t len) {
+    size_t ii = 0;
+#if defined(__SSE2__)
+    for (; ii + 4 <= len; ii += 4)
+        _mm_storeu_ps(out + ii, VectorExp(_mm_loadu_ps(in + ii)));
+#elif defined(__ARM_NEON)
+    for (; ii + 4 <= len; ii += 4)
+        vst1q_f32(out + ii, VectorExp(vld1q_f32(in + ii)));
+#endif
+    for (; ii < len; ++ii)
+        out[ii] = ScalarExp(in[ii]);
+}
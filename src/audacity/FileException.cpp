@@ -51,6 +51,6 @@ std::string FileException::ErrorMessage() const {
 
 #endif
 
-    return string_format(format, target, renameTarget.GetFullName());
+    return string_format(format, target.c_str(), renameTarget.GetFullName().c_str());
 }
 
@@ -14,6 +14,7 @@ information.
 
 *//*******************************************************************/
 
+#include <algorithm>
 #include <iostream>
 #include <cstring>
 #include <string>
@@ -98,3 +99,79 @@ int SFFileCloser::operator()(SNDFILE *sf) const {
     }
     return err;
 }
+
+SFMemory::SFMemory(const void *data, size_t bytes)
+        : mData(static_cast<const char *>(data)), mBytes(bytes), mOut(nullptr) {}
+
+SFMemory::SFMemory(std::vector<char> &out)
+        : mData(nullptr), mBytes(0), mOut(&out) {}
+
+SFFile SFMemory::Open(SF_INFO &info) {
+    static SF_VIRTUAL_IO io = {GetLength, Seek, Read, Write, Tell};
+    SFFile file;
+    mPosition = 0;
+    if (mOut) {
+        mOut->clear();
+        file.reset(SFCall<SNDFILE *>(sf_open_virtual, &io, SFM_WRITE, &info, this));
+    } else {
+        memset(&info, 0, sizeof(info));
+        file.reset(SFCall<SNDFILE *>(sf_open_virtual, &io, SFM_READ, &info, this));
+    }
+    return file;
+}
+
+sf_count_t SFMemory::GetLength(void *user) {
+    auto memory = static_cast<SFMemory *>(user);
+    return memory->mOut ? (sf_count_t) memory->mOut->size() : (sf_count_t) memory->mBytes;
+}
+
+sf_count_t SFMemory::Seek(sf_count_t offset, int whence, void *user) {
+    auto memory = static_cast<SFMemory *>(user);
+    sf_count_t position;
+    switch (whence) {
+        case SEEK_SET:
+            position = offset;
+            break;
+        case SEEK_CUR:
+            position = memory->mPosition + offset;
+            break;
+        case SEEK_END:
+            position = GetLength(user) + offset;
+            break;
+        default:
+            return -1;
+    }
+    // Writing may seek past the end, as a file can
+    if (position < 0 || (!memory->mOut && position > (sf_count_t) memory->mBytes))
+        return -1;
+    memory->mPosition = position;
+    return position;
+}
+
+sf_count_t SFMemory::Read(void *ptr, sf_count_t count, void *user) {
+    auto memory = static_cast<SFMemory *>(user);
+    const char *data = memory->mOut ? memory->mOut->data() : memory->mData;
+    const auto length = GetLength(user);
+    count = std::max<sf_count_t>(0, std::min(count, length - memory->mPosition));
+    if (count > 0)
+        memcpy(ptr, data + memory->mPosition, (size_t) count);
+    memory->mPosition += count;
+    return count;
+}
+
+sf_count_t SFMemory::Write(const void *ptr, sf_count_t count, void *user) {
+    auto memory = static_cast<SFMemory *>(user);
+    if (!memory->mOut || count < 0)
+        return 0;
+    auto &out = *memory->mOut;
+    const auto end = (size_t) (memory->mPosition + count);
+    if (end > out.size())
+        out.resize(end);
+    memcpy(out.data() + memory->mPosition, ptr, (size_t) count);
+    memory->mPosition += count;
+    return count;
+}
+
+sf_count_t SFMemory::Tell(void *user) {
+    return static_cast<SFMemory *>(user)->mPosition;
+}
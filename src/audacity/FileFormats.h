@@ -74,4 +74,30 @@ struct SFFile : public std::unique_ptr<SNDFILE, ::SFFileCloser> {
     }
 };
 
+// Audio in memory instead of a file, through libsndfile's virtual I/O:
+// either the caller's bytes, read where they are, or a vector that writing
+// fills and grows.  Either must outlive the SNDFILE opened on it.
+class SFMemory {
+public:
+    SFMemory(const void *data, size_t bytes);
+
+    explicit SFMemory(std::vector<char> &out);
+
+    // As sf_open_virtual(), for reading the caller's bytes or writing the
+    // vector.  Writing empties the vector first.
+    SFFile Open(SF_INFO &info);
+
+private:
+    static sf_count_t GetLength(void *user);
+    static sf_count_t Seek(sf_count_t offset, int whence, void *user);
+    static sf_count_t Read(void *ptr, sf_count_t count, void *user);
+    static sf_count_t Write(const void *ptr, sf_count_t count, void *user);
+    static sf_count_t Tell(void *user);
+
+    const char *const mData;
+    const size_t mBytes;
+    std::vector<char> *const mOut;
+    sf_count_t mPosition{0};
+};
+
 #endif
@@ -19,16 +19,137 @@
 
 *//*******************************************************************/
 
+#include <condition_variable>
 #include <cstring>
+#include <mutex>
+#include <thread>
 #include "ImportPCM.h"
 
 #include "sndfile.h"
 #include "FileFormats.h"
 #include "ImportPlugin.h"
+#include "Instrumentation.h"
+#include "Parallel.h"
+
+namespace {
+
+// Reads the file in interleaved chunks on a thread of its own, staying at
+// most queueLength chunks ahead of the one being imported
+class ReadAhead {
+public:
+    struct Chunk {
+        SampleBuffer samples;
+        size_t frames;
+    };
+
+    static const size_t queueLength = 3;
+
+    // chunks are queueLength buffers, each of chunkFrames frames
+    ReadAhead(SNDFILE *file, unsigned channels, sampleFormat format, size_t chunkFrames,
+              std::vector<Chunk> &chunks)
+            : mFile(file), mChannels(channels), mFormat(format), mChunkFrames(chunkFrames),
+              mChunks(chunks) {
+        mThread = std::thread([this] { Read(); });
+    }
+
+    ~ReadAhead() {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStop = true;
+        }
+        mChanged.notify_all();
+        mThread.join();
+    }
+
+    // The next chunk, or null at the end of the file; valid until the next
+    // call.  Rethrows what the reading thread threw.
+    const Chunk *Next() {
+        std::unique_lock<std::mutex> lock(mMutex);
+        if (mTaken > mReleased) {
+            ++mReleased;
+            mChanged.notify_all();
+        }
+        mChanged.wait(lock, [this] { return mFilled > mTaken || mDone; });
+        if (mFilled == mTaken) {
+            if (mError)
+                std::rethrow_exception(mError);
+            return nullptr;
+        }
+        return &mChunks[mTaken++ % queueLength];
+    }
+
+private:
+    void Read() {
+        try {
+            while (true) {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mChanged.wait(lock, [this] { return mFilled - mReleased < queueLength || mStop; });
+                if (mStop)
+                    break;
+                auto &chunk = mChunks[mFilled % queueLength];
+                lock.unlock();
+
+                sf_count_t frames;
+                if (mFormat == int16Sample)
+                    frames = SFCall<sf_count_t>(sf_readf_short, mFile, (short *) chunk.samples.ptr(),
+                                                mChunkFrames);
+                else if (mFormat == int24Sample) {
+                    frames = SFCall<sf_count_t>(sf_readf_int, mFile, (int *) chunk.samples.ptr(),
+                                                mChunkFrames);
+                    // libsndfile gives the 3 bytes in the 3 most significant
+                    auto samples = (int *) chunk.samples.ptr();
+                    for (sf_count_t i = 0; i < frames * mChannels; i++)
+                        samples[i] >>= 8;
+                }
+                    //import 24 bit int as float and have the append function convert it.  This is how PCMAliasBlockFile works too.
+                else
+                    frames = SFCall<sf_count_t>(sf_readf_float, mFile, (float *) chunk.samples.ptr(),
+                                                mChunkFrames);
+                if (frames < 0 || frames > (sf_count_t) mChunkFrames) {
+                    assert(false);
+                    frames = mChunkFrames;
+                }
+                if (frames == 0)
+                    break;
+                chunk.frames = frames;
+                NR_COUNT(BytesRead, frames * mChannels * SAMPLE_SIZE(mFormat));
+
+                lock.lock();
+                ++mFilled;
+                mChanged.notify_all();
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mError = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mDone = true;
+        mChanged.notify_all();
+    }
+
+    SNDFILE *const mFile;
+    const unsigned mChannels;
+    const sampleFormat mFormat;
+    const size_t mChunkFrames;
+
+    std::vector<Chunk> &mChunks;
+    std::thread mThread;
+
+    std::mutex mMutex;
+    std::condition_variable mChanged;
+    // Counts of chunks ever read, handed out by Next(), and given back
+    size_t mFilled{0}, mTaken{0}, mReleased{0};
+    bool mDone{false}, mStop{false};
+    std::exception_ptr mError;
+};
+
+}
 
 
 // static
-std::unique_ptr<ImportFileHandle> PCMImportFileHandle::Open(const std::string &filename) {
+std::unique_ptr<ImportFileHandle> PCMImportFileHandle::Open(const std::string &filename,
+                                                           bool keepInt24) {
     SF_INFO info;
     SFFile file;
 
@@ -66,12 +187,29 @@ std::unique_ptr<ImportFileHandle> PCMImportFileHandle::Open(const std::string &f
     }
 
     // Success, so now transfer the duty to close the file from "file".
-    return std::make_unique<PCMImportFileHandle>(filename, std::move(file), info);
+    return std::make_unique<PCMImportFileHandle>(filename, std::move(file), info, keepInt24);
+}
+
+// static
+std::unique_ptr<ImportFileHandle> PCMImportFileHandle::OpenMemory(const void *data, size_t bytes,
+                                                                 bool keepInt24) {
+    auto memory = std::make_unique<SFMemory>(data, bytes);
+    SF_INFO info;
+    SFFile file = memory->Open(info);
+    if (!file || info.channels < 1)
+        return nullptr;
+
+    // OGG is not refused as Open() does: Import() reads from start to end
+    // without seeking, and memory makes any seeking cheap anyway
+    auto handle = std::make_unique<PCMImportFileHandle>("", std::move(file), info, keepInt24);
+    handle->mMemory = std::move(memory);
+    return handle;
 }
 
 
 PCMImportFileHandle::PCMImportFileHandle(std::string name,
-                                         SFFile &&file, SF_INFO info)
+                                         SFFile &&file, SF_INFO info,
+                                         bool keepInt24)
         : ImportFileHandle(name),
           mFile(std::move(file)),
           mInfo(info) {
@@ -90,6 +228,10 @@ PCMImportFileHandle::PCMImportFileHandle(std::string name,
     if (mFormat != floatSample &&
         sf_subtype_more_than_16_bits(mInfo.format))
         mFormat = floatSample;
+
+    // Unless asked to keep 24 bits as they are
+    if (keepInt24 && (mInfo.format & SF_FORMAT_SUBMASK) == SF_FORMAT_PCM_24)
+        mFormat = int24Sample;
 }
 
 std::string PCMImportFileHandle::GetFileDescription() {
@@ -102,6 +244,7 @@ auto PCMImportFileHandle::GetFileUncompressedBytes() -> ByteCount {
 
 ProgressResult PCMImportFileHandle::Import(TrackFactory *trackFactory,
                                            TrackHolders &outTracks) {
+    NR_TIME_SCOPE(Instrumentation::Stage::Import);
     outTracks.clear();
 
     assert(mFile.get());
@@ -128,8 +271,6 @@ ProgressResult PCMImportFileHandle::Import(TrackFactory *trackFactory,
             }
     }
 
-    auto fileTotalFrames =
-            (sampleCount) mInfo.frames; // convert from sf_count_t
     auto maxBlockSize = channels.begin()->get()->GetMaxBlockSize();
 
     // Otherwise, we're in the "copy" mode, where we read in the actual
@@ -147,51 +288,53 @@ ProgressResult PCMImportFileHandle::Import(TrackFactory *trackFactory,
     if (maxBlock < 1)
         return ProgressResult::Failed;
 
-    SampleBuffer srcbuffer, buffer;
-    assert(mInfo.channels >= 0);
-    while (nullptr == srcbuffer.Allocate(maxBlock * mInfo.channels, mFormat).ptr() ||
-           nullptr == buffer.Allocate(maxBlock, mFormat).ptr()) {
+    // The chunks read ahead, and one channel's worth for each track
+    std::vector<ReadAhead::Chunk> chunks(ReadAhead::queueLength);
+    std::vector<SampleBuffer> buffers(mInfo.channels);
+    auto allocate = [&] {
+        for (auto &chunk : chunks)
+            if (nullptr == chunk.samples.Allocate(maxBlock * mInfo.channels, mFormat).ptr())
+                return false;
+        for (auto &buffer : buffers)
+            if (nullptr == buffer.Allocate(maxBlock, mFormat).ptr())
+                return false;
+        return true;
+    };
+    while (!allocate()) {
         maxBlock /= 2;
         if (maxBlock < 1)
             return ProgressResult::Failed;
     }
 
-    decltype(fileTotalFrames) framescompleted = 0;
-
-    long block;
-    do {
-        block = maxBlock;
-
-        if (mFormat == int16Sample)
-            block = SFCall<sf_count_t>(sf_readf_short, mFile.get(), (short *) srcbuffer.ptr(), block);
-            //import 24 bit int as float and have the append function convert it.  This is how PCMAliasBlockFile works too.
+    std::vector<float *> channelPointers;
+    for (auto &buffer : buffers)
+        channelPointers.push_back((float *) buffer.ptr());
+
+    if (mProgress)
+        mProgress->Begin(mInfo.frames);
+    ReadAhead reader(mFile.get(), mInfo.channels, mFormat, maxBlock, chunks);
+    while (const auto chunk = reader.Next()) {
+        const auto block = chunk->frames;
+        if (mFormat == int16Sample) {
+            for (int c = 0; c < mInfo.channels; ++c)
+                for (size_t j = 0; j < block; j++)
+                    ((short *) buffers[c].ptr())[j] =
+                            ((short *) chunk->samples.ptr())[mInfo.channels * j + c];
+        } else if (mFormat == int24Sample)
+            DeinterleaveSamples((const int *) chunk->samples.ptr(), mInfo.channels,
+                                (int *const *) channelPointers.data(), block);
         else
-            block = SFCall<sf_count_t>(sf_readf_float, mFile.get(), (float *) srcbuffer.ptr(), block);
+            DeinterleaveSamples((const float *) chunk->samples.ptr(), mInfo.channels,
+                                channelPointers.data(), block);
 
-        if (block < 0 || block > (long) maxBlock) {
-            assert(false);
-            block = maxBlock;
-        }
-
-        if (block) {
-            auto iter = channels.begin();
-            for (int c = 0; c < mInfo.channels; ++iter, ++c) {
-                if (mFormat == int16Sample) {
-                    for (int j = 0; j < block; j++)
-                        ((short *) buffer.ptr())[j] =
-                                ((short *) srcbuffer.ptr())[mInfo.channels * j + c];
-                } else {
-                    for (int j = 0; j < block; j++)
-                        ((float *) buffer.ptr())[j] =
-                                ((float *) srcbuffer.ptr())[mInfo.channels * j + c];
-                }
+        // Each channel's track and blocks are its own
+        ForEachInParallel(mInfo.channels, [&](size_t c) {
+            channels[c]->Append(buffers[c].ptr(), mFormat, block);
+        });
 
-                iter->get()->Append(buffer.ptr(), (mFormat == int16Sample) ? int16Sample : floatSample, block);
-            }
-            framescompleted += block;
-        }
-
-    } while (block > 0);
+        if (mProgress && !mProgress->Advance(block))
+            return ProgressResult::Cancelled;
+    }
 
     for (const auto &channel : channels) {
         channel->Flush();
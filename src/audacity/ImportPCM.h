@@ -18,9 +18,19 @@
 
 class PCMImportFileHandle final : public ImportFileHandle {
 public:
-    static std::unique_ptr<ImportFileHandle> Open(const std::string &filename);
+    // With keepInt24, 24-bit PCM files import to int24Sample tracks, read as
+    // integers without going through float
+    static std::unique_ptr<ImportFileHandle> Open(const std::string &filename,
+                                                  bool keepInt24 = false);
 
-    PCMImportFileHandle(std::string name, SFFile &&file, SF_INFO info);
+    // The same for a file's bytes in memory, read where they are, so they
+    // must outlive the handle.  Formats libsndfile reads, such as FLAC and
+    // OGG, decode as they would from a file.
+    static std::unique_ptr<ImportFileHandle> OpenMemory(const void *data, size_t bytes,
+                                                        bool keepInt24 = false);
+
+    PCMImportFileHandle(std::string name, SFFile &&file, SF_INFO info,
+                        bool keepInt24 = false);
 
     ~PCMImportFileHandle();
 
@@ -40,6 +50,8 @@ public:
     void SetStreamUsage(int32_t StreamID, bool Use) override {}
 
 private:
+    // Declared before mFile, which reads through it
+    std::unique_ptr<SFMemory> mMemory;
     SFFile mFile;
     const SF_INFO mInfo;
     sampleFormat mFormat;
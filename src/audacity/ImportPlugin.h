@@ -58,6 +58,7 @@ but little else.
 
 #include "wxFileName.h"
 #include "NoiseReduction.h"
+#include "Progress.h"
 
 using TrackHolders = std::vector<std::unique_ptr<WaveTrack>>;
 
@@ -107,8 +108,13 @@ public:
     // Set stream "import/don't import" flag
     virtual void SetStreamUsage(int32_t StreamID, bool Use) = 0;
 
+    // Import() counts the frames it reads against progress, if any, and
+    // returns ProgressResult::Cancelled, with no tracks, once it is cancelled
+    void SetProgress(Progress *progress) { mProgress = progress; }
+
 protected:
     std::string mFilename;
+    Progress *mProgress{nullptr};
 };
 
 #endif
@@ -0,0 +1,96 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  Instrumentation.cpp
+
+**********************************************************************/
+
+#include <atomic>
+#include <sstream>
+
+#include "Instrumentation.h"
+
+namespace Instrumentation {
+
+namespace {
+
+const char *const stageNames[] = {
+        "import", "profile", "reduce", "analyze", "forward_fft", "classify", "smoothing",
+        "inverse_fft", "clear_and_paste", "export",
+};
+static_assert(sizeof(stageNames) / sizeof(*stageNames) == (size_t) Stage::Count,
+              "a name for each stage");
+
+const char *const counterNames[] = {
+        "bytes_read", "bytes_written", "block_files", "block_file_bytes",
+        "silent_block_files", "compressed_bytes", "allocations", "allocated_bytes",
+        "silent_steps",
+};
+static_assert(sizeof(counterNames) / sizeof(*counterNames) == (size_t) Counter::Count,
+              "a name for each counter");
+
+// Each on a cache line of its own, so that threads adding to different
+// ones do not contend; relaxed, since only the totals matter
+struct alignas(64) StageTotals {
+    std::atomic<std::uint64_t> nanoseconds{0};
+    std::atomic<std::uint64_t> calls{0};
+};
+
+struct alignas(64) CounterTotal {
+    std::atomic<std::uint64_t> value{0};
+};
+
+StageTotals stages[(size_t) Stage::Count];
+CounterTotal counters[(size_t) Counter::Count];
+
+} // namespace
+
+bool Enabled() {
+#ifdef USE_INSTRUMENTATION
+    return true;
+#else
+    return false;
+#endif
+}
+
+void AddTime(Stage stage, std::chrono::steady_clock::duration time) {
+    auto &totals = stages[(size_t) stage];
+    totals.nanoseconds.fetch_add(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(time).count(),
+            std::memory_order_relaxed);
+    totals.calls.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Add(Counter counter, std::uint64_t amount) {
+    counters[(size_t) counter].value.fetch_add(amount, std::memory_order_relaxed);
+}
+
+void Reset() {
+    for (auto &totals : stages) {
+        totals.nanoseconds = 0;
+        totals.calls = 0;
+    }
+    for (auto &total : counters)
+        total.value = 0;
+}
+
+std::string ToJSON() {
+    if (!Enabled())
+        return "{\"enabled\": false}";
+
+    std::ostringstream json;
+    json << "{\"enabled\": true, \"stages\": {";
+    for (size_t ii = 0; ii < (size_t) Stage::Count; ++ii)
+        json << (ii ? ", " : "") << '"' << stageNames[ii] << "\": {\"seconds\": "
+             << stages[ii].nanoseconds.load(std::memory_order_relaxed) * 1e-9
+             << ", \"calls\": " << stages[ii].calls.load(std::memory_order_relaxed) << '}';
+    json << "}, \"counters\": {";
+    for (size_t ii = 0; ii < (size_t) Counter::Count; ++ii)
+        json << (ii ? ", " : "") << '"' << counterNames[ii] << "\": "
+             << counters[ii].value.load(std::memory_order_relaxed);
+    json << "}}";
+    return json.str();
+}
+
+} // namespace Instrumentation
@@ -0,0 +1,95 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  Instrumentation.h
+
+  Where the time and the bytes of noise reduction jobs go, to tell the
+  ones bound by I/O from the ones bound by the DSP.  Built only with
+  USE_INSTRUMENTATION; otherwise the NR_ macros below are nothing at all
+  and ToJSON() says that the counters are not there.
+
+**********************************************************************/
+
+#ifndef __AUDACITY_INSTRUMENTATION__
+#define __AUDACITY_INSTRUMENTATION__
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace Instrumentation {
+
+// Times are summed over all threads, so the stages of channels or files
+// done at once may add up to more than the wall time of the job
+enum class Stage : unsigned {
+    Import,
+    Profile,
+    Reduce,
+    Analyze,
+    // Per window, within the three above
+    ForwardFFT,
+    Classify,
+    Smoothing,
+    InverseFFT,
+    ClearAndPaste,
+    Export,
+    Count
+};
+
+enum class Counter : unsigned {
+    BytesRead,      // of samples from libsndfile
+    BytesWritten,   // of samples to libsndfile
+    BlockFiles,     // made by DirManager::NewSimpleBlockFile()
+    BlockFileBytes, // of samples in those
+    SilentBlockFiles, // of those, all zero and so kept as SilentBlockFiles
+    CompressedBytes, // of the others coded, when DirManager compresses them
+    Allocations,    // of SampleBuffers, which hold the samples in transit
+    AllocatedBytes,
+    SilentSteps,    // skipped by Workers in long silences
+    Count
+};
+
+// Whether the counters are built in
+bool Enabled();
+
+void AddTime(Stage stage, std::chrono::steady_clock::duration time);
+void Add(Counter counter, std::uint64_t amount);
+
+// All to zero
+void Reset();
+
+// {"enabled": true, "stages": {"import": {"seconds": ..., "calls": ...}, ...},
+//  "counters": {"bytes_read": ..., ...}}, or {"enabled": false}
+std::string ToJSON();
+
+class ScopedTimer final {
+public:
+    explicit ScopedTimer(Stage stage)
+            : mStage(stage), mStart(std::chrono::steady_clock::now()) {}
+
+    ~ScopedTimer() { AddTime(mStage, std::chrono::steady_clock::now() - mStart); }
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+    const Stage mStage;
+    const std::chrono::steady_clock::time_point mStart;
+};
+
+} // namespace Instrumentation
+
+// The rest of the enclosing scope counts as stage, a Stage; at most once in
+// a scope.  Neither argument is evaluated when compiled out.
+#ifdef USE_INSTRUMENTATION
+#define NR_TIME_SCOPE(stage) \
+    const Instrumentation::ScopedTimer nrScopedTimer(stage)
+#define NR_COUNT(counter, amount) \
+    Instrumentation::Add(Instrumentation::Counter::counter, (amount))
+#else
+#define NR_TIME_SCOPE(stage) ((void) 0)
+#define NR_COUNT(counter, amount) ((void) 0)
+#endif
+
+#endif
@@ -0,0 +1,61 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  MappedBlockFile.cpp
+
+**********************************************************************/
+
+#include <algorithm>
+#include <cstring>
+
+#include "MappedBlockFile.h"
+#include "FileException.h"
+#include "SampleFormat.h"
+
+MappedBlockFile::MappedBlockFile(const std::shared_ptr<BlockStore> &store,
+                                 samplePtr sampleData, size_t sampleLen,
+                                 sampleFormat format, bool summaries)
+        : BlockFile{wxFileNameWrapper{}, sampleLen},
+          mStore{store},
+          mExtent{store->Allocate(sampleLen * SAMPLE_SIZE(format))},
+          mFormat{format},
+          mSummaries{summaries} {
+    memcpy(mExtent.data, sampleData, sampleLen * SAMPLE_SIZE(format));
+}
+
+MappedBlockFile::~MappedBlockFile() {
+    mStore->Release(mExtent);
+}
+
+bool MappedBlockFile::ReadSummary(ArrayOf<char> &data) {
+    return ReadSummaryOfSamples(data, mExtent.data, mFormat, mSummaries);
+}
+
+size_t MappedBlockFile::ReadData(samplePtr data, sampleFormat format,
+                                 size_t start, size_t len, bool mayThrow) const {
+    auto framesRead = std::min(len, std::max(start, mLen) - start);
+    CopySamples(mExtent.data + start * SAMPLE_SIZE(mFormat), mFormat,
+                data, format, framesRead);
+
+    if (framesRead < len) {
+        if (mayThrow)
+            throw FileException{FileException::Cause::Read, mFileName};
+        ClearSamples(data, format, framesRead, len - framesRead);
+    }
+
+    return framesRead;
+}
+
+samplePtr MappedBlockFile::GetSampleData(sampleFormat &format) const {
+    format = mFormat;
+    return mExtent.data;
+}
+
+BlockFilePtr MappedBlockFile::Copy(wxFileNameWrapper &&) {
+    return make_blockfile<MappedBlockFile>(mStore, mExtent.data, mLen, mFormat, mSummaries);
+}
+
+auto MappedBlockFile::GetSpaceUsage() const -> DiskByteCount {
+    return mExtent.bytes;
+}
@@ -0,0 +1,57 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  MappedBlockFile.h
+
+*******************************************************************//**
+
+\class MappedBlockFile
+\brief A BlockFile whose samples live in an extent of a BlockStore.
+
+  The samples are copied into the store's mapping once, in the block's
+  own format, and read back from there; nothing else is written.  The
+  extent goes back to the store when the block is destroyed.
+
+*//*******************************************************************/
+
+#ifndef __AUDACITY_MAPPED_BLOCKFILE__
+#define __AUDACITY_MAPPED_BLOCKFILE__
+
+#include "BlockFile.h"
+#include "BlockStore.h"
+
+class MappedBlockFile final : public BlockFile {
+public:
+    /// Copy sampleData into the store; throws FileException if the
+    /// store can't grow.  Without summaries, ReadSummary() fails.
+    MappedBlockFile(const std::shared_ptr<BlockStore> &store,
+                    samplePtr sampleData, size_t sampleLen,
+                    sampleFormat format, bool summaries = true);
+
+    virtual ~MappedBlockFile();
+
+    /// Summaries aren't kept; they are calculated from the samples
+    /// on each call
+    bool ReadSummary(ArrayOf<char> &data) override;
+
+    size_t ReadData(samplePtr data, sampleFormat format,
+                    size_t start, size_t len, bool mayThrow) const override;
+
+    samplePtr GetSampleData(sampleFormat &format) const override;
+
+    /// Create a NEW block file in the same store, identical to this one
+    BlockFilePtr Copy(wxFileNameWrapper &&newFileName) override;
+
+    DiskByteCount GetSpaceUsage() const override;
+
+    void Recover() override {};
+
+private:
+    const std::shared_ptr<BlockStore> mStore;
+    const BlockStore::Extent mExtent;
+    const sampleFormat mFormat;
+    const bool mSummaries;
+};
+
+#endif
@@ -0,0 +1,84 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  MemoryBlockFile.cpp
+
+**********************************************************************/
+
+#include <algorithm>
+#include <cstring>
+
+#include "MemoryBlockFile.h"
+#include "FileException.h"
+#include "SampleFormat.h"
+
+MemoryBlockBudget::MemoryBlockBudget(size_t limit)
+        : mLimit(limit), mUsed(0) {
+}
+
+bool MemoryBlockBudget::Reserve(size_t bytes) {
+    auto used = mUsed.load();
+    do {
+        if (mLimit != 0 && used + bytes > mLimit)
+            return false;
+    } while (!mUsed.compare_exchange_weak(used, used + bytes));
+    return true;
+}
+
+void MemoryBlockBudget::Release(size_t bytes) {
+    mUsed -= bytes;
+}
+
+auto MemoryBlockFile::MakeBuffer(const std::shared_ptr<MemoryBlockBudget> &budget,
+                                 const char *data, size_t bytes) -> Buffer {
+    if (!budget->Reserve(bytes))
+        return nullptr;
+
+    auto copy = new char[bytes];
+    memcpy(copy, data, bytes);
+    return Buffer{copy, [budget, bytes](const char *buffer) {
+        delete[] buffer;
+        budget->Release(bytes);
+    }};
+}
+
+MemoryBlockFile::MemoryBlockFile(Buffer buffer, size_t sampleLen,
+                                 sampleFormat format, bool summaries)
+        : BlockFile{wxFileNameWrapper{}, sampleLen},
+          mBuffer{std::move(buffer)},
+          mData{const_cast<char *>(mBuffer.get())},
+          mFormat{format},
+          mSummaries{summaries} {
+}
+
+MemoryBlockFile::~MemoryBlockFile() {
+}
+
+bool MemoryBlockFile::ReadSummary(ArrayOf<char> &data) {
+    return ReadSummaryOfSamples(data, mData, mFormat, mSummaries);
+}
+
+size_t MemoryBlockFile::ReadData(samplePtr data, sampleFormat format,
+                                 size_t start, size_t len, bool mayThrow) const {
+    auto framesRead = std::min(len, std::max(start, mLen) - start);
+    CopySamples(mData + start * SAMPLE_SIZE(mFormat), mFormat,
+                data, format, framesRead);
+
+    if (framesRead < len) {
+        if (mayThrow)
+            throw FileException{FileException::Cause::Read, mFileName};
+        ClearSamples(data, format, framesRead, len - framesRead);
+    }
+
+    return framesRead;
+}
+
+samplePtr MemoryBlockFile::GetSampleData(sampleFormat &format) const {
+    format = mFormat;
+    return mData;
+}
+
+BlockFilePtr MemoryBlockFile::Copy(wxFileNameWrapper &&) {
+    return make_blockfile<MemoryBlockFile>(mBuffer, mLen, mFormat, mSummaries);
+}
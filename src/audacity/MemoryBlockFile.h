@@ -0,0 +1,87 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  MemoryBlockFile.h
+
+*******************************************************************//**
+
+\class MemoryBlockFile
+\brief A BlockFile whose samples are only ever in memory.
+
+  The samples are an immutable, reference counted buffer, so copies of
+  the block share them, and no file is touched at all.  Buffers are
+  charged to a MemoryBlockBudget until the last block using them goes.
+
+*//*******************************************************************/
+
+#ifndef __AUDACITY_MEMORY_BLOCKFILE__
+#define __AUDACITY_MEMORY_BLOCKFILE__
+
+#include <atomic>
+
+#include "BlockFile.h"
+
+/// Bytes held by the buffers of MemoryBlockFiles, against a limit
+class MemoryBlockBudget {
+public:
+    /// limit of 0 means no limit
+    explicit MemoryBlockBudget(size_t limit);
+
+    /// Charge bytes, unless that would pass the limit
+    bool Reserve(size_t bytes);
+
+    void Release(size_t bytes);
+
+    size_t GetUsed() const { return mUsed; }
+
+    size_t GetLimit() const { return mLimit; }
+
+private:
+    const size_t mLimit;
+    std::atomic<size_t> mUsed;
+};
+
+class MemoryBlockFile final : public BlockFile {
+public:
+    using Buffer = std::shared_ptr<const char>;
+
+    /// A copy of bytes of data charged to budget, or null if the budget
+    /// can't take it
+    static Buffer MakeBuffer(const std::shared_ptr<MemoryBlockBudget> &budget,
+                             const char *data, size_t bytes);
+
+    /// buffer holds sampleLen samples of format.  Without summaries,
+    /// ReadSummary() fails.
+    MemoryBlockFile(Buffer buffer, size_t sampleLen, sampleFormat format,
+                    bool summaries = true);
+
+    virtual ~MemoryBlockFile();
+
+    /// Summaries aren't kept; they are calculated from the samples
+    /// on each call
+    bool ReadSummary(ArrayOf<char> &data) override;
+
+    size_t ReadData(samplePtr data, sampleFormat format,
+                    size_t start, size_t len, bool mayThrow) const override;
+
+    samplePtr GetSampleData(sampleFormat &format) const override;
+
+    /// Create a NEW block file sharing this one's samples
+    BlockFilePtr Copy(wxFileNameWrapper &&newFileName) override;
+
+    /// Nothing is on disk
+    DiskByteCount GetSpaceUsage() const override { return 0; }
+
+    void Recover() override {};
+
+private:
+    const Buffer mBuffer;
+    // mBuffer's samples, for functions that take them non-const; never
+    // written through
+    const samplePtr mData;
+    const sampleFormat mFormat;
+    const bool mSummaries;
+};
+
+#endif
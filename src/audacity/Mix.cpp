@@ -23,6 +23,12 @@
 #include <cstring>
 #include "Mix.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 MixerSpec::MixerSpec(unsigned numTracks, unsigned maxNumChannels) {
     mNumTracks = mNumChannels = numTracks;
     mMaxNumChannels = maxNumChannels;
@@ -237,10 +243,70 @@ size_t Mixer::Process(size_t maxToProcess) {
     return maxOut;
 }
 
+// Both channels of a stereo interleaved dst at once, each frame's sample of
+// src times the two gains.  Returns how many frames were done.
+static size_t MixStereoVectors(const float *src, const float *gains,
+                               float *dst, size_t len)
+{
+   size_t j = 0;
+#if defined(__SSE2__)
+   const __m128 g = _mm_setr_ps(gains[0], gains[1], gains[0], gains[1]);
+   for (; j + 4 <= len; j += 4, dst += 8) {
+      const __m128 s = _mm_loadu_ps(src + j);
+      _mm_storeu_ps(dst, _mm_add_ps(_mm_loadu_ps(dst),
+                                    _mm_mul_ps(_mm_unpacklo_ps(s, s), g)));
+      _mm_storeu_ps(dst + 4, _mm_add_ps(_mm_loadu_ps(dst + 4),
+                                        _mm_mul_ps(_mm_unpackhi_ps(s, s), g)));
+   }
+#elif defined(__ARM_NEON)
+   const float32x4_t g = {gains[0], gains[1], gains[0], gains[1]};
+   for (; j + 4 <= len; j += 4, dst += 8) {
+      const float32x4_t s = vld1q_f32(src + j);
+      const float32x4x2_t pairs = vzipq_f32(s, s);
+      vst1q_f32(dst, vaddq_f32(vld1q_f32(dst), vmulq_f32(pairs.val[0], g)));
+      vst1q_f32(dst + 4, vaddq_f32(vld1q_f32(dst + 4), vmulq_f32(pairs.val[1], g)));
+   }
+#else
+   (void)src, (void)gains, (void)dst, (void)len;
+#endif
+   return j;
+}
+
+// One channel, from frame j on.  The multiply and the add are kept apart in
+// the vectors too, so that the sums are those of the scalar loop.
+static void MixChannel(const float *src, float gain, float *dst, unsigned skip,
+                       size_t j, size_t len)
+{
+   if (skip == 1) {
+#if defined(__SSE2__)
+      const __m128 g = _mm_set1_ps(gain);
+      for (; j + 4 <= len; j += 4)
+         _mm_storeu_ps(dst + j, _mm_add_ps(_mm_loadu_ps(dst + j),
+                                           _mm_mul_ps(_mm_loadu_ps(src + j), g)));
+#elif defined(__ARM_NEON)
+      const float32x4_t g = vdupq_n_f32(gain);
+      for (; j + 4 <= len; j += 4)
+         vst1q_f32(dst + j, vaddq_f32(vld1q_f32(dst + j),
+                                      vmulq_f32(vld1q_f32(src + j), g)));
+#endif
+   }
+   for (dst += j * skip; j < len; j++) {
+      *dst += src[j] * gain;   // the actual mixing process
+      dst += skip;
+   }
+}
+
 void MixBuffers(unsigned numChannels, int *channelFlags, float *gains,
                 samplePtr src, SampleBuffer *dests,
                 int len, bool interleaved)
 {
+   const float *temp = (const float *)src;
+
+   // Frames already mixed into every channel
+   size_t done = 0;
+   if (interleaved && numChannels == 2 && channelFlags[0] && channelFlags[1])
+      done = MixStereoVectors(temp, gains, (float *)dests[0].ptr(), len);
+
    for (unsigned int c = 0; c < numChannels; c++) {
       if (!channelFlags[c])
          continue;
@@ -256,13 +322,7 @@ void MixBuffers(unsigned numChannels, int *channelFlags, float *gains,
          skip = 1;
       }
 
-      float gain = gains[c];
-      float *dest = (float *)destPtr;
-      float *temp = (float *)src;
-      for (int j = 0; j < len; j++) {
-         *dest += temp[j] * gain;   // the actual mixing process
-         dest += skip;
-      }
+      MixChannel(temp, gains[c], (float *)destPtr, skip, done, len);
    }
 }
 
@@ -314,6 +374,7 @@ size_t Mixer::MixVariableRates(int *channelFlags, WaveTrackCache &cache,
 
             // Nothing to do if past end of play interval
             if (getLen > 0) {
+                double envTime;
                 if (backwards) {
                     auto results = cache.Get(floatSample, *pos - (getLen - 1), getLen, mMayThrow);
                     if (results)
@@ -321,9 +382,7 @@ size_t Mixer::MixVariableRates(int *channelFlags, WaveTrackCache &cache,
                     else
                         memset(&queue[*queueLen], 0, sizeof(float) * getLen);
 
-                    track->GetEnvelopeValues(mEnvValues.get(),
-                                             getLen,
-                                             (*pos - (getLen - 1)).as_double() / trackRate);
+                    envTime = (*pos - (getLen - 1)).as_double() / trackRate;
                     *pos -= getLen;
                 } else {
                     auto results = cache.Get(floatSample, *pos, getLen, mMayThrow);
@@ -332,16 +391,11 @@ size_t Mixer::MixVariableRates(int *channelFlags, WaveTrackCache &cache,
                     else
                         memset(&queue[*queueLen], 0, sizeof(float) * getLen);
 
-                    track->GetEnvelopeValues(mEnvValues.get(),
-                                             getLen,
-                                             (*pos).as_double() / trackRate);
-
+                    envTime = (*pos).as_double() / trackRate;
                     *pos += getLen;
                 }
 
-                for (decltype(getLen) i = 0; i < getLen; i++) {
-                    queue[(*queueLen) + i] *= mEnvValues[i];
-                }
+                ApplyEnvelope(cache, &queue[*queueLen], getLen, envTime);
 
                 if (backwards)
                     ReverseSamples((samplePtr) &queue[0], floatSample,
@@ -425,9 +479,7 @@ size_t Mixer::MixSameRate(int *channelFlags, WaveTrackCache &cache,
             memcpy(mFloatBuffer.get(), results, sizeof(float) * slen);
         else
             memset(mFloatBuffer.get(), 0, sizeof(float) * slen);
-        track->GetEnvelopeValues(mEnvValues.get(), slen, t - (slen - 1) / mRate);
-        for (decltype(slen) i = 0; i < slen; i++)
-            mFloatBuffer[i] *= mEnvValues[i]; // Track gain control will go here?
+        ApplyEnvelope(cache, mFloatBuffer.get(), slen, t - (slen - 1) / mRate);
         ReverseSamples((samplePtr) mFloatBuffer.get(), floatSample, 0, slen);
 
         *pos -= slen;
@@ -437,9 +489,7 @@ size_t Mixer::MixSameRate(int *channelFlags, WaveTrackCache &cache,
             memcpy(mFloatBuffer.get(), results, sizeof(float) * slen);
         else
             memset(mFloatBuffer.get(), 0, sizeof(float) * slen);
-        track->GetEnvelopeValues(mEnvValues.get(), slen, t);
-        for (decltype(slen) i = 0; i < slen; i++)
-            mFloatBuffer[i] *= mEnvValues[i]; // Track gain control will go here?
+        ApplyEnvelope(cache, mFloatBuffer.get(), slen, t);
 
         *pos += slen;
     }
@@ -456,6 +506,26 @@ size_t Mixer::MixSameRate(int *channelFlags, WaveTrackCache &cache,
     return slen;
 }
 
+void Mixer::ApplyEnvelope(WaveTrackCache &cache, float *buffer, size_t len, double t0) {
+    // Most tracks have no envelope at all, and most chunks of the others
+    // fall where it is flat: one gain, or none for 1
+    double gain;
+    if (cache.EnvelopeIsConstant(len, t0, gain)) {
+        if (gain != 1.0)
+            for (decltype(len) i = 0; i < len; i++)
+                buffer[i] *= gain;
+        return;
+    }
+    cache.GetEnvelopeValues(mEnvValues.get(), len, t0);
+    for (decltype(len) i = 0; i < len; i++)
+        buffer[i] *= mEnvValues[i]; // Track gain control will go here?
+}
+
+void Mixer::SetReadAhead(size_t depth) {
+    for (size_t i = 0; i < mNumInputTracks; i++)
+        mInputTrack[i].SetReadAhead(depth);
+}
+
 samplePtr Mixer::GetBuffer()
 {
    return mBuffer[0].ptr();
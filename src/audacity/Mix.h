@@ -52,6 +52,14 @@ public:
 };
 
 
+// Adds len samples of src, times gains[c], into each channel c of dests
+// whose channelFlags[c] is set; dests is one buffer of numChannels
+// interleaved channels or one buffer per channel.  Four samples at a time
+// where SSE2 or NEON is there, with the same sums as one at a time.
+void MixBuffers(unsigned numChannels, int *channelFlags, float *gains,
+                samplePtr src, SampleBuffer *dests,
+                int len, bool interleaved);
+
 class Mixer {
 public:
 
@@ -72,6 +80,10 @@ public:
    /// Retrieve the main buffer or the interleaved buffer
    samplePtr GetBuffer();
 
+    // Reads depth blocks of each track ahead on other threads, see
+    // WaveTrackCache::SetReadAhead()
+    void SetReadAhead(size_t depth);
+
 private:
 
     void Clear();
@@ -81,6 +93,10 @@ private:
     size_t MixSameRate(int *channelFlags, WaveTrackCache &cache,
                        sampleCount *pos);
 
+    // Multiplies len samples of buffer by the envelope of the cache's track
+    // from t0
+    void ApplyEnvelope(WaveTrackCache &cache, float *buffer, size_t len, double t0);
+
     size_t MixVariableRates(int *channelFlags, WaveTrackCache &cache,
                             sampleCount *pos, float *queue,
                             int *queueStart, int *queueLen,
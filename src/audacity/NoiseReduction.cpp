@@ -41,20 +41,49 @@
 #include <memory>
 #include <string>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
 #include <vector>
 #include <iostream>
 #include <cmath>
 #include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <limits>
+#include <exception>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <tuple>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include "Audacity.h"
 #include "Types.h"
-#include "RealFFTf.h"
+#include "FastMath.h"
+#include "FFTBackend.h"
 #include "NoiseReduction.h"
+#include "Parallel.h"
+#include "Progress.h"
+#include "RealFFTf.h"
+#include "Resample.h"
 #include "WaveTrack.h"
-
-// SPECTRAL_SELECTION not to affect this effect for now, as there might be no indication that it does.
-// [Discussed and agreed for v2.1 by Steve, Paul, Bill].
-#undef EXPERIMENTAL_SPECTRAL_EDITING
+#include "ExportPCM.h"
+#include "FileFormats.h"
+#include "ImportPlugin.h"
+#include "ImportPCM.h"
+#include "Instrumentation.h"
+#include "SampleFormat.h"
+#include "sndfile.h"
 
 typedef std::vector<float> FloatVector;
 
@@ -131,6 +160,389 @@ enum NoiseReductionChoice {
     NRC_LEAVE_RESIDUE,
 };
 
+// Frames read from libsndfile at a time by the streaming entry points
+const size_t streamBufferFrames = 65536;
+
+// Steps whose windows a Worker transforms at once, when a buffer brings
+// them all: one batch of the built-in transforms
+const size_t batchSteps = FFTBatchFrames;
+
+// One channel of a stream through a constant rate resampler, for Workers
+// that run at another rate than the stream's
+class StreamResampler final {
+public:
+    StreamResampler(bool useBestMethod, double factor, const ResampleOptions &options)
+            : mResample(useBestMethod, factor, factor, options), mFactor(factor),
+              mOut((size_t) ceil(streamBufferFrames * factor) + 1024), mGenerated(0) {}
+
+    // Takes len samples of buffer, or with last all of them and whatever
+    // the resampler still holds, handing each piece of output to
+    // consume(samples, len)
+    template<typename Consume>
+    void Process(float *buffer, size_t len, bool last, const Consume &consume) {
+        size_t used = 0;
+        for (;;) {
+            const auto results = mResample.Process(mFactor, buffer + used, len - used, last,
+                                                   &mOut[0], mOut.size());
+            used += results.first;
+            mGenerated += results.second;
+            if (results.second > 0)
+                consume(&mOut[0], results.second);
+            if ((results.first == 0 && results.second == 0) || (used == len && !last))
+                break;
+        }
+    }
+
+    // The samples handed out so far
+    sampleCount GetGenerated() const { return mGenerated; }
+
+private:
+    Resample mResample;
+    const double mFactor;
+    FloatVector mOut;
+    sampleCount mGenerated;
+};
+
+// Receives the Worker's finished samples, mStepSize at a time
+class WorkerOutput {
+public:
+    virtual ~WorkerOutput() {}
+
+    virtual void Append(float *buffer, size_t len) = 0;
+
+    // When only classifying, receives instead for each step the noise mask
+    // of the window that ends there: 1 in the bands that are noise, else 0
+    virtual void AppendMask(const float *noise, size_t bands) {}
+
+    // Passes on whatever is still held; the Worker calls this once it has
+    // appended the last samples of a track or stream
+    virtual void Flush() {}
+};
+
+// Gathers the steps into buffers of the track's maximum block size, so that
+// WaveTrack::Append and the clip and sequence bookkeeping under it run once
+// per block rather than once per step
+class TrackOutput final : public WorkerOutput {
+public:
+    explicit TrackOutput(WaveTrack &track)
+            : mTrack(track), mBuffer(track.GetMaxBlockSize()), mLen(0) {}
+
+    void Append(float *buffer, size_t len) override {
+        while (len > 0) {
+            const auto avail = std::min(len, mBuffer.size() - mLen);
+            memcpy(&mBuffer[mLen], buffer, avail * sizeof(float));
+            mLen += avail;
+            buffer += avail;
+            len -= avail;
+            if (mLen == mBuffer.size())
+                Flush();
+        }
+    }
+
+    void Flush() override {
+        if (mLen > 0)
+            mTrack.Append((samplePtr) &mBuffer[0], floatSample, mLen);
+        mLen = 0;
+    }
+
+private:
+    WaveTrack &mTrack;
+    FloatVector mBuffer;
+    size_t mLen;
+};
+
+// Collects one channel's samples until every channel has some to interleave
+class BufferOutput final : public WorkerOutput {
+public:
+    void Append(float *buffer, size_t len) override {
+        mBuffer.insert(mBuffer.end(), buffer, buffer + len);
+    }
+
+    FloatVector mBuffer;
+};
+
+// Interleaves the channels' output for libsndfile, dropping whatever comes
+// past the end of the input, as ProcessOne does with HandleClear.  Take()
+// runs where the Workers do, and Write() on the writing thread.
+class SoundFileOutput final {
+public:
+    SoundFileOutput(SNDFILE *file, sampleFormat format, size_t channels, sampleCount limit)
+            : mFile(file), mFormat(format), mChannels(channels), mRemaining(limit), mTaken(0),
+              mOk(true) {}
+
+    // Takes no more than limit frames in all, for when that is known only
+    // at the end
+    void SetLimit(sampleCount limit) { mRemaining = std::max(sampleCount(0), limit - mTaken); }
+
+    // Interleaves into samples as many of the frames that all channels have
+    // as fit, and keeps the rest; returns how many frames are to be written
+    size_t Take(const std::vector<std::unique_ptr<BufferOutput>> &channels, FloatVector &samples) {
+        size_t frames = channels[0]->mBuffer.size();
+        for (const auto &channel : channels)
+            frames = std::min(frames, channel->mBuffer.size());
+        const auto len = limitSampleBufferSize(std::min(frames, samples.size() / mChannels), mRemaining);
+
+        for (size_t cc = 0; cc < mChannels; ++cc) {
+            const float *source = channels[cc]->mBuffer.data();
+            for (size_t ii = 0; ii < len; ++ii)
+                samples[ii * mChannels + cc] = source[ii];
+        }
+        mRemaining -= len;
+        mTaken += len;
+
+        // Past the end, the rest goes too
+        const auto used = mRemaining == 0 ? frames : len;
+        for (const auto &channel : channels)
+            channel->mBuffer.erase(channel->mBuffer.begin(), channel->mBuffer.begin() + used);
+        return len;
+    }
+
+    // Writes len interleaved frames, unless a write already failed
+    void Write(const float *samples, size_t len) {
+        if (!mOk || len == 0)
+            return;
+
+        sf_count_t written;
+        if (mFormat == int16Sample) {
+            mShorts.Resize(len * mChannels, int16Sample);
+            CopySamples((samplePtr) samples, floatSample, mShorts.ptr(), int16Sample, len * mChannels);
+            written = SFCall<sf_count_t>(sf_writef_short, mFile, (short *) mShorts.ptr(), len);
+        } else
+            written = SFCall<sf_count_t>(sf_writef_float, mFile, samples, len);
+        NR_COUNT(BytesWritten, len * mChannels * SAMPLE_SIZE(mFormat));
+        if (static_cast<size_t>(written) != len) {
+            char buffer2[1000];
+            sf_error_str(mFile, buffer2, 1000);
+            std::cerr << "Error while writing file (disk full?).\nLibsndfile says \""
+                      << buffer2 << "\"" << std::endl;
+            mOk = false;
+        }
+    }
+
+    bool Ok() const { return mOk; }
+
+private:
+    SNDFILE *const mFile;
+    const sampleFormat mFormat;
+    const size_t mChannels;
+    sampleCount mRemaining;
+    sampleCount mTaken;
+    bool mOk;
+    GrowableSampleBuffer mShorts;
+};
+
+// What the stages of ProcessStream() hand on: frames read, a channel at a
+// time, and frames to write, interleaved
+struct ReadBlock {
+    std::vector<FloatVector> channels;
+    size_t frames;
+};
+
+struct WriteBlock {
+    FloatVector samples;
+    size_t frames;
+};
+
+// Blocks each stage of ProcessStream() may get ahead of the next
+const size_t streamPipeSlots = 3;
+
+// The buffers ProcessStream() holds for channels besides the Workers: the
+// slots of both pipes and the interleaved samples being read
+size_t StreamBufferBytes(size_t channels) {
+    return (2 * streamPipeSlots + 1) * streamBufferFrames * channels * sizeof(float);
+}
+
+// Writes one channel's samples into every channels-th float of an
+// interleaved buffer of frames, dropping whatever comes past the end
+class ArrayOutput final : public WorkerOutput {
+public:
+    ArrayOutput(float *buffer, size_t channels, size_t frames)
+            : mBuffer(buffer), mChannels(channels), mRemaining(frames) {}
+
+    void Append(float *buffer, size_t len) override {
+        len = std::min(len, mRemaining);
+        for (size_t ii = 0; ii < len; ++ii)
+            mBuffer[ii * mChannels] = buffer[ii];
+        mBuffer += len * mChannels;
+        mRemaining -= len;
+    }
+
+private:
+    float *mBuffer;
+    const size_t mChannels;
+    size_t mRemaining;
+};
+
+// Passes on only samples [skip, skip + count) of what the Worker produces
+class SegmentOutput final : public WorkerOutput {
+public:
+    SegmentOutput(WorkerOutput &output, sampleCount skip, sampleCount count)
+            : mOutput(output), mSkip(skip), mCount(count) {}
+
+    void Append(float *buffer, size_t len) override {
+        const auto skipped = limitSampleBufferSize(len, mSkip);
+        buffer += skipped;
+        len -= skipped;
+        mSkip -= skipped;
+
+        len = limitSampleBufferSize(len, mCount);
+        if (len > 0) {
+            mOutput.Append(buffer, len);
+            mCount -= len;
+        }
+    }
+
+    void Flush() override {
+        mOutput.Flush();
+    }
+
+private:
+    WorkerOutput &mOutput;
+    sampleCount mSkip;
+    sampleCount mCount;
+};
+
+// Keeps, for each step, the fraction of bands [0, bands) marked as noise,
+// and if asked those bands of the mask
+class NoiseFractionOutput final : public WorkerOutput {
+public:
+    NoiseFractionOutput(size_t bands, bool keepMasks)
+            : mBands(bands), mKeepMasks(keepMasks) {}
+
+    void Append(float *, size_t) override {}
+
+    void AppendMask(const float *noise, size_t bands) override {
+        const auto end = noise + std::min(mBands, bands);
+        mFractions.push_back(std::accumulate(noise, end, 0.0f) / mBands);
+        if (mKeepMasks)
+            mMasks.insert(mMasks.end(), noise, end);
+    }
+
+    const size_t mBands;
+    const bool mKeepMasks;
+    FloatVector mFractions;
+    std::vector<unsigned char> mMasks;
+};
+
+// The analysis and synthesis windows depend only on these, so they are made
+// once for the process and copied into each Worker
+struct Windows {
+    FloatVector in;
+    FloatVector out;
+};
+
+std::shared_ptr<const Windows> GetWindows(int windowTypes, size_t windowSize,
+                                          size_t stepsPerWindow, bool doProfile) {
+    static std::map<std::tuple<int, size_t, size_t, bool>, std::shared_ptr<const Windows>> cache;
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &cached = cache[std::make_tuple(windowTypes, windowSize, stepsPerWindow, doProfile)];
+    if (cached)
+        return cached;
+
+    auto windows = std::make_shared<Windows>();
+    const double constantTerm =
+            windowTypesInfo[windowTypes].productConstantTerm;
+
+    // One or the other window must by multiplied by this to correct for
+    // overlap.  Must scale down as steps get smaller, and overlaps larger.
+    const double multiplier = 1.0 / (constantTerm * stepsPerWindow);
+
+    // Create the analysis window
+    switch (windowTypes) {
+        case WT_RECTANGULAR_HANN:
+            break;
+        default: {
+            const bool rectangularOut =
+                    windowTypes == WT_HAMMING_RECTANGULAR ||
+                    windowTypes == WT_HANN_RECTANGULAR;
+            const double m =
+                    rectangularOut ? multiplier : 1;
+            const double *const coefficients =
+                    windowTypesInfo[windowTypes].inCoefficients;
+            const double c0 = coefficients[0];
+            const double c1 = coefficients[1];
+            const double c2 = coefficients[2];
+            windows->in.resize(windowSize);
+            for (size_t ii = 0; ii < windowSize; ++ii)
+                windows->in[ii] = m *
+                                  (c0 + c1 * cos((2.0 * M_PI * ii) / windowSize)
+                                   + c2 * cos((4.0 * M_PI * ii) / windowSize));
+        }
+            break;
+    }
+
+    if (!doProfile) {
+        // Create the synthesis window
+        switch (windowTypes) {
+            case WT_HANN_RECTANGULAR:
+            case WT_HAMMING_RECTANGULAR:
+                break;
+            case WT_HAMMING_INV_HAMMING: {
+                windows->out.resize(windowSize);
+                for (size_t ii = 0; ii < windowSize; ++ii)
+                    windows->out[ii] = multiplier / windows->in[ii];
+            }
+                break;
+            default: {
+                const double *const coefficients =
+                        windowTypesInfo[windowTypes].outCoefficients;
+                const double c0 = coefficients[0];
+                const double c1 = coefficients[1];
+                const double c2 = coefficients[2];
+                windows->out.resize(windowSize);
+                for (size_t ii = 0; ii < windowSize; ++ii)
+                    windows->out[ii] = multiplier *
+                                       (c0 + c1 * cos((2.0 * M_PI * ii) / windowSize)
+                                        + c2 * cos((4.0 * M_PI * ii) / windowSize));
+            }
+                break;
+        }
+    }
+
+    cached = windows;
+    return cached;
+}
+
+// Header of a saved noise profile, in native byte order as for block files.
+// It is followed by spectrumSize float means.  The sums are not kept, since
+// they are reset once each profile track is finished.
+struct ProfileHeader {
+    char magic[4];
+    uint32_t version;
+    double rate;
+    uint32_t windowSize;
+    int32_t windowTypes;
+    int32_t totalWindows;
+    uint32_t spectrumSize;
+    double f0;
+    double f1;
+};
+
+const char profileMagic[4] = {'N', 'R', 'P', 'F'};
+const uint32_t profileVersion = 2;
+
+SFFile OpenSoundFile(const std::string &path, SF_INFO &info) {
+    SFFile file;
+    memset(&info, 0, sizeof(info));
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd >= 0)
+        file.reset(SFCall<SNDFILE *>(sf_open_fd, fd, SFM_READ, &info, true));
+    if (!file || info.channels < 1)
+        std::cerr << "Cannot open audio file " << path << std::endl;
+    return file;
+}
+
+// The bands [low, high) of windows of windowSize at rate that the frequency
+// range f0..f1 of SetFrequencyRange() takes
+void FrequencyBands(double rate, size_t windowSize, double f0, double f1, int &low, int &high) {
+    const size_t spectrumSize = 1 + windowSize / 2;
+    const double bin = rate / windowSize;
+    low = f0 >= 0.0 ? (int) std::min<double>(spectrumSize, floor(f0 / bin)) : 0;
+    high = f1 >= 0.0 ? (int) std::min<double>(spectrumSize, ceil(f1 / bin)) : (int) spectrumSize;
+    high = std::max(low, high);
+}
+
 } // namespace
 
 //----------------------------------------------------------------------------
@@ -140,8 +552,8 @@ enum NoiseReductionChoice {
 class EffectNoiseReduction::Statistics {
 public:
     Statistics(size_t spectrumSize, double rate, int windowTypes)
-            : mRate(rate), mWindowSize((spectrumSize - 1) * 2), mWindowTypes(windowTypes), mTotalWindows(0),
-              mTrackWindows(0), mSums(spectrumSize), mMeans(spectrumSize)
+            : mRate(rate), mWindowSize((spectrumSize - 1) * 2), mWindowTypes(windowTypes), mF0(-1.0), mF1(-1.0),
+              mTotalWindows(0), mTrackWindows(0), mSums(spectrumSize), mMeans(spectrumSize)
 #ifdef OLD_METHOD_AVAILABLE
     , mNoiseThreshold(spectrumSize)
 #endif
@@ -152,6 +564,17 @@ public:
     double mRate; // Rate of profile track(s) -- processed tracks must match
     size_t mWindowSize;
     int mWindowTypes;
+    // The frequency range profiled, as SetFrequencyRange() took it; the
+    // means of the bands outside are zero
+    double mF0, mF1;
+
+    // Whether the bands of the range f0..f1 were all profiled
+    bool Covers(double f0, double f1) const {
+        int low, high, profiledLow, profiledHigh;
+        FrequencyBands(mRate, mWindowSize, f0, f1, low, high);
+        FrequencyBands(mRate, mWindowSize, mF0, mF1, profiledLow, profiledHigh);
+        return profiledLow <= low && high <= profiledHigh;
+    }
 
     int mTotalWindows;
     int mTrackWindows;
@@ -164,6 +587,46 @@ public:
 #endif
 };
 
+//----------------------------------------------------------------------------
+// EffectNoiseReduction::NoiseMasks
+//----------------------------------------------------------------------------
+
+// One channel's classification, step by step, as a bit per band: what the
+// classifier marks on a row of zeros, so 1 for noise when isolating it and
+// otherwise 1 for the rest.  Recorded by the first reduction of a sweep,
+// then replayed by the others.
+class EffectNoiseReduction::NoiseMasks {
+public:
+    bool Recording() const { return !mFinished; }
+
+    // Ends the recording
+    void Finish() { mFinished = true; }
+
+    // Keeps the marks of the next step, bands long
+    void Append(const float *marks, size_t bands) {
+        const auto stride = (bands + 7) / 8;
+        const auto offset = mBits.size();
+        mBits.resize(offset + stride);
+        unsigned char *const bits = &mBits[offset];
+        for (size_t band = 0; band < bands; ++band)
+            if (marks[band] != 0.0f)
+                bits[band / 8] |= 1u << (band % 8);
+    }
+
+    // The marks kept for step, bands long
+    void Get(size_t step, float *marks, size_t bands) const {
+        const auto stride = (bands + 7) / 8;
+        assert((step + 1) * stride <= mBits.size());
+        const unsigned char *const bits = &mBits[step * stride];
+        for (size_t band = 0; band < bands; ++band)
+            marks[band] = (bits[band / 8] >> (band % 8)) & 1u;
+    }
+
+private:
+    std::vector<unsigned char> mBits;
+    bool mFinished{false};
+};
+
 //----------------------------------------------------------------------------
 // EffectNoiseReduction::Settings
 //----------------------------------------------------------------------------
@@ -185,6 +648,7 @@ public:
     unsigned StepsPerWindow() const { return 1u << (1 + mStepsPerWindowChoice); }
 
     bool mDoProfile;
+    bool mDoAnalysis; // classify the bands without reducing; see PreviewNoise()
 
     // Stored in preferences:
 
@@ -206,10 +670,25 @@ public:
     int mWindowSizeChoice;
     int mStepsPerWindowChoice;
     int mMethod;
+
+    // Not stored in preferences:
+    unsigned mThreads; // segments of one track reduced at once
+    double mAdaptTime; // in secs, or 0 to keep the profile's means fixed
+    bool mResample; // audio at another rate than the profile's is resampled to it
+    ResampleOptions mResampleOptions;
+    bool mCompactHistory; // the Workers keep their windows' parts in 16 bits
+    Progress *mProgress; // counts the samples processed, or null
+    bool mProgressBegun; // mProgress was begun for all the work, which each stream only advances
+    ChannelLink mChannelLink; // how the channels of one input are classified
+    double mF0, mF1; // the frequency range processed, either negative for no bound
+
+    bool Cancelled() const { return mProgress && mProgress->IsCancelled(); }
 };
 
 EffectNoiseReduction::Settings::Settings()
-        : mDoProfile(true) {
+        : mDoProfile(true), mDoAnalysis(false), mThreads(1), mAdaptTime(0.0), mResample(false),
+          mCompactHistory(false), mProgress(nullptr), mProgressBegun(false), mChannelLink(ChannelLink::None),
+          mF0(-1.0), mF1(-1.0) {
     PrefsIO(true);
 }
 
@@ -223,64 +702,216 @@ public:
     typedef EffectNoiseReduction::Settings Settings;
     typedef EffectNoiseReduction::Statistics Statistics;
 
-    Worker(const Settings &settings, double sampleRate
-#ifdef EXPERIMENTAL_SPECTRAL_EDITING
-            , double f0, double f1
-#endif
-    );
+    Worker(const Settings &settings, double sampleRate);
 
     ~Worker();
 
     bool Process(EffectNoiseReduction &effect, WaveTrack *track,
-                 Statistics &statistics, TrackFactory &factory, double mT0, double mT1);
+                 const Statistics &statistics, TrackFactory &factory, double mT0, double mT1);
+
+    // Streaming: one channel's samples are fed in pieces of any size between
+    // StartStream and FinishStream; output is unused when profiling
+    bool StartStream(double rate);
+
+    void ProcessStream(const Statistics &statistics, WorkerOutput *output, size_t len, const float *buffer);
+
+    void FinishStream(const Statistics &statistics, WorkerOutput *output);
+
+    // When reducing, makes this Worker classify for the Workers of the other
+    // channels too, which from then on only transform and synthesize their
+    // own channel as this one drives them.  Their power combines as link
+    // says into this one's spectra; its gains then apply to every channel.
+    void Link(const std::vector<Worker *> &others, ChannelLink link);
+
+    // The same as Process(), ProcessStream() and FinishStream() for all the
+    // linked channels at once, in step, this one's being the first of each
+    bool ProcessLinked(EffectNoiseReduction &effect, const std::vector<WaveTrack *> &tracks,
+                       const Statistics &statistics, TrackFactory &factory, double mT0, double mT1);
+
+    void ProcessLinkedStream(const Statistics &statistics, WorkerOutput *const *outputs,
+                             size_t len, const float *const *buffers);
+
+    void FinishLinkedStream(const Statistics &statistics, WorkerOutput *const *outputs);
+
+    bool IsLinked() const { return !mLinked.empty(); }
+
+    // Classifies through masks, recording into them until they are
+    // finished, or not at all with null.  Ignored when adapting, where the
+    // masks follow the noise gain.
+    void UseMasks(NoiseMasks *masks) { mMasks = mAdapted ? nullptr : masks; }
+
+    // When profiling, the statistics the windows are summed into; the
+    // profile given to the other calls is only ever read, and then unused
+    void GatherInto(Statistics &statistics) { mGathering = &statistics; }
+
+    size_t GetStepSize() const { return mStepSize; }
+
+    // About the bytes it holds: the spectral history and the window buffers
+    size_t GetFootprint() const {
+        return mHistory->GetBytes() + (batchSteps + 4) * mWindowSize * sizeof(float);
+    }
+
+    // When reducing, the steps of input taken before the first step of
+    // output: the padded windows and the history behind the one classified
+    unsigned GetDelaySteps() const { return mHistoryLen + mStepsPerWindow - 2; }
 
 private:
+    bool CheckRate(double rate) const;
+
     bool ProcessOne(EffectNoiseReduction &effect,
-                    Statistics &statistics, TrackFactory &factory,
+                    const Statistics &statistics, TrackFactory &factory,
                     int count, WaveTrack *track,
                     sampleCount start, sampleCount len);
 
+    void ProcessTrack(const Statistics &statistics, WaveTrack *track,
+                      sampleCount start, sampleCount len, WorkerOutput *output);
+
+    // ProcessTrack() of the tracks of all the linked channels, a block of
+    // each at a time
+    void ProcessTracks(const Statistics &statistics, WaveTrack *const *tracks,
+                       sampleCount start, sampleCount len, WorkerOutput *const *outputs);
+
+    void ProcessRanges(const Statistics &statistics, TrackFactory &factory, WaveTrack *track,
+                       sampleCount start, sampleCount len, const TimeRanges &ranges);
+
+    // The parts of [start, start + len) of track within ranges, in order,
+    // those that overlap or touch joined
+    static std::vector<std::pair<sampleCount, sampleCount>>
+    MergeRanges(const WaveTrack &track, sampleCount start, sampleCount len, const TimeRanges &ranges);
+
+    bool ProcessSegments(const Statistics &statistics, TrackFactory &factory, WaveTrack *track,
+                         sampleCount start, sampleCount len, WaveTrack &outputTrack);
+
     void StartNewTrack();
 
-    void ProcessSamples(Statistics &statistics,
-                        WaveTrack *outputTrack, size_t len, float *buffer);
+    // len samples of each linked channel, outputs[0] and buffers[0] being
+    // this one's and the only ones when not linked
+    void ProcessSamples(const Statistics &statistics,
+                        WorkerOutput *const *outputs, size_t len, const float *const *buffers);
+
+    // This Worker, or with cc > 0 the linked Worker of channel cc
+    Worker &Channel(size_t cc) { return cc == 0 ? *this : *mLinked[cc - 1]; }
+
+    // Counts the steps in a row whose new samples are all zero in every
+    // channel, and in long silence gives out the step of silence in place
+    // of a whole step; see mSilentStepsToSkip
+    bool SkipSilentStep(WorkerOutput *const *outputs);
+
+    // What the samples going through this Worker count as
+    Instrumentation::Stage TimedStage() const {
+        return mDoProfile ? Instrumentation::Stage::Profile
+                          : mDoAnalysis ? Instrumentation::Stage::Analyze : Instrumentation::Stage::Reduce;
+    }
 
+    template<bool InWindowed>
     void FillFirstHistoryWindow();
 
-    void ApplyFreqSmoothing(FloatVector &gains);
+    // Windows and transforms the windows of the next batchSteps steps at
+    // once, into mBatchFrames, for FillFirstHistoryWindow() to take in turn.
+    // mInWaveBuffer holds all of the first window but its last step, and
+    // buffer the rest of them.
+    void PrepareBatch(const float *buffer);
+
+    void ApplyFreqSmoothing(float *gains);
+
+    // Combines the power of the newest window of every linked channel into
+    // this one's, as mChannelLink says
+    void CombineLinkedSpectra();
+
+    // Applies gains to the parts of the oldest window, transforms them back
+    // and overlap-adds them, giving out a step if append
+    template<int Choice, bool OutWindowed>
+    void Synthesize(const float *gains, WorkerOutput *output, bool append);
 
     void GatherStatistics(Statistics &statistics);
 
-    inline bool Classify(const Statistics &statistics, int band);
+    // Classification of all the bands of a window at once, one
+    // instantiation for each method and choice; see ClassifyBands()
+    using BandClassifier = void (Worker::*)(const Statistics &statistics, float *gains);
+
+    template<unsigned Rank, bool Isolate>
+    void ClassifyBands(const Statistics &statistics, float *gains);
+#ifdef OLD_METHOD_AVAILABLE
+    template<bool Isolate>
+    void ClassifyBandsOld(const Statistics &statistics, float *gains);
+#endif
+
+    // Classify, as recorded into or replayed from mMasks
+    template<bool Isolate, BandClassifier Classify>
+    void ClassifyWithMasks(const Statistics &statistics, float *gains);
+
+    // Fills mThresholds, if not already done for these statistics
+    void UpdateThresholds(const Statistics &statistics);
+
+    // Moves mAdapted toward the bands of the center window just marked as
+    // noise in gains
+    template<bool Isolate>
+    void AdaptStatistics(const float *gains);
+
+    template<int Choice, bool OutWindowed, BandClassifier Classify>
+    void ReduceNoise(const Statistics &statistics, WorkerOutput *output);
+
+    // The work on each new window, specialized on the settings that the
+    // per band and per sample loops depend on, so that those are constants
+    // there; picked once by ChooseStep()
+    using StepFunction = void (Worker::*)(const Statistics &statistics, WorkerOutput *output);
+
+    template<bool InWindowed>
+    void ProfileStep(const Statistics &statistics, WorkerOutput *output);
+
+    template<bool InWindowed, bool OutWindowed, int Choice, BandClassifier Classify>
+    void ReduceStep(const Statistics &statistics, WorkerOutput *output);
+
+    template<bool InWindowed, BandClassifier Classify>
+    void AnalyzeStep(const Statistics &statistics, WorkerOutput *output);
+
+    StepFunction ChooseStep() const;
 
-    void ReduceNoise(const Statistics &statistics, WaveTrack *outputTrack);
+    template<bool InWindowed, bool OutWindowed>
+    StepFunction ChooseReduceStep() const;
+
+    template<bool InWindowed, bool OutWindowed, int Choice>
+    StepFunction ChooseClassifyStep() const;
+
+    template<bool InWindowed>
+    StepFunction ChooseAnalyzeStep() const;
 
     void RotateHistoryWindows();
 
     void FinishTrackStatistics(Statistics &statistics);
 
-    void FinishTrack(Statistics &statistics, WaveTrack *outputTrack);
+    void FinishTrack(const Statistics &statistics, WorkerOutput *const *outputs);
 
 private:
 
+    const Settings &mSettings;
     const bool mDoProfile;
+    const bool mDoAnalysis;
 
     const double mSampleRate;
 
     const size_t mWindowSize;
     // These have that size:
-    HFFT hFFT;
+    std::unique_ptr<FFTPlan> mFFT;
     FloatVector mFFTBuffer;
     FloatVector mInWaveBuffer;
     FloatVector mOutOverlapBuffer;
+    // batchSteps of that size, the spectra of the windows of the steps
+    // ahead, of which mBatchReady are made and mBatchNext is the next step's
+    FloatVector mBatchFrames;
+    std::vector<float *> mBatchPointers;
+    size_t mBatchReady;
+    size_t mBatchNext;
     // These have that size, or 0:
     FloatVector mInWindow;
     FloatVector mOutWindow;
 
     const size_t mSpectrumSize;
     FloatVector mFreqSmoothingScratch;
+    std::vector<double> mFreqSmoothingSums;
     const size_t mFreqSmoothingBins;
-    // When spectral selection limits the affected band:
+    // The bands of SetFrequencyRange(), the only ones profiled, classified
+    // and given gains; those outside pass through as they are
     int mBinLow;  // inclusive lower bound
     int mBinHigh; // exclusive upper bound
 
@@ -304,23 +935,187 @@ private:
     unsigned mCenter;
     unsigned mHistoryLen;
 
-    struct Record {
-        Record(size_t spectrumSize)
-                : mSpectrums(spectrumSize), mGains(spectrumSize), mRealFFTs(spectrumSize - 1),
-                  mImagFFTs(spectrumSize - 1) {
+    // For splitting a track into segments; see ProcessSegments()
+    unsigned mWarmUpSteps;
+    unsigned mLookAheadSteps;
+
+    // Steps in a row whose new samples were all zero, up to
+    // mSilentStepsToSkip, from which on steps are skipped; 0 for never
+    unsigned mSilentSteps;
+    unsigned mSilentStepsToSkip;
+
+    // The spectral history.  Each quantity is one block of rows, one row per
+    // window, each row padded to a whole number of cache lines and aligned to
+    // one.  Window 0 is the newest; rotating moves an offset, not the rows.
+    // A row of real or imaginary parts has spectrumSize - 1 values in use.
+    // Only the newest spectrumWindows keep their power, as far back as
+    // classification looks.  When compact, the real and imaginary parts are
+    // kept as 16 bit integers with a scale for each row, halving the bytes
+    // of those rows, which are written once and read once, windows later.
+    class History {
+    public:
+        History(size_t windows, size_t spectrumWindows, size_t spectrumSize, bool compact)
+                : mWindows(windows), mSpectrumWindows(spectrumWindows), mFirst(0), mFirstSpectrum(0),
+                  mUsed(spectrumSize - 1),
+                  mStride((spectrumSize + rowAlignment - 1) / rowAlignment * rowAlignment),
+                  mCompact(compact),
+                  mStorage((spectrumWindows + windows + 2 * (compact ? 1 : windows)) * mStride + rowAlignment),
+                  mPacked(compact ? 2 * windows * mStride : 0), mScales(compact ? 2 * windows : 0) {
+            const auto misalignment =
+                    reinterpret_cast<uintptr_t>(mStorage.data()) % (rowAlignment * sizeof(float));
+            mSpectrums = mStorage.data() +
+                         (misalignment ? rowAlignment - misalignment / sizeof(float) : 0);
+            mGains = mSpectrums + mSpectrumWindows * mStride;
+            mRealFFTs = mGains + mWindows * mStride;
+            mImagFFTs = mRealFFTs + (compact ? 1 : mWindows) * mStride;
+        }
+
+        float *Spectrums(unsigned window) {
+            assert(window < mSpectrumWindows);
+            return mSpectrums + (mFirstSpectrum + window) % mSpectrumWindows * mStride;
+        }
+        float *Gains(unsigned window) { return Row(mGains, window); }
+
+        // FillFirstHistoryWindow() writes the parts of window 0 here, then
+        // KeepNewFFTs() stores them
+        float *NewRealFFTs() { return mCompact ? mRealFFTs : Row(mRealFFTs, 0); }
+        float *NewImagFFTs() { return mCompact ? mImagFFTs : Row(mImagFFTs, 0); }
+        void KeepNewFFTs() {
+            if (mCompact) {
+                Pack(0, mRealFFTs);
+                Pack(1, mImagFFTs);
+            }
+        }
+
+        // The parts of window, valid until the next call for the same part
+        const float *RealFFTs(unsigned window) {
+            return mCompact ? Unpack(0, window, mRealFFTs) : Row(mRealFFTs, window);
+        }
+        const float *ImagFFTs(unsigned window) {
+            return mCompact ? Unpack(1, window, mImagFFTs) : Row(mImagFFTs, window);
+        }
+
+        // All power and parts zero, all gains gain
+        void Clear(float gain) {
+            for (size_t ii = 0; ii < mSpectrumWindows; ++ii)
+                std::fill(mSpectrums + ii * mStride, mSpectrums + ii * mStride + mUsed + 1, 0.0f);
+            for (size_t ii = 0; ii < mWindows; ++ii)
+                std::fill(mGains + ii * mStride, mGains + ii * mStride + mUsed + 1, gain);
+            if (mCompact) {
+                std::fill(mPacked.begin(), mPacked.end(), 0);
+                std::fill(mScales.begin(), mScales.end(), 0.0f);
+            } else
+                for (size_t ii = 0; ii < mWindows; ++ii) {
+                    std::fill(mRealFFTs + ii * mStride, mRealFFTs + ii * mStride + mUsed, 0.0f);
+                    std::fill(mImagFFTs + ii * mStride, mImagFFTs + ii * mStride + mUsed, 0.0f);
+                }
+        }
+
+        // The oldest window becomes window 0
+        void Rotate() {
+            mFirst = (mFirst + mWindows - 1) % mWindows;
+            mFirstSpectrum = (mFirstSpectrum + mSpectrumWindows - 1) % mSpectrumWindows;
+        }
+
+        size_t GetBytes() const {
+            return mStorage.size() * sizeof(float) + mPacked.size() * sizeof(int16_t) +
+                   mScales.size() * sizeof(float);
         }
 
-        FloatVector mSpectrums;
-        FloatVector mGains;
-        FloatVector mRealFFTs;
-        FloatVector mImagFFTs;
+    private:
+        // Floats in a 64 byte cache line
+        static constexpr size_t rowAlignment = 16;
+
+        float *Row(float *rows, unsigned window) {
+            return rows + (mFirst + window) % mWindows * mStride;
+        }
+
+        void Pack(unsigned part, const float *values) {
+            const auto row = part * mWindows + mFirst;
+            int16_t *const packed = &mPacked[row * mStride];
+            float greatest = 0.0f;
+            for (size_t ii = 0; ii < mUsed; ++ii)
+                greatest = std::max(greatest, std::abs(values[ii]));
+            mScales[row] = greatest / 32767.0f;
+            const float inverse = greatest > 0.0f ? 32767.0f / greatest : 0.0f;
+            for (size_t ii = 0; ii < mUsed; ++ii)
+                packed[ii] = (int16_t) lrintf(values[ii] * inverse);
+        }
+
+        const float *Unpack(unsigned part, unsigned window, float *values) {
+            const auto row = part * mWindows + (mFirst + window) % mWindows;
+            const int16_t *const packed = &mPacked[row * mStride];
+            const float scale = mScales[row];
+            for (size_t ii = 0; ii < mUsed; ++ii)
+                values[ii] = packed[ii] * scale;
+            return values;
+        }
+
+        const size_t mWindows;
+        const size_t mSpectrumWindows;
+        size_t mFirst;
+        size_t mFirstSpectrum;
+        const size_t mUsed;
+        const size_t mStride;
+        const bool mCompact;
+        FloatVector mStorage;
+        // When compact, the parts, and one row of mStorage for each, which
+        // the newest window is written to and the others are unpacked into
+        std::vector<int16_t> mPacked;
+        FloatVector mScales;
+        float *mSpectrums;
+        float *mGains;
+        float *mRealFFTs;
+        float *mImagFFTs;
     };
 
-    std::vector<std::unique_ptr<Record>> mQueue;
+    std::unique_ptr<History> mHistory;
+    // Scratch for the attack loop in ReduceNoise(), mHistoryLen long
+    std::vector<float *> mGainRows;
+
+    // Kept so that each track or stream allocates nothing once started:
+    // mStepSize zeros flushed through by FinishTrack(), and the buffer for
+    // samples ProcessTrack() can't read in place, which only grows
+    FloatVector mEmptyStep;
+    FloatVector mTrackBuffer;
+
+    StepFunction mStep;
+    // Scratch for ClassifyBands(), mNWindowsToExamine long
+    std::vector<const float *> mSpectrumRows;
+    // The noise thresholds of each band, in single precision
+    FloatVector mThresholds;
+    const Statistics *mThresholdsFor;
+
+    // When adapting, the profile as followed through this track, copied
+    // from mAdaptedFrom at its first step, and how far each window of noise
+    // moves the means
+    std::unique_ptr<Statistics> mAdapted;
+    const Statistics *mAdaptedFrom;
+    float mAdaptFactor;
+
+    // See UseMasks(): the step of the track, and its marks, mSpectrumSize long
+    NoiseMasks *mMasks;
+    size_t mMaskStep;
+    FloatVector mMaskMarks;
+
+    // See GatherInto()
+    Statistics *mGathering;
+
+    // See Link(): the Workers of the other channels, none unless linked,
+    // and how their power combines.  A linked Worker gives out its
+    // synthesis to mLinkedOutput, which ProcessSamples() of the one linking
+    // it sets.  Scratch: a step of zeros for each channel, for FinishTrack(),
+    // and where ProcessTracks() finds each channel's samples.
+    std::vector<Worker *> mLinked;
+    ChannelLink mChannelLink;
+    WorkerOutput *mLinkedOutput;
+    std::vector<const float *> mEmptySteps;
+    std::vector<const float *> mTrackSamples;
 };
 
 EffectNoiseReduction::EffectNoiseReduction()
-        : mSettings(std::make_unique<EffectNoiseReduction::Settings>()) {
+        : mRanges(nullptr), mSettings(std::make_unique<EffectNoiseReduction::Settings>()),
+          mNewStatistics(nullptr), mLastError(Error::None) {
     Init();
 }
 
@@ -331,6 +1126,96 @@ bool EffectNoiseReduction::Init() {
 EffectNoiseReduction::~EffectNoiseReduction() {
 }
 
+bool EffectNoiseReduction::Fail(Error error) const {
+    auto none = Error::None;
+    mLastError.compare_exchange_strong(none, error);
+    return false;
+}
+
+void EffectNoiseReduction::SetThreads(unsigned numThreads) {
+    mSettings->mThreads = std::max(1u, numThreads);
+}
+
+bool EffectNoiseReduction::SetAdaptiveProfile(double timeConstant) {
+    mLastError = Error::None;
+    if (!(timeConstant >= 0.0) || std::isinf(timeConstant)) {
+        std::cerr << "The adaptation time must be a finite number of seconds, or 0." << std::endl;
+        return Fail(Error::Settings);
+    }
+    mSettings->mAdaptTime = timeConstant;
+    return true;
+}
+
+void EffectNoiseReduction::SetResampling(bool enable, const ResampleOptions &options) {
+    mSettings->mResample = enable;
+    mSettings->mResampleOptions = options;
+}
+
+void EffectNoiseReduction::SetCompactHistory(bool enable) {
+    mSettings->mCompactHistory = enable;
+}
+
+void EffectNoiseReduction::SetProgress(Progress *progress) {
+    mSettings->mProgress = progress;
+}
+
+void EffectNoiseReduction::SetChannelLink(ChannelLink link) {
+    mSettings->mChannelLink = link;
+}
+
+bool EffectNoiseReduction::SetFrequencyRange(double f0, double f1) {
+    mLastError = Error::None;
+    if (std::isnan(f0) || std::isnan(f1) || (f0 >= 0.0 && f1 >= 0.0 && f0 >= f1)) {
+        std::cerr << "The frequency range must be from a lower to a higher frequency." << std::endl;
+        return Fail(Error::Settings);
+    }
+    // Any negative bound is the same, and kept as one value, so that
+    // profiles compare and cache alike
+    mSettings->mF0 = f0 < 0.0 ? -1.0 : f0;
+    mSettings->mF1 = f1 < 0.0 ? -1.0 : f1;
+    return true;
+}
+
+double EffectNoiseReduction::WorkerRate(double rate) const {
+    return mSettings->mResample && !mSettings->mDoProfile && mStatistics ? mStatistics->mRate : rate;
+}
+
+bool EffectNoiseReduction::SetAdvancedSettings(size_t windowSize, unsigned stepsPerWindow,
+                                               int windowTypes, int method) {
+    // The sizes are powers of two, kept as their logarithms
+    auto choiceOf = [](size_t size, unsigned first, int &choice) {
+        for (choice = 0; first + choice < 32; ++choice)
+            if ((size_t{1} << (first + choice)) == size)
+                return true;
+        return false;
+    };
+
+    mLastError = Error::None;
+    Settings settings(*mSettings);
+    settings.mWindowTypes = windowTypes;
+    settings.mMethod = method;
+    if (!choiceOf(windowSize, 3, settings.mWindowSizeChoice)) {
+        std::cerr << "The window size must be a power of two." << std::endl;
+        return Fail(Error::Settings);
+    }
+    if (!choiceOf(stepsPerWindow, 1, settings.mStepsPerWindowChoice)) {
+        std::cerr << "Steps per block must be a power of two." << std::endl;
+        return Fail(Error::Settings);
+    }
+    if (!settings.Validate(this))
+        return Fail(Error::Settings);
+
+    *mSettings = settings;
+    return true;
+}
+
+std::vector<std::string> EffectNoiseReduction::GetWindowTypesNames() {
+    std::vector<std::string> names;
+    for (const auto &info : windowTypesInfo)
+        names.push_back(info.name);
+    return names;
+}
+
 namespace {
 template<typename StructureType, typename FieldType>
 struct PrefsTableEntry {
@@ -377,6 +1262,7 @@ bool EffectNoiseReduction::Settings::PrefsIO(bool read) {
         mReleaseTime = doubleTable[3].defaultValue;
         mFreqSmoothingBands = doubleTable[4].defaultValue;
         mOldSensitivity = doubleTable[5].defaultValue;
+        mNoiseReductionChoice = intTable[0].defaultValue;
 
         // Ignore preferences for unavailable options.
 #ifndef RESIDUE_CHOICE
@@ -405,6 +1291,30 @@ bool EffectNoiseReduction::Settings::PrefsIO(bool read) {
 }
 
 bool EffectNoiseReduction::Settings::Validate(EffectNoiseReduction *effect) const {
+    if (mWindowTypes < 0 || mWindowTypes >= WT_N_WINDOW_TYPES) {
+        std::cerr << "There is no such choice of window types." << std::endl;
+        return false;
+    }
+
+    if (mWindowSizeChoice < 0 || mWindowSizeChoice > 11) {
+        std::cerr << "The window size must be from 8 to 16384." << std::endl;
+        return false;
+    }
+
+    if (mStepsPerWindowChoice < 0 || mStepsPerWindowChoice > 5) {
+        std::cerr << "Steps per block must be from 2 to 64." << std::endl;
+        return false;
+    }
+
+    if (mMethod < 0 || mMethod >= DM_N_METHODS
+#ifndef OLD_METHOD_AVAILABLE
+        || mMethod == DM_OLD_METHOD
+#endif
+        ) {
+        std::cerr << "There is no such discrimination method." << std::endl;
+        return false;
+    }
+
     if (StepsPerWindow() < windowTypesInfo[mWindowTypes].minSteps) {
         std::cerr << "Steps per block are too few for the window types." << std::endl;
         return false;
@@ -426,21 +1336,39 @@ bool EffectNoiseReduction::Settings::Validate(EffectNoiseReduction *effect) cons
 bool EffectNoiseReduction::GetProfile(WaveTrack *track, double t0, double t1,
                                       double noiseGain, double sensitivity, double freqSmoothingBands,
                                       TrackFactory *factory) {
-    mFactory = factory;
-    mSettings->mDoProfile = true;
-    mSettings->mFreqSmoothingBands = freqSmoothingBands;
-    mSettings->mNoiseGain = noiseGain;
-    mSettings->mNewSensitivity = sensitivity;
+    return GetProfile(std::vector<WaveTrack *>{track}, t0, t1,
+                      noiseGain, sensitivity, freqSmoothingBands, factory);
+}
 
-    double duration = 0.0;
-    mT0 = t0;
-    mT1 = t1;
+bool
+EffectNoiseReduction::ReduceNoise(WaveTrack *track, double noiseGain, double sensitivity, double freqSmoothingBands,
+                                  TrackFactory *factory) {
+    return ReduceNoise(std::vector<WaveTrack *>{track},
+                       noiseGain, sensitivity, freqSmoothingBands, factory);
+}
+
+bool EffectNoiseReduction::GetProfile(const std::vector<WaveTrack *> &tracks, double t0, double t1,
+                                      double noiseGain, double sensitivity, double freqSmoothingBands,
+                                      TrackFactory *factory) {
+    mLastError = Error::None;
+    if (tracks.empty())
+        return false;
+
+    mFactory = factory;
+    mSettings->mDoProfile = true;
+    mSettings->mFreqSmoothingBands = freqSmoothingBands;
+    mSettings->mNoiseGain = noiseGain;
+    mSettings->mNewSensitivity = sensitivity;
+
+    double duration = 0.0;
+    mT0 = t0;
+    mT1 = t1;
     if (mT1 > mT0) {
         // there is a selection: let's fit in there...
         // MJS: note that this is just for the TTC and is independent of the track rate
         // but we do need to make sure we have the right number of samples at the project rate
-        double quantMT0 = QUANTIZED_TIME(mT0, track->GetRate());
-        double quantMT1 = QUANTIZED_TIME(mT1, track->GetRate());
+        double quantMT0 = QUANTIZED_TIME(mT0, tracks[0]->GetRate());
+        double quantMT1 = QUANTIZED_TIME(mT1, tracks[0]->GetRate());
         duration = quantMT1 - quantMT0;
         mT1 = mT0 + duration;
     }
@@ -450,81 +1378,1448 @@ bool EffectNoiseReduction::GetProfile(WaveTrack *track, double t0, double t1,
         return false;
     }
 
-    return Process(track);
+    return Process(tracks);
 }
 
 bool
-EffectNoiseReduction::ReduceNoise(WaveTrack *track, double noiseGain, double sensitivity, double freqSmoothingBands,
+EffectNoiseReduction::ReduceNoise(const std::vector<WaveTrack *> &tracks,
+                                  double noiseGain, double sensitivity, double freqSmoothingBands,
                                   TrackFactory *factory) {
+    mLastError = Error::None;
+    if (tracks.empty())
+        return false;
+
     mFactory = factory;
     mSettings->mDoProfile = false;
     mSettings->mFreqSmoothingBands = freqSmoothingBands;
     mSettings->mNoiseGain = noiseGain;
     mSettings->mNewSensitivity = sensitivity;
 
-    mT0 = track->GetStartTime();
-    mT1 = track->GetEndTime();
+    mT0 = tracks[0]->GetStartTime();
+    mT1 = tracks[0]->GetEndTime();
+    for (auto track : tracks) {
+        mT0 = std::min(mT0, track->GetStartTime());
+        mT1 = std::max(mT1, track->GetEndTime());
+    }
     double duration = 0.0;
     if (mT1 > mT0) {
         // there is a selection: let's fit in there...
         // MJS: note that this is just for the TTC and is independent of the track rate
         // but we do need to make sure we have the right number of samples at the project rate
-        double quantMT0 = QUANTIZED_TIME(mT0, track->GetRate());
-        double quantMT1 = QUANTIZED_TIME(mT1, track->GetRate());
+        double quantMT0 = QUANTIZED_TIME(mT0, tracks[0]->GetRate());
+        double quantMT1 = QUANTIZED_TIME(mT1, tracks[0]->GetRate());
         duration = quantMT1 - quantMT0;
         mT1 = mT0 + duration;
     }
 
-    return Process(track);
+    return Process(tracks);
 }
 
-bool EffectNoiseReduction::Process(WaveTrack *track) {
+bool EffectNoiseReduction::ReduceNoiseRanges(const std::vector<WaveTrack *> &tracks, const TimeRanges &ranges,
+                                             double noiseGain, double sensitivity, double freqSmoothingBands,
+                                             TrackFactory *factory) {
+    mRanges = &ranges;
+    auto clearRanges = finally([this] { mRanges = nullptr; });
+    return ReduceNoise(tracks, noiseGain, sensitivity, freqSmoothingBands, factory);
+}
+
+bool EffectNoiseReduction::GetProfileStreaming(const std::string &path, double t0, double t1,
+                                               double noiseGain, double sensitivity,
+                                               double freqSmoothingBands) {
+    mLastError = Error::None;
+    mSettings->mDoProfile = true;
+    mSettings->mFreqSmoothingBands = freqSmoothingBands;
+    mSettings->mNoiseGain = noiseGain;
+    mSettings->mNewSensitivity = sensitivity;
+
+    SF_INFO info;
+    SFFile file = OpenSoundFile(path, info);
+    if (!file || info.channels < 1)
+        return Fail(Error::File);
+
+    return GetProfileStream(file.get(), info, t0, t1);
+}
+
+bool EffectNoiseReduction::GetProfileMemory(const void *data, size_t bytes, double t0, double t1,
+                                            double noiseGain, double sensitivity,
+                                            double freqSmoothingBands) {
+    mLastError = Error::None;
+    mSettings->mDoProfile = true;
+    mSettings->mFreqSmoothingBands = freqSmoothingBands;
+    mSettings->mNoiseGain = noiseGain;
+    mSettings->mNewSensitivity = sensitivity;
+
+    SFMemory memory(data, bytes);
+    SF_INFO info;
+    SFFile file = memory.Open(info);
+    if (!file || info.channels < 1)
+        return Fail(Error::File);
+
+    return GetProfileStream(file.get(), info, t0, t1);
+}
+
+bool EffectNoiseReduction::GetProfileStream(SNDFILE *file, const SF_INFO &info, double t0, double t1) {
+    const double rate = info.samplerate;
+    mT0 = t0;
+    mT1 = t1;
+    const auto start = std::max(sampleCount(0), sampleCount(floor(mT0 * rate + 0.5)));
+    const auto end = std::min(sampleCount(info.frames), sampleCount(floor(mT1 * rate + 0.5)));
+
+    if (!StartProcess(rate))
+        return false;
+
+    bool bGoodResult = false;
+    if (end > start)
+        bGoodResult = ProcessStream(file, info, start, end - start, nullptr, floatSample);
+    else {
+        std::cerr << "Selected noise profile is too short." << std::endl;
+        Fail(Error::ProfileTooShort);
+    }
+
+    EndProcess(bGoodResult);
+    return bGoodResult;
+}
+
+bool EffectNoiseReduction::ReduceNoiseStreaming(const std::string &srcPath, const std::string &dstPath,
+                                                double noiseGain, double sensitivity,
+                                                double freqSmoothingBands, int subformat) {
+    mLastError = Error::None;
+    mSettings->mDoProfile = false;
+    mSettings->mFreqSmoothingBands = freqSmoothingBands;
+    mSettings->mNoiseGain = noiseGain;
+    mSettings->mNewSensitivity = sensitivity;
+
+    SF_INFO info;
+    SFFile file = OpenSoundFile(srcPath, info);
+    if (!file || info.channels < 1)
+        return Fail(Error::File);
+
+    if (!StartProcess(info.samplerate))
+        return false;
+
+    bool bGoodResult = ReduceStream(file.get(), info, dstPath, subformat);
+
+    EndProcess(bGoodResult);
+    return bGoodResult;
+}
+
+bool EffectNoiseReduction::ReduceNoiseMemory(const void *src, size_t srcBytes, std::vector<char> &dst,
+                                             double noiseGain, double sensitivity,
+                                             double freqSmoothingBands, int subformat) {
+    mLastError = Error::None;
+    mSettings->mDoProfile = false;
+    mSettings->mFreqSmoothingBands = freqSmoothingBands;
+    mSettings->mNoiseGain = noiseGain;
+    mSettings->mNewSensitivity = sensitivity;
+
+    SFMemory srcMemory(src, srcBytes);
+    SF_INFO info;
+    SFFile file = srcMemory.Open(info);
+    if (!file || info.channels < 1)
+        return Fail(Error::File);
+
+    if (!StartProcess(info.samplerate))
+        return false;
+
+    SFMemory dstMemory(dst);
+    bool bGoodResult = ReduceStream(file.get(), info, "memory", subformat, nullptr, &dstMemory);
+
+    EndProcess(bGoodResult);
+    return bGoodResult;
+}
+
+bool EffectNoiseReduction::ReduceNoiseBatch(const std::vector<std::pair<std::string, std::string>> &files,
+                                            double noiseGain, double sensitivity, double freqSmoothingBands,
+                                            std::vector<BatchResult> &results, unsigned numThreads,
+                                            int subformat, MemoryAdmission *admission) const {
+    mLastError = Error::None;
+    results.assign(files.size(), BatchResult{false, 0.0});
+
+    auto effect = MakeReducer(noiseGain, sensitivity, freqSmoothingBands);
+    // The rate only matters when profiling
+    if (!effect->StartProcess(0))
+        return Fail(effect->GetLastError());
+
+    if (numThreads == 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    numThreads = std::min<size_t>(numThreads, std::max<size_t>(1, files.size()));
+    const auto workerBytes = admission ? effect->MakeWorker()->GetFootprint() : 0;
+
+    // One stage of all the files' frames, which each file's stream only
+    // advances, so that the fraction does not start over as each file does
+    if (const auto progress = effect->mSettings->mProgress) {
+        double total = 0.0;
+        for (const auto &file : files) {
+            // Quietly: a file that cannot be opened is reported in its turn
+            SF_INFO info = {};
+            SFFile header;
+            header.reset(SFCall<SNDFILE *>(sf_open, file.first.c_str(), SFM_READ, &info));
+            if (header)
+                total += info.frames;
+        }
+        effect->mSettings->mProgressBegun = true;
+        progress->Begin(total);
+    }
+
+    // The files are independent and each is a sizeable job, so the threads
+    // just take the next one not yet claimed until none are left
+    std::atomic<size_t> next{0};
+    ForEachInParallel(numThreads, [&](size_t) {
+        for (size_t ii; (ii = next++) < files.size();) {
+            const auto begin = std::chrono::steady_clock::now();
+            bool success = false;
+            try {
+                SF_INFO info;
+                SFFile file = OpenSoundFile(files[ii].first, info);
+                if (!file)
+                    success = effect->Fail(Error::File);
+                else if (admission) {
+                    const size_t channels = info.channels;
+                    const auto ticket = admission->Admit(
+                            channels * workerBytes + StreamBufferBytes(channels));
+                    success = effect->ReduceStream(file.get(), info, files[ii].second, subformat);
+                } else
+                    success = effect->ReduceStream(file.get(), info, files[ii].second, subformat);
+            } catch (const std::exception &e) {
+                std::cerr << files[ii].first << ": " << e.what() << std::endl;
+            }
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+            results[ii] = BatchResult{success, elapsed.count()};
+        }
+    });
+
+    effect->EndProcess(true);
+    if (effect->GetLastError() != Error::None)
+        Fail(effect->GetLastError());
+    return std::all_of(results.begin(), results.end(),
+                       [](const BatchResult &result) { return result.success; });
+}
+
+bool EffectNoiseReduction::EstimateFootprint(const std::string &path, Footprint &footprint) const {
+    mLastError = Error::None;
+    if (!mStatistics) {
+        std::cerr << "A noise profile must be taken before estimating a reduction." << std::endl;
+        return Fail(Error::NoProfile);
+    }
+    SF_INFO info;
+    SFFile file = OpenSoundFile(path, info);
+    auto handle = file ? PCMImportFileHandle::Open(path) : nullptr;
+    if (!handle)
+        return Fail(Error::File);
+
+    const size_t channels = info.channels;
+    const auto workers = channels * MakeWorker()->GetFootprint();
+    footprint.trackBytes = 2 * (size_t) handle->GetFileUncompressedBytes() + workers;
+    footprint.streamBytes = workers + StreamBufferBytes(channels);
+    return true;
+}
+
+bool EffectNoiseReduction::ReduceNoiseSweep(const std::string &srcPath, double sensitivity,
+                                            const std::vector<SweepSetting> &settings, int subformat) const {
+    mLastError = Error::None;
+
+    SF_INFO info;
+    SFFile file = OpenSoundFile(srcPath, info);
+    if (!file || info.channels < 1)
+        return Fail(Error::File);
+
+    auto effect = MakeReducer(mSettings->mNoiseGain, sensitivity, mSettings->mFreqSmoothingBands);
+    if (!effect->StartProcess(info.samplerate))
+        return Fail(effect->GetLastError());
+
+    // Recorded by the first setting, replayed by the rest
+    std::vector<std::unique_ptr<NoiseMasks>> masks;
+    bool bGoodResult = true;
+    for (const auto &setting : settings) {
+        effect->mSettings->mNoiseGain = setting.noiseGain;
+        effect->mSettings->mFreqSmoothingBands = setting.freqSmoothingBands;
+        if (!effect->ReduceStream(file.get(), info, setting.dstPath, subformat, &masks)) {
+            bGoodResult = Fail(effect->GetLastError());
+            break;
+        }
+        for (const auto &channel : masks)
+            channel->Finish();
+    }
+
+    effect->EndProcess(bGoodResult);
+    return bGoodResult;
+}
+
+bool EffectNoiseReduction::ReduceStream(SNDFILE *file, const SF_INFO &info,
+                                        const std::string &dstPath, int subformat,
+                                        std::vector<std::unique_ptr<NoiseMasks>> *masks,
+                                        SFMemory *dstMemory) {
+    SF_INFO outInfo;
+    sampleFormat format;
+    const double rate = WorkerRate(info.samplerate);
+    const auto frames = llrint(info.frames * rate / info.samplerate);
+    SFFile outFile = dstMemory
+                     ? ExportPCM::OpenMemory(*dstMemory, rate, info.channels, frames,
+                                             subformat, outInfo, format)
+                     : ExportPCM::OpenFile(dstPath, rate, info.channels, frames,
+                                           subformat, outInfo, format);
+    if (!outFile)
+        return Fail(Error::File);
+
+    bool bGoodResult = ProcessStream(file, info, 0, info.frames, outFile.get(), format, masks);
+
+    if (0 != outFile.close()) {
+        std::cerr << "Unable to export" << std::endl;
+        bGoodResult = Fail(Error::File);
+    }
+    return bGoodResult;
+}
+
+bool EffectNoiseReduction::ProcessStream(SNDFILE *file, const SF_INFO &info,
+                                         sampleCount start, sampleCount len,
+                                         SNDFILE *outFile, sampleFormat outFormat,
+                                         std::vector<std::unique_ptr<NoiseMasks>> *masks) {
+    const auto channels = (size_t) info.channels;
+    const double rate = WorkerRate(info.samplerate);
+    const double factor = rate / info.samplerate;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::unique_ptr<BufferOutput>> outputs;
+    std::vector<std::unique_ptr<StreamResampler>> resamplers;
+    for (size_t cc = 0; cc < channels; ++cc) {
+        workers.push_back(MakeWorker());
+        if (!workers.back()->StartStream(rate))
+            return Fail(Error::SampleRate);
+        outputs.push_back(std::make_unique<BufferOutput>());
+        if (factor != 1.0)
+            resamplers.push_back(std::make_unique<StreamResampler>(true, factor, mSettings->mResampleOptions));
+        if (masks) {
+            if (masks->size() == cc)
+                masks->push_back(std::make_unique<NoiseMasks>());
+            workers.back()->UseMasks((*masks)[cc].get());
+        }
+    }
+    if (!LinkWorkers(workers))
+        return false;
+    const bool linked = workers[0]->IsLinked();
+
+    auto channelStatistics = MakeChannelStatistics(workers);
+
+    // Resampled, the output is as long as the resampler's, known at the end
+    std::unique_ptr<SoundFileOutput> fileOutput;
+    if (outFile)
+        fileOutput = std::make_unique<SoundFileOutput>(
+                outFile, outFormat, channels, resamplers.empty() ? len : sampleCount(LLONG_MAX));
+
+    if (SFCall<sf_count_t>(sf_seek, file, start.as_long_long(), SEEK_SET) < 0) {
+        std::cerr << "Cannot seek in audio file." << std::endl;
+        return Fail(Error::File);
+    }
+
+    const auto progress = mSettings->mProgress;
+    if (progress && !mSettings->mProgressBegun)
+        progress->Begin(len.as_double());
+
+    // Reading, reducing and writing overlap, each on a thread of its own and
+    // at most streamPipeSlots blocks ahead of the next, so a stream takes
+    // about as long as its slowest stage rather than all three in turn
+    StagePipe<ReadBlock> input(streamPipeSlots);
+    for (auto &block : input.Slots())
+        block.channels.assign(channels, FloatVector(streamBufferFrames));
+    StagePipe<WriteBlock> output(streamPipeSlots);
+    for (auto &block : output.Slots())
+        block.samples.resize(outFile ? streamBufferFrames * channels : 0);
+
+    std::exception_ptr readError;
+    std::thread reader([&] {
+        try {
+            FloatVector interleaved(streamBufferFrames * channels);
+            std::vector<float *> channelPointers(channels);
+            auto samplePos = start;
+            while (samplePos < start + len) {
+                const auto block = input.Back();
+                if (!block)
+                    break;
+                const auto blockSize = limitSampleBufferSize(streamBufferFrames, start + len - samplePos);
+                const auto framesRead = SFCall<sf_count_t>(sf_readf_float, file, &interleaved[0], blockSize);
+                if (framesRead <= 0)
+                    break;
+                NR_COUNT(BytesRead, framesRead * channels * sizeof(float));
+                for (size_t cc = 0; cc < channels; ++cc)
+                    channelPointers[cc] = &block->channels[cc][0];
+                DeinterleaveSamples(&interleaved[0], channels, channelPointers.data(), framesRead);
+                block->frames = framesRead;
+                input.Push();
+                samplePos += framesRead;
+            }
+        } catch (...) {
+            readError = std::current_exception();
+        }
+        input.Close();
+    });
+
+    std::thread writer;
+    if (fileOutput)
+        writer = std::thread([&] {
+            while (const auto block = output.Front()) {
+                fileOutput->Write(&block->samples[0], block->frames);
+                output.Pop();
+            }
+        });
+
+    // However the reducing ends, the other stages stop and are joined
+    auto joinStages = finally([&] {
+        input.Cancel();
+        output.Close();
+        reader.join();
+        if (writer.joinable())
+            writer.join();
+    });
+
+    // Hands len samples of channel cc in buffer to its Worker, through its
+    // resampler if any; last drains the resampler
+    auto feed = [&](size_t cc, float *buffer, size_t len, bool last) {
+        auto &worker = *workers[cc];
+        if (resamplers.empty())
+            worker.ProcessStream(*mStatistics, outputs[cc].get(), len, buffer);
+        else
+            resamplers[cc]->Process(buffer, len, last, [&](const float *samples, size_t count) {
+                worker.ProcessStream(*mStatistics, outputs[cc].get(), count, samples);
+            });
+    };
+
+    // Linked, every channel goes to the first Worker at once: as read, or
+    // resampled, gathered until every channel has them
+    std::vector<FloatVector> pending(linked && !resamplers.empty() ? channels : 0);
+    std::vector<const float *> channelSamples(channels);
+    std::vector<WorkerOutput *> channelOutputs(channels);
+    for (size_t cc = 0; cc < channels; ++cc)
+        channelOutputs[cc] = outputs[cc].get();
+    auto feedLinked = [&](ReadBlock *block, bool last) {
+        if (resamplers.empty()) {
+            for (size_t cc = 0; cc < channels; ++cc)
+                channelSamples[cc] = &block->channels[cc][0];
+            workers[0]->ProcessLinkedStream(*mStatistics, channelOutputs.data(), block->frames,
+                                            channelSamples.data());
+            return;
+        }
+        size_t count = SIZE_MAX;
+        for (size_t cc = 0; cc < channels; ++cc) {
+            auto &samples = pending[cc];
+            resamplers[cc]->Process(block ? &block->channels[cc][0] : nullptr, block ? block->frames : 0, last,
+                                    [&](const float *resampled, size_t len) {
+                                        samples.insert(samples.end(), resampled, resampled + len);
+                                    });
+            count = std::min(count, samples.size());
+        }
+        if (count == 0)
+            return;
+        for (size_t cc = 0; cc < channels; ++cc)
+            channelSamples[cc] = &pending[cc][0];
+        workers[0]->ProcessLinkedStream(*mStatistics, channelOutputs.data(), count, channelSamples.data());
+        for (auto &samples : pending)
+            samples.erase(samples.begin(), samples.begin() + count);
+    };
+
+    // Passes on to the writer the frames that every channel has
+    auto handOn = [&] {
+        if (!fileOutput)
+            return;
+        for (;;) {
+            const auto block = output.Back();
+            block->frames = fileOutput->Take(outputs, block->samples);
+            if (block->frames == 0)
+                break;
+            output.Push();
+        }
+    };
+
+    while (const auto block = input.Front()) {
+        if (linked)
+            feedLinked(block, false);
+        else
+            ForEachInParallel(channels, [&](size_t cc) {
+                feed(cc, &block->channels[cc][0], block->frames, false);
+            });
+        const auto frames = block->frames;
+        input.Pop();
+        handOn();
+        // Cancelled, joinStages stops the reader and the writer
+        if (progress && !progress->Advance((double) frames))
+            return Fail(Error::Cancelled);
+    }
+    if (readError)
+        std::rethrow_exception(readError);
+
+    if (!resamplers.empty()) {
+        if (linked)
+            feedLinked(nullptr, true);
+        else
+            ForEachInParallel(channels, [&](size_t cc) {
+                feed(cc, nullptr, 0, true);
+            });
+        if (fileOutput)
+            fileOutput->SetLimit(resamplers[0]->GetGenerated());
+    }
+    if (mSettings->mDoProfile) {
+        if (!FinishChannelStatistics(workers, channelStatistics))
+            return false;
+    } else if (linked)
+        workers[0]->FinishLinkedStream(*mStatistics, channelOutputs.data());
+    else
+        ForEachInParallel(channels, [&](size_t cc) {
+            workers[cc]->FinishStream(*mStatistics, outputs[cc].get());
+        });
+
+    if (fileOutput) {
+        handOn();
+        output.Close();
+        writer.join();
+        return fileOutput->Ok() || Fail(Error::File);
+    }
+    return true;
+}
+
+std::vector<std::unique_ptr<EffectNoiseReduction::Statistics>>
+EffectNoiseReduction::MakeChannelStatistics(const std::vector<std::unique_ptr<Worker>> &workers) const {
+    std::vector<std::unique_ptr<Statistics>> channelStatistics;
+    if (mSettings->mDoProfile)
+        for (const auto &worker : workers) {
+            channelStatistics.push_back(std::make_unique<Statistics>
+                    (mStatistics->mMeans.size(), mStatistics->mRate, mStatistics->mWindowTypes));
+            worker->GatherInto(*channelStatistics.back());
+        }
+    return channelStatistics;
+}
+
+bool EffectNoiseReduction::FinishChannelStatistics(const std::vector<std::unique_ptr<Worker>> &workers,
+                                                   std::vector<std::unique_ptr<Statistics>> &channelStatistics) {
+    // Fold in the channels' sums in order
+    for (size_t cc = 0; cc < workers.size(); ++cc) {
+        mNewStatistics->mSums.swap(channelStatistics[cc]->mSums);
+        mNewStatistics->mTrackWindows = channelStatistics[cc]->mTrackWindows;
+        workers[cc]->GatherInto(*mNewStatistics);
+        workers[cc]->FinishStream(*mStatistics, nullptr);
+    }
+    if (mNewStatistics->mTotalWindows == 0) {
+        std::cerr << "Selected noise profile is too short." << std::endl;
+        return Fail(Error::ProfileTooShort);
+    }
+    return true;
+}
+
+bool EffectNoiseReduction::GetProfileBuffer(const float *samples, size_t channels, size_t frames,
+                                            double rate, double noiseGain, double sensitivity,
+                                            double freqSmoothingBands) {
+    mLastError = Error::None;
+    mSettings->mDoProfile = true;
+    mSettings->mFreqSmoothingBands = freqSmoothingBands;
+    mSettings->mNoiseGain = noiseGain;
+    mSettings->mNewSensitivity = sensitivity;
+
+    if (channels < 1 || !StartProcess(rate))
+        return false;
+
+    bool bGoodResult = false;
+    if (frames > 0)
+        bGoodResult = ProcessBuffer(samples, channels, frames, rate, nullptr);
+    else {
+        std::cerr << "Selected noise profile is too short." << std::endl;
+        Fail(Error::ProfileTooShort);
+    }
+
+    EndProcess(bGoodResult);
+    return bGoodResult;
+}
+
+bool EffectNoiseReduction::ReduceNoiseBuffer(const float *in, float *out, size_t channels, size_t frames,
+                                             double rate, double noiseGain, double sensitivity,
+                                             double freqSmoothingBands) {
+    mLastError = Error::None;
+    mSettings->mDoProfile = false;
+    mSettings->mFreqSmoothingBands = freqSmoothingBands;
+    mSettings->mNoiseGain = noiseGain;
+    mSettings->mNewSensitivity = sensitivity;
+
+    if (channels < 1 || !StartProcess(rate))
+        return false;
+
+    bool bGoodResult = ProcessBuffer(in, channels, frames, rate, out);
+
+    EndProcess(bGoodResult);
+    return bGoodResult;
+}
+
+bool EffectNoiseReduction::ProcessBuffer(const float *in, size_t channels, size_t frames,
+                                         double rate, float *out) {
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (size_t cc = 0; cc < channels; ++cc) {
+        workers.push_back(MakeWorker());
+        if (!workers.back()->StartStream(rate))
+            return Fail(Error::SampleRate);
+    }
+    if (!LinkWorkers(workers))
+        return false;
+
+    if (workers[0]->IsLinked()) {
+        // Every channel's pieces go to the first Worker at once
+        std::vector<std::unique_ptr<ArrayOutput>> outputs(channels);
+        std::vector<WorkerOutput *> channelOutputs(channels);
+        if (out)
+            for (size_t cc = 0; cc < channels; ++cc) {
+                outputs[cc] = std::make_unique<ArrayOutput>(out + cc, channels, frames);
+                channelOutputs[cc] = outputs[cc].get();
+            }
+        const auto pieceSize = std::min(frames, streamBufferFrames);
+        FloatVector buffer(channels * pieceSize);
+        std::vector<const float *> channelSamples(channels);
+        for (size_t cc = 0; cc < channels; ++cc)
+            channelSamples[cc] = &buffer[cc * pieceSize];
+        for (size_t pos = 0; pos < frames; pos += pieceSize) {
+            const auto len = std::min(pieceSize, frames - pos);
+            for (size_t cc = 0; cc < channels; ++cc) {
+                const float *source = in + pos * channels + cc;
+                float *const dest = &buffer[cc * pieceSize];
+                for (size_t ii = 0; ii < len; ++ii)
+                    dest[ii] = source[ii * channels];
+            }
+            workers[0]->ProcessLinkedStream(*mStatistics, channelOutputs.data(), len, channelSamples.data());
+        }
+        workers[0]->FinishLinkedStream(*mStatistics, channelOutputs.data());
+        return true;
+    }
+
+    auto channelStatistics = MakeChannelStatistics(workers);
+
+    // Each channel reads and writes only its own samples, so the channels
+    // can share a buffer, and the Worker writes each sample out well after
+    // it has read it in, so out can be in
+    ForEachInParallel(channels, [&](size_t cc) {
+        auto &worker = *workers[cc];
+        const auto &statistics = *mStatistics;
+        std::unique_ptr<ArrayOutput> output;
+        if (out)
+            output = std::make_unique<ArrayOutput>(out + cc, channels, frames);
+
+        if (channels == 1)
+            worker.ProcessStream(statistics, output.get(), frames, in);
+        else {
+            // Gather the channel's samples a piece at a time
+            FloatVector buffer(std::min(frames, streamBufferFrames));
+            for (size_t pos = 0; pos < frames; pos += buffer.size()) {
+                const auto len = std::min(buffer.size(), frames - pos);
+                const float *source = in + pos * channels + cc;
+                for (size_t ii = 0; ii < len; ++ii)
+                    buffer[ii] = source[ii * channels];
+                worker.ProcessStream(statistics, output.get(), len, &buffer[0]);
+            }
+        }
+
+        if (!mSettings->mDoProfile)
+            worker.FinishStream(statistics, output.get());
+    });
+
+    if (mSettings->mDoProfile)
+        return FinishChannelStatistics(workers, channelStatistics);
+    return true;
+}
+
+bool EffectNoiseReduction::PreviewNoise(const std::string &srcPath, unsigned decimation,
+                                        double sensitivity, NoisePreview &result, bool keepMasks) {
+    mLastError = Error::None;
+    result = NoisePreview{0.0, {}, {}, 0};
+    if (!mStatistics) {
+        std::cerr << "A noise profile must be taken before previewing noise." << std::endl;
+        return Fail(Error::NoProfile);
+    }
+    if (mStatistics->mWindowSize != mSettings->WindowSize()) {
+        // possible only with advanced settings
+        std::cerr << "You must specify the same window size for steps 1 and 2." << std::endl;
+        return Fail(Error::Settings);
+    }
+    if (!mStatistics->Covers(mSettings->mF0, mSettings->mF1)) {
+        std::cerr << "The frequency range must be within that of the noise profile." << std::endl;
+        return Fail(Error::Settings);
+    }
+
+    int shift = 0;
+    while (shift < 32 && (1u << shift) < decimation)
+        ++shift;
+    if (decimation == 0 || (1u << shift) != decimation) {
+        std::cerr << "The decimation must be a power of two." << std::endl;
+        return Fail(Error::Settings);
+    }
+
+    // The same steps with windows decimation times shorter, so each step
+    // still spans the same time and the step fractions line up with the
+    // steps of reduction
+    Settings settings(*mSettings);
+    settings.mDoProfile = false;
+    settings.mDoAnalysis = true;
+    settings.mNewSensitivity = sensitivity;
+    settings.mWindowSizeChoice -= shift;
+    if (!settings.Validate(this))
+        return Fail(Error::Settings);
+
+    // Band k of the shorter window is at the frequency it was.  Band limited
+    // to the lower rate, noise of the same density has decimation times less
+    // power per sample, over decimation times fewer samples.
+    const size_t spectrumSize = 1 + settings.WindowSize() / 2;
+    const double rate = mStatistics->mRate / decimation;
+    Statistics statistics(spectrumSize, rate, mStatistics->mWindowTypes);
+    statistics.mTotalWindows = mStatistics->mTotalWindows;
+    const double scale = 1.0 / ((double) decimation * decimation);
+    for (size_t ii = 0; ii < spectrumSize; ++ii)
+        statistics.mMeans[ii] = mStatistics->mMeans[ii] * scale;
+#ifdef OLD_METHOD_AVAILABLE
+    for (size_t ii = 0; ii < spectrumSize; ++ii)
+        statistics.mNoiseThreshold[ii] = mStatistics->mNoiseThreshold[ii] * scale;
+#endif
+
+    SF_INFO info;
+    SFFile file = OpenSoundFile(srcPath, info);
+    if (!file || info.channels < 1)
+        return Fail(Error::File);
+    const auto channels = (size_t) info.channels;
+
+    // Decimated, and with SetResampling() brought to the profile's rate, in
+    // one conversion
+    const double workerRate = mSettings->mResample ? rate : info.samplerate / (double) decimation;
+    const double factor = workerRate / info.samplerate;
+    const size_t bands = factor == 1.0
+                         ? spectrumSize
+                         : std::max<size_t>(1, (spectrumSize - 1) * 9 / 10);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::unique_ptr<NoiseFractionOutput>> outputs;
+    std::vector<std::unique_ptr<StreamResampler>> resamplers;
+    for (size_t cc = 0; cc < channels; ++cc) {
+        workers.push_back(std::make_unique<Worker>(settings, rate));
+        // The rate of the file is checked here, at the lower rate
+        if (!workers.back()->StartStream(workerRate))
+            return Fail(Error::SampleRate);
+        outputs.push_back(std::make_unique<NoiseFractionOutput>(bands, keepMasks));
+        if (factor != 1.0)
+            resamplers.push_back(std::make_unique<StreamResampler>(false, factor, mSettings->mResampleOptions));
+    }
+
+    FloatVector interleaved(streamBufferFrames * channels);
+    std::vector<FloatVector> buffers(channels, FloatVector(streamBufferFrames));
+    std::vector<float *> buffersPtrs(channels);
+    for (size_t cc = 0; cc < channels; ++cc)
+        buffersPtrs[cc] = &buffers[cc][0];
+
+    // Feeds len samples of channel cc through its resampler, if any, to its
+    // Worker; last drains the resampler
+    auto feed = [&](size_t cc, size_t len, bool last) {
+        auto &worker = *workers[cc];
+        if (resamplers.empty())
+            worker.ProcessStream(statistics, outputs[cc].get(), len, &buffers[cc][0]);
+        else
+            resamplers[cc]->Process(&buffers[cc][0], len, last, [&](const float *samples, size_t count) {
+                worker.ProcessStream(statistics, outputs[cc].get(), count, samples);
+            });
+    };
+
+    for (;;) {
+        const auto framesRead = SFCall<sf_count_t>(sf_readf_float, file.get(), &interleaved[0],
+                                                   streamBufferFrames);
+        if (framesRead <= 0)
+            break;
+        NR_COUNT(BytesRead, framesRead * channels * sizeof(float));
+        DeinterleaveSamples(&interleaved[0], channels, &buffersPtrs[0], framesRead);
+        ForEachInParallel(channels, [&](size_t cc) {
+            feed(cc, framesRead, false);
+        });
+    }
+
+    ForEachInParallel(channels, [&](size_t cc) {
+        feed(cc, 0, true);
+        workers[cc]->FinishStream(statistics, outputs[cc].get());
+    });
+
+    double sum = 0;
+    size_t steps = 0;
+    for (auto &output : outputs) {
+        sum = std::accumulate(output->mFractions.begin(), output->mFractions.end(), sum);
+        steps += output->mFractions.size();
+        result.stepFractions.emplace_back(std::move(output->mFractions));
+        if (keepMasks)
+            result.stepMasks.emplace_back(std::move(output->mMasks));
+    }
+    result.bands = bands;
+    result.noiseFraction = steps > 0 ? sum / steps : 0.0;
+    return true;
+}
+
+bool EffectNoiseReduction::MergeProfile(const EffectNoiseReduction &other) {
+    mLastError = Error::None;
+    if (!other.mStatistics) {
+        std::cerr << "A noise profile must be taken before it can be merged." << std::endl;
+        return Fail(Error::NoProfile);
+    }
+    const auto &theirs = *other.mStatistics;
+    if (!mStatistics) {
+        mStatistics = other.mStatistics;
+        mSettings->mDoProfile = false;
+        return true;
+    }
+
+    // Merged into a copy, as the profile may be shared
+    auto merged = std::make_shared<Statistics>(*mStatistics);
+    auto &ours = *merged;
+    if (ours.mRate != theirs.mRate) {
+        std::cerr << "All noise profile data must have the same sample rate." << std::endl;
+        return Fail(Error::SampleRate);
+    }
+    if (ours.mWindowSize != theirs.mWindowSize || ours.mWindowTypes != theirs.mWindowTypes ||
+        ours.mF0 != theirs.mF0 || ours.mF1 != theirs.mF1) {
+        std::cerr << "Noise profiles must have the same window size, types and frequency range to be merged."
+                  << std::endl;
+        return Fail(Error::Settings);
+    }
+
+    // Each mean weighted by its windows, as FinishTrackStatistics() combines
+    // profile tracks
+    const double ourWindows = ours.mTotalWindows;
+    const double theirWindows = theirs.mTotalWindows;
+    for (size_t ii = 0, nn = ours.mMeans.size(); ii < nn; ++ii)
+        ours.mMeans[ii] = (ours.mMeans[ii] * ourWindows + theirs.mMeans[ii] * theirWindows)
+                          / (ourWindows + theirWindows);
+#ifdef OLD_METHOD_AVAILABLE
+    for (size_t ii = 0, nn = ours.mNoiseThreshold.size(); ii < nn; ++ii)
+        ours.mNoiseThreshold[ii] = std::max(ours.mNoiseThreshold[ii], theirs.mNoiseThreshold[ii]);
+#endif
+    ours.mTotalWindows += theirs.mTotalWindows;
+    mStatistics = std::move(merged);
+    mSettings->mDoProfile = false;
+    return true;
+}
+
+bool EffectNoiseReduction::GetProfileSegments(const std::vector<ProfileSegment> &segments,
+                                              unsigned numThreads) {
+    mLastError = Error::None;
+    if (segments.empty()) {
+        std::cerr << "Selected noise profile is too short." << std::endl;
+        return Fail(Error::ProfileTooShort);
+    }
+
+    if (numThreads == 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    numThreads = std::min<size_t>(numThreads, segments.size());
+
+    // Each segment is profiled by an effect of its own with these settings,
+    // taking the next segment not yet claimed as ReduceNoiseBatch() does
+    std::vector<std::unique_ptr<EffectNoiseReduction>> parts(segments.size());
+    std::atomic<size_t> next{0};
+    ForEachInParallel(numThreads, [&](size_t) {
+        for (size_t ii; (ii = next++) < segments.size();) {
+            auto part = std::make_unique<EffectNoiseReduction>();
+            *part->mSettings = *mSettings;
+            try {
+                part->GetProfileStreaming(segments[ii].path, segments[ii].t0, segments[ii].t1,
+                                          mSettings->mNoiseGain, mSettings->mNewSensitivity,
+                                          mSettings->mFreqSmoothingBands);
+            } catch (const std::exception &e) {
+                std::cerr << segments[ii].path << ": " << e.what() << std::endl;
+                // As ReduceNoiseBatch() counts a file it cannot read
+                part->Fail(Error::File);
+            }
+            parts[ii] = std::move(part);
+        }
+    });
+
+    // Merged in order, so the rounding does not depend on the threads
+    mStatistics.reset();
+    for (const auto &part : parts) {
+        if (!part->HasProfile()) {
+            mStatistics.reset();
+            return Fail(part->GetLastError());
+        }
+        // Keeping the error MergeProfile() gives a part it rejects
+        if (!MergeProfile(*part)) {
+            mStatistics.reset();
+            return false;
+        }
+    }
+    return true;
+}
+
+namespace {
+
+void WriteProfile(std::ostream &file, const EffectNoiseReduction::Statistics &statistics) {
+    ProfileHeader header;
+    memcpy(header.magic, profileMagic, sizeof(header.magic));
+    header.version = profileVersion;
+    header.rate = statistics.mRate;
+    header.windowSize = statistics.mWindowSize;
+    header.windowTypes = statistics.mWindowTypes;
+    header.totalWindows = statistics.mTotalWindows;
+    header.spectrumSize = statistics.mMeans.size();
+    header.f0 = statistics.mF0;
+    header.f1 = statistics.mF1;
+
+    file.write((const char *) &header, sizeof(header));
+    file.write((const char *) &statistics.mMeans[0], header.spectrumSize * sizeof(float));
+}
+
+// Null, with a message naming path, if file holds no valid profile
+std::unique_ptr<EffectNoiseReduction::Statistics> ReadProfile(std::istream &file, const std::string &path) {
+    ProfileHeader header;
+    if (!file.read((char *) &header, sizeof(header)) ||
+        memcmp(header.magic, profileMagic, sizeof(header.magic)) != 0) {
+        std::cerr << "Not a noise profile: " << path << std::endl;
+        return nullptr;
+    }
+    if (header.version != profileVersion ||
+        header.spectrumSize != 1 + header.windowSize / 2 ||
+        header.windowTypes < 0 || header.windowTypes >= WT_N_WINDOW_TYPES ||
+        header.totalWindows <= 0 || !(header.rate > 0) ||
+        std::isnan(header.f0) || std::isnan(header.f1) ||
+        (header.f0 >= 0.0 && header.f1 >= 0.0 && header.f0 >= header.f1)) {
+        std::cerr << "Unsupported or damaged noise profile: " << path << std::endl;
+        return nullptr;
+    }
+
+    auto statistics = std::make_unique<EffectNoiseReduction::Statistics>(
+            header.spectrumSize, header.rate, header.windowTypes);
+    statistics->mTotalWindows = header.totalWindows;
+    statistics->mF0 = header.f0;
+    statistics->mF1 = header.f1;
+    if (!file.read((char *) &statistics->mMeans[0], header.spectrumSize * sizeof(float))) {
+        std::cerr << "Unsupported or damaged noise profile: " << path << std::endl;
+        return nullptr;
+    }
+    return statistics;
+}
+
+// What a cached profile depends on besides the noise: all of it compared
+// bit for bit, so the padding is zeroed
+struct ProfileCacheKey {
+    uint64_t contentHash;
+    double t0;
+    double t1;
+    double f0;
+    double f1;
+    uint32_t windowSize;
+    uint32_t stepsPerWindow;
+    int32_t windowTypes;
+    uint32_t version;
+};
+
+inline uint64_t RotateLeft(uint64_t value, unsigned bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// MurmurHash3's 64 bit mixing
+inline uint64_t MixHash(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    return hash ^ (hash >> 33);
+}
+
+uint64_t HashBytes(uint64_t hash, const char *bytes, size_t len) {
+    size_t ii = 0;
+    for (; ii + sizeof(uint64_t) <= len; ii += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes + ii, sizeof word);
+        hash = RotateLeft(hash ^ RotateLeft(word * 0x87c37b91114253d5ull, 31) * 0x4cf5ad432745937full, 27)
+               * 5 + 0x52dce729;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, bytes + ii, len - ii);
+    return MixHash(hash ^ tail ^ len);
+}
+
+// The hash of the contents of the file at path; false if it can't be read
+bool HashFile(const std::string &path, uint64_t &hash) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    std::vector<char> buffer(1 << 20);
+    hash = 0;
+    while (file) {
+        file.read(buffer.data(), buffer.size());
+        hash = HashBytes(hash, buffer.data(), (size_t) file.gcount());
+    }
+    return file.eof();
+}
+
+class ProfileCache {
+public:
+    using Statistics = EffectNoiseReduction::Statistics;
+
+    bool Set(bool enable, const std::string &dir) {
+        if (enable && !dir.empty() && mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST) {
+            std::cerr << "Cannot make the profile cache directory " << dir << std::endl;
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mMutex);
+        mEnabled = enable;
+        mDir = enable ? dir : std::string{};
+        return true;
+    }
+
+    void Clear() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mHashes.clear();
+        mProfiles.clear();
+    }
+
+    bool Enabled() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mEnabled;
+    }
+
+    // False if the file can't be read
+    bool MakeKey(const std::string &path, double t0, double t1,
+                 const EffectNoiseReduction::Settings &settings, ProfileCacheKey &key);
+
+    std::unique_ptr<Statistics> Find(const ProfileCacheKey &key);
+
+    void Store(const ProfileCacheKey &key, const Statistics &statistics);
+
+private:
+    static std::string KeyBytes(const ProfileCacheKey &key) {
+        return std::string((const char *) &key, sizeof key);
+    }
+
+    std::string FilePath(const ProfileCacheKey &key) const {
+        char name[32];
+        snprintf(name, sizeof name, "%016llx.nrprofile",
+                 (unsigned long long) HashBytes(0, (const char *) &key, sizeof key));
+        return mDir + "/" + name;
+    }
+
+    // A file's hash stays good while its size and times do
+    struct FileHash {
+        struct stat status;
+        uint64_t hash;
+    };
+
+    std::mutex mMutex;
+    bool mEnabled{false};
+    std::string mDir;
+    std::map<std::string, FileHash> mHashes;
+    std::map<std::string, std::shared_ptr<const Statistics>> mProfiles;
+};
+
+bool ProfileCache::MakeKey(const std::string &path, double t0, double t1,
+                           const EffectNoiseReduction::Settings &settings, ProfileCacheKey &key) {
+    struct stat status;
+    if (stat(path.c_str(), &status) != 0)
+        return false;
+    auto unchanged = [&status](const struct stat &old) {
+        return old.st_dev == status.st_dev && old.st_ino == status.st_ino &&
+               old.st_size == status.st_size &&
+               old.st_mtim.tv_sec == status.st_mtim.tv_sec && old.st_mtim.tv_nsec == status.st_mtim.tv_nsec &&
+               old.st_ctim.tv_sec == status.st_ctim.tv_sec && old.st_ctim.tv_nsec == status.st_ctim.tv_nsec;
+    };
+
+    memset(&key, 0, sizeof key);
+    std::unique_lock<std::mutex> lock(mMutex);
+    const auto found = mHashes.find(path);
+    if (found != mHashes.end() && unchanged(found->second.status))
+        key.contentHash = found->second.hash;
+    else {
+        // Without the lock: other profiles needn't wait for this file
+        lock.unlock();
+        if (!HashFile(path, key.contentHash))
+            return false;
+        lock.lock();
+        mHashes[path] = FileHash{status, key.contentHash};
+    }
+
+    key.t0 = t0;
+    key.t1 = t1;
+    key.f0 = settings.mF0;
+    key.f1 = settings.mF1;
+    key.windowSize = settings.WindowSize();
+    key.stepsPerWindow = settings.StepsPerWindow();
+    key.windowTypes = settings.mWindowTypes;
+    key.version = profileVersion;
+    return true;
+}
+
+auto ProfileCache::Find(const ProfileCacheKey &key) -> std::unique_ptr<Statistics> {
+    std::lock_guard<std::mutex> lock(mMutex);
+    const auto found = mProfiles.find(KeyBytes(key));
+    if (found != mProfiles.end())
+        return std::make_unique<Statistics>(*found->second);
+    if (mDir.empty())
+        return nullptr;
+
+    // Another process may have taken it
+    const auto path = FilePath(key);
+    std::ifstream file(path, std::ios::binary);
+    ProfileCacheKey fileKey;
+    if (!file.read((char *) &fileKey, sizeof fileKey) || memcmp(&fileKey, &key, sizeof key) != 0)
+        return nullptr;
+    auto statistics = ReadProfile(file, path);
+    if (statistics)
+        mProfiles[KeyBytes(key)] = std::make_shared<const Statistics>(*statistics);
+    return statistics;
+}
+
+void ProfileCache::Store(const ProfileCacheKey &key, const Statistics &statistics) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mProfiles[KeyBytes(key)] = std::make_shared<const Statistics>(statistics);
+    if (mDir.empty())
+        return;
+
+    // Written aside and renamed into place, so that other processes read
+    // a whole profile or none
+    const auto path = FilePath(key);
+    const auto temp = path + "." + std::to_string(getpid()) + ".tmp";
+    std::ofstream file(temp, std::ios::binary);
+    file.write((const char *) &key, sizeof key);
+    WriteProfile(file, statistics);
+    file.close();
+    if (!file || rename(temp.c_str(), path.c_str()) != 0) {
+        std::cerr << "Could not write noise profile " << path << std::endl;
+        remove(temp.c_str());
+    }
+}
+
+ProfileCache &TheProfileCache() {
+    static ProfileCache cache;
+    return cache;
+}
+
+} // namespace
+
+bool EffectNoiseReduction::SaveProfile(const std::string &path) const {
+    mLastError = Error::None;
+    if (!mStatistics) {
+        std::cerr << "A noise profile must be taken before it can be saved." << std::endl;
+        return Fail(Error::NoProfile);
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    WriteProfile(file, *mStatistics);
+    file.close();
+    if (!file) {
+        std::cerr << "Could not write noise profile " << path << std::endl;
+        return Fail(Error::File);
+    }
+    return true;
+}
+
+bool EffectNoiseReduction::LoadProfile(const std::string &path) {
+    mLastError = Error::None;
+    std::ifstream file(path, std::ios::binary);
+    auto statistics = ReadProfile(file, path);
+    if (!statistics)
+        return Fail(Error::File);
+
+    mStatistics = std::move(statistics);
+    mSettings->mDoProfile = false;
+    return true;
+}
+
+std::unique_ptr<EffectNoiseReduction> EffectNoiseReduction::MakeReducer(double noiseGain, double sensitivity,
+                                                                        double freqSmoothingBands) const {
+    auto effect = std::make_unique<EffectNoiseReduction>();
+    *effect->mSettings = *mSettings;
+    effect->mSettings->mDoProfile = false;
+    effect->mSettings->mFreqSmoothingBands = freqSmoothingBands;
+    effect->mSettings->mNoiseGain = noiseGain;
+    effect->mSettings->mNewSensitivity = sensitivity;
+    effect->mStatistics = mStatistics;
+    return effect;
+}
+
+std::shared_ptr<const EffectNoiseReduction::Statistics> EffectNoiseReduction::ShareProfile() const {
+    return mStatistics;
+}
+
+void EffectNoiseReduction::UseProfile(std::shared_ptr<const Statistics> profile) {
+    mStatistics = std::move(profile);
+    mSettings->mDoProfile = false;
+}
+
+bool EffectNoiseReduction::SetProfileCache(bool enable, const std::string &dir) {
+    return TheProfileCache().Set(enable, dir);
+}
+
+void EffectNoiseReduction::ClearProfileCache() {
+    TheProfileCache().Clear();
+}
+
+bool EffectNoiseReduction::GetProfileCached(const std::string &path, double t0, double t1,
+                                            double noiseGain, double sensitivity,
+                                            double freqSmoothingBands) {
+    auto &cache = TheProfileCache();
+    ProfileCacheKey key;
+    if (!cache.Enabled() || !cache.MakeKey(path, t0, t1, *mSettings, key))
+        return GetProfileStreaming(path, t0, t1, noiseGain, sensitivity, freqSmoothingBands);
+
+    if (auto statistics = cache.Find(key)) {
+        mLastError = Error::None;
+        mSettings->mFreqSmoothingBands = freqSmoothingBands;
+        mSettings->mNoiseGain = noiseGain;
+        mSettings->mNewSensitivity = sensitivity;
+        if (!mSettings->Validate(this))
+            return Fail(Error::Settings);
+        mT0 = t0;
+        mT1 = t1;
+        mStatistics = std::move(statistics);
+        mSettings->mDoProfile = false;
+        return true;
+    }
+
+    if (!GetProfileStreaming(path, t0, t1, noiseGain, sensitivity, freqSmoothingBands))
+        return false;
+    cache.Store(key, *mStatistics);
+    return true;
+}
+
+std::unique_ptr<EffectNoiseReduction::Worker> EffectNoiseReduction::MakeWorker() const {
+    return std::make_unique<Worker>(*mSettings, mStatistics->mRate);
+}
+
+bool EffectNoiseReduction::LinkWorkers(const std::vector<std::unique_ptr<Worker>> &workers) const {
+    const auto link = mSettings->mChannelLink;
+    if (mSettings->mDoProfile || mSettings->mDoAnalysis || link == ChannelLink::None || workers.size() < 2)
+        return true;
+    if (link == ChannelLink::MidSide && workers.size() != 2) {
+        std::cerr << "Mid/side linking needs two channels." << std::endl;
+        return Fail(Error::Settings);
+    }
+
+    std::vector<Worker *> others;
+    for (size_t cc = 1; cc < workers.size(); ++cc)
+        others.push_back(workers[cc].get());
+    workers[0]->Link(others, link);
+    return true;
+}
+
+bool EffectNoiseReduction::StartProcess(double rate) {
+    if (!mSettings->Validate(this))
+        return Fail(Error::Settings);
+
     // Initialize statistics if gathering them, or check for mismatched (advanced)
     // settings if reducing noise.
     if (mSettings->mDoProfile) {
         size_t spectrumSize = 1 + mSettings->WindowSize() / 2;
-        mStatistics = std::make_unique<Statistics>
-                (spectrumSize, track->GetRate(), mSettings->mWindowTypes);
+        auto statistics = std::make_shared<Statistics>
+                (spectrumSize, rate, mSettings->mWindowTypes);
+        statistics->mF0 = mSettings->mF0;
+        statistics->mF1 = mSettings->mF1;
+        mNewStatistics = statistics.get();
+        mStatistics = std::move(statistics);
+    } else if (!mStatistics) {
+        std::cerr << "A noise profile must be taken before reducing noise." << std::endl;
+        return Fail(Error::NoProfile);
     } else if (mStatistics->mWindowSize != mSettings->WindowSize()) {
         // possible only with advanced settings
         std::cerr << "You must specify the same window size for steps 1 and 2." << std::endl;
-        return false;
+        return Fail(Error::Settings);
+    } else if (!mStatistics->Covers(mSettings->mF0, mSettings->mF1)) {
+        std::cerr << "The frequency range must be within that of the noise profile." << std::endl;
+        return Fail(Error::Settings);
     } else if (mStatistics->mWindowTypes != mSettings->mWindowTypes) {
         // A warning only
         std::cerr << "Warning: window types are not the same as for profiling." << std::endl;
     }
 
-    Worker worker(*mSettings, mStatistics->mRate
-#ifdef EXPERIMENTAL_SPECTRAL_EDITING
-            , mF0, mF1
-#endif
-    );
-    bool bGoodResult = worker.Process(*this, track, *mStatistics, *mFactory, mT0, mT1);
+    return true;
+}
+
+void EffectNoiseReduction::EndProcess(bool bGoodResult) {
     if (mSettings->mDoProfile) {
         if (bGoodResult)
             mSettings->mDoProfile = false; // So that "repeat last effect" will reduce noise
         else
             mStatistics.reset(); // So that profiling must be done again before noise reduction
+        mNewStatistics = nullptr;
+    }
+}
+
+bool EffectNoiseReduction::Process(WaveTrack *track) {
+    return Process(std::vector<WaveTrack *>{track});
+}
+
+bool EffectNoiseReduction::Process(const std::vector<WaveTrack *> &tracks) {
+    if (tracks.empty() || !StartProcess(tracks[0]->GetRate()))
+        return false;
+
+    if (mSettings->mProgress) {
+        double total = 0.0;
+        for (auto track : tracks) {
+            const double t0 = std::max(track->GetStartTime(), mT0);
+            const double t1 = std::min(track->GetEndTime(), mT1);
+            if (t1 > t0)
+                total += (track->TimeToLongSamples(t1) - track->TimeToLongSamples(t0)).as_double();
+        }
+        mSettings->mProgress->Begin(total);
+    }
+
+    bool bGoodResult = true;
+    if (mSettings->mDoProfile) {
+        // All channels add to the one profile, in turn
+        auto worker = MakeWorker();
+        worker->GatherInto(*mNewStatistics);
+        for (auto track : tracks)
+            if (!worker->Process(*this, track, *mStatistics, *mFactory, mT0, mT1)) {
+                bGoodResult = false;
+                break;
+            }
+    } else {
+        // In place, to the rate of the profile, with SetResampling()
+        ForEachInParallel(tracks.size(), [&](size_t ii) {
+            if (WorkerRate(tracks[ii]->GetRate()) != tracks[ii]->GetRate())
+                tracks[ii]->Resample((int) WorkerRate(tracks[ii]->GetRate()), mSettings->mResampleOptions);
+        });
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        for (size_t ii = 0; ii < tracks.size(); ++ii)
+            workers.push_back(MakeWorker());
+
+        if (!LinkWorkers(workers))
+            bGoodResult = false;
+        else if (workers[0]->IsLinked())
+            // The channels in step on this thread, classified as one
+            bGoodResult = workers[0]->ProcessLinked(*this, tracks, *mStatistics, *mFactory, mT0, mT1);
+        else {
+            std::vector<char> results(tracks.size(), false);
+            ForEachInParallel(tracks.size(), [&](size_t ii) {
+                results[ii] = workers[ii]->Process(*this, tracks[ii], *mStatistics, *mFactory, mT0, mT1);
+            });
+            bGoodResult = std::all_of(results.begin(), results.end(), [](char result) { return result; });
+        }
     }
+    EndProcess(bGoodResult);
 
     return bGoodResult;
 }
 
-EffectNoiseReduction::Worker::~Worker() {
+//----------------------------------------------------------------------------
+// NoiseReducer
+//----------------------------------------------------------------------------
+
+// The Worker's output, waiting to be handed back by Process()
+class NoiseReducer::Queue final : public WorkerOutput {
+public:
+    explicit Queue(size_t capacity)
+            : mBuffer(capacity), mFirst(0), mLen(0) {}
+
+    void Append(float *buffer, size_t len) override {
+        assert(mLen + len <= mBuffer.size());
+        while (len > 0) {
+            const auto end = (mFirst + mLen) % mBuffer.size();
+            const auto avail = std::min(len, mBuffer.size() - end);
+            memcpy(&mBuffer[end], buffer, avail * sizeof(float));
+            mLen += avail;
+            buffer += avail;
+            len -= avail;
+        }
+    }
+
+    void Take(float *buffer, size_t len) {
+        assert(len <= mLen);
+        while (len > 0) {
+            const auto avail = std::min(len, mBuffer.size() - mFirst);
+            memcpy(buffer, &mBuffer[mFirst], avail * sizeof(float));
+            mFirst = (mFirst + avail) % mBuffer.size();
+            mLen -= avail;
+            buffer += avail;
+            len -= avail;
+        }
+    }
+
+    // Starts over holding len zeros
+    void Reset(size_t len) {
+        std::fill(mBuffer.begin(), mBuffer.begin() + len, 0.0f);
+        mFirst = 0;
+        mLen = len;
+    }
+
+private:
+    FloatVector mBuffer;
+    size_t mFirst;
+    size_t mLen;
+};
+
+std::unique_ptr<NoiseReducer> NoiseReducer::Create(const EffectNoiseReduction &effect, double rate,
+                                                   double noiseGain, double sensitivity,
+                                                   double freqSmoothingBands) {
+    if (!effect.mStatistics) {
+        std::cerr << "A noise profile must be taken before reducing noise." << std::endl;
+        return nullptr;
+    }
+    if (effect.mStatistics->mWindowSize != effect.mSettings->WindowSize()) {
+        // possible only with advanced settings
+        std::cerr << "You must specify the same window size for steps 1 and 2." << std::endl;
+        return nullptr;
+    }
+    if (rate != effect.mStatistics->mRate) {
+        std::cerr << "The sample rate of the noise profile must match that of the sound to be processed."
+                  << std::endl;
+        return nullptr;
+    }
+    if (!effect.mStatistics->Covers(effect.mSettings->mF0, effect.mSettings->mF1)) {
+        std::cerr << "The frequency range must be within that of the noise profile." << std::endl;
+        return nullptr;
+    }
+
+    auto settings = std::make_unique<EffectNoiseReduction::Settings>(*effect.mSettings);
+    settings->mDoProfile = false;
+    settings->mFreqSmoothingBands = freqSmoothingBands;
+    settings->mNoiseGain = noiseGain;
+    settings->mNewSensitivity = sensitivity;
+    return std::unique_ptr<NoiseReducer>(new NoiseReducer(std::move(settings), effect.mStatistics));
 }
 
-bool EffectNoiseReduction::Worker::Process
-        (EffectNoiseReduction &effect, WaveTrack *track, Statistics &statistics,
-         TrackFactory &factory, double inT0, double inT1) {
-    int count = 0;
-    if (track->GetRate() != mSampleRate) {
-        if (mDoProfile)
-            std::cerr << "All noise profile data must have the same sample rate." << std::endl;
-        else
-            std::cerr << "The sample rate of the noise profile must match that of the sound to be processed."
-                      << std::endl;
-        return false;
+NoiseReducer::NoiseReducer(std::unique_ptr<EffectNoiseReduction::Settings> settings,
+                           std::shared_ptr<const EffectNoiseReduction::Statistics> statistics)
+        : mSettings(std::move(settings)), mStatistics(std::move(statistics)) {
+    mWorker = std::make_unique<EffectNoiseReduction::Worker>(*mSettings, mStatistics->mRate);
+
+    // After n samples in, the Worker has given whole steps of output for
+    // all but the delay steps' worth and what is short of a step
+    const auto stepSize = mWorker->GetStepSize();
+    mLatency = (mWorker->GetDelaySteps() + 1) * stepSize - 1;
+    // Process() feeds at most a step at a time, and so gets at most a step
+    // back before taking as much as it fed; Flush() takes less than a step
+    // more than was fed
+    mQueue = std::make_unique<Queue>(mLatency + stepSize);
+    Start();
+}
+
+NoiseReducer::~NoiseReducer() {
+}
+
+void NoiseReducer::Start() {
+    mWorker->StartStream(mStatistics->mRate);
+    mQueue->Reset(mLatency);
+}
+
+void NoiseReducer::Process(const float *in, float *out, size_t len) {
+    const auto stepSize = mWorker->GetStepSize();
+    while (len > 0) {
+        // The Worker copies in before out is written, so they may overlap
+        const auto block = std::min(len, stepSize);
+        mWorker->ProcessStream(*mStatistics, mQueue.get(), block, in);
+        mQueue->Take(out, block);
+        in += block;
+        out += block;
+        len -= block;
     }
+}
+
+void NoiseReducer::Flush(float *out) {
+    mWorker->FinishStream(*mStatistics, mQueue.get());
+    mQueue->Take(out, mLatency);
+    Start();
+}
+
+EffectNoiseReduction::Worker::~Worker() {
+}
+
+bool EffectNoiseReduction::Worker::Process
+        (EffectNoiseReduction &effect, WaveTrack *track, const Statistics &statistics,
+         TrackFactory &factory, double inT0, double inT1) {
+    int count = 0;
+    if (!CheckRate(track->GetRate()))
+        return effect.Fail(Error::SampleRate);
 
     double trackStart = track->GetStartTime();
     double trackEnd = track->GetEndTime();
@@ -536,23 +2831,131 @@ bool EffectNoiseReduction::Worker::Process
         auto end = track->TimeToLongSamples(t1);
         auto len = end - start;
 
-        if (!ProcessOne(effect, statistics, factory,
-                        count, track, start, len))
+        if (!mDoProfile && effect.mRanges)
+            ProcessRanges(statistics, factory, track, start, len, *effect.mRanges);
+        else if (!ProcessOne(effect, statistics, factory,
+                             count, track, start, len))
             return false;
+        if (mSettings.Cancelled())
+            return effect.Fail(Error::Cancelled);
     }
     ++count;
 
     if (mDoProfile) {
-        if (statistics.mTotalWindows == 0) {
+        if (mGathering->mTotalWindows == 0) {
             std::cerr << "Selected noise profile is too short." << std::endl;
-            return false;
+            return effect.Fail(Error::ProfileTooShort);
         }
     }
 
     return true;
 }
 
-void EffectNoiseReduction::Worker::ApplyFreqSmoothing(FloatVector &gains) {
+bool EffectNoiseReduction::Worker::CheckRate(double rate) const {
+    if (rate != mSampleRate) {
+        if (mDoProfile)
+            std::cerr << "All noise profile data must have the same sample rate." << std::endl;
+        else
+            std::cerr << "The sample rate of the noise profile must match that of the sound to be processed."
+                      << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool EffectNoiseReduction::Worker::StartStream(double rate) {
+    if (!CheckRate(rate))
+        return false;
+
+    StartNewTrack();
+    return true;
+}
+
+void EffectNoiseReduction::Worker::ProcessStream
+        (const Statistics &statistics, WorkerOutput *output, size_t len, const float *buffer) {
+    mInSampleCount += len;
+    ProcessSamples(statistics, &output, len, &buffer);
+}
+
+void EffectNoiseReduction::Worker::FinishStream(const Statistics &statistics, WorkerOutput *output) {
+    if (mDoProfile)
+        FinishTrackStatistics(*mGathering);
+    else
+        FinishTrack(statistics, &output);
+}
+
+void EffectNoiseReduction::Worker::Link(const std::vector<Worker *> &others, ChannelLink link) {
+    assert(!mDoProfile && !mDoAnalysis);
+    mLinked = others;
+    mChannelLink = link;
+    mEmptySteps.assign(1 + mLinked.size(), &mEmptyStep[0]);
+}
+
+void EffectNoiseReduction::Worker::ProcessLinkedStream
+        (const Statistics &statistics, WorkerOutput *const *outputs, size_t len, const float *const *buffers) {
+    mInSampleCount += len;
+    ProcessSamples(statistics, outputs, len, buffers);
+}
+
+void EffectNoiseReduction::Worker::FinishLinkedStream(const Statistics &statistics, WorkerOutput *const *outputs) {
+    FinishTrack(statistics, outputs);
+}
+
+void EffectNoiseReduction::Worker::CombineLinkedSpectra() {
+    // Only the bands of the frequency range have power
+    float *const power = mHistory->Spectrums(0);
+    const int low = mBinLow, high = mBinHigh;
+    switch (mChannelLink) {
+        case ChannelLink::Max:
+            for (auto worker : mLinked) {
+                const float *const other = worker->mHistory->Spectrums(0);
+                for (int jj = low; jj < high; ++jj)
+                    power[jj] = std::max(power[jj], other[jj]);
+            }
+            break;
+        case ChannelLink::Mean: {
+            for (auto worker : mLinked) {
+                const float *const other = worker->mHistory->Spectrums(0);
+                for (int jj = low; jj < high; ++jj)
+                    power[jj] += other[jj];
+            }
+            const float scale = 1.0f / (1 + mLinked.size());
+            for (int jj = low; jj < high; ++jj)
+                power[jj] *= scale;
+            break;
+        }
+        case ChannelLink::MidSide: {
+            // From the parts, which the newest window still has unpacked.
+            // Halved, the power of the sum and of the difference of noise
+            // uncorrelated between the channels is that of either channel.
+            assert(mLinked.size() == 1);
+            auto &other = *mLinked[0]->mHistory;
+            const float *const leftReal = mHistory->NewRealFFTs();
+            const float *const leftImag = mHistory->NewImagFFTs();
+            const float *const rightReal = other.NewRealFFTs();
+            const float *const rightImag = other.NewImagFFTs();
+            auto midSide = [](float left, float right, float leftImag, float rightImag) {
+                const float midReal = left + right, midImag = leftImag + rightImag;
+                const float sideReal = left - right, sideImag = leftImag - rightImag;
+                return 0.5f * std::max(midReal * midReal + midImag * midImag,
+                                       sideReal * sideReal + sideImag * sideImag);
+            };
+            const int last = mSpectrumSize - 1;
+            for (int jj = std::max(1, low); jj < std::min(last, high); ++jj)
+                power[jj] = midSide(leftReal[jj], rightReal[jj], leftImag[jj], rightImag[jj]);
+            // DC, and Fs/2 stored as the imaginary part of DC
+            if (low == 0 && high > 0)
+                power[0] = midSide(leftReal[0], rightReal[0], 0.0f, 0.0f);
+            if (low <= last && high > last)
+                power[last] = midSide(leftImag[0], rightImag[0], 0.0f, 0.0f);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void EffectNoiseReduction::Worker::ApplyFreqSmoothing(float *gains) {
     // Given an array of gain mutipliers, average them
     // GEOMETRICALLY.  Don't multiply and take nth root --
     // that may quickly cause underflows.  Instead, average the logs.
@@ -560,53 +2963,55 @@ void EffectNoiseReduction::Worker::ApplyFreqSmoothing(FloatVector &gains) {
     if (mFreqSmoothingBins == 0)
         return;
 
-    {
-        float *pScratch = &mFreqSmoothingScratch[0];
-        std::fill(pScratch, pScratch + mSpectrumSize, 0.0f);
-    }
+    // Only the bands of the frequency range have gains, and only they are
+    // averaged
+    const int low = mBinLow, high = mBinHigh;
+    const size_t bands = high - low;
+
+    // Windows that are all noise average to what they were
+    const float attenFactor = mNoiseAttenFactor;
+    if (std::all_of(gains + low, gains + high,
+                    [attenFactor](float gain) { return gain == attenFactor; }))
+        return;
+
+    // See FastMath.h for the accuracy of the log and exp
+    float *const logs = &mFreqSmoothingScratch[0];
+    FastLog(gains + low, logs + low, bands);
 
-    for (size_t ii = 0; ii < mSpectrumSize; ++ii)
-        gains[ii] = log(gains[ii]);
+    // Box filter each band's neighborhood through running sums, kept in
+    // double so the differences lose nothing
+    double *const sums = &mFreqSmoothingSums[0];
+    sums[low] = 0;
+    for (int ii = low; ii < high; ++ii)
+        sums[ii + 1] = sums[ii] + logs[ii];
 
     // ii must be signed
-    for (int ii = 0; ii < (int) mSpectrumSize; ++ii) {
-        const int j0 = std::max(0, ii - (int) mFreqSmoothingBins);
-        const int j1 = std::min(mSpectrumSize - 1, ii + mFreqSmoothingBins);
-        for (int jj = j0; jj <= j1; ++jj) {
-            mFreqSmoothingScratch[ii] += gains[jj];
-        }
-        mFreqSmoothingScratch[ii] /= (j1 - j0 + 1);
+    for (int ii = low; ii < high; ++ii) {
+        const int j0 = std::max(low, ii - (int) mFreqSmoothingBins);
+        const int j1 = std::min(high - 1, ii + (int) mFreqSmoothingBins);
+        logs[ii] = (sums[j1 + 1] - sums[j0]) / (j1 - j0 + 1);
     }
 
-    for (size_t ii = 0; ii < mSpectrumSize; ++ii)
-        gains[ii] = exp(mFreqSmoothingScratch[ii]);
+    FastExp(logs + low, gains + low, bands);
 }
 
 EffectNoiseReduction::Worker::Worker
-        (const Settings &settings, double sampleRate
-#ifdef EXPERIMENTAL_SPECTRAL_EDITING
-        , double f0, double f1
-#endif
-)
-        : mDoProfile(settings.mDoProfile), mSampleRate(sampleRate), mWindowSize(settings.WindowSize()),
-          hFFT(GetFFT(mWindowSize)), mFFTBuffer(mWindowSize), mInWaveBuffer(mWindowSize),
+        (const Settings &settings, double sampleRate)
+        : mSettings(settings), mDoProfile(settings.mDoProfile),
+          mDoAnalysis(settings.mDoAnalysis), mSampleRate(sampleRate), mWindowSize(settings.WindowSize()),
+          mFFT(MakeFFTPlan(mWindowSize)), mFFTBuffer(mWindowSize), mInWaveBuffer(mWindowSize),
           mOutOverlapBuffer(mWindowSize), mInWindow(), mOutWindow(), mSpectrumSize(1 + mWindowSize / 2),
-          mFreqSmoothingScratch(mSpectrumSize), mFreqSmoothingBins((int) (settings.mFreqSmoothingBands)), mBinLow(0),
+          mFreqSmoothingScratch(mSpectrumSize), mFreqSmoothingSums(mSpectrumSize + 1), mFreqSmoothingBins((int) (settings.mFreqSmoothingBands)), mBinLow(0),
           mBinHigh(mSpectrumSize), mNoiseReductionChoice(settings.mNoiseReductionChoice),
           mStepsPerWindow(settings.StepsPerWindow()), mStepSize(mWindowSize / mStepsPerWindow),
           mMethod(settings.mMethod)
 
 // Sensitivity setting is a base 10 log, turn it into a natural log
         , mNewSensitivity(settings.mNewSensitivity * log(10.0)), mInSampleCount(0), mOutStepCount(0), mInWavePos(0) {
-#ifdef EXPERIMENTAL_SPECTRAL_EDITING
     {
-       const double bin = mSampleRate / mWindowSize;
-       if (f0 >= 0.0 )
-          mBinLow = floor(f0 / bin);
-       if (f1 >= 0.0)
-          mBinHigh = ceil(f1 / bin);
+        // See SetFrequencyRange()
+        FrequencyBands(mSampleRate, mWindowSize, settings.mF0, settings.mF1, mBinLow, mBinHigh);
     }
-#endif
 
     const double noiseGain = -settings.mNoiseGain;
     const unsigned nAttackBlocks = 1 + (int) (settings.mAttackTime * sampleRate / mStepSize);
@@ -632,6 +3037,9 @@ EffectNoiseReduction::Worker::Worker
 #else
         mHistoryLen = 1;
 #endif
+    else if (mDoAnalysis)
+        // Only the windows examined for the center one
+        mHistoryLen = mNWindowsToExamine;
     else {
         // Allow long enough queue for sufficient inspection of the middle
         // and for attack processing
@@ -639,91 +3047,150 @@ EffectNoiseReduction::Worker::Worker
         mHistoryLen = std::max(mNWindowsToExamine, mCenter + nAttackBlocks);
     }
 
-    mQueue.resize(mHistoryLen);
-    for (unsigned ii = 0; ii < mHistoryLen; ++ii)
-        mQueue[ii] = std::make_unique<Record>(mSpectrumSize);
+    // A Worker started this many steps before some point produces, from that
+    // point on, exactly what a Worker started at the beginning would.  Its
+    // first windows are zero padded, each window is classified against its
+    // neighbours, release carries a raised gain forward until it decays to
+    // mNoiseAttenFactor, and each step of output overlaps mStepsPerWindow
+    // windows.  The history length and two more steps are spare.
+    mWarmUpSteps = mHistoryLen + 2 * mStepsPerWindow + mNWindowsToExamine + nReleaseBlocks + 2;
+    // A step of output is final once this many more steps of input are read
+    mLookAheadSteps = mHistoryLen + mStepsPerWindow + 1;
+
+    mHistory = std::make_unique<History>(mHistoryLen, std::min(mHistoryLen, mNWindowsToExamine),
+                                         mSpectrumSize, settings.mCompactHistory);
+    mGainRows.resize(mHistoryLen);
+    mEmptyStep.resize(mStepSize);
+    mEmptySteps.assign(1, &mEmptyStep[0]);
+    mChannelLink = ChannelLink::None;
+    mLinkedOutput = nullptr;
+
+    mBatchFrames.resize(batchSteps * mWindowSize);
+    for (size_t ii = 0; ii < batchSteps; ++ii)
+        mBatchPointers.push_back(&mBatchFrames[ii * mWindowSize]);
+    mBatchReady = mBatchNext = 0;
+
+    mSpectrumRows.resize(mNWindowsToExamine);
+    mThresholds.resize(mSpectrumSize);
+    mThresholdsFor = nullptr;
+
+    // An exponential decay over mAdaptTime, one step at a time
+    mAdaptedFrom = nullptr;
+    mAdaptFactor = 0.0f;
+    if (!mDoProfile && !mDoAnalysis && settings.mAdaptTime > 0.0) {
+        mAdapted = std::make_unique<Statistics>(mSpectrumSize, sampleRate, settings.mWindowTypes);
+        mAdaptFactor = 1.0 - exp(-(double) mStepSize / (settings.mAdaptTime * sampleRate));
+    }
 
-    // Create windows
+    mMasks = nullptr;
+    mMaskStep = 0;
+    mMaskMarks.resize(mSpectrumSize);
+    mGathering = nullptr;
+
+    // StartNewTrack() leaves the windows zero, the gains at
+    // mNoiseAttenFactor and nothing to overlap.  From there a step of
+    // silence changes nothing but which row is first: every band of a
+    // window of zeros is noise, unless a negative sensitivity puts the
+    // thresholds below zero, and the gain times a zero spectrum adds
+    // nothing.  Silence after sound gets back to that state as a
+    // warmed up Worker starts from it, so such steps give out silence and
+    // leave the rest as it is.  Adapting moves the means even in silence,
+    // and profiling and analysis take every window.
+    mSilentStepsToSkip = (mDoProfile || mDoAnalysis || mAdapted || mNewSensitivity < 0.0)
+                         ? 0 : mWarmUpSteps + mStepsPerWindow;
+    mSilentSteps = 0;
+
+    // Windows are shared by all Workers with the same shape
+    const auto windows = GetWindows(settings.mWindowTypes, mWindowSize, mStepsPerWindow,
+                                    mDoProfile || mDoAnalysis);
+    mInWindow = windows->in;
+    mOutWindow = windows->out;
+
+    mStep = ChooseStep();
+}
 
-    const double constantTerm =
-            windowTypesInfo[settings.mWindowTypes].productConstantTerm;
+// The window types decide only whether each window is rectangular, which
+// is when its multiplications are left out
+EffectNoiseReduction::Worker::StepFunction EffectNoiseReduction::Worker::ChooseStep() const {
+    const bool inWindowed = mInWindow.size() > 0;
+    const bool outWindowed = mOutWindow.size() > 0;
+    if (mDoProfile)
+        return inWindowed ? &Worker::ProfileStep<true> : &Worker::ProfileStep<false>;
+    if (mDoAnalysis)
+        return inWindowed ? ChooseAnalyzeStep<true>() : ChooseAnalyzeStep<false>();
+    if (!inWindowed)
+        return outWindowed ? ChooseReduceStep<false, true>() : ChooseReduceStep<false, false>();
+    return outWindowed ? ChooseReduceStep<true, true>() : ChooseReduceStep<true, false>();
+}
 
-    // One or the other window must by multiplied by this to correct for
-    // overlap.  Must scale down as steps get smaller, and overlaps larger.
-    const double multiplier = 1.0 / (constantTerm * mStepsPerWindow);
+template<bool InWindowed, bool OutWindowed>
+EffectNoiseReduction::Worker::StepFunction EffectNoiseReduction::Worker::ChooseReduceStep() const {
+    switch (mNoiseReductionChoice) {
+        case NRC_ISOLATE_NOISE:
+            return ChooseClassifyStep<InWindowed, OutWindowed, NRC_ISOLATE_NOISE>();
+        case NRC_LEAVE_RESIDUE:
+            return ChooseClassifyStep<InWindowed, OutWindowed, NRC_LEAVE_RESIDUE>();
+        default:
+            return ChooseClassifyStep<InWindowed, OutWindowed, NRC_REDUCE_NOISE>();
+    }
+}
 
-    // Create the analysis window
-    switch (settings.mWindowTypes) {
-        case WT_RECTANGULAR_HANN:
-            break;
-        default: {
-            const bool rectangularOut =
-                    settings.mWindowTypes == WT_HAMMING_RECTANGULAR ||
-                    settings.mWindowTypes == WT_HANN_RECTANGULAR;
-            const double m =
-                    rectangularOut ? multiplier : 1;
-            const double *const coefficients =
-                    windowTypesInfo[settings.mWindowTypes].inCoefficients;
-            const double c0 = coefficients[0];
-            const double c1 = coefficients[1];
-            const double c2 = coefficients[2];
-            mInWindow.resize(mWindowSize);
-            for (size_t ii = 0; ii < mWindowSize; ++ii)
-                mInWindow[ii] = m *
-                                (c0 + c1 * cos((2.0 * M_PI * ii) / mWindowSize)
-                                 + c2 * cos((4.0 * M_PI * ii) / mWindowSize));
-        }
-            break;
+template<bool InWindowed, bool OutWindowed, int Choice>
+EffectNoiseReduction::Worker::StepFunction EffectNoiseReduction::Worker::ChooseClassifyStep() const {
+    constexpr bool isolate = Choice == NRC_ISOLATE_NOISE;
+    switch (mMethod) {
+#ifdef OLD_METHOD_AVAILABLE
+        case DM_OLD_METHOD:
+            return &Worker::ReduceStep<InWindowed, OutWindowed, Choice,
+                    &Worker::ClassifyBandsOld<isolate>>;
+#endif
+        case DM_MEDIAN:
+            if (mNWindowsToExamine == 3)
+                return &Worker::ReduceStep<InWindowed, OutWindowed, Choice,
+                        &Worker::ClassifyBands<2, isolate>>;
+            if (mNWindowsToExamine == 5)
+                return &Worker::ReduceStep<InWindowed, OutWindowed, Choice,
+                        &Worker::ClassifyBands<3, isolate>>;
+            return &Worker::ReduceStep<InWindowed, OutWindowed, Choice,
+                    &Worker::ClassifyBands<0, isolate>>;
+        case DM_SECOND_GREATEST:
+            return &Worker::ReduceStep<InWindowed, OutWindowed, Choice,
+                    &Worker::ClassifyBands<2, isolate>>;
+        default:
+            assert(false);
+            return &Worker::ReduceStep<InWindowed, OutWindowed, Choice,
+                    &Worker::ClassifyBands<0, isolate>>;
     }
+}
 
-    if (!mDoProfile) {
-        // Create the synthesis window
-        switch (settings.mWindowTypes) {
-            case WT_HANN_RECTANGULAR:
-            case WT_HAMMING_RECTANGULAR:
-                break;
-            case WT_HAMMING_INV_HAMMING: {
-                mOutWindow.resize(mWindowSize);
-                for (size_t ii = 0; ii < mWindowSize; ++ii)
-                    mOutWindow[ii] = multiplier / mInWindow[ii];
-            }
-                break;
-            default: {
-                const double *const coefficients =
-                        windowTypesInfo[settings.mWindowTypes].outCoefficients;
-                const double c0 = coefficients[0];
-                const double c1 = coefficients[1];
-                const double c2 = coefficients[2];
-                mOutWindow.resize(mWindowSize);
-                for (size_t ii = 0; ii < mWindowSize; ++ii)
-                    mOutWindow[ii] = multiplier *
-                                     (c0 + c1 * cos((2.0 * M_PI * ii) / mWindowSize)
-                                      + c2 * cos((4.0 * M_PI * ii) / mWindowSize));
-            }
-                break;
-        }
+// The same classifiers, in their isolating form, which marks the noise
+template<bool InWindowed>
+EffectNoiseReduction::Worker::StepFunction EffectNoiseReduction::Worker::ChooseAnalyzeStep() const {
+    switch (mMethod) {
+#ifdef OLD_METHOD_AVAILABLE
+        case DM_OLD_METHOD:
+            return &Worker::AnalyzeStep<InWindowed, &Worker::ClassifyBandsOld<true>>;
+#endif
+        case DM_MEDIAN:
+            if (mNWindowsToExamine == 3)
+                return &Worker::AnalyzeStep<InWindowed, &Worker::ClassifyBands<2, true>>;
+            if (mNWindowsToExamine == 5)
+                return &Worker::AnalyzeStep<InWindowed, &Worker::ClassifyBands<3, true>>;
+            return &Worker::AnalyzeStep<InWindowed, &Worker::ClassifyBands<0, true>>;
+        case DM_SECOND_GREATEST:
+            return &Worker::AnalyzeStep<InWindowed, &Worker::ClassifyBands<2, true>>;
+        default:
+            assert(false);
+            return &Worker::AnalyzeStep<InWindowed, &Worker::ClassifyBands<0, true>>;
     }
 }
 
 void EffectNoiseReduction::Worker::StartNewTrack() {
-    float *pFill;
-    for (unsigned ii = 0; ii < mHistoryLen; ++ii) {
-        Record &record = *mQueue[ii];
-
-        pFill = &record.mSpectrums[0];
-        std::fill(pFill, pFill + mSpectrumSize, 0.0f);
-
-        pFill = &record.mRealFFTs[0];
-        std::fill(pFill, pFill + mSpectrumSize - 1, 0.0f);
+    for (auto worker : mLinked)
+        worker->StartNewTrack();
+    mHistory->Clear(mNoiseAttenFactor);
 
-        pFill = &record.mImagFFTs[0];
-        std::fill(pFill, pFill + mSpectrumSize - 1, 0.0f);
-
-        pFill = &record.mGains[0];
-        std::fill(pFill, pFill + mSpectrumSize, mNoiseAttenFactor);
-    }
-
-    pFill = &mOutOverlapBuffer[0];
+    float *pFill = &mOutOverlapBuffer[0];
     std::fill(pFill, pFill + mWindowSize, 0.0f);
 
     pFill = &mInWaveBuffer[0];
@@ -733,6 +3200,12 @@ void EffectNoiseReduction::Worker::StartNewTrack() {
         // We do not want leading zero padded windows
         mInWavePos = 0;
         mOutStepCount = -(int) (mHistoryLen - 1);
+    } else if (mDoAnalysis) {
+        // Zero padded in front as when reducing; the first window with
+        // mStepSize samples of wave data is classified once it reaches the
+        // center of the history
+        mInWavePos = mWindowSize - mStepSize;
+        mOutStepCount = -(int) mCenter;
     } else {
         // So that the queue gets primed with some windows,
         // zero-padded in front, the first having mStepSize
@@ -746,80 +3219,220 @@ void EffectNoiseReduction::Worker::StartNewTrack() {
     }
 
     mInSampleCount = 0;
+    // Adapting starts over from the profile
+    mAdaptedFrom = nullptr;
+    mMaskStep = 0;
+    mSilentSteps = mSilentStepsToSkip;
+    mBatchReady = mBatchNext = 0;
 }
 
 void EffectNoiseReduction::Worker::ProcessSamples
-        (Statistics &statistics, WaveTrack *outputTrack,
-         size_t len, float *buffer) {
-    while (len && mOutStepCount * mStepSize < mInSampleCount) {
-        auto avail = std::min(len, mWindowSize - mInWavePos);
-        memmove(&mInWaveBuffer[mInWavePos], buffer, avail * sizeof(float));
-        buffer += avail;
-        len -= avail;
+        (const Statistics &statistics, WorkerOutput *const *outputs,
+         size_t len, const float *const *buffers) {
+    NR_TIME_SCOPE(TimedStage());
+    // The linked channels move in step with this one, which keeps the count
+    const size_t channels = 1 + mLinked.size();
+    for (size_t cc = 1; cc < channels; ++cc)
+        mLinked[cc - 1]->mLinkedOutput = outputs[cc];
+
+    size_t pos = 0;
+    while (pos < len && mOutStepCount * mStepSize < mInSampleCount) {
+        // Long buffers are transformed a batch of steps at a time, except
+        // in silence that is being skipped
+        if (mBatchNext == mBatchReady && len - pos >= batchSteps * mStepSize &&
+            mInWavePos == (int) (mWindowSize - mStepSize) &&
+            !(mSilentStepsToSkip && mSilentSteps == mSilentStepsToSkip))
+            for (size_t cc = 0; cc < channels; ++cc)
+                Channel(cc).PrepareBatch(buffers[cc] + pos);
+
+        auto avail = std::min(len - pos, mWindowSize - mInWavePos);
+        for (size_t cc = 0; cc < channels; ++cc)
+            memmove(&Channel(cc).mInWaveBuffer[mInWavePos], buffers[cc] + pos, avail * sizeof(float));
+        pos += avail;
         mInWavePos += avail;
 
         if (mInWavePos == (int) mWindowSize) {
-            FillFirstHistoryWindow();
-            if (mDoProfile)
-                GatherStatistics(statistics);
-            else
-                ReduceNoise(statistics, outputTrack);
+            if (!SkipSilentStep(outputs))
+                (this->*mStep)(statistics, outputs[0]);
             ++mOutStepCount;
-            RotateHistoryWindows();
-
-            // Rotate for overlap-add
-            memmove(&mInWaveBuffer[0], &mInWaveBuffer[mStepSize],
-                    (mWindowSize - mStepSize) * sizeof(float));
+            for (size_t cc = 0; cc < channels; ++cc) {
+                auto &channel = Channel(cc);
+                if (channel.mBatchNext < channel.mBatchReady)
+                    ++channel.mBatchNext;
+                channel.RotateHistoryWindows();
+
+                // Rotate for overlap-add
+                memmove(&channel.mInWaveBuffer[0], &channel.mInWaveBuffer[mStepSize],
+                        (mWindowSize - mStepSize) * sizeof(float));
+            }
             mInWavePos -= mStepSize;
         }
     }
 }
 
+bool EffectNoiseReduction::Worker::SkipSilentStep(WorkerOutput *const *outputs) {
+    if (!mSilentStepsToSkip)
+        return false;
+    const size_t channels = 1 + mLinked.size();
+    for (size_t cc = 0; cc < channels; ++cc) {
+        const float *const newest = &Channel(cc).mInWaveBuffer[mWindowSize - mStepSize];
+        if (std::any_of(newest, newest + mStepSize, [](float sample) { return sample != 0.0f; })) {
+            mSilentSteps = 0;
+            return false;
+        }
+    }
+    if (mSilentSteps < mSilentStepsToSkip) {
+        ++mSilentSteps;
+        return false;
+    }
+
+    NR_COUNT(SilentSteps, channels);
+    if (mOutStepCount >= 0)
+        for (size_t cc = 0; cc < channels; ++cc)
+            outputs[cc]->Append(&mEmptyStep[0], mStepSize);
+    return true;
+}
+
+template<bool InWindowed>
+void EffectNoiseReduction::Worker::ProfileStep(const Statistics &, WorkerOutput *) {
+    FillFirstHistoryWindow<InWindowed>();
+    GatherStatistics(*mGathering);
+}
+
+template<bool InWindowed, bool OutWindowed, int Choice,
+        EffectNoiseReduction::Worker::BandClassifier Classify>
+void EffectNoiseReduction::Worker::ReduceStep(const Statistics &statistics, WorkerOutput *output) {
+    FillFirstHistoryWindow<InWindowed>();
+    if (!mLinked.empty()) {
+        for (auto worker : mLinked)
+            worker->FillFirstHistoryWindow<InWindowed>();
+        CombineLinkedSpectra();
+    }
+    if (!mAdapted) {
+        ReduceNoise<Choice, OutWindowed, Classify>(statistics, output);
+        return;
+    }
+
+    if (mAdaptedFrom != &statistics) {
+        mAdaptedFrom = &statistics;
+        std::copy(statistics.mMeans.begin(), statistics.mMeans.end(), mAdapted->mMeans.begin());
+#ifdef OLD_METHOD_AVAILABLE
+        std::copy(statistics.mNoiseThreshold.begin(), statistics.mNoiseThreshold.end(),
+                  mAdapted->mNoiseThreshold.begin());
+#endif
+        mThresholdsFor = nullptr;
+    }
+    ReduceNoise<Choice, OutWindowed, Classify>(*mAdapted, output);
+}
+
+// Marks the noise of the center window, and gives out that mask in place of
+// samples.  Mask n is of the window ending at sample (n + 1) * mStepSize.
+template<bool InWindowed, EffectNoiseReduction::Worker::BandClassifier Classify>
+void EffectNoiseReduction::Worker::AnalyzeStep(const Statistics &statistics, WorkerOutput *output) {
+    FillFirstHistoryWindow<InWindowed>();
+    if (mOutStepCount >= 0) {
+        // The gains are not otherwise used, so hold the mask
+        float *const noise = mHistory->Gains(mCenter);
+        // All above or below the selected frequency range is non-noise
+        std::fill(noise, noise + mBinLow, 0.0f);
+        std::fill(noise + mBinHigh, noise + mSpectrumSize, 0.0f);
+        {
+            NR_TIME_SCOPE(Instrumentation::Stage::Classify);
+            (this->*Classify)(statistics, noise);
+        }
+        output->AppendMask(noise, mSpectrumSize);
+    }
+}
+
+template<bool InWindowed>
 void EffectNoiseReduction::Worker::FillFirstHistoryWindow() {
-    // Transform samples to frequency domain, windowed as needed
-    if (mInWindow.size() > 0)
-        for (size_t ii = 0; ii < mWindowSize; ++ii)
-            mFFTBuffer[ii] = mInWaveBuffer[ii] * mInWindow[ii];
-    else
-        memmove(&mFFTBuffer[0], &mInWaveBuffer[0], mWindowSize * sizeof(float));
-    RealFFTf(&mFFTBuffer[0], hFFT.get());
+    // Transform samples to frequency domain, windowed as needed, unless
+    // that was done with the steps before
+    const float *spectrum = &mFFTBuffer[0];
+    if (mBatchNext < mBatchReady)
+        spectrum = mBatchPointers[mBatchNext];
+    else {
+        if (InWindowed) {
+            float *const pBuffer = &mFFTBuffer[0];
+            const float *const pIn = &mInWaveBuffer[0];
+            const float *const pWindow = &mInWindow[0];
+            for (size_t ii = 0; ii < mWindowSize; ++ii)
+                pBuffer[ii] = pIn[ii] * pWindow[ii];
+        } else
+            memmove(&mFFTBuffer[0], &mInWaveBuffer[0], mWindowSize * sizeof(float));
+        NR_TIME_SCOPE(Instrumentation::Stage::ForwardFFT);
+        mFFT->Forward(&mFFTBuffer[0]);
+    }
 
-    Record &record = *mQueue[0];
+    float *const realFFTs = mHistory->NewRealFFTs();
+    float *const imagFFTs = mHistory->NewImagFFTs();
+    float *const spectrums = mHistory->Spectrums(0);
 
     // Store real and imaginary parts for later inverse FFT, and compute
-    // power
+    // power, of the bands of the frequency range only
     {
-        float *pReal = &record.mRealFFTs[1];
-        float *pImag = &record.mImagFFTs[1];
-        float *pPower = &record.mSpectrums[1];
-        int *pBitReversed = &hFFT->BitReversed[1];
-        const auto last = mSpectrumSize - 1;
-        for (unsigned int ii = 1; ii < last; ++ii) {
-            const int kk = *pBitReversed++;
-            const float realPart = *pReal++ = mFFTBuffer[kk];
-            const float imagPart = *pImag++ = mFFTBuffer[kk + 1];
+        const int last = mSpectrumSize - 1;
+        const int low = std::min(last, std::max(1, mBinLow));
+        const int high = std::max(low, std::min(last, mBinHigh));
+        auto keepParts = [&](int first, int end) {
+            for (int ii = first; ii < end; ++ii) {
+                realFFTs[ii] = spectrum[2 * ii];
+                imagFFTs[ii] = spectrum[2 * ii + 1];
+            }
+        };
+        keepParts(1, low);
+        float *pReal = &realFFTs[low];
+        float *pImag = &imagFFTs[low];
+        float *pPower = &spectrums[low];
+        const float *pBuffer = &spectrum[2 * low];
+        for (int ii = low; ii < high; ++ii) {
+            const float realPart = *pReal++ = *pBuffer++;
+            const float imagPart = *pImag++ = *pBuffer++;
             *pPower++ = realPart * realPart + imagPart * imagPart;
         }
-        // DC and Fs/2 bins need to be handled specially
-        const float dc = mFFTBuffer[0];
-        record.mRealFFTs[0] = dc;
-        record.mSpectrums[0] = dc * dc;
+        keepParts(high, last);
 
-        const float nyquist = mFFTBuffer[1];
-        record.mImagFFTs[0] = nyquist; // For Fs/2, not really imaginary
-        record.mSpectrums[last] = nyquist * nyquist;
+        // DC and Fs/2 bins need to be handled specially
+        const float dc = spectrum[0];
+        realFFTs[0] = dc;
+        if (mBinLow == 0 && mBinHigh > 0)
+            spectrums[0] = dc * dc;
+
+        const float nyquist = spectrum[1];
+        imagFFTs[0] = nyquist; // For Fs/2, not really imaginary
+        if (mBinLow <= last && mBinHigh > last)
+            spectrums[last] = nyquist * nyquist;
     }
+    mHistory->KeepNewFFTs();
+}
 
-    if (mNoiseReductionChoice != NRC_ISOLATE_NOISE) {
-        // Default all gains to the reduction factor,
-        // until we decide to raise some of them later
-        float *pGain = &record.mGains[0];
-        std::fill(pGain, pGain + mSpectrumSize, mNoiseAttenFactor);
+void EffectNoiseReduction::Worker::PrepareBatch(const float *buffer) {
+    const size_t held = mWindowSize - mStepSize;
+    for (size_t ii = 0; ii < batchSteps; ++ii) {
+        // Window ii begins ii steps on, in mInWaveBuffer and then in buffer
+        const size_t begin = ii * mStepSize;
+        const size_t fromHeld = begin < held ? held - begin : 0;
+        float *const frame = mBatchPointers[ii];
+        if (fromHeld)
+            memcpy(frame, &mInWaveBuffer[begin], fromHeld * sizeof(float));
+        memcpy(frame + fromHeld, buffer + begin + fromHeld - held,
+               (mWindowSize - fromHeld) * sizeof(float));
+        if (!mInWindow.empty()) {
+            const float *const pWindow = &mInWindow[0];
+            for (size_t jj = 0; jj < mWindowSize; ++jj)
+                frame[jj] *= pWindow[jj];
+        }
+    }
+    {
+        NR_TIME_SCOPE(Instrumentation::Stage::ForwardFFT);
+        mFFT->ForwardBatch(mBatchPointers.data(), batchSteps);
     }
+    mBatchReady = batchSteps;
+    mBatchNext = 0;
 }
 
 void EffectNoiseReduction::Worker::RotateHistoryWindows() {
-    std::rotate(mQueue.begin(), mQueue.end() - 1, mQueue.end());
+    mHistory->Rotate();
 }
 
 void EffectNoiseReduction::Worker::FinishTrackStatistics(Statistics &statistics) {
@@ -843,7 +3456,7 @@ void EffectNoiseReduction::Worker::FinishTrackStatistics(Statistics &statistics)
 }
 
 void EffectNoiseReduction::Worker::FinishTrack
-        (Statistics &statistics, WaveTrack *outputTrack) {
+        (const Statistics &statistics, WorkerOutput *const *outputs) {
     // Keep flushing empty input buffers through the history
     // windows until we've output exactly as many samples as
     // were input.
@@ -851,22 +3464,22 @@ void EffectNoiseReduction::Worker::FinishTrack
     // at the end.
     // We'll DELETE them later in ProcessOne.
 
-    FloatVector empty(mStepSize);
-
     while (mOutStepCount * mStepSize < mInSampleCount) {
-        ProcessSamples(statistics, outputTrack, mStepSize, &empty[0]);
+        ProcessSamples(statistics, outputs, mStepSize, &mEmptySteps[0]);
     }
+    for (size_t cc = 0; cc <= mLinked.size(); ++cc)
+        outputs[cc]->Flush();
 }
 
 void EffectNoiseReduction::Worker::GatherStatistics(Statistics &statistics) {
     ++statistics.mTrackWindows;
 
     {
-        // NEW statistics
-        const float *pPower = &mQueue[0]->mSpectrums[0];
+        // NEW statistics, of the bands processed only
+        const float *pPower = mHistory->Spectrums(0);
         float *pSum = &statistics.mSums[0];
-        for (size_t jj = 0; jj < mSpectrumSize; ++jj) {
-            *pSum++ += *pPower++;
+        for (int jj = mBinLow; jj < mBinHigh; ++jj) {
+            pSum[jj] += pPower[jj];
         }
     }
 
@@ -879,128 +3492,235 @@ void EffectNoiseReduction::Worker::GatherStatistics(Statistics &statistics) {
 
     {
        // old statistics
-       const float *pPower = &mQueue[0]->mSpectrums[0];
+       const float *pPower = mHistory->Spectrums(0);
        float *pThreshold = &statistics.mNoiseThreshold[0];
-       for (int jj = 0; jj < mSpectrumSize; ++jj) {
-          float min = *pPower++;
+       for (int jj = mBinLow; jj < mBinHigh; ++jj) {
+          float min = pPower[jj];
           for (unsigned ii = 1; ii < finish; ++ii)
-             min = std::min(min, mQueue[ii]->mSpectrums[jj]);
-          *pThreshold = std::max(*pThreshold, min);
-          ++pThreshold;
+             min = std::min(min, mHistory->Spectrums(ii)[jj]);
+          pThreshold[jj] = std::max(pThreshold[jj], min);
        }
     }
 #endif
 }
 
-// Return true iff the given band of the "center" window looks like noise.
-// Examine the band in a few neighboring windows to decide.
-inline
-bool EffectNoiseReduction::Worker::Classify(const Statistics &statistics, int band) {
-    switch (mMethod) {
-#ifdef OLD_METHOD_AVAILABLE
-        case DM_OLD_METHOD:
-           {
-              float min = mQueue[0]->mSpectrums[band];
-              for (unsigned ii = 1; ii < mNWindowsToExamine; ++ii)
-                 min = std::min(min, mQueue[ii]->mSpectrums[band]);
-              return min <= mOldSensitivityFactor * statistics.mNoiseThreshold[band];
-           }
-#endif
-        // New methods suppose an exponential distribution of power values
-        // in the noise; NEW sensitivity is meant to be log of probability
-        // that noise strays above the threshold.  Call that probability
-        // 1 - F.  The quantile function of an exponential distribution is
-        // log (1 - F) * mean.  Thus simply multiply mean by sensitivity
-        // to get the threshold.
-        case DM_MEDIAN:
-            // This method examines the window and all windows
-            // that partly overlap it, and takes a median, to
-            // avoid being fooled by up and down excursions into
-            // either the mistake of classifying noise as not noise
-            // (leaving a musical noise chime), or the opposite
-            // (distorting the signal with a drop out).
-            if (mNWindowsToExamine == 3)
-                // No different from second greatest.
-                goto secondGreatest;
-            else if (mNWindowsToExamine == 5) {
-                float greatest = 0.0, second = 0.0, third = 0.0;
-                for (unsigned ii = 0; ii < mNWindowsToExamine; ++ii) {
-                    const float power = mQueue[ii]->mSpectrums[band];
-                    if (power >= greatest)
-                        third = second, second = greatest, greatest = power;
-                    else if (power >= second)
-                        third = second, second = power;
-                    else if (power >= third)
-                        third = power;
-                }
-                return third <= mNewSensitivity * statistics.mMeans[band];
-            } else {
-                return true;
+void EffectNoiseReduction::Worker::UpdateThresholds(const Statistics &statistics) {
+    if (mThresholdsFor == &statistics)
+        return;
+    mThresholdsFor = &statistics;
+    // A power, being a float, is at most the double threshold exactly when
+    // it is at most the greatest float not above that threshold, so the
+    // comparisons can be done in single precision with the same results.
+    for (size_t ii = 0; ii < mSpectrumSize; ++ii) {
+        const double threshold = mNewSensitivity * statistics.mMeans[ii];
+        float &single = mThresholds[ii] = (float) threshold;
+        if (single > threshold)
+            single = std::nextafter(single, -std::numeric_limits<float>::infinity());
+    }
+}
+
+// Each mean moves by mAdaptFactor toward the center window's power, in the
+// bands that ClassifyBands() found to be noise: those marked 1 when
+// isolating, and otherwise those it left below 1, which release never
+// raises them to while there is any noise gain.  Only windows wholly of
+// input count, not the zero padding at either end of the track.
+template<bool Isolate>
+void EffectNoiseReduction::Worker::AdaptStatistics(const float *gains) {
+    // Where the center window ends, counting from the first sample
+    const long long end = (mOutStepCount.as_long_long() + mHistoryLen + mStepsPerWindow - 1 - mCenter)
+                          * (long long) mStepSize;
+    if (end < (long long) mWindowSize || end > mInSampleCount.as_long_long())
+        return;
+
+    const float *const power = mHistory->Spectrums(mCenter);
+    float *const means = &mAdapted->mMeans[0];
+    for (int band = mBinLow; band < mBinHigh; ++band)
+        if (Isolate ? gains[band] == 1.0f : gains[band] < 1.0f)
+            means[band] += mAdaptFactor * (power[band] - means[band]);
+    // So that the next window is classified against the new means
+    mThresholdsFor = nullptr;
+}
+
+// Decide which bands of the "center" window look like noise, examining
+// each band in a few neighboring windows, and mark them in its gains:
+// if isolating noise, 1 for noise and 0 for the rest, otherwise 1 for the
+// bands that are not noise.  Only [mBinLow, mBinHigh) is visited.
+//
+// New methods suppose an exponential distribution of power values
+// in the noise; NEW sensitivity is meant to be log of probability
+// that noise strays above the threshold.  Call that probability
+// 1 - F.  The quantile function of an exponential distribution is
+// log (1 - F) * mean.  Thus simply multiply mean by sensitivity
+// to get the threshold.
+//
+// The band is noise if the Rank-th greatest of its powers is below the
+// threshold.  DM_SECOND_GREATEST just throws out the high outlier.  It
+// should be less prone to distortions and more prone to chimes.
+// DM_MEDIAN examines the window and all windows that partly overlap it,
+// and takes a median, to avoid being fooled by up and down excursions into
+// either the mistake of classifying noise as not noise (leaving a musical
+// noise chime), or the opposite (distorting the signal with a drop out).
+// Of three windows that is the second greatest, of five the third; for
+// other counts every band is noise.
+//
+// The greatest powers are kept by a min/max network, so there are no
+// branches, and four bands are done at once where SSE2 or NEON is there.
+template<unsigned Rank, bool Isolate>
+void EffectNoiseReduction::Worker::ClassifyBands(const Statistics &statistics, float *gains) {
+    if (Rank == 0) {
+        if (Isolate)
+            std::fill(gains + mBinLow, gains + mBinHigh, 1.0f);
+        return;
+    }
+    // Rank 0 never gets here, but the arrays need a size
+    enum : unsigned { Ranks = Rank > 0 ? Rank : 1 };
+
+    UpdateThresholds(statistics);
+    const float *const thresholds = &mThresholds[0];
+    const float **const rows = &mSpectrumRows[0];
+    const unsigned nWindows = mNWindowsToExamine;
+    for (unsigned ii = 0; ii < nWindows; ++ii)
+        rows[ii] = mHistory->Spectrums(ii);
+
+    int band = mBinLow;
+#if defined(__SSE2__)
+    {
+        const __m128 one = _mm_set1_ps(1.0f);
+        for (; band + 4 <= mBinHigh; band += 4) {
+            __m128 greatest[Ranks];
+            for (auto &value : greatest)
+                value = _mm_setzero_ps();
+            for (unsigned ii = 0; ii < nWindows; ++ii) {
+                const __m128 power = _mm_loadu_ps(rows[ii] + band);
+                for (unsigned rr = Ranks - 1; rr > 0; --rr)
+                    greatest[rr] = _mm_max_ps(greatest[rr], _mm_min_ps(greatest[rr - 1], power));
+                greatest[0] = _mm_max_ps(greatest[0], power);
             }
-        secondGreatest:
-        case DM_SECOND_GREATEST: {
-            // This method just throws out the high outlier.  It
-            // should be less prone to distortions and more prone to
-            // chimes.
-            float greatest = 0.0, second = 0.0;
-            for (unsigned ii = 0; ii < mNWindowsToExamine; ++ii) {
-                const float power = mQueue[ii]->mSpectrums[band];
-                if (power >= greatest)
-                    second = greatest, greatest = power;
-                else if (power >= second)
-                    second = power;
+            const __m128 noise = _mm_cmple_ps(greatest[Ranks - 1], _mm_loadu_ps(thresholds + band));
+            const __m128 gain = Isolate
+                                ? _mm_and_ps(noise, one)
+                                : _mm_or_ps(_mm_and_ps(noise, _mm_loadu_ps(gains + band)),
+                                            _mm_andnot_ps(noise, one));
+            _mm_storeu_ps(gains + band, gain);
+        }
+    }
+#elif defined(__ARM_NEON)
+    {
+        const float32x4_t one = vdupq_n_f32(1.0f);
+        for (; band + 4 <= mBinHigh; band += 4) {
+            float32x4_t greatest[Ranks];
+            for (auto &value : greatest)
+                value = vdupq_n_f32(0.0f);
+            for (unsigned ii = 0; ii < nWindows; ++ii) {
+                const float32x4_t power = vld1q_f32(rows[ii] + band);
+                for (unsigned rr = Ranks - 1; rr > 0; --rr)
+                    greatest[rr] = vmaxq_f32(greatest[rr], vminq_f32(greatest[rr - 1], power));
+                greatest[0] = vmaxq_f32(greatest[0], power);
             }
-            return second <= mNewSensitivity * statistics.mMeans[band];
+            const uint32x4_t noise = vcleq_f32(greatest[Ranks - 1], vld1q_f32(thresholds + band));
+            const float32x4_t gain = vbslq_f32(noise, Isolate ? one : vld1q_f32(gains + band),
+                                               Isolate ? vdupq_n_f32(0.0f) : one);
+            vst1q_f32(gains + band, gain);
         }
-        default:
-            assert(false);
-            return true;
     }
+#endif
+    for (; band < mBinHigh; ++band) {
+        float greatest[Ranks] = {};
+        for (unsigned ii = 0; ii < nWindows; ++ii) {
+            const float power = rows[ii][band];
+            for (unsigned rr = Ranks - 1; rr > 0; --rr)
+                greatest[rr] = std::max(greatest[rr], std::min(greatest[rr - 1], power));
+            greatest[0] = std::max(greatest[0], power);
+        }
+        const bool noise = greatest[Ranks - 1] <= thresholds[band];
+        if (Isolate)
+            gains[band] = noise ? 1.0f : 0.0f;
+        else if (!noise)
+            gains[band] = 1.0f;
+    }
+}
+
+// Recording, Classify marks a row of zeros, which is kept; replaying, that
+// row is read back.  Either way the marks then go into gains as Classify
+// itself would have put them.
+template<bool Isolate, EffectNoiseReduction::Worker::BandClassifier Classify>
+void EffectNoiseReduction::Worker::ClassifyWithMasks(const Statistics &statistics, float *gains) {
+    float *const marks = &mMaskMarks[0];
+    const size_t bands = mBinHigh - mBinLow;
+    if (mMasks->Recording()) {
+        std::fill(marks + mBinLow, marks + mBinHigh, 0.0f);
+        (this->*Classify)(statistics, marks);
+        mMasks->Append(marks + mBinLow, bands);
+    } else
+        mMasks->Get(mMaskStep, marks + mBinLow, bands);
+    ++mMaskStep;
+
+    for (int band = mBinLow; band < mBinHigh; ++band)
+        if (Isolate)
+            gains[band] = marks[band];
+        else if (marks[band] != 0.0f)
+            gains[band] = 1.0f;
+}
 
+#ifdef OLD_METHOD_AVAILABLE
+template<bool Isolate>
+void EffectNoiseReduction::Worker::ClassifyBandsOld(const Statistics &statistics, float *gains) {
+    for (int band = mBinLow; band < mBinHigh; ++band) {
+       float min = mHistory->Spectrums(0)[band];
+       for (unsigned ii = 1; ii < mNWindowsToExamine; ++ii)
+          min = std::min(min, mHistory->Spectrums(ii)[band]);
+       const bool noise = min <= mOldSensitivityFactor * statistics.mNoiseThreshold[band];
+       if (Isolate)
+          gains[band] = noise ? 1.0f : 0.0f;
+       else if (!noise)
+          gains[band] = 1.0f;
+    }
 }
+#endif
 
+template<int Choice, bool OutWindowed,
+        EffectNoiseReduction::Worker::BandClassifier Classify>
 void EffectNoiseReduction::Worker::ReduceNoise
-        (const Statistics &statistics, WaveTrack *outputTrack) {
+        (const Statistics &statistics, WorkerOutput *output) {
+    if (Choice != NRC_ISOLATE_NOISE) {
+        // Default all gains of the new window to the reduction factor,
+        // until we decide to raise some of them later.  Only the bands of
+        // the frequency range have gains; Synthesize() passes the rest.
+        float *pGain = mHistory->Gains(0);
+        std::fill(pGain + mBinLow, pGain + mBinHigh, mNoiseAttenFactor);
+    }
+
     // Raise the gain for elements in the center of the sliding history
     // or, if isolating noise, zero out the non-noise
     {
-        float *pGain = &mQueue[mCenter]->mGains[0];
-        if (mNoiseReductionChoice == NRC_ISOLATE_NOISE) {
-            // All above or below the selected frequency range is non-noise
-            std::fill(pGain, pGain + mBinLow, 0.0f);
-            std::fill(pGain + mBinHigh, pGain + mSpectrumSize, 0.0f);
-            pGain += mBinLow;
-            for (int jj = mBinLow; jj < mBinHigh; ++jj) {
-                const bool isNoise = Classify(statistics, jj);
-                *pGain++ = isNoise ? 1.0f : 0.0f;
-            }
-        } else {
-            // All above or below the selected frequency range is non-noise
-            std::fill(pGain, pGain + mBinLow, 1.0f);
-            std::fill(pGain + mBinHigh, pGain + mSpectrumSize, 1.0f);
-            pGain += mBinLow;
-            for (int jj = mBinLow; jj < mBinHigh; ++jj) {
-                const bool isNoise = Classify(statistics, jj);
-                if (!isNoise)
-                    *pGain = 1.0;
-                ++pGain;
-            }
+        float *pGain = mHistory->Gains(mCenter);
+        {
+            NR_TIME_SCOPE(Instrumentation::Stage::Classify);
+            if (mMasks)
+                ClassifyWithMasks<Choice == NRC_ISOLATE_NOISE, Classify>(statistics, pGain);
+            else
+                (this->*Classify)(statistics, pGain);
         }
+        if (mAdapted)
+            AdaptStatistics<Choice == NRC_ISOLATE_NOISE>(pGain);
     }
 
-    if (mNoiseReductionChoice != NRC_ISOLATE_NOISE) {
+    if (Choice != NRC_ISOLATE_NOISE) {
         // In each direction, define an exponential decay of gain from the
         // center; make actual gains the maximum of mNoiseAttenFactor, and
         // the decay curve, and their prior values.
 
         // First, the attack, which goes backward in time, which is,
         // toward higher indices in the queue.
-        for (size_t jj = 0; jj < mSpectrumSize; ++jj) {
+        float **const gains = &mGainRows[0];
+        for (unsigned ii = mCenter; ii < mHistoryLen; ++ii)
+            gains[ii] = mHistory->Gains(ii);
+        for (int jj = mBinLow; jj < mBinHigh; ++jj) {
             for (unsigned ii = mCenter + 1; ii < mHistoryLen; ++ii) {
                 const float minimum =
                         std::max(mNoiseAttenFactor,
-                                 mQueue[ii - 1]->mGains[jj] * mOneBlockAttack);
-                float &gain = mQueue[ii]->mGains[jj];
+                                 gains[ii - 1][jj] * mOneBlockAttack);
+                float &gain = gains[ii][jj];
                 if (gain < minimum)
                     gain = minimum;
                 else
@@ -1014,9 +3734,9 @@ void EffectNoiseReduction::Worker::ReduceNoise
         // be visited again when we examine the next window, and
         // carry the decay further.
         {
-            float *pNextGain = &mQueue[mCenter - 1]->mGains[0];
-            const float *pThisGain = &mQueue[mCenter]->mGains[0];
-            for (int nn = mSpectrumSize; nn--;) {
+            float *pNextGain = mHistory->Gains(mCenter - 1) + mBinLow;
+            const float *pThisGain = mHistory->Gains(mCenter) + mBinLow;
+            for (int nn = mBinHigh - mBinLow; nn--;) {
                 *pNextGain =
                         std::max(*pNextGain,
                                  std::max(mNoiseAttenFactor,
@@ -1028,128 +3748,359 @@ void EffectNoiseReduction::Worker::ReduceNoise
 
 
     if (mOutStepCount >= -(int) (mStepsPerWindow - 1)) {
-        Record &record = *mQueue[mHistoryLen - 1];  // end of the queue
-        const auto last = mSpectrumSize - 1;
+        // end of the queue
+        float *const gains = mHistory->Gains(mHistoryLen - 1);
 
-        if (mNoiseReductionChoice != NRC_ISOLATE_NOISE)
+        if (Choice != NRC_ISOLATE_NOISE) {
+            NR_TIME_SCOPE(Instrumentation::Stage::Smoothing);
             // Apply frequency smoothing to output gain
             // Gains are not less than mNoiseAttenFactor
-            ApplyFreqSmoothing(record.mGains);
+            ApplyFreqSmoothing(gains);
+        }
 
-        // Apply gain to FFT
-        {
-            const float *pGain = &record.mGains[1];
-            const float *pReal = &record.mRealFFTs[1];
-            const float *pImag = &record.mImagFFTs[1];
-            float *pBuffer = &mFFTBuffer[2];
-            auto nn = mSpectrumSize - 2;
-            if (mNoiseReductionChoice == NRC_LEAVE_RESIDUE) {
-                for (; nn--;) {
-                    // Subtract the gain we would otherwise apply from 1, and
-                    // negate that to flip the phase.
-                    const double gain = *pGain++ - 1.0;
-                    *pBuffer++ = *pReal++ * gain;
-                    *pBuffer++ = *pImag++ * gain;
-                }
-                mFFTBuffer[0] = record.mRealFFTs[0] * (record.mGains[0] - 1.0f);
-                // The Fs/2 component is stored as the imaginary part of the DC component
-                mFFTBuffer[1] = record.mImagFFTs[0] * (record.mGains[last] - 1.0f);
-            } else {
-                for (; nn--;) {
-                    const double gain = *pGain++;
-                    *pBuffer++ = *pReal++ * gain;
-                    *pBuffer++ = *pImag++ * gain;
-                }
-                mFFTBuffer[0] = record.mRealFFTs[0] * record.mGains[0];
-                // The Fs/2 component is stored as the imaginary part of the DC component
-                mFFTBuffer[1] = record.mImagFFTs[0] * record.mGains[last];
-            }
+        // The same gains for every linked channel
+        Synthesize<Choice, OutWindowed>(gains, output, mOutStepCount >= 0);
+        for (auto worker : mLinked)
+            worker->Synthesize<Choice, OutWindowed>(gains, worker->mLinkedOutput, mOutStepCount >= 0);
+    }
+}
+
+template<int Choice, bool OutWindowed>
+void EffectNoiseReduction::Worker::Synthesize(const float *gains, WorkerOutput *output, bool append) {
+    const float *const realFFTs = mHistory->RealFFTs(mHistoryLen - 1);
+    const float *const imagFFTs = mHistory->ImagFFTs(mHistoryLen - 1);
+    const auto last = mSpectrumSize - 1;
+
+    // Outside the frequency range the parts pass through as they are when
+    // reducing, and are gone when isolating or leaving the residue
+    const bool pass = Choice == NRC_REDUCE_NOISE;
+    const int low = std::min((int) last, std::max(1, mBinLow));
+    const int high = std::min((int) last, mBinHigh);
+    const bool dc = mBinLow == 0 && mBinHigh > 0;
+    const bool nyquist = mBinLow <= (int) last && mBinHigh > (int) last;
+    auto passBands = [&](int first, int end) {
+        for (int band = first; band < end; ++band) {
+            mFFTBuffer[2 * band] = pass ? realFFTs[band] : 0.0f;
+            mFFTBuffer[2 * band + 1] = pass ? imagFFTs[band] : 0.0f;
         }
+    };
+    passBands(1, low);
+    passBands(std::max(low, high), last);
 
-        // Invert the FFT into the output buffer
-        InverseRealFFTf(&mFFTBuffer[0], hFFT.get());
-
-        // Overlap-add
-        if (mOutWindow.size() > 0) {
-            float *pOut = &mOutOverlapBuffer[0];
-            float *pWindow = &mOutWindow[0];
-            int *pBitReversed = &hFFT->BitReversed[0];
-            for (unsigned int jj = 0; jj < last; ++jj) {
-                int kk = *pBitReversed++;
-                *pOut++ += mFFTBuffer[kk] * (*pWindow++);
-                *pOut++ += mFFTBuffer[kk + 1] * (*pWindow++);
+    // Apply gain to FFT
+    {
+        const float *pGain = &gains[low];
+        const float *pReal = &realFFTs[low];
+        const float *pImag = &imagFFTs[low];
+        float *pBuffer = &mFFTBuffer[2 * low];
+        auto nn = std::max(0, high - low);
+        if (Choice == NRC_LEAVE_RESIDUE) {
+            for (; nn--;) {
+                // Subtract the gain we would otherwise apply from 1, and
+                // negate that to flip the phase.
+                const double gain = *pGain++ - 1.0;
+                *pBuffer++ = *pReal++ * gain;
+                *pBuffer++ = *pImag++ * gain;
             }
+            mFFTBuffer[0] = dc ? realFFTs[0] * (gains[0] - 1.0f) : 0.0f;
+            // The Fs/2 component is stored as the imaginary part of the DC component
+            mFFTBuffer[1] = nyquist ? imagFFTs[0] * (gains[last] - 1.0f) : 0.0f;
         } else {
-            float *pOut = &mOutOverlapBuffer[0];
-            int *pBitReversed = &hFFT->BitReversed[0];
-            for (unsigned int jj = 0; jj < last; ++jj) {
-                int kk = *pBitReversed++;
-                *pOut++ += mFFTBuffer[kk];
-                *pOut++ += mFFTBuffer[kk + 1];
+            for (; nn--;) {
+                const double gain = *pGain++;
+                *pBuffer++ = *pReal++ * gain;
+                *pBuffer++ = *pImag++ * gain;
             }
+            mFFTBuffer[0] = dc ? realFFTs[0] * gains[0] : pass ? realFFTs[0] : 0.0f;
+            // The Fs/2 component is stored as the imaginary part of the DC component
+            mFFTBuffer[1] = nyquist ? imagFFTs[0] * gains[last] : pass ? imagFFTs[0] : 0.0f;
         }
+    }
 
-        float *buffer = &mOutOverlapBuffer[0];
-        if (mOutStepCount >= 0) {
-            // Output the first portion of the overlap buffer, they're done
-            outputTrack->Append((samplePtr) buffer, floatSample, mStepSize);
-        }
+    // Invert the FFT into the output buffer
+    {
+        NR_TIME_SCOPE(Instrumentation::Stage::InverseFFT);
+        mFFT->Inverse(&mFFTBuffer[0]);
+    }
+
+    // Overlap-add
+    if (OutWindowed) {
+        float *pOut = &mOutOverlapBuffer[0];
+        const float *pIn = &mFFTBuffer[0];
+        const float *pWindow = &mOutWindow[0];
+        for (size_t jj = 0; jj < mWindowSize; ++jj)
+            *pOut++ += *pIn++ * *pWindow++;
+    } else {
+        float *pOut = &mOutOverlapBuffer[0];
+        const float *pIn = &mFFTBuffer[0];
+        for (size_t jj = 0; jj < mWindowSize; ++jj)
+            *pOut++ += *pIn++;
+    }
 
-        // Shift the remainder over.
-        memmove(buffer, buffer + mStepSize, sizeof(float) * (mWindowSize - mStepSize));
-        std::fill(buffer + mWindowSize - mStepSize, buffer + mWindowSize, 0.0f);
+    float *buffer = &mOutOverlapBuffer[0];
+    if (append) {
+        // Output the first portion of the overlap buffer, they're done
+        output->Append(buffer, mStepSize);
     }
+
+    // Shift the remainder over.
+    memmove(buffer, buffer + mStepSize, sizeof(float) * (mWindowSize - mStepSize));
+    std::fill(buffer + mWindowSize - mStepSize, buffer + mWindowSize, 0.0f);
 }
 
 bool EffectNoiseReduction::Worker::ProcessOne
-        (EffectNoiseReduction &effect, Statistics &statistics, TrackFactory &factory,
+        (EffectNoiseReduction &effect, const Statistics &statistics, TrackFactory &factory,
          int count, WaveTrack *track, sampleCount start, sampleCount len) {
     if (track == nullptr)
         return false;
 
-    StartNewTrack();
+    if (mDoProfile) {
+        ProcessTrack(statistics, track, start, len, nullptr);
+        return !mSettings.Cancelled() || effect.Fail(Error::Cancelled);
+    }
+
+    auto outputTrack = factory.NewWaveTrack(track->GetSampleFormat(), track->GetRate());
+    if (!ProcessSegments(statistics, factory, track, start, len, *outputTrack)) {
+        TrackOutput output(*outputTrack);
+        ProcessTrack(statistics, track, start, len, &output);
+    }
+    // Cancelled, the track is left as it was
+    if (mSettings.Cancelled())
+        return effect.Fail(Error::Cancelled);
+
+    // Flush the output WaveTrack (since it's buffered)
+    outputTrack->Flush();
+
+    // Take the output track and insert it in place of the original
+    // sample data (as operated on -- this may not match mT0/mT1)
+    double t0 = outputTrack->LongSamplesToTime(start);
+    double tLen = outputTrack->LongSamplesToTime(len);
+    // Filtering effects always end up with more data than they started with.  Delete this 'tail'.
+    outputTrack->HandleClear(tLen, outputTrack->GetEndTime(), false, false);
+    // Usually the selection is a whole clip, whose samples can simply be
+    // exchanged for the output's, without splitting, copying and merging
+    if (!track->SwapClipSamples(start, len, *outputTrack))
+        track->ClearAndPaste(t0, t0 + tLen, &*outputTrack, true, false);
+
+    return true;
+}
 
-    WaveTrack::Holder outputTrack;
-    if (!mDoProfile)
-        outputTrack = factory.NewWaveTrack(track->GetSampleFormat(), track->GetRate());
+void EffectNoiseReduction::Worker::ProcessTrack
+        (const Statistics &statistics, WaveTrack *track,
+         sampleCount start, sampleCount len, WorkerOutput *output) {
+    ProcessTracks(statistics, &track, start, len, &output);
+}
+
+void EffectNoiseReduction::Worker::ProcessTracks
+        (const Statistics &statistics, WaveTrack *const *tracks,
+         sampleCount start, sampleCount len, WorkerOutput *const *outputs) {
+    StartNewTrack();
 
-    auto bufferSize = track->GetMaxBlockSize();
-    FloatVector buffer(bufferSize);
+    const size_t channels = 1 + mLinked.size();
+    size_t bufferSize = 0;
+    for (size_t cc = 0; cc < channels; ++cc)
+        bufferSize = std::max(bufferSize, tracks[cc]->GetMaxBlockSize());
+    auto &buffer = mTrackBuffer;
+    buffer.resize(channels * bufferSize);
+    mTrackSamples.resize(channels);
 
     auto samplePos = start;
     while (samplePos < start + len) {
         //Get a blockSize of samples (smaller than the size of the buffer)
         const auto blockSize = limitSampleBufferSize(
-                track->GetBestBlockSize(samplePos),
+                tracks[0]->GetBestBlockSize(samplePos),
                 start + len - samplePos
         );
 
-        //Get the samples from the track and put them in the buffer
-        track->Get((samplePtr) &buffer[0], floatSample, samplePos, blockSize);
+        //Read the samples straight from each track's block if it can, else
+        //get them into the buffer
+        for (size_t cc = 0; cc < channels; ++cc) {
+            auto samples = (const float *) tracks[cc]->GetSpan(floatSample, samplePos, blockSize);
+            if (!samples) {
+                float *const channelBuffer = &buffer[cc * bufferSize];
+                tracks[cc]->Get((samplePtr) channelBuffer, floatSample, samplePos, blockSize);
+                samples = channelBuffer;
+            }
+            mTrackSamples[cc] = samples;
+        }
         samplePos += blockSize;
 
         mInSampleCount += blockSize;
-        ProcessSamples(statistics, outputTrack.get(), blockSize, &buffer[0]);
+        ProcessSamples(statistics, outputs, blockSize, &mTrackSamples[0]);
 
+        // Polled once a block, so that a cancelled job gives up its
+        // thread within a block's time; what was done is thrown away
+        if (mSettings.mProgress && !mSettings.mProgress->Advance(channels * blockSize))
+            return;
     }
 
     if (mDoProfile)
-        FinishTrackStatistics(statistics);
+        FinishTrackStatistics(*mGathering);
     else
-        FinishTrack(statistics, &*outputTrack);
-
-    if (!mDoProfile) {
-        // Flush the output WaveTrack (since it's buffered)
-        outputTrack->Flush();
-
-        // Take the output track and insert it in place of the original
-        // sample data (as operated on -- this may not match mT0/mT1)
-        double t0 = outputTrack->LongSamplesToTime(start);
-        double tLen = outputTrack->LongSamplesToTime(len);
-        // Filtering effects always end up with more data than they started with.  Delete this 'tail'.
-        outputTrack->HandleClear(tLen, outputTrack->GetEndTime(), false, false);
-        track->ClearAndPaste(t0, t0 + tLen, &*outputTrack, true, false);
+        FinishTrack(statistics, outputs);
+}
+
+// Reduces [start, start + len) of track as up to mSettings.mThreads
+// segments at once, and appends the result to outputTrack.  Each segment's
+// Worker begins mWarmUpSteps early and reads mLookAheadSteps past the end;
+// of its output only the segment itself is kept, which is then the same as
+// sequential processing would produce.  Returns false, doing nothing, if
+// the track is too short for segments to pay off.
+bool EffectNoiseReduction::Worker::ProcessSegments
+        (const Statistics &statistics, TrackFactory &factory, WaveTrack *track,
+         sampleCount start, sampleCount len, WaveTrack &outputTrack) {
+    const auto stepSize = (long long) mStepSize;
+    const auto totalSteps = (len.as_long_long() + stepSize - 1) / stepSize;
+    // Keep the overlap to a fraction of each segment
+    const auto minSteps = 4 * (long long) (mWarmUpSteps + mLookAheadSteps);
+    const auto numSegments = (size_t) std::min<long long>(mSettings.mThreads, totalSteps / minSteps);
+    // Adapted means depend on the whole track before each window
+    if (numSegments < 2 || mAdapted)
+        return false;
+
+    // Boundaries fall on whole steps, so that all Workers share one window grid
+    std::vector<sampleCount> bounds;
+    for (size_t ii = 0; ii < numSegments; ++ii)
+        bounds.push_back(start + (totalSteps * ii / numSegments) * stepSize);
+    bounds.push_back(start + len);
+
+    std::vector<WaveTrack::Holder> segmentTracks;
+    for (size_t ii = 0; ii < numSegments; ++ii)
+        segmentTracks.push_back(factory.NewWaveTrack(track->GetSampleFormat(), track->GetRate()));
+
+    ForEachInParallel(numSegments, [&](size_t ii) {
+        const auto segmentStart = std::max(start, bounds[ii] - mWarmUpSteps * stepSize);
+        const auto segmentEnd = std::min(start + len, bounds[ii + 1] + mLookAheadSteps * stepSize);
+
+        Worker worker(mSettings, mSampleRate);
+        TrackOutput trackOutput(*segmentTracks[ii]);
+        SegmentOutput output(trackOutput, bounds[ii] - segmentStart, bounds[ii + 1] - bounds[ii]);
+        worker.ProcessTrack(statistics, track, segmentStart, segmentEnd - segmentStart, &output);
+        segmentTracks[ii]->Flush();
+    });
+
+    // Join the segments into one clip
+    outputTrack.Paste(0.0, segmentTracks[0].get());
+    for (size_t ii = 1; ii < numSegments; ++ii)
+        outputTrack.GetClipByIndex(0)->Paste(outputTrack.GetEndTime(), segmentTracks[ii]->GetClipByIndex(0));
+
+    return true;
+}
+
+// Reduces the parts of [start, start + len) of track within ranges, each as
+// ProcessSegments() does a segment, its Worker beginning mWarmUpSteps early
+// on the step grid from start.  The outputs go back into track only once
+// all are made, so that no range reads what another put there.
+void EffectNoiseReduction::Worker::ProcessRanges
+        (const Statistics &statistics, TrackFactory &factory, WaveTrack *track,
+         sampleCount start, sampleCount len, const TimeRanges &ranges) {
+    const auto merged = MergeRanges(*track, start, len, ranges);
+
+    const auto stepSize = (long long) mStepSize;
+    std::vector<WaveTrack::Holder> rangeTracks;
+    for (const auto &bound : merged) {
+        const auto gridStart = start + (bound.first - start).as_long_long() / stepSize * stepSize;
+        const auto rangeStart = std::max(start, gridStart - mWarmUpSteps * stepSize);
+        const auto rangeEnd = std::min(start + len, bound.second + mLookAheadSteps * stepSize);
+
+        rangeTracks.push_back(factory.NewWaveTrack(track->GetSampleFormat(), track->GetRate()));
+        TrackOutput trackOutput(*rangeTracks.back());
+        SegmentOutput output(trackOutput, bound.first - rangeStart, bound.second - bound.first);
+        ProcessTrack(statistics, track, rangeStart, rangeEnd - rangeStart, &output);
+        rangeTracks.back()->Flush();
+        if (mSettings.Cancelled())
+            return;
+    }
+
+    for (size_t ii = 0; ii < merged.size(); ++ii) {
+        const auto rangeLen = merged[ii].second - merged[ii].first;
+        const double t0 = track->LongSamplesToTime(merged[ii].first);
+        const double tLen = track->LongSamplesToTime(rangeLen);
+        if (!track->SwapClipSamples(merged[ii].first, rangeLen, *rangeTracks[ii]))
+            track->ClearAndPaste(t0, t0 + tLen, rangeTracks[ii].get(), true, false);
+    }
+}
+
+std::vector<std::pair<sampleCount, sampleCount>> EffectNoiseReduction::Worker::MergeRanges
+        (const WaveTrack &track, sampleCount start, sampleCount len, const TimeRanges &ranges) {
+    std::vector<std::pair<sampleCount, sampleCount>> bounds;
+    for (const auto &range : ranges) {
+        const auto first = std::max(start, track.TimeToLongSamples(range.first));
+        const auto last = std::min(start + len, track.TimeToLongSamples(range.second));
+        if (first < last)
+            bounds.emplace_back(first, last);
+    }
+    // Those that overlap or touch become one
+    std::sort(bounds.begin(), bounds.end());
+    std::vector<std::pair<sampleCount, sampleCount>> merged;
+    for (const auto &bound : bounds)
+        if (!merged.empty() && bound.first <= merged.back().second)
+            merged.back().second = std::max(merged.back().second, bound.second);
+        else
+            merged.push_back(bound);
+    return merged;
+}
+
+// As ProcessRanges() does one track, with the whole selection as the one
+// range when there are no ranges, except that every channel goes through
+// ProcessTracks() together.  The channels share the first one's times.
+bool EffectNoiseReduction::Worker::ProcessLinked
+        (EffectNoiseReduction &effect, const std::vector<WaveTrack *> &tracks,
+         const Statistics &statistics, TrackFactory &factory, double inT0, double inT1) {
+    assert(tracks.size() == 1 + mLinked.size());
+    for (auto track : tracks)
+        if (!CheckRate(track->GetRate()))
+            return effect.Fail(Error::SampleRate);
+
+    const auto first = tracks[0];
+    const double t0 = std::max(first->GetStartTime(), inT0);
+    const double t1 = std::min(first->GetEndTime(), inT1);
+    if (!(t1 > t0))
+        return true;
+
+    const auto start = first->TimeToLongSamples(t0);
+    const auto len = first->TimeToLongSamples(t1) - start;
+    const auto merged = effect.mRanges
+                        ? MergeRanges(*first, start, len, *effect.mRanges)
+                        : std::vector<std::pair<sampleCount, sampleCount>>{{start, len + start}};
+
+    const auto channels = tracks.size();
+    const auto stepSize = (long long) mStepSize;
+    // For each range, a track of each channel
+    std::vector<WaveTrack::Holder> rangeTracks;
+    std::vector<std::unique_ptr<TrackOutput>> trackOutputs(channels);
+    std::vector<std::unique_ptr<SegmentOutput>> segmentOutputs(channels);
+    std::vector<WorkerOutput *> outputs(channels);
+    for (const auto &bound : merged) {
+        const auto gridStart = start + (bound.first - start).as_long_long() / stepSize * stepSize;
+        const auto rangeStart = std::max(start, gridStart - mWarmUpSteps * stepSize);
+        const auto rangeEnd = std::min(start + len, bound.second + mLookAheadSteps * stepSize);
+
+        for (size_t cc = 0; cc < channels; ++cc) {
+            rangeTracks.push_back(factory.NewWaveTrack(tracks[cc]->GetSampleFormat(), tracks[cc]->GetRate()));
+            trackOutputs[cc] = std::make_unique<TrackOutput>(*rangeTracks.back());
+            segmentOutputs[cc] = std::make_unique<SegmentOutput>(
+                    *trackOutputs[cc], bound.first - rangeStart, bound.second - bound.first);
+            outputs[cc] = segmentOutputs[cc].get();
+        }
+        ProcessTracks(statistics, tracks.data(), rangeStart, rangeEnd - rangeStart, outputs.data());
+        for (size_t cc = 0; cc < channels; ++cc)
+            rangeTracks[rangeTracks.size() - channels + cc]->Flush();
+        // Cancelled, the tracks are left as they were
+        if (mSettings.Cancelled())
+            return effect.Fail(Error::Cancelled);
     }
 
+    for (size_t ii = 0; ii < merged.size(); ++ii) {
+        const auto rangeLen = merged[ii].second - merged[ii].first;
+        for (size_t cc = 0; cc < channels; ++cc) {
+            const auto track = tracks[cc];
+            const auto &rangeTrack = rangeTracks[ii * channels + cc];
+            const double rangeT0 = track->LongSamplesToTime(merged[ii].first);
+            const double tLen = track->LongSamplesToTime(rangeLen);
+            if (!track->SwapClipSamples(merged[ii].first, rangeLen, *rangeTrack))
+                track->ClearAndPaste(rangeT0, rangeT0 + tLen, rangeTrack.get(), true, false);
+        }
+    }
     return true;
 }
@@ -13,8 +13,19 @@
 #ifndef __AUDACITY_EFFECT_NOISE_REDUCTION__
 #define __AUDACITY_EFFECT_NOISE_REDUCTION__
 
+#include <atomic>
+#include <string>
+#include <utility>
+#include <vector>
 #include "MemoryX.h"
 #include "WaveTrack.h"
+#include "sndfile.h"
+
+class SFMemory;
+
+class MemoryAdmission;
+
+class Progress;
 
 class TrackFactory {
 public:
@@ -57,24 +68,380 @@ public:
     bool Init();
     bool Process();
     bool Process(WaveTrack *waveTrack);
+    bool Process(const std::vector<WaveTrack *> &waveTracks);
     bool GetProfile(WaveTrack *track, double t0, double t1, double noiseGain, double sensitivity, double freqSmoothingBands,TrackFactory *factory);
     bool ReduceNoise(WaveTrack *track, double noiseGain, double sensitivity, double freqSmoothingBands, TrackFactory *factory);
+
+    // Reduce long tracks as up to numThreads overlapping segments at once.
+    // The result is the same as with the default of one.
+    void SetThreads(unsigned numThreads);
+
+    // The advanced settings, kept for the calls that follow.  windowSize is a
+    // power of two from 8 to 16384 and stepsPerWindow one from 2 to 64;
+    // windowTypes indexes GetWindowTypesNames() and method is 0 for the
+    // median or 1 for the second greatest.  Profiling and reducing must use
+    // the same window size.  Returns false with a message, changing nothing,
+    // if the combination is not valid.
+    bool SetAdvancedSettings(size_t windowSize, unsigned stepsPerWindow,
+                             int windowTypes, int method);
+
+    // Lets the profile follow noise that drifts through a long recording:
+    // while reducing, each band's mean moves toward the power of the windows
+    // classified as noise in that band, decaying over timeConstant seconds.
+    // Every track or stream starts again from the profile, which itself
+    // stays as taken.  0, the default, keeps the means fixed.  Tracks are not
+    // split for SetThreads() when adapting, the result depending on all that
+    // came before, and nothing adapts when no noise gain is applied.
+    bool SetAdaptiveProfile(double timeConstant);
+
+    // Lets audio at another rate than the profile's be reduced, by
+    // resampling it to the profile's rate on the way in with soxr: tracks
+    // in place before reducing them, so they stay at that rate, and files
+    // as they are streamed, so the output file has that rate too.
+    // PreviewNoise() resamples in the same pass as it decimates.  Off by
+    // default, when other rates fail with Error::SampleRate, as they still
+    // do for buffers in memory and the NoiseReducer.  options may trade
+    // quality for speed, and convert the clips of each track at once.
+    void SetResampling(bool enable, const ResampleOptions &options = {});
+
+    // Keeps the real and imaginary parts of the windows waiting in each
+    // Worker's history in 16 bits, with a scale for each window, instead of
+    // as floats.  With large windows or long attack times the history then
+    // takes about half the memory and stays in cache.  Each part is rounded
+    // to 1/32767 of the largest of its window, some 90 dB below the loudest
+    // band, and the output differs by about that much.  The power that
+    // classification looks at stays exact, and so do the gains.  Off by
+    // default.
+    void SetCompactHistory(bool enable);
+
+    // Counts the samples each call reduces or profiles against progress,
+    // a block at a time, or none with null.  Once it is cancelled the
+    // Workers stop at their next block, and the call fails with
+    // Error::Cancelled, leaving the tracks as they were.  Streamed, the
+    // output file is left unfinished.
+    void SetProgress(Progress *progress);
+
+    // How the channels of one input are classified when reducing.  Unlinked,
+    // each channel's Worker classifies its own power on its own thread.
+    // Linked, one Worker classifies the channels' power combined, and the
+    // one mask, attack, release and frequency smoothing then apply to every
+    // channel, which keeps the stereo image steady; the channels are then
+    // transformed on that one thread, without segments.  MidSide takes the
+    // greater of the power of the sum and of the difference of two
+    // channels, each halved so that uncorrelated noise keeps the level of
+    // the profile; it fails with Error::Settings for more than two channels.
+    // A single channel is never linked.
+    enum class ChannelLink {
+        None,
+        Max,     // the greatest of the channels' power in each band
+        Mean,    // their mean
+        MidSide, // see above
+    };
+    void SetChannelLink(ChannelLink link);
+
+    // Limits the work to the bands from f0 to f1 Hz, either negative for no
+    // bound (the default for both).  Only those bands are profiled,
+    // classified, attacked, released and smoothed; the rest pass through
+    // as they are, or are gone when isolating noise or leaving the
+    // residue.  A profile taken so is of those bands only, and reductions
+    // with it of a range beyond them fail with Error::Settings.  Fails with
+    // Error::Settings unless f0 is below f1.
+    bool SetFrequencyRange(double f0, double f1);
+
+    // The analysis and synthesis windows of each windowTypes choice
+    static std::vector<std::string> GetWindowTypesNames();
+
+    // Multichannel variants, one track per channel.  All channels contribute
+    // to a single profile; when reducing, each channel runs on its own Worker
+    // in its own thread, unless they are linked; see SetChannelLink().
+    bool GetProfile(const std::vector<WaveTrack *> &tracks, double t0, double t1,
+                    double noiseGain, double sensitivity, double freqSmoothingBands, TrackFactory *factory);
+    bool ReduceNoise(const std::vector<WaveTrack *> &tracks,
+                     double noiseGain, double sensitivity, double freqSmoothingBands, TrackFactory *factory);
+
+    // Reduces only some ranges of the tracks, (start, end) in seconds, such
+    // as the speech a voice activity detector found.  Each range comes out
+    // as it would from ReduceNoise(): its Worker starts far enough ahead of
+    // it, on the same grid of steps, and reads on past its end.  The rest of
+    // each track keeps its samples, and blocks wholly outside the ranges are
+    // not written again.  Ranges may overlap and come in any order.  When
+    // adapting, each range adapts afresh from the profile, from a little
+    // before its start.
+    using TimeRanges = std::vector<std::pair<double, double>>;
+    bool ReduceNoiseRanges(const std::vector<WaveTrack *> &tracks, const TimeRanges &ranges,
+                           double noiseGain, double sensitivity, double freqSmoothingBands,
+                           TrackFactory *factory);
+
+    // Streaming variants: samples go from libsndfile through fixed size
+    // buffers into the Workers and back out to libsndfile, never touching
+    // WaveTracks or BlockFiles.  Every channel of the file is processed,
+    // as with the multichannel variants above.  Reading and writing each run
+    // on a thread of their own, overlapping the Workers.
+    bool GetProfileStreaming(const std::string &path, double t0, double t1,
+                             double noiseGain, double sensitivity, double freqSmoothingBands);
+    bool ReduceNoiseStreaming(const std::string &srcPath, const std::string &dstPath,
+                              double noiseGain, double sensitivity, double freqSmoothingBands,
+                              int subformat = 0);
+
+    // The same for the bytes of sound files in memory, as they would be read
+    // from or written to disk, in any format libsndfile reads.  dst is
+    // replaced by a file of the subformat.
+    bool GetProfileMemory(const void *data, size_t bytes, double t0, double t1,
+                          double noiseGain, double sensitivity, double freqSmoothingBands);
+    bool ReduceNoiseMemory(const void *src, size_t srcBytes, std::vector<char> &dst,
+                           double noiseGain, double sensitivity, double freqSmoothingBands,
+                           int subformat = 0);
+
+    // In-memory variants, for audio decoded elsewhere: frames of channels
+    // interleaved samples at rate, read where they are.  out may be in.
+    bool GetProfileBuffer(const float *samples, size_t channels, size_t frames, double rate,
+                          double noiseGain, double sensitivity, double freqSmoothingBands);
+    bool ReduceNoiseBuffer(const float *in, float *out, size_t channels, size_t frames, double rate,
+                           double noiseGain, double sensitivity, double freqSmoothingBands);
+
+    // Streams each (source, destination) pair through its own Workers on a
+    // pool of numThreads threads (0 for one per core), all of them sharing the
+    // current profile.  results gets the outcome and wall time of each pair.
+    // Returns true only if every pair succeeded.  It and ReduceNoiseSweep()
+    // reduce with settings of their own, leaving the effect unchanged.
+    struct BatchResult {
+        bool success;
+        double seconds;
+    };
+    // With admission, each file waits to start until its streamBytes from
+    // EstimateFootprint() fit in the budget.  A Progress counts the frames of
+    // all the files as one stage.
+    bool ReduceNoiseBatch(const std::vector<std::pair<std::string, std::string>> &files,
+                          double noiseGain, double sensitivity, double freqSmoothingBands,
+                          std::vector<BatchResult> &results, unsigned numThreads = 0,
+                          int subformat = 0, MemoryAdmission *admission = nullptr) const;
+
+    // About the bytes that reducing the file at path against the current
+    // profile holds at once, in memory or tmpfs.  Through tracks, as
+    // ReduceNoise() on imported tracks does, that is the samples as
+    // imported (GetFileUncompressedBytes()), again as reduced, and a Worker
+    // per channel.  Streamed, it is only the Workers and the buffers
+    // between the stages, however long the file.  False if there is no
+    // profile or the file can't be opened.
+    struct Footprint {
+        size_t trackBytes;
+        size_t streamBytes;
+    };
+    bool EstimateFootprint(const std::string &path, Footprint &footprint) const;
+
+    // Sweeps of the settings that come after classification, over one file:
+    // reduces srcPath once for each setting, into its dstPath, against the
+    // current profile with one sensitivity.  The first reduction keeps each
+    // channel's noise masks, a bit per band per step, and the rest apply
+    // them instead of classifying again; each output is the same as
+    // reducing with that setting alone.  Attack and release would be swept
+    // the same way.  When adapting the profile, the masks follow the noise
+    // gain, so every setting is classified afresh.  Stops at the first
+    // setting that fails.
+    struct SweepSetting {
+        double noiseGain;
+        double freqSmoothingBands;
+        std::string dstPath;
+    };
+    bool ReduceNoiseSweep(const std::string &srcPath, double sensitivity,
+                          const std::vector<SweepSetting> &settings, int subformat = 0) const;
+
+    // Triage without reducing: measures how much of a file looks like noise
+    // against the current profile.  Every channel is decimated by decimation,
+    // a power of two, and analysed with a window that much shorter but the
+    // same steps, so each FFT is that much less work, and the profile is
+    // scaled to match.  Only the bands below nine tenths of the lowered
+    // Nyquist frequency count, where decimating filters leave the spectrum
+    // as it was, and so too when resampling.  A decimation of 1 classifies just as reducing would, and
+    // may keep the masks.  No synthesis is done either way.
+    struct NoisePreview {
+        // Over all steps of all channels
+        double noiseFraction;
+        // For each channel, for each step of the window that ends there
+        std::vector<std::vector<float>> stepFractions;
+        // With keepMasks, for each channel the steps' masks one after another,
+        // bands long: 1 for each band that is noise, else 0
+        std::vector<std::vector<unsigned char>> stepMasks;
+        size_t bands;
+    };
+    bool PreviewNoise(const std::string &srcPath, unsigned decimation, double sensitivity,
+                      NoisePreview &result, bool keepMasks = false);
+
+    // Profiles built up from many pieces of noise.  MergeProfile() adds the
+    // profile of other to this one, or takes it if there is none, as if the
+    // noise had been profiled here too; merging in any grouping or order
+    // gives the same profile but for rounding.  The profiles must have the
+    // same rate, window size, window types and frequency range.
+    bool MergeProfile(const EffectNoiseReduction &other);
+
+    // Profiles each segment of noise on a pool of numThreads threads (0 for
+    // one per core) and merges them all, in order, into a new profile, the
+    // same whatever the threads
+    struct ProfileSegment {
+        std::string path;
+        double t0;
+        double t1;
+    };
+    bool GetProfileSegments(const std::vector<ProfileSegment> &segments, unsigned numThreads = 0);
+
+    // The noise profile can be kept across runs in a small binary file
+    bool HasProfile() const { return mStatistics != nullptr; }
+    bool SaveProfile(const std::string &path) const;
+    bool LoadProfile(const std::string &path);
+
+    // Profiles of files kept across calls, by a hash of the file's contents,
+    // the time and frequency ranges and the advanced settings that shape
+    // them, so that taking the same noise again only reads the file's
+    // bytes.  They are kept in memory, and with a directory also in a file
+    // each there, for other processes; a changed file hashes to another
+    // profile.  Off until set; returns false, changing nothing, if dir
+    // can't be made.
+    // ClearProfileCache() forgets those in memory.
+    static bool SetProfileCache(bool enable, const std::string &dir = {});
+    static void ClearProfileCache();
+
+    // The profile of path from the cache, or else as GetProfileStreaming()
+    // takes it, cached for next time
+    bool GetProfileCached(const std::string &path, double t0, double t1,
+                          double noiseGain, double sensitivity, double freqSmoothingBands);
+
+    // Why the last call that returned false failed, beyond the message on
+    // std::cerr; None if that is not known
+    enum class Error {
+        None,
+        File,            // an audio or profile file could not be read or written
+        SampleRate,      // the audio and the profile are at different rates
+        ProfileTooShort, // the noise gave no whole window
+        NoProfile,       // there is no profile yet
+        Settings,        // the settings are not valid, or not those of the profile
+        Cancelled,       // the Progress given to SetProgress() was cancelled
+    };
+    Error GetLastError() const { return mLastError; }
+
     class Settings;
 
     class Statistics;
 
+    // A profile is never changed once taken, only replaced, so it can be
+    // shared: an effect given it by UseProfile() reduces with it on another
+    // thread while this one goes on being set, profiling or merging.  Null
+    // if there is none.
+    std::shared_ptr<const Statistics> ShareProfile() const;
+    void UseProfile(std::shared_ptr<const Statistics> profile);
+
 // profile extracting region
     double mT0;
     double mT1;
 
 private:
     class Worker;
+    class NoiseMasks;
+
+    std::unique_ptr<Worker> MakeWorker() const;
+
+    // An effect with a copy of these settings, to reduce with those given,
+    // sharing the profile, for the calls that leave this one unchanged
+    std::unique_ptr<EffectNoiseReduction> MakeReducer(double noiseGain, double sensitivity,
+                                                      double freqSmoothingBands) const;
+
+    // Links the first of the Workers of the channels to the rest, as
+    // SetChannelLink() asks, if reducing more than one; false, failing,
+    // if they can't be linked that way
+    bool LinkWorkers(const std::vector<std::unique_ptr<Worker>> &workers) const;
+
+    // The rate the Workers run at for audio at rate: the profile's when
+    // reducing with SetResampling(), else rate itself
+    double WorkerRate(double rate) const;
+
+    bool StartProcess(double rate);
+    void EndProcess(bool bGoodResult);
+
+    // Frames [start, start + len) of every channel of file go through one
+    // Worker per channel; the result is interleaved into outFile, if any.
+    // With masks, the Workers classify through them, making one for each
+    // channel if there are none yet.
+    bool ProcessStream(SNDFILE *file, const SF_INFO &info, sampleCount start, sampleCount len,
+                       SNDFILE *outFile, sampleFormat outFormat,
+                       std::vector<std::unique_ptr<NoiseMasks>> *masks = nullptr);
+
+    // The same for frames of channels interleaved samples in memory
+    bool ProcessBuffer(const float *in, size_t channels, size_t frames, double rate, float *out);
+
+    // When profiling, each channel's Worker sums into its own statistics,
+    // which FinishChannelStatistics() folds into the profile in order, just
+    // as if the channels had been profiled in turn
+    std::vector<std::unique_ptr<Statistics>> MakeChannelStatistics(
+            const std::vector<std::unique_ptr<Worker>> &workers) const;
+    bool FinishChannelStatistics(const std::vector<std::unique_ptr<Worker>> &workers,
+                                 std::vector<std::unique_ptr<Statistics>> &channelStatistics);
+
+    // Frames [t0, t1) of file, in seconds, become the profile
+    bool GetProfileStream(SNDFILE *file, const SF_INFO &info, double t0, double t1);
+
+    // Reduces all of file into a new file at dstPath, or with dstMemory into
+    // that instead; leaves the effect unchanged
+    bool ReduceStream(SNDFILE *file, const SF_INFO &info, const std::string &dstPath, int subformat,
+                      std::vector<std::unique_ptr<NoiseMasks>> *masks = nullptr,
+                      SFMemory *dstMemory = nullptr);
+
+    // Keeps error, unless the call already failed otherwise, and returns
+    // false; the Workers may call it from their threads
+    bool Fail(Error error) const;
 
     friend class Dialog;
+    friend class NoiseReducer;
 
     TrackFactory *mFactory;
+    // The ranges ReduceNoiseRanges() is reducing, or null for all of mT0..mT1
+    const TimeRanges *mRanges;
     std::unique_ptr<Settings> mSettings;
-    std::unique_ptr<Statistics> mStatistics;
+    std::shared_ptr<const Statistics> mStatistics;
+    // While profiling, mStatistics as it is taken, for the Workers to sum into
+    Statistics *mNewStatistics;
+    mutable std::atomic<Error> mLastError;
+};
+
+// Reduces one channel of live audio against the noise profile of an effect,
+// a buffer of any size at a time.  Process() gives back as many samples as
+// it is given, lagging by GetLatency(): the window size less one step for the
+// overlap, the steps the classification and attack look ahead across, and
+// one step less a sample for buffering.  The first GetLatency() samples out
+// are silence and Flush() gives back the last ones.  Nothing is allocated
+// once the reducer is made.
+class NoiseReducer final {
+public:
+    // Null, with a message, if effect has no profile, it was taken at
+    // another rate or window size, or its frequency range is not within the
+    // profile's.  The profile is shared, so effect need
+    // not outlive the reducer.
+    static std::unique_ptr<NoiseReducer> Create(const EffectNoiseReduction &effect, double rate,
+                                                double noiseGain, double sensitivity,
+                                                double freqSmoothingBands);
+
+    ~NoiseReducer();
+
+    size_t GetLatency() const { return mLatency; }
+
+    // in and out may be the same buffer
+    void Process(const float *in, float *out, size_t len);
+
+    // Writes the GetLatency() samples still held to out, and starts over for
+    // another stream
+    void Flush(float *out);
+
+private:
+    class Queue;
+
+    NoiseReducer(std::unique_ptr<EffectNoiseReduction::Settings> settings,
+                 std::shared_ptr<const EffectNoiseReduction::Statistics> statistics);
+
+    void Start();
+
+    std::unique_ptr<EffectNoiseReduction::Settings> mSettings;
+    std::shared_ptr<const EffectNoiseReduction::Statistics> mStatistics;
+    std::unique_ptr<EffectNoiseReduction::Worker> mWorker;
+    std::unique_ptr<Queue> mQueue;
+    size_t mLatency;
 };
 
 #endif
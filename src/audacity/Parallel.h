@@ -0,0 +1,243 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  Parallel.h
+
+  Running independent pieces of work on threads of their own, for the
+  channels of the noise reduction and of import, handing work from one
+  stage of a pipeline to the next, admitting jobs under a budget of
+  memory, and a pool of threads for work submitted to run later.
+
+**********************************************************************/
+
+#ifndef __AUDACITY_PARALLEL__
+#define __AUDACITY_PARALLEL__
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Calls function(ii) for each ii in [0, count), on count threads at once
+// (the first being this one); rethrows the first exception any of them threw
+template<typename Function>
+void ForEachInParallel(size_t count, const Function &function) {
+    if (count == 1) {
+        function(0);
+        return;
+    }
+
+    std::vector<std::exception_ptr> errors(count);
+    auto guarded = [&](size_t ii) {
+        try {
+            function(ii);
+        } catch (...) {
+            errors[ii] = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(count - 1);
+    for (size_t ii = 1; ii < count; ++ii)
+        threads.emplace_back(guarded, ii);
+    guarded(0);
+    for (auto &thread : threads)
+        thread.join();
+
+    for (const auto &error : errors)
+        if (error)
+            std::rethrow_exception(error);
+}
+
+// A fixed ring of slots between one producing and one consuming thread,
+// for stages that run at once.  The producer fills Back() and Push()es it,
+// waiting while every slot is full, so it gets no further ahead than the
+// ring; the consumer reads Front() and Pop()s it, waiting while none is.
+// The slots are made once and reused, so nothing is allocated per item.
+template<typename T>
+class StagePipe {
+public:
+    explicit StagePipe(size_t slots) : mSlots(slots) {}
+
+    // To size the slots before the stages start
+    std::vector<T> &Slots() { return mSlots; }
+
+    // The slot to fill next, or null once the consumer has Cancel()ed
+    T *Back() {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mChanged.wait(lock, [this] { return mPushed - mPopped < mSlots.size() || mCancelled; });
+        return mCancelled ? nullptr : &mSlots[mPushed % mSlots.size()];
+    }
+
+    void Push() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        ++mPushed;
+        mChanged.notify_all();
+    }
+
+    // The producer is done; Front() returns null once the rest is read
+    void Close() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mClosed = true;
+        mChanged.notify_all();
+    }
+
+    // The slot to read next, or null once the pipe is closed and empty
+    T *Front() {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mChanged.wait(lock, [this] { return mPushed > mPopped || mClosed; });
+        return mPushed > mPopped ? &mSlots[mPopped % mSlots.size()] : nullptr;
+    }
+
+    void Pop() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        ++mPopped;
+        mChanged.notify_all();
+    }
+
+    // The consumer will read no more; Back() returns null from now on
+    void Cancel() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mCancelled = true;
+        mChanged.notify_all();
+    }
+
+private:
+    std::vector<T> mSlots;
+    std::mutex mMutex;
+    std::condition_variable mChanged;
+    // Counts of slots ever pushed and popped
+    size_t mPushed{0}, mPopped{0};
+    bool mClosed{false}, mCancelled{false};
+};
+
+// Admits jobs while the bytes they are expected to hold at once fit in a
+// budget, in the order they ask; a job waits until enough of those before
+// it are done.  A job larger than the whole budget is admitted once it
+// would be alone.  A budget of 0 admits everything at once.
+class MemoryAdmission {
+public:
+    explicit MemoryAdmission(size_t budget) : mBudget(budget) {}
+
+    // Held while the job runs; gives its bytes back when destroyed
+    class Ticket {
+    public:
+        Ticket(Ticket &&other) noexcept : mAdmission(other.mAdmission), mBytes(other.mBytes) {
+            other.mAdmission = nullptr;
+        }
+
+        Ticket &operator=(Ticket &&) = delete;
+
+        ~Ticket() {
+            if (mAdmission)
+                mAdmission->Release(mBytes);
+        }
+
+    private:
+        friend class MemoryAdmission;
+
+        Ticket(MemoryAdmission *admission, size_t bytes) : mAdmission(admission), mBytes(bytes) {}
+
+        MemoryAdmission *mAdmission;
+        const size_t mBytes;
+    };
+
+    Ticket Admit(size_t bytes) {
+        std::unique_lock<std::mutex> lock(mMutex);
+        const auto turn = mNextTurn++;
+        mChanged.wait(lock, [&] {
+            return turn == mServing &&
+                   (mBudget == 0 || mAdmitted == 0 || mAdmitted + bytes <= mBudget);
+        });
+        ++mServing;
+        mAdmitted += bytes;
+        mChanged.notify_all();
+        return Ticket{this, bytes};
+    }
+
+    size_t GetBudget() const { return mBudget; }
+
+    // Whether a job of bytes fits in the budget at all
+    bool Fits(size_t bytes) const { return mBudget == 0 || bytes <= mBudget; }
+
+    size_t GetAdmitted() const {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mAdmitted;
+    }
+
+private:
+    void Release(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mAdmitted -= bytes;
+        mChanged.notify_all();
+    }
+
+    const size_t mBudget;
+    mutable std::mutex mMutex;
+    std::condition_variable mChanged;
+    size_t mAdmitted{0};
+    // Turns taken by Admit() and the one being served, for the order
+    size_t mNextTurn{0}, mServing{0};
+};
+
+// Threads that stay, each taking the next task submitted, for work that
+// outlives the call submitting it.  Tasks run in the order they were
+// submitted, as many at once as there are threads, and must not throw.
+// The destructor waits for the tasks already submitted.
+class TaskPool {
+public:
+    explicit TaskPool(size_t threads) {
+        mThreads.reserve(threads);
+        for (size_t ii = 0; ii < threads; ++ii)
+            mThreads.emplace_back([this] { Run(); });
+    }
+
+    ~TaskPool() {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStopping = true;
+        }
+        mChanged.notify_all();
+        for (auto &thread : mThreads)
+            thread.join();
+    }
+
+    void Submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mTasks.push_back(std::move(task));
+        }
+        mChanged.notify_one();
+    }
+
+    size_t GetThreads() const { return mThreads.size(); }
+
+private:
+    void Run() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mChanged.wait(lock, [this] { return mStopping || !mTasks.empty(); });
+                if (mTasks.empty())
+                    return;
+                task = std::move(mTasks.front());
+                mTasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::mutex mMutex;
+    std::condition_variable mChanged;
+    std::deque<std::function<void()>> mTasks;
+    bool mStopping{false};
+    std::vector<std::thread> mThreads;
+};
+
+#endif
@@ -0,0 +1,79 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  Progress.h
+
+  How far long work has got, polled once per block by import, the noise
+  reduction and export, which stop early once it is cancelled.
+
+**********************************************************************/
+
+#ifndef __AUDACITY_PROGRESS__
+#define __AUDACITY_PROGRESS__
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <utility>
+
+// Shared by the threads of one job, and by whoever may cancel it from
+// another.  Each stage of the job starts it over with Begin() and then
+// counts its work with Advance(), so the fraction reported is of the
+// stage under way.
+class Progress {
+public:
+    // Called with the fraction of the stage done, one call at a time, from
+    // whichever thread advanced it; returning false cancels
+    using Callback = std::function<bool(double fraction)>;
+
+    Progress() = default;
+
+    explicit Progress(Callback callback) : mCallback(std::move(callback)) {}
+
+    // From any thread; the work stops at its next block
+    void Cancel() { mCancelled = true; }
+
+    bool IsCancelled() const { return mCancelled; }
+
+    // A stage of total units of work starts
+    void Begin(double total) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mTotal = total;
+        mDone = 0.0;
+        mReported = -1.0;
+        Report(0.0);
+    }
+
+    // done more units of work are done; false once cancelled.  The
+    // callback hears of every hundredth of the stage, not every block.
+    bool Advance(double done) {
+        if (mCancelled)
+            return false;
+        std::lock_guard<std::mutex> lock(mMutex);
+        mDone += done;
+        const double fraction = mTotal > 0.0 ? std::min(1.0, mDone / mTotal) : 1.0;
+        if (fraction >= mReported + reportStep || (fraction == 1.0 && mReported < 1.0))
+            Report(fraction);
+        return !mCancelled;
+    }
+
+private:
+    static constexpr double reportStep = 0.01;
+
+    void Report(double fraction) {
+        mReported = fraction;
+        if (mCallback && !mCallback(fraction))
+            mCancelled = true;
+    }
+
+    const Callback mCallback;
+    std::atomic<bool> mCancelled{false};
+    std::mutex mMutex;
+    double mTotal{0.0};
+    double mDone{0.0};
+    double mReported{-1.0};
+};
+
+#endif
@@ -9,22 +9,34 @@ struct FFTParam {
    ArrayOf<int> BitReversed;
    ArrayOf<fft_type> SinTable;
    size_t Points;
-#ifdef EXPERIMENTAL_EQ_SSE_THREADED
-   int pow2Bits;
-#endif
-};
-
-struct FFTDeleter{
-   void operator () (FFTParam *p) const;
 };
 
-using HFFT = std::unique_ptr<
-   FFTParam, FFTDeleter
->;
+// Tables are cached for the life of the process and shared by size
+using HFFT = std::shared_ptr<const FFTParam>;
 
 HFFT GetFFT(size_t);
 void RealFFTf(fft_type *, const FFTParam *);
 void InverseRealFFTf(fft_type *, const FFTParam *);
+// The same transforms with spectrum and samples in natural order; scratch
+// holds as many values as buffer
+void RealFFTfNatural(fft_type *buffer, fft_type *scratch, const FFTParam *);
+void InverseRealFFTfNatural(fft_type *buffer, fft_type *scratch, const FFTParam *);
+
+// Forward transforms of count frames, each in place as by RealFFTfNatural
+// and identical to it, done FFTBatchFrames at a time with the vector lanes
+// running across frames.  scratch holds FFTBatchFrames frames' values.
+const size_t FFTBatchFrames = 8;
+void RealFFTfNaturalBatch(fft_type *const *frames, size_t count, fft_type *scratch, const FFTParam *);
+
+// The butterflies run on the fastest vector kernel the CPU supports unless
+// another is chosen, for instance to compare speeds.  Every kernel gives
+// results identical to Scalar, in the same bit-reversed layout.
+enum class FFTKernel { Scalar, SSE2, AVX, AVX512, NEON };
+bool FFTKernelSupported(FFTKernel kernel);
+FFTKernel GetFFTKernel();
+// Returns false, changing nothing, if the kernel is not supported here
+bool SetFFTKernel(FFTKernel kernel);
+
 void ReorderToTime(const FFTParam *hFFT, const fft_type *buffer, fft_type *TimeOut);
 void ReorderToFreq(const FFTParam *hFFT, const fft_type *buffer,
 		   fft_type *RealOut, fft_type *ImagOut);
@@ -168,8 +168,9 @@ size_t EnumSetting::Find( const std::string &value ) const
          - mSymbols );
 }
 
-Resample::Resample(const bool useBestMethod, const double dMinFactor, const double dMaxFactor) {
-    this->SetMethod(useBestMethod);
+Resample::Resample(const bool useBestMethod, const double dMinFactor, const double dMaxFactor,
+                   const ResampleOptions &options) {
+    this->SetMethod(useBestMethod, options.method);
     soxr_quality_spec_t q_spec;
     if (dMinFactor == dMaxFactor) {
         mbWantConstRateResampling = true; // constant rate resampling
@@ -258,8 +259,10 @@ Resample::Process(double factor,
     return {idone, odone};
 }
 
-void Resample::SetMethod(const bool useBestMethod) {
-    if (useBestMethod)
+void Resample::SetMethod(const bool useBestMethod, int method) {
+    if (method >= 0 && method < (int) numMethods)
+        mMethod = method;
+    else if (useBestMethod)
         mMethod = BestMethodSetting.ReadInt();
     else
         mMethod = FastMethodSetting.ReadInt();
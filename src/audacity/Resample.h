@@ -27,6 +27,17 @@ struct soxr_deleter {
 };
 using soxrHandle = std::unique_ptr<soxr, soxr_deleter>;
 
+// How a conversion is done, beyond its factors
+struct ResampleOptions
+{
+   // One of the method settings' codes, from 0 (Low Quality, fastest) to 3
+   // (Best Quality, slowest), or -1 for the setting useBestMethod picks
+   int method{ -1 };
+   // Clips of a track converted at once by WaveTrack::Resample(), 0 for one
+   // per core.  Each clip is still one mono soxr stream, on one thread.
+   unsigned threads{ 1 };
+};
+
 class Resample final
 {
  public:
@@ -40,7 +51,8 @@ class Resample final
    /// the fast method.
    // dMinFactor and dMaxFactor specify the range of factors for variable-rate resampling.
    // For constant-rate, pass the same value for both.
-   Resample(const bool useBestMethod, const double dMinFactor, const double dMaxFactor);
+   Resample(const bool useBestMethod, const double dMinFactor, const double dMaxFactor,
+            const ResampleOptions &options = {});
    ~Resample();
 
    static EncodedEnumSetting FastMethodSetting;
@@ -77,7 +89,7 @@ class Resample final
                         size_t  outBufferLen);
 
  protected:
-   void SetMethod(const bool useBestMethod);
+   void SetMethod(const bool useBestMethod, int method);
 
  protected:
    int   mMethod; // resampler-specific enum for resampling method
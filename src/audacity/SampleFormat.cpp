@@ -35,10 +35,17 @@
 *//*******************************************************************/
 
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "SampleFormat.h"
 #include "Dither.h"
 
@@ -99,3 +106,144 @@ void CopySamples(samplePtr src, sampleFormat srcFormat,
       highQuality ? gHighQualityDither : gLowQualityDither,
       src, srcFormat, dst, dstFormat, len, srcStride, dstStride);
 }
+
+// The frames that are whole vectors, done with loads, shuffles and stores
+// alone, so that any 32 bit samples can pass through as floats.  Returns how
+// many were done.
+static size_t DeinterleaveVectors(const float *src, unsigned channels,
+                                  float *const *dst, size_t frames)
+{
+   size_t j = 0;
+#if defined(__SSE2__)
+   if (channels == 2) {
+      for (; j + 4 <= frames; j += 4, src += 8) {
+         const __m128 lo = _mm_loadu_ps(src), hi = _mm_loadu_ps(src + 4);
+         _mm_storeu_ps(dst[0] + j, _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+         _mm_storeu_ps(dst[1] + j, _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+      }
+   }
+   else if (channels == 4 || channels == 8) {
+      // Transpose 4 frames by 4 channels at a time
+      for (; j + 4 <= frames; j += 4, src += 4 * channels)
+         for (unsigned c = 0; c < channels; c += 4) {
+            __m128 r0 = _mm_loadu_ps(src + c);
+            __m128 r1 = _mm_loadu_ps(src + channels + c);
+            __m128 r2 = _mm_loadu_ps(src + 2 * channels + c);
+            __m128 r3 = _mm_loadu_ps(src + 3 * channels + c);
+            _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+            _mm_storeu_ps(dst[c] + j, r0);
+            _mm_storeu_ps(dst[c + 1] + j, r1);
+            _mm_storeu_ps(dst[c + 2] + j, r2);
+            _mm_storeu_ps(dst[c + 3] + j, r3);
+         }
+   }
+#elif defined(__ARM_NEON)
+   if (channels == 2) {
+      for (; j + 4 <= frames; j += 4, src += 8) {
+         const float32x4x2_t v = vld2q_f32(src);
+         vst1q_f32(dst[0] + j, v.val[0]);
+         vst1q_f32(dst[1] + j, v.val[1]);
+      }
+   }
+   else if (channels == 4) {
+      for (; j + 4 <= frames; j += 4, src += 16) {
+         const float32x4x4_t v = vld4q_f32(src);
+         for (unsigned c = 0; c < 4; c++)
+            vst1q_f32(dst[c] + j, v.val[c]);
+      }
+   }
+   else if (channels == 8) {
+      // Each vld4q takes two frames, channel c and c + 4 alternating
+      for (; j + 4 <= frames; j += 4, src += 32) {
+         const float32x4x4_t a = vld4q_f32(src), b = vld4q_f32(src + 16);
+         for (unsigned c = 0; c < 4; c++) {
+            const float32x4x2_t v = vuzpq_f32(a.val[c], b.val[c]);
+            vst1q_f32(dst[c] + j, v.val[0]);
+            vst1q_f32(dst[c + 4] + j, v.val[1]);
+         }
+      }
+   }
+#endif
+   return j;
+}
+
+template<typename T>
+static void DeinterleaveRest(const T *src, unsigned channels,
+                             T *const *dst, size_t j, size_t frames)
+{
+   for (src += j * channels; j < frames; j++, src += channels)
+      for (unsigned c = 0; c < channels; c++)
+         dst[c][j] = src[c];
+}
+
+void DeinterleaveSamples(const float *src, unsigned channels,
+                         float *const *dst, size_t frames)
+{
+   const auto j = DeinterleaveVectors(src, channels, dst, frames);
+   DeinterleaveRest(src, channels, dst, j, frames);
+}
+
+void DeinterleaveSamples(const int *src, unsigned channels,
+                         int *const *dst, size_t frames)
+{
+   const auto j = DeinterleaveVectors((const float *) src, channels,
+                                      (float *const *) dst, frames);
+   DeinterleaveRest(src, channels, dst, j, frames);
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define INT24_BIG_ENDIAN 1
+#else
+#define INT24_BIG_ENDIAN 0
+#endif
+
+void PackInt24(const int *src, char *dst, size_t len)
+{
+   size_t i = 0;
+#if !INT24_BIG_ENDIAN
+   // Four samples make three whole words
+   for (; i + 4 <= len; i += 4, src += 4, dst += 12) {
+      const uint32_t a = src[0], b = src[1], c = src[2], d = src[3];
+      const uint32_t words[3] = {
+         (a & 0xffffff) | (b << 24),
+         ((b >> 8) & 0xffff) | (c << 16),
+         ((c >> 16) & 0xff) | (d << 8),
+      };
+      memcpy(dst, words, sizeof(words));
+   }
+#endif
+   for (; i < len; i++, src++, dst += 3) {
+      const uint32_t v = *src;
+#if INT24_BIG_ENDIAN
+      dst[0] = (char) (v >> 16), dst[1] = (char) (v >> 8), dst[2] = (char) v;
+#else
+      dst[0] = (char) v, dst[1] = (char) (v >> 8), dst[2] = (char) (v >> 16);
+#endif
+   }
+}
+
+void UnpackInt24(const char *src, int *dst, size_t len)
+{
+   // Shifting the 24 bits to the top and back extends the sign
+   auto extend = [](uint32_t v) { return (int32_t) (v << 8) >> 8; };
+   const auto bytes = (const unsigned char *) src;
+   size_t i = 0;
+#if !INT24_BIG_ENDIAN
+   for (; i + 4 <= len; i += 4, dst += 4) {
+      uint32_t words[3];
+      memcpy(words, bytes + 3 * i, sizeof(words));
+      dst[0] = extend(words[0]);
+      dst[1] = extend((words[0] >> 24) | (words[1] << 8));
+      dst[2] = extend((words[1] >> 16) | (words[2] << 16));
+      dst[3] = (int32_t) words[2] >> 8;
+   }
+#endif
+   for (; i < len; i++, dst++) {
+      const auto p = bytes + 3 * i;
+#if INT24_BIG_ENDIAN
+      *dst = extend((p[0] << 16) | (p[1] << 8) | p[2]);
+#else
+      *dst = extend(p[0] | (p[1] << 8) | (p[2] << 16));
+#endif
+   }
+}
@@ -13,6 +13,7 @@
 
 #include "Audacity.h"
 #include "MemoryX.h"
+#include "Instrumentation.h"
 
 #include "Types.h"
 
@@ -55,7 +56,10 @@ public:
             : mPtr(0) {}
 
     SampleBuffer(size_t count, sampleFormat format)
-            : mPtr((samplePtr) malloc(count * SAMPLE_SIZE(format))) {}
+            : mPtr((samplePtr) malloc(count * SAMPLE_SIZE(format))) {
+        NR_COUNT(Allocations, 1);
+        NR_COUNT(AllocatedBytes, count * SAMPLE_SIZE(format));
+    }
 
     ~SampleBuffer() {
         Free();
@@ -65,6 +69,8 @@ public:
     SampleBuffer &Allocate(size_t count, sampleFormat format) {
         Free();
         mPtr = (samplePtr) malloc(count * SAMPLE_SIZE(format));
+        NR_COUNT(Allocations, 1);
+        NR_COUNT(AllocatedBytes, count * SAMPLE_SIZE(format));
         return *this;
     }
 
@@ -124,6 +130,20 @@ void CopySamples(samplePtr src, sampleFormat srcFormat,
                  unsigned int srcStride = 1,
                  unsigned int dstStride = 1);
 
+// Splits frames of channels interleaved samples in src into the channels
+// arrays of dst, four frames at a time where SSE2 or NEON is there for 2, 4
+// and 8 channels
+void DeinterleaveSamples(const float *src, unsigned channels,
+                         float *const *dst, size_t frames);
+// The same for int24Sample samples
+void DeinterleaveSamples(const int *src, unsigned channels,
+                         int *const *dst, size_t frames);
+
+// Packs len int24Sample samples into 3 bytes each in native byte order, as
+// on disk, and back again with the sign extended, four samples at a time
+void PackInt24(const int *src, char *dst, size_t len);
+void UnpackInt24(const char *src, int *dst, size_t len);
+
 // These are so commonly done for processing samples in floating point form in memory,
 // let's have abbeviations.
 using Floats = ArrayOf<float>;
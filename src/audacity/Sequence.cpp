@@ -35,14 +35,16 @@
 #include "Utils.h"
 #include "BlockFile.h"
 #include "SilentBlockFile.h"
+#include "Parallel.h"
 
 #include <algorithm>
+#include <atomic>
 #include <float.h>
 #include <math.h>
 #include <cstring>
 #include <iostream>
+#include <thread>
 
-size_t Sequence::sMaxDiskBlockSize = 1048576;
 
 namespace {
     inline bool Overflows(double numSamples) {
@@ -52,7 +54,8 @@ namespace {
 
 // Sequence methods
 Sequence::Sequence(const std::shared_ptr<DirManager> &projDirManager, sampleFormat format)
-        : mSampleFormat(format), mMinSamples(Sequence::sMaxDiskBlockSize / SAMPLE_SIZE(mSampleFormat) / 2),
+        : mSampleFormat(format),
+          mMinSamples(projDirManager->GetMaxBlockBytes() / SAMPLE_SIZE(mSampleFormat) / 2),
           mMaxSamples(mMinSamples * 2),
           mDirManager(projDirManager) {
 }
@@ -107,6 +110,23 @@ bool Sequence::Get(int b, samplePtr buffer, sampleFormat format,
     return result;
 }
 
+constSamplePtr Sequence::GetSpan(sampleFormat format,
+                                 sampleCount start, size_t len) const {
+    if (len == 0 || start < 0 || start + len > mNumSamples)
+        return nullptr;
+
+    const SeqBlock &block = mBlock[FindBlock(start)];
+    const auto bstart = (start - block.start).as_size_t();
+    if (bstart + len > block.f->GetLength())
+        return nullptr;
+
+    sampleFormat blockFormat;
+    const auto data = block.f->GetSampleData(blockFormat);
+    if (!data || blockFormat != format)
+        return nullptr;
+    return data + bstart * SAMPLE_SIZE(format);
+}
+
 namespace {
     void ensureSampleBufferSize(SampleBuffer &buffer, sampleFormat format,
                                 size_t &size, size_t required,
@@ -286,8 +306,7 @@ void Sequence::Append(samplePtr buffer, sampleFormat format,
     int numBlocks = mBlock.size();
     SeqBlock *pLastBlock;
     decltype(pLastBlock->f->GetLength()) length;
-    size_t bufferSize = mMaxSamples;
-    SampleBuffer buffer2(bufferSize, mSampleFormat);
+    auto &buffer2 = mAppendScratch;
     bool replaceLast = false;
     if (numBlocks > 0 &&
         (length =
@@ -296,6 +315,7 @@ void Sequence::Append(samplePtr buffer, sampleFormat format,
         const SeqBlock &lastBlock = *pLastBlock;
         const auto addLen = std::min(mMaxSamples - length, len);
 
+        buffer2.Resize(mMaxSamples, mSampleFormat);
         Read(buffer2.ptr(), mSampleFormat, lastBlock, 0, length, true);
 
         CopySamples(buffer,
@@ -321,35 +341,43 @@ void Sequence::Append(samplePtr buffer, sampleFormat format,
         replaceLast = true;
     }
     // Append the rest as NEW blocks
-    while (len) {
-        const auto idealSamples = GetIdealBlockSize();
-        const auto addedLen = std::min(idealSamples, len);
-        BlockFilePtr pFile;
-        if (format == mSampleFormat) {
-            pFile = mDirManager->NewSimpleBlockFile(
-                    buffer, addedLen, mSampleFormat);
-        } else {
-            CopySamples(buffer, format, buffer2.ptr(), mSampleFormat, addedLen);
-            pFile = mDirManager->NewSimpleBlockFile(
-                    buffer2.ptr(), addedLen, mSampleFormat);
+    const auto idealSamples = GetIdealBlockSize();
+    std::vector<size_t> lengths;
+    for (auto rest = len; rest;) {
+        lengths.push_back(std::min(idealSamples, rest));
+        rest -= lengths.back();
+    }
+    std::vector<BlockFilePtr> files(lengths.size());
+    // Compressing blocks is slow enough to be worth a thread each
+    size_t numThreads = 1;
+    if (mDirManager->GetCompression())
+        numThreads = std::min<size_t>(lengths.size(),
+                                      std::max(1u, std::thread::hardware_concurrency()));
+    std::atomic<size_t> next{0};
+    ForEachInParallel(numThreads, [&](size_t thread) {
+        // Each thread but this one converts into a buffer of its own
+        GrowableSampleBuffer ownBuffer;
+        for (size_t ii; (ii = next++) < lengths.size();) {
+            const auto source = buffer + ii * idealSamples * SAMPLE_SIZE(format);
+            if (format == mSampleFormat)
+                files[ii] = mDirManager->NewSimpleBlockFile(
+                        source, lengths[ii], mSampleFormat);
+            else {
+                auto &converted = thread == 0 ? buffer2 : ownBuffer;
+                converted.Resize(mMaxSamples, mSampleFormat);
+                CopySamples(source, format, converted.ptr(), mSampleFormat, lengths[ii]);
+                files[ii] = mDirManager->NewSimpleBlockFile(
+                        converted.ptr(), lengths[ii], mSampleFormat);
+            }
         }
-
-        newBlock.push_back(SeqBlock(pFile, newNumSamples));
-
-        buffer += addedLen * SAMPLE_SIZE(format);
-        newNumSamples += addedLen;
-        len -= addedLen;
+    });
+    for (size_t ii = 0; ii < files.size(); ++ii) {
+        newBlock.push_back(SeqBlock(files[ii], newNumSamples));
+        newNumSamples += lengths[ii];
     }
 
     AppendBlocksIfConsistent(newBlock, replaceLast,
                              newNumSamples, "Append");
-
-// JKC: During generate we use Append again and again.
-// If generating a long sequence this test would give O(n^2)
-// performance - not good!
-#ifdef VERY_SLOW_CHECKING
-    ConsistencyCheck(wxT("Append"));
-#endif
 }
 
 sampleFormat Sequence::GetSampleFormat() const {
@@ -442,7 +470,7 @@ void Sequence::Delete(sampleCount start, sampleCount len)
 
         // This consistency check won't throw, it asserts.
         // Proof that we kept consistency is not hard.
-        ConsistencyCheck("Delete - branch one", false);
+        Validate(mBlock, 0, mNumSamples, "Delete - branch one", false);
         return;
     }
 
@@ -595,10 +623,12 @@ void Sequence::Paste(sampleCount s, const Sequence *src)
         // Build and swap a copy so there is a strong exception safety guarantee
         BlockArray newBlock{mBlock};
         sampleCount samples = mNumSamples;
-        for (unsigned int i = 0; i < srcNumBlocks; i++)
-            // AppendBlock may throw for limited disk space, if pasting from
+        for (unsigned int i = 0; i < srcNumBlocks; i++) {
+            // AppendBlockOf may throw for limited disk space, if pasting from
             // one project into another.
-            AppendBlock(*mDirManager, newBlock, samples, srcBlock[i]);
+            AppendBlockOf(srcBlock[i], newBlock, samples);
+            samples += srcBlock[i].f->GetLength();
+        }
         // Increase ref count or duplicate file
 
         CommitChangesIfConsistent
@@ -651,7 +681,7 @@ void Sequence::Paste(sampleCount s, const Sequence *src)
 
         // This consistency check won't throw, it asserts.
         // Proof that we kept consistency is not hard.
-        ConsistencyCheck("Paste branch two", false);
+        Validate(mBlock, 0, mNumSamples, "Paste branch two", false);
         return;
     }
 
@@ -716,9 +746,7 @@ void Sequence::Paste(sampleCount s, const Sequence *src)
 
         for (i = 2; i < srcNumBlocks - 2; i++) {
             const SeqBlock &block = srcBlock[i];
-            auto file = mDirManager->CopyBlockFile(block.f);
-            // We can assume file is not null
-            newBlock.push_back(SeqBlock(file, block.start + s));
+            AppendBlockOf(block, newBlock, block.start + s);
         }
 
         auto lastStart = penultimate.start;
@@ -742,6 +770,10 @@ void Sequence::Paste(sampleCount s, const Sequence *src)
 
 std::unique_ptr<Sequence> Sequence::Copy(sampleCount s0, sampleCount s1) const {
     auto dest = std::make_unique<Sequence>(mDirManager, mSampleFormat);
+    // With blocks of this size, whatever the DirManager's now, so that they
+    // can be shared
+    dest->mMinSamples = mMinSamples;
+    dest->mMaxSamples = mMaxSamples;
     if (s0 >= s1 || s0 >= mNumSamples || s1 < 0) {
         return dest;
     }
@@ -800,7 +832,7 @@ std::unique_ptr<Sequence> Sequence::Copy(sampleCount s0, sampleCount s1) const {
         // Increase ref count or duplicate file
     }
 
-    dest->ConsistencyCheck("Sequence::Copy()");
+    dest->Validate(dest->mBlock, 0, dest->mNumSamples, "Sequence::Copy()");
 
     return dest;
 }
@@ -813,6 +845,16 @@ int Sequence::FindBlock(sampleCount pos) const {
 
     int numBlocks = mBlock.size();
 
+    const auto last = mLastBlock.load(std::memory_order_relaxed);
+    for (auto b = last; b < std::min(last + 2, mBlock.size()); ++b) {
+        const SeqBlock &block = mBlock[b];
+        if (pos >= block.start && pos < block.start + block.f->GetLength()) {
+            if (b != last)
+                mLastBlock.store(b, std::memory_order_relaxed);
+            return b;
+        }
+    }
+
     size_t lo = 0, hi = numBlocks, guess;
     sampleCount loSamples = 0, hiSamples = mNumSamples;
 
@@ -849,6 +891,7 @@ int Sequence::FindBlock(sampleCount pos) const {
            pos >= mBlock[rval].start &&
            pos < mBlock[rval].start + mBlock[rval].f->GetLength());
 
+    mLastBlock.store(guess, std::memory_order_relaxed);
     return rval;
 }
 
@@ -913,9 +956,10 @@ void Sequence::AppendBlocksIfConsistent
     std::copy(additionalBlocks.begin(), additionalBlocks.end(),
               std::back_inserter(mBlock));
 
-    // Check consistency only of the blocks that were added,
-    // avoiding quadratic time for repeated checking of repeating appends
-    ConsistencyCheck(mBlock, mMaxSamples, prevSize, numSamples, whereStr); // may throw
+    // Check consistency only of the blocks that were added, unless asked
+    // for more, avoiding quadratic time for repeated checking of repeating
+    // appends
+    Validate(mBlock, prevSize, numSamples, whereStr); // may throw
 
     // now commit
     // use NOFAIL-GUARANTEE
@@ -928,6 +972,40 @@ void Sequence::ConsistencyCheck(const char *whereStr, bool mayThrow) const {
     ConsistencyCheck(mBlock, mMaxSamples, 0, mNumSamples, whereStr, mayThrow);
 }
 
+namespace {
+std::atomic<Sequence::Validation> sValidation{
+#ifdef NDEBUG
+        Sequence::Validation::Off
+#else
+        Sequence::Validation::NewBlocks
+#endif
+};
+}
+
+void Sequence::SetValidation(Validation validation) {
+    sValidation = validation;
+}
+
+Sequence::Validation Sequence::GetValidation() {
+    return sValidation;
+}
+
+void Sequence::Validate(const BlockArray &block, size_t from, sampleCount numSamples,
+                        const char *whereStr, bool mayThrow) const {
+    switch (sValidation.load(std::memory_order_relaxed)) {
+        case Validation::Off:
+            // The last block alone: its start is taken as right
+            from = std::max(from, block.empty() ? 0 : block.size() - 1);
+            break;
+        case Validation::NewBlocks:
+            break;
+        case Validation::Full:
+            from = 0;
+            break;
+    }
+    ConsistencyCheck(block, mMaxSamples, from, numSamples, whereStr, mayThrow);
+}
+
 void Sequence::ConsistencyCheck
         (const BlockArray &mBlock, size_t maxSamples, size_t from,
          sampleCount mNumSamples, const char *whereStr,
@@ -1001,7 +1079,7 @@ void Sequence::Blockify
 
 void Sequence::CommitChangesIfConsistent
         (BlockArray &newBlock, sampleCount numSamples, const char *whereStr) {
-    ConsistencyCheck(newBlock, mMaxSamples, 0, numSamples, whereStr); // may throw
+    Validate(newBlock, 0, numSamples, whereStr); // may throw
 
     // now commit
     // use NOFAIL-GUARANTEE
@@ -1017,6 +1095,9 @@ bool Sequence::ConvertToSampleFormat(sampleFormat format)
         // no change
         return false;
 
+    // Its size was counted in samples of the old format
+    mAppendScratch.Free();
+
     if (mBlock.size() == 0) {
         mSampleFormat = format;
         return true;
@@ -1027,7 +1108,7 @@ bool Sequence::ConvertToSampleFormat(sampleFormat format)
 
     const auto oldMinSamples = mMinSamples, oldMaxSamples = mMaxSamples;
     // These are the same calculations as in the constructor.
-    mMinSamples = sMaxDiskBlockSize / SAMPLE_SIZE(mSampleFormat) / 2;
+    mMinSamples = mDirManager->GetMaxBlockBytes() / SAMPLE_SIZE(mSampleFormat) / 2;
     mMaxSamples = mMinSamples * 2;
 
     bool bSuccess = false;
@@ -1091,6 +1172,20 @@ bool Sequence::ConvertToSampleFormat(sampleFormat format)
     return true;
 }
 
+void Sequence::AppendBlockOf(const SeqBlock &b, BlockArray &blocks, sampleCount start) const {
+    const auto len = b.f->GetLength();
+    if (len <= mMaxSamples) {
+        // Bump ref count if not locked, else copy
+        blocks.push_back(SeqBlock(mDirManager->CopyBlockFile(b.f), start));
+        return;
+    }
+
+    // From a sequence with larger blocks
+    SampleBuffer buffer(len, mSampleFormat);
+    Read(buffer.ptr(), mSampleFormat, b, 0, len, true);
+    Blockify(*mDirManager, mMaxSamples, mSampleFormat, blocks, start, buffer.ptr(), len);
+}
+
 void Sequence::AppendBlock
         (DirManager &mDirManager,
          BlockArray &mBlock, sampleCount &mNumSamples, const SeqBlock &b) {
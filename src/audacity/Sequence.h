@@ -12,8 +12,10 @@
 #define __AUDACITY_SEQUENCE__
 
 #include "MemoryX.h"
+#include "SampleFormat.h"
 #include "Types.h"
 #include "DirManager.h"
+#include <atomic>
 #include <vector>
 
 
@@ -89,11 +91,20 @@ public:
     bool Get(samplePtr buffer, sampleFormat format,
              sampleCount start, size_t len, bool mayThrow) const;
 
+    // The samples from start to start + len without copying them, if they
+    // are all in one block that keeps them in memory in format; else null.
+    // Valid until the sequence changes.
+    constSamplePtr GetSpan(sampleFormat format, sampleCount start, size_t len) const;
+
     // Note that len is not size_t, because nullptr may be passed for buffer, in
     // which case, silence is inserted, possibly a large amount.
     void SetSamples(samplePtr buffer, sampleFormat format,
                     sampleCount start, sampleCount len);
 
+    // A last block shorter than the minimum is written again, enlarged, by
+    // the next Append.  Short pieces should go through WaveClip::Append(),
+    // whose buffer passes them on a block at a time, or come in pieces of
+    // GetIdealAppendLen().
     void Append(samplePtr buffer, sampleFormat format, size_t len);
 
     size_t GetIdealAppendLen() const;
@@ -112,6 +123,9 @@ public:
 
     const std::shared_ptr<DirManager> &GetDirManager() { return mDirManager; }
 
+    // The block that holds pos.  Readers mostly go forward a piece at a
+    // time, so the block of the last lookup and the one after it are tried
+    // before searching, making a pass through the sequence O(1) a lookup.
     int FindBlock(sampleCount pos) const;
 
     size_t GetIdealBlockSize() const;
@@ -124,6 +138,23 @@ public:
     // because of inconsistent block starts & lengths
     void ConsistencyCheck(const char *whereStr, bool mayThrow = true) const;
 
+    // How much of the block array edits check, for all sequences.  Off
+    // checks only the last block, in constant time: that it ends at the
+    // length of the sequence and is no larger than the maximum.  NewBlocks
+    // checks every block an append adds, and the whole array after other
+    // edits.  Full checks the whole array after appends as well, which
+    // makes a long run of appends quadratic.  Off by default in release
+    // builds (NDEBUG), NewBlocks otherwise.
+    enum class Validation {
+        Off,
+        NewBlocks,
+        Full,
+    };
+
+    static void SetValidation(Validation validation);
+
+    static Validation GetValidation();
+
     // Accumulate NEW block files onto the end of a block array.
     // Does not change this sequence.  The intent is to use
     // CommitChangesIfConsistent later.
@@ -150,11 +181,21 @@ private:
     bool Get(int b, samplePtr buffer, sampleFormat format,
              sampleCount start, size_t len, bool mayThrow) const;
 
+    // Appends a block of another sequence to blocks at start: a copy of its
+    // file, or of its samples in as many blocks as this sequence's size
+    // takes, when it comes from one with larger blocks
+    void AppendBlockOf(const SeqBlock &b, BlockArray &blocks, sampleCount start) const;
+
     static void ConsistencyCheck
             (const BlockArray &block, size_t maxSamples, size_t from,
              sampleCount numSamples, const char *whereStr,
              bool mayThrow = true);
 
+    // ConsistencyCheck() of block from from on, or less or more of it, as
+    // the validation level says
+    void Validate(const BlockArray &block, size_t from, sampleCount numSamples,
+                  const char *whereStr, bool mayThrow = true) const;
+
     // The next two are used in methods that give a strong guarantee.
     // They either throw because final consistency check fails, or swap the
     // changed contents into place.
@@ -162,12 +203,6 @@ private:
     void CommitChangesIfConsistent
             (BlockArray &newBlock, sampleCount numSamples, const char *whereStr);
 
-    //
-    // Private static variables
-    //
-
-    static size_t sMaxDiskBlockSize;
-
     //
     // Private variables
     //
@@ -183,6 +218,14 @@ private:
 
     std::shared_ptr<DirManager> mDirManager;
 
+    // Only a hint for FindBlock(), checked before use; atomic, since
+    // threads may read one sequence at once
+    mutable std::atomic<size_t> mLastBlock{0};
+
+    // Reused by Append to enlarge the last block or convert samples,
+    // so that appending allocates no sample memory of its own
+    GrowableSampleBuffer mAppendScratch;
+
 };
 
 
@@ -19,6 +19,7 @@ BlockFile{ wxFileNameWrapper{}, sampleLen }
    mMin = 0.;
    mMax = 0.;
    mRMS = 0.;
+   mHaveMinMaxRMS = true;
 }
 
 SilentBlockFile::~SilentBlockFile()
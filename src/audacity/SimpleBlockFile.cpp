@@ -126,6 +126,7 @@ SimpleBlockFile::SimpleBlockFile(wxFileNameWrapper &&existingFile, size_t len,
     mMin = min;
     mMax = max;
     mRMS = rms;
+    mHaveMinMaxRMS = true;
 
     mCache.active = false;
 }
@@ -198,17 +199,9 @@ bool SimpleBlockFile::WriteSimpleBlockFile(
         // we can't write the buffer directly to disk, because 24-bit samples
         // on disk need to be packed, not padded to 32 bits like they are in
         // memory
-        int *int24sampleData = (int *) sampleData;
-
-        for (size_t i = 0; i < sampleLen; i++) {
-            nBytesToWrite = 3;
-#if wxBYTE_ORDER == wxBIG_ENDIAN
-                    file.write((char *) &int24sampleData[i] + 1, nBytesToWrite);
-#else
-            file.Write((char*)&int24sampleData[i], nBytesToWrite);
-#endif
-
-        }
+        ArrayOf<char> packed{sampleLen * SAMPLE_SIZE_DISK(int24Sample)};
+        PackInt24((const int *) sampleData, packed.get(), sampleLen);
+        file.write(packed.get(), sampleLen * SAMPLE_SIZE_DISK(int24Sample));
     } else {
         // for all other sample formats we can write straight from the buffer
         // to disk
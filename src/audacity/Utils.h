@@ -7,9 +7,22 @@
 
 #include <string>
 #include <memory>
+#include <type_traits>
+
+template<typename ... Args>
+struct string_format_args;
+
+template<>
+struct string_format_args<> : std::true_type {};
+
+template<typename First, typename ... Rest>
+struct string_format_args<First, Rest ...>
+        : std::integral_constant<bool, std::is_scalar<First>::value && string_format_args<Rest ...>::value> {};
 
 template<typename ... Args>
 std::string string_format(const std::string &format, Args ... args) {
+    // snprintf takes only numbers and pointers; pass strings as c_str()
+    static_assert(string_format_args<Args ...>::value, "string_format arguments must be scalars");
     size_t size = std::snprintf(nullptr, 0, format.c_str(), args ...) + 1; // Extra space for '\0'
     std::unique_ptr<char[]> buf(new char[size]);
     snprintf(buf.get(), size, format.c_str(), args ...);
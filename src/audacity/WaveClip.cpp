@@ -27,6 +27,7 @@
 #include "InconsistencyException.h"
 #include "Resample.h"
 
+#include <algorithm>
 #include <functional>
 #include <vector>
 #include <cstring>
@@ -149,6 +150,20 @@ void WaveClip::SetSamples(samplePtr buffer, sampleFormat format,
     MarkChanged();
 }
 
+bool WaveClip::SwapSamples(WaveClip &other)
+// NOFAIL-GUARANTEE
+{
+    if (mAppendBufferLen != 0 || other.mAppendBufferLen != 0 ||
+        GetNumSamples() != other.GetNumSamples() ||
+        mSequence->GetSampleFormat() != other.mSequence->GetSampleFormat())
+        return false;
+
+    mSequence.swap(other.mSequence);
+    MarkChanged();
+    other.MarkChanged();
+    return true;
+}
+
 void WaveClip::Flush()
 // NOFAIL-GUARANTEE that the clip will be in a flushed state.
 // PARTIAL-GUARANTEE in case of exceptions:
@@ -444,7 +459,7 @@ void WaveClip::OffsetCutLines(double t0, double len)
    }
 }
 
-void WaveClip::Resample(int rate)
+void WaveClip::Resample(int rate, const ResampleOptions &options)
 // STRONG-GUARANTEE
 {
    // Note:  it is not necessary to do this recursively to cutlines.
@@ -454,7 +469,7 @@ void WaveClip::Resample(int rate)
       return; // Nothing to do
 
    double factor = (double)rate / (double)mRate;
-   ::Resample resample(true, factor, factor); // constant rate resampling
+   ::Resample resample(true, factor, factor, options); // constant rate resampling
 
    const size_t bufsize = 65536;
    Floats inBuffer{ bufsize };
@@ -467,6 +482,12 @@ void WaveClip::Resample(int rate)
    auto newSequence =
       std::make_unique<Sequence>(mSequence->GetDirManager(), mSequence->GetSampleFormat());
 
+   // The output goes to the sequence a whole block at a time, as through
+   // the append buffer, so that no block is written twice
+   const auto blockSize = newSequence->GetMaxBlockSize();
+   Floats pending{ blockSize };
+   size_t pendingLen = 0;
+
    /**
     * We want to keep going as long as we have something to feed the resampler
     * with OR as long as the resampler spews out samples (which could continue
@@ -496,15 +517,26 @@ void WaveClip::Resample(int rate)
          break;
       }
 
-      newSequence->Append((samplePtr)outBuffer.get(), floatSample,
-                          outGenerated);
-
+      for (size_t outPos = 0; outPos < (size_t)outGenerated;)
+      {
+         const auto toCopy = std::min(blockSize - pendingLen, outGenerated - outPos);
+         std::copy(outBuffer.get() + outPos, outBuffer.get() + outPos + toCopy,
+                   pending.get() + pendingLen);
+         outPos += toCopy;
+         pendingLen += toCopy;
+         if (pendingLen == blockSize)
+         {
+            newSequence->Append((samplePtr)pending.get(), floatSample, pendingLen);
+            pendingLen = 0;
+         }
+      }
    }
 
    if (error)
        THROW_INCONSISTENCY_EXCEPTION;
    else
    {
+      newSequence->Append((samplePtr)pending.get(), floatSample, pendingLen);
       mSequence = std::move(newSequence);
       mRate = rate;
    }
@@ -20,6 +20,7 @@
 #include "SampleFormat.h"
 #include "Envelope.h"
 #include "DirManager.h"
+#include "Resample.h"
 
 class WaveClip;
 
@@ -89,6 +90,11 @@ public:
     void SetSamples(samplePtr buffer, sampleFormat format,
                     sampleCount start, size_t len);
 
+    // Exchanges the samples of two flushed clips of the same length and
+    // format, leaving offsets, envelopes and cut lines where they were;
+    // false, changing nothing, for any others
+    bool SwapSamples(WaveClip &other); // NOFAIL-GUARANTEE
+
     /** WaveTrack calls this whenever data in the wave clip changes. It is
      * called automatically when WaveClip has a chance to know that something
      * has changed, like when member functions SetSamples() etc. are called. */
@@ -100,6 +106,8 @@ public:
     // think they are useful for general use)
     Sequence *GetSequence() { return mSequence.get(); }
 
+    const Sequence *GetSequence() const { return mSequence.get(); }
+
     /// Flush must be called after last Append
     void Flush();
 
@@ -144,7 +152,7 @@ public:
 
     // Resample clip. This also will set the rate, but without changing
     // the length of the clip
-    void Resample(int rate);
+    void Resample(int rate, const ResampleOptions &options = {});
 
     void ConvertToSampleFormat(sampleFormat format);
 
@@ -29,8 +29,10 @@ Track classes.
 #include <float.h>
 #include <math.h>
 #include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <cstring>
+#include <thread>
 
 #include "MemoryX.h"
 #include "WaveTrack.h"
@@ -38,6 +40,8 @@ Track classes.
 #include "InconsistencyException.h"
 #include "Track.h"
 #include "TimeWarper.h"
+#include "Instrumentation.h"
+#include "Parallel.h"
 
 
 WaveTrack::Holder TrackFactory::NewWaveTrack(sampleFormat format, double rate) {
@@ -83,6 +87,24 @@ void WaveTrack::SetRate(double newRate) {
     mRate = (int) newRate;
 }
 
+void WaveTrack::Resample(int rate, const ResampleOptions &options)
+// WEAK-GUARANTEE
+// Partial completion may leave clips at differing sample rates!
+{
+    size_t numThreads = options.threads;
+    if (numThreads == 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    numThreads = std::min(numThreads, std::max<size_t>(1, mClips.size()));
+
+    // The clips are independent, their samples in sequences of their own
+    std::atomic<size_t> next{0};
+    ForEachInParallel(numThreads, [&](size_t) {
+        for (size_t ii; (ii = next++) < mClips.size();)
+            mClips[ii]->Resample(rate, options);
+    });
+    mRate = rate;
+}
+
 float WaveTrack::GetGain() const {
     return mGain;
 }
@@ -212,6 +234,17 @@ bool WaveTrack::Get(samplePtr buffer, sampleFormat format,
     return result;
 }
 
+constSamplePtr WaveTrack::GetSpan(sampleFormat format,
+                                  sampleCount start, size_t len) const {
+    for (const auto &clip: mClips) {
+        const auto clipStart = clip->GetStartSample();
+        if (start >= clipStart && start + len <= clip->GetEndSample())
+            return static_cast<const WaveClip &>(*clip).GetSequence()
+                    ->GetSpan(format, start - clipStart, len);
+    }
+    return nullptr;
+}
+
 size_t WaveTrack::GetBestBlockSize(sampleCount s) const {
     auto bestBlockSize = GetMaxBlockSize();
 
@@ -644,7 +677,7 @@ sampleCount WaveTrack::GetBlockStart(sampleCount s) const {
 }
 
 void WaveTrack::GetEnvelopeValues(double *buffer, size_t bufferLen,
-                                  double t0) const {
+                                  double t0, EnvelopeCursors *cursors) const {
     // The output buffer corresponds to an unbroken span of time which the callers expect
     // to be fully valid.  As clips are processed below, the output buffer is updated with
     // envelope values from any portion of a clip, start, end, middle, or none at all.
@@ -699,9 +732,56 @@ void WaveTrack::GetEnvelopeValues(double *buffer, size_t bufferLen,
             }
             // Samples are obtained for the purpose of rendering a wave track,
             // so quantize time
-            clip->GetEnvelope()->GetValues(rbuf, rlen, rt0, tstep);
+            if (cursors)
+                cursors->For(*clip->GetEnvelope()).GetValues(rbuf, rlen, rt0, tstep);
+            else
+                clip->GetEnvelope()->GetValues(rbuf, rlen, rt0, tstep);
+        }
+    }
+}
+
+bool WaveTrack::EnvelopeIsConstant(size_t bufferLen, double t0, double &value,
+                                   EnvelopeCursors &cursors) const {
+    const auto tstep = 1.0 / mRate;
+    const double endTime = t0 + tstep * bufferLen;
+    int clips = 0;
+    bool whole = false;
+    value = 1.0;
+    for (const auto &clip: mClips) {
+        const auto clipStart = clip->GetStartTime();
+        const auto clipEnd = clip->GetEndTime();
+        if (clipStart < endTime && clipEnd > t0) {
+            double clipValue;
+            if (!cursors.For(*clip->GetEnvelope()).IsConstant(
+                    std::max(t0, clipStart), std::min(endTime, clipEnd), clipValue))
+                return false;
+            ++clips;
+            whole = clipStart <= t0 && clipEnd >= endTime;
+            if (clipValue != 1.0) {
+                if (value != 1.0)
+                    return false;
+                value = clipValue;
+            }
         }
     }
+    // Outside the clips GetEnvelopeValues() gives 1, so another value must
+    // be that of one clip over the whole span
+    return value == 1.0 || (clips == 1 && whole);
+}
+
+bool WaveTrack::EnvelopeIsUnity(size_t bufferLen, double t0) const {
+    // The clips GetEnvelopeValues() would ask, or more; between them it gives 1
+    const auto tstep = 1.0 / mRate;
+    const double endTime = t0 + tstep * bufferLen;
+    for (const auto &clip: mClips) {
+        if (clip->GetStartTime() < endTime && clip->GetEndTime() > t0) {
+            const auto envelope = clip->GetEnvelope();
+            if (envelope->GetNumberOfPoints() != 0 ||
+                envelope->GetValue(clip->GetStartTime()) != 1.0)
+                return false;
+        }
+    }
+    return true;
 }
 
 float WaveTrack::GetChannelGain(int channel) const {
@@ -720,6 +800,10 @@ float WaveTrack::GetChannelGain(int channel) const {
 }
 
 WaveTrackCache::~WaveTrackCache() {
+    // The reads ahead write into the slots
+    for (auto &slot : mSlots)
+        if (slot.pending.valid())
+            slot.pending.wait();
 }
 
 void WaveTrackCache::SetTrack(const std::shared_ptr<const WaveTrack> &pTrack) {
@@ -736,9 +820,28 @@ void WaveTrackCache::SetTrack(const std::shared_ptr<const WaveTrack> &pTrack) {
             Free();
         mPTrack = pTrack;
         mNValidBuffers = 0;
+        // Not to be handed on to the slots as the new track's
+        mBuffers[0].len = mBuffers[1].len = 0;
+        ResetSlots();
     }
 }
 
+void WaveTrackCache::SetReadAhead(size_t depth) {
+    mReadAheadDepth = depth;
+    ResetSlots();
+}
+
+void WaveTrackCache::ResetSlots() {
+    for (auto &slot : mSlots)
+        if (slot.pending.valid())
+            slot.pending.wait();
+    // As many to keep behind as to read ahead
+    mSlots = std::vector<Slot>(2 * mReadAheadDepth);
+    if (mPTrack)
+        for (auto &slot : mSlots)
+            slot.buffer.data = Floats{mBufferSize};
+}
+
 void WaveTrackCache::Free() {
     mBuffers[0].Free();
     mBuffers[1].Free();
@@ -746,8 +849,97 @@ void WaveTrackCache::Free() {
     mNValidBuffers = 0;
 }
 
+bool WaveTrackCache::FillBuffer(int ii, sampleCount start0, bool mayThrow) {
+    auto &buffer = mBuffers[ii];
+    const auto len0 = mPTrack->GetBestBlockSize(start0);
+    assert(len0 <= mBufferSize);
+
+    for (auto &slot : mSlots) {
+        if (slot.buffer.len == 0 || slot.buffer.start != start0)
+            continue;
+        const bool read = !slot.pending.valid() || slot.pending.get();
+        if (read && slot.buffer.len == len0) {
+            // The block the buffer held goes to the slot, in case the
+            // reader steps back to it
+            buffer.swap(slot.buffer);
+            return true;
+        }
+        // Read again below, where a failure may throw
+        slot.buffer.len = 0;
+        break;
+    }
+
+    buffer.len = 0;
+    if (!mPTrack->Get(samplePtr(buffer.data.get()), floatSample, start0, len0, fillZero, mayThrow))
+        return false;
+    buffer.start = start0;
+    buffer.len = len0;
+    return true;
+}
+
+void WaveTrackCache::ReadAhead(sampleCount pos, bool backwards) {
+    // The span the reads cover so far, whose slots are not to be reused
+    auto first = pos, last = pos;
+    for (size_t kk = 0; kk < mReadAheadDepth; ++kk) {
+        sampleCount start;
+        if (backwards) {
+            start = mPTrack->GetBlockStart(first - 1);
+            if (start < 0 || start + mPTrack->GetBestBlockSize(start) != first)
+                break;
+            first = start;
+        } else {
+            start = last;
+            if (mPTrack->GetBlockStart(start) != start)
+                break;
+            last += mPTrack->GetBestBlockSize(start);
+        }
+
+        bool atHand = false;
+        for (int ii = 0; ii < mNValidBuffers; ++ii)
+            atHand = atHand || mBuffers[ii].start == start;
+        for (const auto &slot : mSlots)
+            atHand = atHand || (slot.buffer.len > 0 && slot.buffer.start == start);
+        if (atHand)
+            continue;
+
+        // An empty slot, else the one farthest from the span
+        Slot *victim = nullptr;
+        sampleCount farthest = -1;
+        for (auto &slot : mSlots) {
+            if (slot.buffer.len == 0) {
+                victim = &slot;
+                break;
+            }
+            const auto distance = slot.buffer.start < first ? first - slot.buffer.start
+                                  : slot.buffer.start >= last ? slot.buffer.start - last + 1
+                                  : sampleCount(0);
+            if (distance > farthest) {
+                farthest = distance;
+                victim = &slot;
+            }
+        }
+        if (!victim || farthest == 0)
+            break;
+
+        if (victim->pending.valid())
+            victim->pending.wait();
+        const auto len = mPTrack->GetBestBlockSize(start);
+        victim->buffer.start = start;
+        victim->buffer.len = len;
+        const auto track = mPTrack;
+        const auto data = samplePtr(victim->buffer.data.get());
+        victim->pending = std::async(std::launch::async, [track, data, start, len] {
+            return track->Get(data, floatSample, start, len, fillZero, false);
+        });
+    }
+}
+
 constSamplePtr WaveTrackCache::Get(sampleFormat format,
                                    sampleCount start, size_t len, bool mayThrow) {
+    // Nothing to cache if the samples can be read in place
+    if (const auto span = mPTrack->GetSpan(format, start, len))
+        return span;
+
     if (format == floatSample && len > 0) {
         const auto end = start + len;
 
@@ -789,17 +981,13 @@ constSamplePtr WaveTrackCache::Get(sampleFormat format,
         }
 
         // Refill buffers as needed
+        const bool backwards = fillFirst && !fillSecond;
+        const bool filled = fillFirst || fillSecond;
         if (fillFirst) {
             const auto start0 = mPTrack->GetBlockStart(start);
             if (start0 >= 0) {
-                const auto len0 = mPTrack->GetBestBlockSize(start0);
-                assert(len0 <= mBufferSize);
-                if (!mPTrack->Get(
-                        samplePtr(mBuffers[0].data.get()), floatSample, start0, len0,
-                        fillZero, mayThrow))
+                if (!FillBuffer(0, start0, mayThrow))
                     return 0;
-                mBuffers[0].start = start0;
-                mBuffers[0].len = len0;
                 if (!fillSecond &&
                     mBuffers[0].end() != mBuffers[1].start)
                     fillSecond = true;
@@ -819,18 +1007,18 @@ constSamplePtr WaveTrackCache::Get(sampleFormat format,
             if (end > end0) {
                 const auto start1 = mPTrack->GetBlockStart(end0);
                 if (start1 == end0) {
-                    const auto len1 = mPTrack->GetBestBlockSize(start1);
-                    assert(len1 <= mBufferSize);
-                    if (!mPTrack->Get(samplePtr(mBuffers[1].data.get()), floatSample, start1, len1, fillZero, mayThrow))
+                    if (!FillBuffer(1, start1, mayThrow))
                         return 0;
-                    mBuffers[1].start = start1;
-                    mBuffers[1].len = len1;
                     mNValidBuffers = 2;
                 }
             }
         }
         assert(mNValidBuffers < 2 || mBuffers[0].end() == mBuffers[1].start);
 
+        // While the caller works on these, the next blocks are read
+        if (filled && mReadAheadDepth > 0 && mNValidBuffers > 0)
+            ReadAhead(backwards ? mBuffers[0].start : mBuffers[mNValidBuffers - 1].end(), backwards);
+
         samplePtr buffer = 0;
         auto remaining = len;
 
@@ -1002,6 +1190,7 @@ void WaveTrack::ClearAndPaste(double t0, // Start of time to clear
 // this WaveTrack remains destructible in case of AudacityException.
 // But some of its cutline clips may have been destroyed.
 {
+    NR_TIME_SCOPE(Instrumentation::Stage::ClearAndPaste);
     double dur = std::min(t1 - t0, src->GetEndTime());
 
     // If duration is 0, then it's just a plain paste
@@ -1152,3 +1341,29 @@ void WaveTrack::ClearAndPaste(double t0, // Start of time to clear
         }
     }
 }
+
+bool WaveTrack::SwapClipSamples(sampleCount start, sampleCount len, WaveTrack &src)
+// NOFAIL-GUARANTEE
+{
+    NR_TIME_SCOPE(Instrumentation::Stage::ClearAndPaste);
+    if (src.mClips.size() != 1 || src.mDirManager != mDirManager)
+        return false;
+    auto &srcClip = *src.mClips[0];
+    if (srcClip.GetStartSample() != 0 || srcClip.GetNumSamples() != len ||
+        srcClip.GetEnvelope()->GetNumberOfPoints() != 0 ||
+        srcClip.GetEnvelope()->GetValue(srcClip.GetStartTime()) != 1.0)
+        return false;
+
+    for (const auto &clip : mClips) {
+        if (clip->GetStartSample() != start || clip->GetNumSamples() != len)
+            continue;
+        // ClearAndPaste() would drop the cut lines and the envelope, leaving
+        // those of src; so only when there are none to lose
+        const auto envelope = clip->GetEnvelope();
+        if (clip->NumCutLines() != 0 || envelope->GetNumberOfPoints() != 0 ||
+            envelope->GetValue(clip->GetStartTime()) != 1.0)
+            return false;
+        return clip->SwapSamples(srcClip);
+    }
+    return false;
+}
@@ -12,6 +12,7 @@
 #define __AUDACITY_WAVETRACK__
 
 #include <cassert>
+#include <future>
 
 #include "Types.h"
 #include "WaveClip.h"
@@ -73,6 +74,10 @@ public:
 
     void SetRate(double newRate);
 
+    // Converts the samples of every clip to rate, keeping their times; with
+    // options.threads, several clips at once
+    void Resample(int rate, const ResampleOptions &options = {});
+
     // Multiplicative factor.  Only converted to dB for display.
     float GetGain() const;
 
@@ -138,6 +143,11 @@ public:
              sampleCount start, size_t len,
              fillFormat fill = fillZero, bool mayThrow = true, sampleCount *pNumCopied = nullptr) const;
 
+    /// The samples from start to start + len without copying them, if they
+    /// lie in one block of one clip that keeps them in memory in format;
+    /// else null, and Get() must be used.  Valid until the track changes.
+    constSamplePtr GetSpan(sampleFormat format, sampleCount start, size_t len) const;
+
     // These return a nonnegative number of samples meant to size a memory buffer
     size_t GetBestBlockSize(sampleCount t) const;
 
@@ -199,9 +209,21 @@ public:
     sampleCount GetBlockStart(sampleCount t) const;
 
     // Fetch envelope values corresponding to uniformly separated sample times
-    // starting at the given time.
+    // starting at the given time.  With cursors, each clip's envelope is read
+    // through its cursor there, which saves the search for reads in time order.
     void GetEnvelopeValues(double *buffer, size_t bufferLen,
-                           double t0) const;
+                           double t0, EnvelopeCursors *cursors = nullptr) const;
+
+    // True if GetEnvelopeValues() would give one value, into value, for the
+    // same span (up to rounding, see EnvelopeCursor::IsConstant()); then the
+    // samples can be scaled by it, or left alone for 1.
+    bool EnvelopeIsConstant(size_t bufferLen, double t0, double &value,
+                            EnvelopeCursors &cursors) const;
+
+    // True if GetEnvelopeValues() would give all ones for the same span,
+    // because no clip in it has envelope points or another default value;
+    // then the values need not be fetched nor applied.
+    bool EnvelopeIsUnity(size_t bufferLen, double t0) const;
 
     // Takes gain and pan into account
     float GetChannelGain(int channel) const;
@@ -213,6 +235,15 @@ public:
                        bool merge = true,
                        const TimeWarper *effectWarper = nullptr) /* not override */;
 
+    // The cheap case of ClearAndPaste(), for an effect's output of the same
+    // length as a whole clip: when one clip of this track spans exactly
+    // samples [start, start + len), with no cut lines and a flat envelope,
+    // and src holds one flushed clip of len samples from 0 in the same format
+    // and storage, the two clips exchange their samples and true is returned;
+    // otherwise nothing changes and false is returned.  src is left with the
+    // old samples.
+    bool SwapClipSamples(sampleCount start, sampleCount len, WaveTrack &src);
+
     // Add all wave clips to the given array 'clips' and sort the array by
     // clip start time. The array is emptied prior to adding the clips.
     WaveClipPointers SortedClipArray();
@@ -276,9 +307,37 @@ public:
     constSamplePtr Get(
             sampleFormat format, sampleCount start, size_t len, bool mayThrow);
 
+    // With depth > 0, blocks are read ahead on other threads: whenever the
+    // cache moves on to a block, the depth blocks after it (or before it,
+    // for a reader going backwards) are fetched while the caller works, and
+    // as many blocks already passed are kept for readers that step back or
+    // jump around.  0, the default, reads only on demand.
+    void SetReadAhead(size_t depth);
+
+    // The track's envelope, as WaveTrack::GetEnvelopeValues() and
+    // EnvelopeIsConstant() give it, through cursors kept for the track
+    void GetEnvelopeValues(double *buffer, size_t len, double t0) {
+        mPTrack->GetEnvelopeValues(buffer, len, t0, &mEnvelopeCursors);
+    }
+
+    bool EnvelopeIsConstant(size_t len, double t0, double &value) {
+        return mPTrack->EnvelopeIsConstant(len, t0, value, mEnvelopeCursors);
+    }
+
 private:
     void Free();
 
+    // Fills buffer with the block at start0, from a read-ahead slot that has
+    // it if any; false if the read failed
+    bool FillBuffer(int ii, sampleCount start0, bool mayThrow);
+
+    // Starts reads of up to mReadAheadDepth blocks from pos on, or before pos
+    // when backwards, that are not at hand already
+    void ReadAhead(sampleCount pos, bool backwards);
+
+    // Waits for reads in progress and empties the slots, (re)allocated
+    void ResetSlots();
+
     struct Buffer {
         Floats data;
         sampleCount start;
@@ -301,11 +360,21 @@ private:
         }
     };
 
+    // A block read ahead, or kept after the cache passed it; the read is
+    // done once pending is invalid or got
+    struct Slot {
+        Buffer buffer;
+        std::future<bool> pending;
+    };
+
     std::shared_ptr<const WaveTrack> mPTrack;
     size_t mBufferSize;
     Buffer mBuffers[2];
     GrowableSampleBuffer mOverlapBuffer;
     int mNValidBuffers;
+    size_t mReadAheadDepth{0};
+    std::vector<Slot> mSlots;
+    EnvelopeCursors mEnvelopeCursors;
 };
 
 #endif // __AUDACITY_WAVETRACK__
@@ -1,9 +1,303 @@
+import asyncio
+import json
 import os, sys
 sys.path.append(os.path.dirname(__file__))
 
 import cmodule
 
 
+# advanced settings, taken by every call below as keywords:
+#   window_size       power of two from 8 to 16384
+#   steps_per_window  power of two from 2 to 64, no more than window_size
+#   window_types      index into WINDOW_TYPES; 2, 3 and 5 need at least 4 steps, the others 2
+#   method            0 for the median (up to 4 steps), 1 for the second greatest
+#   adapt_time        seconds over which, while reducing, the profile follows noise that drifts; 0 keeps it fixed.
+#                     taken by the calls that reduce; each file or array starts again from the profile.
+#   resample          True to take files at another rate than the profile's, resampling them to it as they are
+#                     read; the output is then at the profile's rate. taken by the calls that read files.
+#   compact_history   True to keep the real and imaginary parts of the windows waiting in the reduction's history
+#                     in 16 bits, with a scale per window, for about half the memory: large windows and long attacks
+#                     then stay in cache. the output differs by some 90 dB below the loudest band of each window.
+#                     taken by the calls that reduce.
+#   channel_link      classify the channels of each input together: 'max' or 'mean' of their power, or 'mid_side'
+#                     (stereo only), applying the one gain mask to every channel so that the stereo image holds
+#                     still; None classifies each channel alone. linked channels run on one thread. taken by the
+#                     calls that reduce files or arrays.
+#   f0, f1            process only the bands from f0 to f1 Hz (None: no bound), e.g. (40, 400) for hum or
+#                     (4000, None) for hiss. only those bands are profiled, classified and smoothed, and the rest
+#                     pass through as they are. a profile taken so is of those bands only, and reduces only within them.
+# a profile and the reductions against it must use the same window_size.
+WINDOW_TYPES = cmodule.window_types()
+
+
+# raised by noisered(): NoiseReductionError, or one of its subclasses, which are also OSError or ValueError,
+# but for CancelledError
+NoiseReductionError = cmodule.NoiseReductionError
+AudioFileError = cmodule.AudioFileError
+SampleRateError = cmodule.SampleRateError
+ProfileTooShortError = cmodule.ProfileTooShortError
+SettingsError = cmodule.SettingsError
+CancelledError = cmodule.CancelledError
+
+
+# passed as cancel to noisered() and noisered_streaming(), stops them from any thread with token.cancel():
+# each stage (profiling, import, reduction, export) gives up at its next block, within milliseconds, leaving
+# dst_path unfinished. noisered() then raises CancelledError, noisered_streaming() returns False.
+# CancelToken(callback) also calls callback(fraction) from the working threads as each stage gets on, a
+# hundredth at a time from 0 to 1; returning False, or raising, cancels.
+CancelToken = cmodule.CancelToken
+
+
 # pyaudacity_module c extension wrapper
-def noisered(profile_path, profile_start, profile_end, src_path, noise_gain, sensitivity, smoothing, dst_path):
-    return cmodule.noisered(profile_path, profile_start, profile_end, src_path, noise_gain, sensitivity, smoothing, dst_path)
+# threads > 1 splits long files into segments reduced at once, with the same result.
+# block_size is the largest block of the tracks in bytes, from 1 KB to 64 MB (0: 1 MB); larger blocks suit long files.
+# the samples of the tracks are kept in memory up to memory_limit bytes (0: none), and past that in storage:
+# a directory, or several tried in order, such as ['/dev/shm/nr', '/var/tmp/nr']. the first with room for all
+# the samples is used, moving on to the next as each fills up (None: the temp dir, /dev/shm/audacity-noisered).
+# ranges, a list of (start, end) seconds such as a voice activity detector gives, reduces only those; each comes
+# out as it would reducing all the file, and the rest as it was (None: all of it).
+# compression keeps the samples of the tracks losslessly compressed, from 1 (fastest) to 3 (smallest) (0: off).
+# cancel, a CancelToken, stops it early (None: never).
+# runs without the GIL; returns True, or raises one of the errors above.
+def noisered(profile_path, profile_start, profile_end, src_path, noise_gain, sensitivity, smoothing, dst_path,
+             threads=1, window_size=2048, steps_per_window=4, window_types=2, method=1, adapt_time=0.0,
+             block_size=0, storage=None, memory_limit=0, resample=False, ranges=None, compression=0, cancel=None,
+             compact_history=False, channel_link=None, f0=None, f1=None):
+    return cmodule.noisered(profile_path, profile_start, profile_end, src_path, noise_gain, sensitivity, smoothing,
+                            dst_path, threads, window_size, steps_per_window, window_types, method, adapt_time,
+                            block_size, storage, memory_limit, resample, ranges, compression, cancel,
+                            compact_history, channel_link, f0, f1)
+
+
+# same as noisered(), but both files are streamed without intermediate block files; runs without the GIL
+def noisered_streaming(profile_path, profile_start, profile_end, src_path, noise_gain, sensitivity, smoothing, dst_path,
+                       window_size=2048, steps_per_window=4, window_types=2, method=1, adapt_time=0.0,
+                       resample=False, cancel=None, compact_history=False, channel_link=None, f0=None, f1=None):
+    return cmodule.noisered_streaming(profile_path, profile_start, profile_end, src_path, noise_gain, sensitivity, smoothing, dst_path,
+                                      window_size, steps_per_window, window_types, method, adapt_time, resample, cancel,
+                                      compact_history, channel_link, f0, f1)
+
+
+# a callback for the cmodule _submit calls that settles future on loop; called from the library's threads
+def _settle_on(loop, future):
+    def settle(result, error):
+        if future.done():  # cancelled meanwhile
+            return
+        if error is None:
+            future.set_result(result)
+        else:
+            future.set_exception(error)
+
+    def callback(result, error):
+        try:
+            loop.call_soon_threadsafe(settle, result, error)
+        except RuntimeError:  # the loop is closed; no one is waiting
+            pass
+    return callback
+
+
+# awaits future; cancelled, cancels token too, so that the work stops at its next block
+async def _await_cancelling(future, token):
+    try:
+        return await future
+    except asyncio.CancelledError:
+        token.cancel()
+        raise
+
+
+# awaitable noisered(), with the same arguments: the work is queued on the library's own threads, one per core,
+# and never holds the GIL, so the event loop stays free. resolves to True, or raises one of the errors above.
+# cancelling the await cancels the reduction, through cancel if given, which may also cancel it alone.
+async def noisered_async(profile_path, profile_start, profile_end, src_path, noise_gain, sensitivity, smoothing,
+                         dst_path, threads=1, window_size=2048, steps_per_window=4, window_types=2, method=1,
+                         adapt_time=0.0, block_size=0, storage=None, memory_limit=0, resample=False, ranges=None,
+                         compression=0, cancel=None, compact_history=False, channel_link=None, f0=None, f1=None):
+    loop = asyncio.get_running_loop()
+    future = loop.create_future()
+    token = cancel if cancel is not None else CancelToken()
+    cmodule.noisered_submit(_settle_on(loop, future),
+                            (profile_path, profile_start, profile_end, src_path, noise_gain, sensitivity, smoothing,
+                             dst_path, threads, window_size, steps_per_window, window_types, method, adapt_time,
+                             block_size, storage, memory_limit, resample, ranges, compression, token,
+                             compact_history, channel_link, f0, f1))
+    return await _await_cancelling(future, token)
+
+
+# awaitable noisered_streaming(), as noisered_async(); resolves to True or False
+async def noisered_streaming_async(profile_path, profile_start, profile_end, src_path, noise_gain, sensitivity,
+                                   smoothing, dst_path, window_size=2048, steps_per_window=4, window_types=2,
+                                   method=1, adapt_time=0.0, resample=False, cancel=None,
+                                   compact_history=False, channel_link=None, f0=None, f1=None):
+    loop = asyncio.get_running_loop()
+    future = loop.create_future()
+    token = cancel if cancel is not None else CancelToken()
+    cmodule.noisered_streaming_submit(_settle_on(loop, future),
+                                      (profile_path, profile_start, profile_end, src_path, noise_gain, sensitivity,
+                                       smoothing, dst_path, window_size, steps_per_window, window_types, method,
+                                       adapt_time, resample, token, compact_history, channel_link, f0, f1))
+    return await _await_cancelling(future, token)
+
+
+# take a noise profile once, to be reused by reduce() or saved with profile.save(path)
+def build_profile(profile_path, profile_start, profile_end,
+                  window_size=2048, steps_per_window=4, window_types=2, method=1, f0=None, f1=None):
+    return cmodule.build_profile(profile_path, profile_start, profile_end,
+                                 window_size, steps_per_window, window_types, method, f0, f1)
+
+
+# one profile from many (path, start, end) segments of noise, taken on a pool of threads (0: one per core)
+# without the GIL, the same whatever the threads. a profile also takes the noise of another with
+# profile.merge(other), returning False if their rates or advanced settings differ.
+def build_profile_segments(segments, threads=0,
+                           window_size=2048, steps_per_window=4, window_types=2, method=1, f0=None, f1=None):
+    return cmodule.build_profile_segments(segments, threads,
+                                          window_size, steps_per_window, window_types, method, f0, f1)
+
+
+# load a profile written by profile.save()
+def load_profile(path):
+    return cmodule.load_profile(path)
+
+
+# keep the profiles noisered(), noisered_streaming() and build_profile() take from files, by a hash of the
+# file's contents, the range and the advanced settings, so that the same noise is never profiled twice.
+# they are kept in memory, and with a directory also in a file each there, for other processes; a changed
+# file is profiled again. off until enabled.
+def set_profile_cache(enable, directory=None):
+    cmodule.set_profile_cache(enable, directory)
+
+
+# forget the profiles cached in memory; those in the directory stay
+def clear_profile_cache():
+    cmodule.clear_profile_cache()
+
+
+# admit the files of noisered() and noisered_batch() only while their estimated memory fits in bytes
+# (0: no budget). a file too big for the budget alone is streamed by noisered() instead.
+def set_memory_budget(bytes):
+    cmodule.set_memory_budget(bytes)
+
+
+# how much of the intermediate tracks' blocks each edit checks: 0 (off: only the last block),
+# 1 (the blocks appended; whole tracks after other edits) or 2 (whole tracks, always)
+def set_validation(level):
+    cmodule.set_validation(level)
+
+
+# streamed noise reduction against a profile from build_profile() or load_profile()
+def reduce(profile, src_path, noise_gain, sensitivity, smoothing, dst_path,
+           window_size=2048, steps_per_window=4, window_types=2, method=1, adapt_time=0.0, resample=False,
+           compact_history=False, channel_link=None, f0=None, f1=None):
+    return cmodule.reduce(profile, src_path, noise_gain, sensitivity, smoothing, dst_path,
+                          window_size, steps_per_window, window_types, method, adapt_time, resample,
+                          compact_history, channel_link, f0, f1)
+
+
+# reduce each (src_path, dst_path) pair against one profile on a pool of threads (0: one per core),
+# without holding the GIL. returns a (success, seconds) tuple per pair.
+def noisered_batch(profile, files, noise_gain=12.0, sensitivity=6.0, smoothing=3.0, threads=0,
+                   window_size=2048, steps_per_window=4, window_types=2, method=1, adapt_time=0.0,
+                   resample=False, compact_history=False, channel_link=None, f0=None, f1=None):
+    return cmodule.noisered_batch(profile, files, noise_gain, sensitivity, smoothing, threads,
+                                  window_size, steps_per_window, window_types, method, adapt_time, resample,
+                                  compact_history, channel_link, f0, f1)
+
+
+# reduce src_path against profile once for each (noise_gain, smoothing, dst_path) in settings, for picking
+# settings: the bands are classified on the first pass only, and each output is the same as from reduce().
+# without the GIL. returns True if all of them were written.
+def sweep(profile, src_path, settings, sensitivity=6.0,
+          window_size=2048, steps_per_window=4, window_types=2, method=1, adapt_time=0.0, resample=False,
+          compact_history=False, channel_link=None, f0=None, f1=None):
+    return cmodule.sweep(profile, src_path, settings, sensitivity,
+                         window_size, steps_per_window, window_types, method, adapt_time, resample,
+                         compact_history, channel_link, f0, f1)
+
+
+# the same for audio decoded elsewhere: float32 arrays of frames, or of frames by channels, taken in place
+# through the buffer protocol (numpy, array('f'), ...), without the GIL. the result goes into out if given,
+# which may be signal itself, else into a new memoryview shaped like signal; None on failure.
+# build_profile_array takes all of samples as noise.
+def build_profile_array(samples, rate, window_size=2048, steps_per_window=4, window_types=2, method=1,
+                        f0=None, f1=None):
+    return cmodule.build_profile_array(samples, rate, window_size, steps_per_window, window_types, method, f0, f1)
+
+
+def reduce_array(profile, signal, rate, noise_gain=12.0, sensitivity=6.0, smoothing=3.0, out=None,
+                 window_size=2048, steps_per_window=4, window_types=2, method=1, adapt_time=0.0,
+                 compact_history=False, channel_link=None, f0=None, f1=None):
+    return cmodule.reduce_array(profile, signal, rate, noise_gain, sensitivity, smoothing, out,
+                                window_size, steps_per_window, window_types, method, adapt_time,
+                                compact_history, channel_link, f0, f1)
+
+
+def noisered_array(profile_array, signal_array, rate, noise_gain=12.0, sensitivity=6.0, smoothing=3.0, out=None,
+                   window_size=2048, steps_per_window=4, window_types=2, method=1, adapt_time=0.0,
+                   compact_history=False, channel_link=None, f0=None, f1=None):
+    return cmodule.noisered_array(profile_array, signal_array, rate, noise_gain, sensitivity, smoothing, out,
+                                  window_size, steps_per_window, window_types, method, adapt_time,
+                                  compact_history, channel_link, f0, f1)
+
+
+# the same for whole sound files in memory, as bytes, bytearray or memoryview, e.g. received over the network:
+# decoded and encoded by libsndfile without touching the file system, in any format it reads (WAV, FLAC, OGG, ...).
+# reduce_bytes returns the bytes of a WAV file of the subformat (0: 16 bit, 1: 24 bit, 2: float), or None.
+def build_profile_bytes(data, profile_start, profile_end,
+                        window_size=2048, steps_per_window=4, window_types=2, method=1, f0=None, f1=None):
+    return cmodule.build_profile_bytes(data, profile_start, profile_end,
+                                       window_size, steps_per_window, window_types, method, f0, f1)
+
+
+def reduce_bytes(profile, data, noise_gain=12.0, sensitivity=6.0, smoothing=3.0, subformat=0,
+                 window_size=2048, steps_per_window=4, window_types=2, method=1, adapt_time=0.0, resample=False,
+                 compact_history=False, channel_link=None, f0=None, f1=None):
+    return cmodule.reduce_bytes(profile, data, noise_gain, sensitivity, smoothing, subformat,
+                                window_size, steps_per_window, window_types, method, adapt_time, resample,
+                                compact_history, channel_link, f0, f1)
+
+
+# how much of src_path looks like noise against profile, without reducing it: analysed at 1/decimation
+# of the rate (a power of two; 1 classifies as reduce() would) for that much less FFT work.
+# returns (fraction, [[fraction of each step] per channel]), or None.
+def preview(profile, src_path, decimation=4, sensitivity=6.0,
+            window_size=2048, steps_per_window=4, window_types=2, method=1, resample=False, f0=None, f1=None):
+    return cmodule.preview(profile, src_path, decimation, sensitivity,
+                           window_size, steps_per_window, window_types, method, resample, f0, f1)
+
+
+# which steps and bands of src_path are noise against profile, for gating downstream, without any synthesis.
+# returns one memoryview per channel, for numpy.asarray(): float32 fractions of each step, or with masks=True
+# uint8 masks of steps by bands, 1 where a band is noise; or None. step n is the window ending at sample
+# (n + 1) * window_size / steps_per_window.
+def analyze(profile, src_path, sensitivity=6.0, masks=False,
+            window_size=2048, steps_per_window=4, window_types=2, method=1, resample=False, f0=None, f1=None):
+    return cmodule.analyze(profile, src_path, sensitivity, masks,
+                           window_size, steps_per_window, window_types, method, resample, f0, f1)
+
+
+# where the time and bytes of all calls so far went, when built with USE_INSTRUMENTATION=1:
+#   {'enabled': True, 'stages': {'import': {'seconds': ..., 'calls': ...}, 'profile': ..., 'reduce': ...,
+#    'analyze': ..., 'forward_fft': ..., 'classify': ..., 'smoothing': ..., 'inverse_fft': ...,
+#    'clear_and_paste': ..., 'export': ...}, 'counters': {'bytes_read': ..., 'bytes_written': ...,
+#    'block_files': ..., 'block_file_bytes': ..., 'allocations': ..., 'allocated_bytes': ...}}
+# else {'enabled': False}. seconds are summed over threads; the fft, classify and smoothing stages are
+# within profile, reduce and analyze. reset=True starts the counts over once read.
+def stats(reset=False):
+    return json.loads(cmodule.stats_json(reset))
+
+
+# the same as JSON text, for dumping to a file
+def stats_json(reset=False):
+    return cmodule.stats_json(reset)
+
+
+def reset_stats():
+    cmodule.reset_stats()
+
+
+# live noise reduction against a profile, one channel a block at a time:
+#   reducer = NoiseReducer(profile, rate); out = reducer.process(block); tail = reducer.flush()
+# blocks are float32 buffers (bytes, array('f'), ...); process() returns as many samples, reducer.latency
+# samples late, into out if given. nothing is allocated per call when out is given.
+# also takes noise_gain, sensitivity, smoothing and the advanced settings as keywords.
+NoiseReducer = cmodule.NoiseReducer
@@ -1,75 +1,575 @@
 #include <Python.h>
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iostream>
 #include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
+#include "BlockCodec.h"
 #include "ExportPCM.h"
 #include "Mix.h"
 #include "DirManager.h"
 #include "ImportPCM.h"
+#include "Instrumentation.h"
+#include "NoiseReduction.h"
+#include "Parallel.h"
+#include "Progress.h"
+#include "Sequence.h"
 
 #define PYTHON_AUDACITY_NOISERED_MODULE
 
+// The advanced settings that every entry point takes as trailing optional
+// arguments, in this order, and their defaults
+struct PyAudacityAdvanced {
+    unsigned int window_size = 2048;
+    unsigned int steps_per_window = 4;
+    int window_types = 2;
+    int method = 1;
+    // taken only by the calls that reduce
+    double adapt_time = 0.0;
+    // taken only by the calls that read files
+    int resample = 0;
+    // taken only by the calls that reduce, after the arguments of the call's own
+    int compact_history = 0;
+    // taken only by the calls that reduce files or arrays
+    EffectNoiseReduction::ChannelLink channel_link = EffectNoiseReduction::ChannelLink::None;
+    // the frequency range, negative for no bound; taken by every call, last
+    double f0 = -1.0;
+    double f1 = -1.0;
 
-static bool
-PyAudacity_Noisered(const char *profile_path, double profile_start, double profile_end,
-                    const char *src_path, double noise_gain, double sensitivity, double smoothing,
-                    const char *dst_path) {
-    // import audio file for profile
-    const auto dir_manager = std::make_shared<DirManager>();
-    auto factory = new TrackFactory(dir_manager);
-    auto profile_handler = PCMImportFileHandle::Open(profile_path);
-    TrackHolders profile_holders{};
-    auto import_result = profile_handler->Import(factory, profile_holders);
-    if (import_result != ProgressResult::Success) {
-        delete factory;
+    bool apply(EffectNoiseReduction &effect) const {
+        effect.SetResampling(resample != 0);
+        effect.SetCompactHistory(compact_history != 0);
+        effect.SetChannelLink(channel_link);
+        return effect.SetAdvancedSettings(window_size, steps_per_window, window_types, method) &&
+               effect.SetAdaptiveProfile(adapt_time) &&
+               effect.SetFrequencyRange(f0, f1);
+    }
+};
+
+// An "O&" converter of a bound of the frequency range, None for no bound
+static int
+PyAudacity_GetFrequency(PyObject *object, void *frequency) {
+    if (object == Py_None) {
+        *(double *) frequency = -1.0;
+        return 1;
+    }
+    const double value = PyFloat_AsDouble(object);
+    if (value == -1.0 && PyErr_Occurred()) {
+        return 0;
+    }
+    *(double *) frequency = value;
+    return 1;
+}
+
+// An "O&" converter of how the channels of an input are classified: None
+// for each alone, or 'max', 'mean' or 'mid_side'
+static int
+PyAudacity_GetChannelLink(PyObject *object, void *link) {
+    static const char *const names[] = {"max", "mean", "mid_side"};
+    if (object == Py_None) {
+        *(EffectNoiseReduction::ChannelLink *) link = EffectNoiseReduction::ChannelLink::None;
+        return 1;
+    }
+    if (PyUnicode_Check(object)) {
+        for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+            if (PyUnicode_CompareWithASCIIString(object, names[i]) == 0) {
+                *(EffectNoiseReduction::ChannelLink *) link = (EffectNoiseReduction::ChannelLink) (i + 1);
+                return 1;
+            }
+        }
+    }
+    PyErr_SetString(PyExc_ValueError, "channel_link must be None, 'max', 'mean' or 'mid_side'.");
+    return 0;
+}
+
+// The outcome of work done without the GIL, to be raised once it is held
+// again: what went wrong, in the terms of EffectNoiseReduction, and where
+struct PyAudacityResult {
+    EffectNoiseReduction::Error error = EffectNoiseReduction::Error::None;
+    std::string context;
+
+    bool fail(EffectNoiseReduction::Error why, const std::string &where) {
+        error = why;
+        context = where;
         return false;
     }
+};
+
+// NoiseReductionError and a subclass for each EffectNoiseReduction::Error,
+// made by PyInit_cmodule()
+static PyObject *NoiseReductionError;
+static PyObject *AudioFileError;
+static PyObject *SampleRateError;
+static PyObject *ProfileTooShortError;
+static PyObject *SettingsError;
+static PyObject *CancelledError;
+
+// Raises the exception for result, and returns nullptr
+static PyObject *
+PyAudacity_Raise(const PyAudacityResult &result) {
+    using Error = EffectNoiseReduction::Error;
+    PyObject *type = NoiseReductionError;
+    const char *what = "noise reduction failed";
+    switch (result.error) {
+        case Error::File:
+            type = AudioFileError;
+            what = "cannot read or write the file";
+            break;
+        case Error::SampleRate:
+            type = SampleRateError;
+            what = "the sample rates of the noise profile and the audio differ";
+            break;
+        case Error::ProfileTooShort:
+            type = ProfileTooShortError;
+            what = "the selected noise profile is too short";
+            break;
+        case Error::NoProfile:
+            what = "there is no noise profile";
+            break;
+        case Error::Settings:
+            type = SettingsError;
+            what = "the advanced settings are not valid";
+            break;
+        case Error::Cancelled:
+            type = CancelledError;
+            what = "cancelled";
+            break;
+        default:
+            break;
+    }
+    PyErr_Format(type, "%s: %s", result.context.c_str(), what);
+    return nullptr;
+}
+
+// A Python callable kept by a Progress, which may be the last to let go of
+// it on a thread without the GIL
+struct PyAudacityCallable {
+    explicit PyAudacityCallable(PyObject *callable) : callable(callable) {
+        Py_INCREF(callable);
+    }
+
+    ~PyAudacityCallable() {
+        if (!Py_IsInitialized()) {
+            return;
+        }
+        auto state = PyGILState_Ensure();
+        Py_DECREF(callable);
+        PyGILState_Release(state);
+    }
+
+    PyObject *const callable;
+};
+
+// Cancels the calls it is given, from any thread, and reports their
+// progress to its callback.  The Progress is shared with the calls, which
+// may outlive the token.
+typedef struct {
+    PyObject_HEAD
+    std::shared_ptr<Progress> *progress;
+} PyAudacityCancelToken;
+
+static PyTypeObject *CancelTokenType;
+
+static PyObject *
+CancelToken_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+    static const char *keywords[] = {"callback", nullptr};
+    PyObject *callback = Py_None;
+
+    // parse args
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", (char **) keywords, &callback)) {
+        return nullptr;
+    }
+    if (callback != Py_None && !PyCallable_Check(callback)) {
+        PyErr_SetString(PyExc_TypeError, "callback must be callable.");
+        return nullptr;
+    }
+
+    // called from the threads doing the work, which hold no GIL; False or
+    // an exception cancels
+    Progress::Callback report{};
+    if (callback != Py_None) {
+        auto holder = std::make_shared<PyAudacityCallable>(callback);
+        report = [holder](double fraction) {
+            if (!Py_IsInitialized()) {
+                return true;
+            }
+            auto state = PyGILState_Ensure();
+            auto returned = PyObject_CallFunction(holder->callable, "d", fraction);
+            if (returned == nullptr) {
+                PyErr_WriteUnraisable(holder->callable);
+            }
+            const bool go_on = returned != nullptr && returned != Py_False;
+            Py_XDECREF(returned);
+            PyGILState_Release(state);
+            return go_on;
+        };
+    }
+
+    auto self = (PyAudacityCancelToken *) type->tp_alloc(type, 0);
+    if (self == nullptr) {
+        return nullptr;
+    }
+    self->progress = new std::shared_ptr<Progress>(std::make_shared<Progress>(std::move(report)));
+    return (PyObject *) self;
+}
+
+static void
+CancelToken_dealloc(PyAudacityCancelToken *self) {
+    auto type = Py_TYPE(self);
+    delete self->progress;
+    type->tp_free(self);
+    // instances of heap types own a reference to their type
+    Py_DECREF(type);
+}
+
+static PyObject *
+CancelToken_cancel(PyAudacityCancelToken *self, PyObject *args) {
+    (*self->progress)->Cancel();
+    Py_RETURN_NONE;
+}
 
-    // get profile
-    auto effect = new EffectNoiseReduction();
-    auto profile_result = effect->GetProfile(profile_holders[0].get(), profile_start, profile_end,
-                                             noise_gain, sensitivity, smoothing, factory);
-    if (!profile_result) {
-        delete factory;
-        delete effect;
+static PyObject *
+CancelToken_get_cancelled(PyAudacityCancelToken *self, void *closure) {
+    return PyBool_FromLong((*self->progress)->IsCancelled());
+}
+
+static PyMethodDef CancelTokenMethods[] = {
+        {"cancel", (PyCFunction) CancelToken_cancel, METH_NOARGS,
+                "stop the calls given this token at their next block; safe from any thread."},
+        {nullptr, nullptr, 0, nullptr}        /* Sentinel */
+};
+
+static PyGetSetDef CancelTokenGetSet[] = {
+        {(char *) "cancelled", (getter) CancelToken_get_cancelled, nullptr,
+                (char *) "whether cancel() was called, or the callback cancelled.", nullptr},
+        {nullptr, nullptr, nullptr, nullptr, nullptr}        /* Sentinel */
+};
+
+static PyType_Slot CancelTokenSlots[] = {
+        {Py_tp_new,     (void *) CancelToken_new},
+        {Py_tp_dealloc, (void *) CancelToken_dealloc},
+        {Py_tp_methods, (void *) CancelTokenMethods},
+        {Py_tp_getset,  (void *) CancelTokenGetSet},
+        {Py_tp_doc,     (void *) "cancels noise reduction calls, and reports their progress."},
+        {0,             nullptr}
+};
+
+static PyType_Spec CancelTokenSpec = {
+        "cmodule.CancelToken",
+        sizeof(PyAudacityCancelToken),
+        0,
+        Py_TPFLAGS_DEFAULT,
+        CancelTokenSlots
+};
+
+// token, None or a CancelToken, into progress; false with the error set if
+// it is neither
+static bool
+PyAudacity_GetProgress(PyObject *token, std::shared_ptr<Progress> &progress) {
+    if (token == Py_None) {
+        return true;
+    }
+    if (!PyObject_TypeCheck(token, CancelTokenType)) {
+        PyErr_SetString(PyExc_TypeError, "cancel must be a CancelToken or None.");
         return false;
     }
+    progress = *((PyAudacityCancelToken *) token)->progress;
+    return true;
+}
+
+// The memory budget of set_memory_budget(), shared by noisered() and
+// noisered_batch(); null for none.  Only set and copied with the GIL held.
+static std::shared_ptr<MemoryAdmission> PyAudacityAdmission{};
+
+// Needs no Python objects, so it runs without the GIL.  dir_manager is made
+// and set up by the caller.  With ranges, only those are reduced.  With an
+// admission, the file waits for its memory, and one whose tracks would not
+// fit the budget at all is streamed instead.  With progress, each stage
+// counts its blocks against it, and stops once it is cancelled.
+static bool
+PyAudacity_Noisered(const std::shared_ptr<DirManager> &dir_manager,
+                    const char *profile_path, double profile_start, double profile_end,
+                    const char *src_path, double noise_gain, double sensitivity, double smoothing,
+                    const char *dst_path, unsigned int threads, const PyAudacityAdvanced &advanced,
+                    const EffectNoiseReduction::TimeRanges *ranges, MemoryAdmission *admission,
+                    Progress *progress, PyAudacityResult &result) {
+    using Error = EffectNoiseReduction::Error;
+    TrackFactory factory(dir_manager);
+    // an import or export that stopped early was cancelled, else it failed
+    auto stopped = [progress] {
+        return progress && progress->IsCancelled() ? Error::Cancelled : Error::File;
+    };
+
+    // the profile is streamed, or taken from the cache, so the profile file
+    // is never imported
+    EffectNoiseReduction effect;
+    effect.SetThreads(threads);
+    effect.SetProgress(progress);
+    if (!advanced.apply(effect)) {
+        return result.fail(effect.GetLastError(), profile_path);
+    }
+    if (!effect.GetProfileCached(profile_path, profile_start, profile_end,
+                                 noise_gain, sensitivity, smoothing)) {
+        return result.fail(effect.GetLastError(), profile_path);
+    }
+
+    // hold the bytes of the tracks until they are exported
+    std::unique_ptr<MemoryAdmission::Ticket> ticket{};
+    EffectNoiseReduction::Footprint footprint{};
+    if (admission && effect.EstimateFootprint(src_path, footprint)) {
+        if (!ranges && !admission->Fits(footprint.trackBytes)) {
+            auto stream_ticket = admission->Admit(footprint.streamBytes);
+            if (!effect.ReduceNoiseStreaming(src_path, dst_path, noise_gain, sensitivity, smoothing)) {
+                return result.fail(effect.GetLastError(), src_path);
+            }
+            return true;
+        }
+        ticket = std::make_unique<MemoryAdmission::Ticket>(admission->Admit(footprint.trackBytes));
+    }
 
     // import src file
     TrackHolders src_holders{};
     auto src_handler = PCMImportFileHandle::Open(src_path);
-    import_result = src_handler->Import(factory, src_holders);
-    if (import_result != ProgressResult::Success) {
-        delete factory;
-        delete effect;
-        return false;
+    if (!src_handler) {
+        return result.fail(Error::File, src_path);
     }
-    // execute noise reduction
-    auto noisered_result = effect->ReduceNoise(src_holders[0].get(),
-                                               noise_gain, sensitivity, smoothing, factory);
-    if (!noisered_result) {
-        delete factory;
-        delete effect;
-        return false;
+    src_handler->SetProgress(progress);
+    if (src_handler->Import(&factory, src_holders) != ProgressResult::Success) {
+        return result.fail(stopped(), src_path);
+    }
+    // execute noise reduction, one thread per channel
+    std::vector<WaveTrack *> src_tracks{};
+    for (const auto &holder : src_holders)
+        src_tracks.push_back(holder.get());
+    if (ranges ? !effect.ReduceNoiseRanges(src_tracks, *ranges, noise_gain, sensitivity, smoothing, &factory)
+               : !effect.ReduceNoise(src_tracks, noise_gain, sensitivity, smoothing, &factory)) {
+        return result.fail(effect.GetLastError(), src_path);
     }
 
     // export
     auto exporter = ExportPCM();
+    exporter.SetProgress(progress);
     auto audioArray = WaveTrackConstArray();
-    audioArray.emplace_back(std::move(src_holders.at(0)));
-    auto export_result = exporter.Export(audioArray, std::string(dst_path));
-    if (export_result != ProgressResult::Success) {
-        delete factory;
-        delete effect;
+    for (auto &holder : src_holders)
+        audioArray.emplace_back(std::move(holder));
+    if (exporter.Export(audioArray, std::string(dst_path)) != ProgressResult::Success) {
+        return result.fail(stopped(), dst_path);
+    }
+    return true;
+}
+
+static bool
+PyAudacity_NoiseredStreaming(const char *profile_path, double profile_start, double profile_end,
+                             const char *src_path, double noise_gain, double sensitivity, double smoothing,
+                             const char *dst_path, const PyAudacityAdvanced &advanced,
+                             Progress *progress) {
+    // no tracks or block files: both files are streamed through libsndfile
+    auto effect = std::make_unique<EffectNoiseReduction>();
+    effect->SetProgress(progress);
+    if (!advanced.apply(*effect) ||
+        !effect->GetProfileCached(profile_path, profile_start, profile_end,
+                                  noise_gain, sensitivity, smoothing))
+        return false;
+
+    return effect->ReduceNoiseStreaming(src_path, dst_path, noise_gain, sensitivity, smoothing);
+}
+
+// The bytes of float samples the tracks of noisered() hold: the source's
+// as imported, and again as reduced
+static size_t
+PyAudacity_ExpectedBytes(const char *src_path) {
+    size_t bytes = 0;
+    SF_INFO info{};
+    if (SNDFILE *sf = sf_open(src_path, SFM_READ, &info)) {
+        bytes = 2 * (size_t) info.frames * info.channels * sizeof(float);
+        sf_close(sf);
+    }
+    return bytes;
+}
+
+// ranges, a sequence of (start, end) pairs in seconds, into result
+static bool
+PyAudacity_GetRanges(PyObject *ranges, EffectNoiseReduction::TimeRanges &result) {
+    auto sequence = PySequence_Fast(ranges, "ranges must be a sequence of (start, end) pairs.");
+    if (sequence == nullptr) {
+        return false;
+    }
+    for (Py_ssize_t i = 0, n = PySequence_Fast_GET_SIZE(sequence); i < n; ++i) {
+        double start, end;
+        if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(sequence, i), "dd", &start, &end)) {
+            Py_DECREF(sequence);
+            return false;
+        }
+        result.emplace_back(start, end);
+    }
+    Py_DECREF(sequence);
+    return true;
+}
+
+// storage, None, a path or a sequence of them, as roots for dir_manager
+static bool
+PyAudacity_SetStorage(DirManager &dir_manager, PyObject *storage, size_t expected_bytes) {
+    if (storage == Py_None) {
+        return true;
+    }
+    std::vector<std::string> roots{};
+    if (PyUnicode_Check(storage)) {
+        roots.push_back(PyUnicode_AsUTF8(storage));
+    } else {
+        auto sequence = PySequence_Fast(storage, "storage must be a path or a sequence of them.");
+        if (sequence == nullptr) {
+            return false;
+        }
+        for (Py_ssize_t i = 0, n = PySequence_Fast_GET_SIZE(sequence); i < n; ++i) {
+            const char *root = PyUnicode_Check(PySequence_Fast_GET_ITEM(sequence, i)) ?
+                               PyUnicode_AsUTF8(PySequence_Fast_GET_ITEM(sequence, i)) : nullptr;
+            if (root == nullptr) {
+                Py_DECREF(sequence);
+                PyErr_SetString(PyExc_TypeError, "storage paths must be str.");
+                return false;
+            }
+            roots.push_back(root);
+        }
+        Py_DECREF(sequence);
+    }
+    if (!dir_manager.SetStorageRoots(roots, expected_bytes)) {
+        PyErr_SetString(PyExc_ValueError, "storage must be one or more absolute paths.");
+        return false;
+    }
+    return true;
+}
+
+// A noisered() call, its arguments parsed and copied, so that it can run
+// after the call that made it has returned
+struct PyAudacityNoiseredJob {
+    std::shared_ptr<DirManager> dir_manager;
+    std::string profile_path;
+    double profile_start;
+    double profile_end;
+    std::string src_path;
+    double noise_gain;
+    double sensitivity;
+    double smoothing;
+    std::string dst_path;
+    unsigned int threads = 1;
+    PyAudacityAdvanced advanced;
+    bool has_ranges = false;
+    EffectNoiseReduction::TimeRanges ranges;
+    std::shared_ptr<MemoryAdmission> admission;
+    std::shared_ptr<Progress> progress;
+    PyAudacityResult result;
+
+    // without the GIL
+    bool run() {
+        const auto success = PyAudacity_Noisered(
+                dir_manager, profile_path.c_str(), profile_start, profile_end,
+                src_path.c_str(), noise_gain, sensitivity, smoothing,
+                dst_path.c_str(), threads, advanced,
+                has_ranges ? &ranges : nullptr, admission.get(), progress.get(), result);
+        dir_manager.reset();
+        return success;
+    }
+};
+
+// args of noisered() into job; false with the error set if they are wrong
+static bool
+PyAudacity_ParseNoisered(PyObject *args, PyAudacityNoiseredJob &job) {
+    const char *profile_path;
+    const char *src_path;
+    const char *dst_path;
+    Py_ssize_t block_size = 0;
+    PyObject *storage = Py_None;
+    Py_ssize_t memory_limit = 0;
+    PyObject *range_list = Py_None;
+    int compression = 0;
+    PyObject *cancel = Py_None;
+    auto &advanced = job.advanced;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "sddsddds|IIIiidnOnpOiOpO&O&O&",
+                          &profile_path, &job.profile_start, &job.profile_end,
+                          &src_path, &job.noise_gain, &job.sensitivity, &job.smoothing,
+                          &dst_path, &job.threads, &advanced.window_size, &advanced.steps_per_window,
+                          &advanced.window_types, &advanced.method,
+                          &advanced.adapt_time, &block_size, &storage, &memory_limit,
+                          &advanced.resample, &range_list, &compression, &cancel,
+                          &advanced.compact_history,
+                          PyAudacity_GetChannelLink, &advanced.channel_link,
+                          PyAudacity_GetFrequency, &advanced.f0, PyAudacity_GetFrequency, &advanced.f1)) {
+        return false;
+    }
+    if (!PyAudacity_GetProgress(cancel, job.progress)) {
+        return false;
+    }
+    job.profile_path = profile_path;
+    job.src_path = src_path;
+    job.dst_path = dst_path;
+    job.has_ranges = range_list != Py_None;
+    if (job.has_ranges && !PyAudacity_GetRanges(range_list, job.ranges)) {
+        return false;
+    }
+    if (memory_limit < 0) {
+        PyErr_SetString(PyExc_ValueError, "memory_limit must not be negative.");
         return false;
     }
 
-    delete factory;
-    delete effect;
+    auto dir_manager = std::make_shared<DirManager>();
+    if (block_size != 0 && (block_size < 0 || !dir_manager->SetMaxBlockBytes((size_t) block_size))) {
+        PyErr_Format(PyExc_ValueError, "block_size must be from %zu to %zu bytes",
+                     DirManager::MinBlockBytes, DirManager::MaxBlockBytes);
+        return false;
+    }
+    if (!dir_manager->SetCompression(compression)) {
+        PyErr_Format(PyExc_ValueError, "compression must be 0 or from %d to %d",
+                     BlockCodec::MinLevel, BlockCodec::MaxLevel);
+        return false;
+    }
+    // the samples past memory_limit go to the first root with room for them all,
+    // then to the next ones as each fills up
+    if (memory_limit > 0) {
+        dir_manager->SetMemoryBlocks(true, (size_t) memory_limit);
+    }
+    if (storage != Py_None) {
+        size_t expected_bytes;
+        Py_BEGIN_ALLOW_THREADS
+        expected_bytes = PyAudacity_ExpectedBytes(src_path);
+        Py_END_ALLOW_THREADS
+        if (!PyAudacity_SetStorage(*dir_manager, storage, expected_bytes - std::min<size_t>(expected_bytes, memory_limit))) {
+            return false;
+        }
+    }
+    job.dir_manager = std::move(dir_manager);
+    job.admission = PyAudacityAdmission;
     return true;
 }
 
 static PyObject *
 pyaudacity_noisered(PyObject *self, PyObject *args) {
+    PyAudacityNoiseredJob job;
+    if (!PyAudacity_ParseNoisered(args, job)) {
+        return nullptr;
+    }
+
+    // the files are imported, reduced and exported without the GIL, so
+    // that other Python threads can reduce at the same time
+    bool success;
+    Py_BEGIN_ALLOW_THREADS
+    success = job.run();
+    Py_END_ALLOW_THREADS
+
+    if (!success) {
+        return PyAudacity_Raise(job.result);
+    }
+    Py_RETURN_TRUE;
+}
+
+static PyObject *
+pyaudacity_noisered_streaming(PyObject *self, PyObject *args) {
     const char *profile_path;
     double profile_start;
     double profile_end;
@@ -78,28 +578,1166 @@ pyaudacity_noisered(PyObject *self, PyObject *args) {
     double sensitivity;
     double smoothing;
     const char *dst_path;
+    PyAudacityAdvanced advanced;
+    PyObject *cancel = Py_None;
+    std::shared_ptr<Progress> progress{};
 
     // parse args
-    if (!PyArg_ParseTuple(args, "sddsddds",
+    if (!PyArg_ParseTuple(args, "sddsddds|IIiidpOpO&O&O&",
                           &profile_path, &profile_start, &profile_end,
                           &src_path, &noise_gain, &sensitivity, &smoothing,
-                          &dst_path)) {
-        return Py_False;
+                          &dst_path, &advanced.window_size, &advanced.steps_per_window,
+                          &advanced.window_types, &advanced.method,
+                          &advanced.adapt_time, &advanced.resample, &cancel,
+                          &advanced.compact_history,
+                          PyAudacity_GetChannelLink, &advanced.channel_link,
+                          PyAudacity_GetFrequency, &advanced.f0, PyAudacity_GetFrequency, &advanced.f1) ||
+        !PyAudacity_GetProgress(cancel, progress)) {
+        return nullptr;
     }
 
-    auto result = PyAudacity_Noisered(profile_path, profile_start, profile_end,
-                                      src_path, noise_gain, sensitivity, smoothing,
-                                      dst_path);
+    // without the GIL, so that another thread can cancel it, and the
+    // token's callback be called
+    bool result;
+    Py_BEGIN_ALLOW_THREADS
+    result = PyAudacity_NoiseredStreaming(profile_path, profile_start, profile_end,
+                                          src_path, noise_gain, sensitivity, smoothing,
+                                          dst_path, advanced, progress.get());
+    Py_END_ALLOW_THREADS
     if (result) {
-        return Py_True;
+        Py_RETURN_TRUE;
+    } else {
+        Py_RETURN_FALSE;
+    }
+}
+
+// The pool that the _submit calls run on, a thread per core.  It is made
+// by the first of them and never destroyed, since its threads call into
+// Python for as long as the process runs.
+static TaskPool *PyAudacityPool = nullptr;
+
+// Runs work, which needs no Python objects, on the pool, then calls
+// callback(result, None) with the GIL held, where result is what finish()
+// returns, or callback(None, error) if finish() raises.  The callback runs
+// on a pool thread, so it should hand the outcome to an event loop in a
+// thread-safe way.  An exception from the callback is reported as
+// unraisable.
+static PyObject *
+PyAudacity_Submit(PyObject *callback, std::function<void()> work, std::function<PyObject *()> finish) {
+    if (!PyCallable_Check(callback)) {
+        PyErr_SetString(PyExc_TypeError, "callback must be callable.");
+        return nullptr;
+    }
+    if (PyAudacityPool == nullptr) {
+        PyAudacityPool = new TaskPool(std::max(1u, std::thread::hardware_concurrency()));
+    }
+
+    Py_INCREF(callback);
+    PyAudacityPool->Submit([callback, work, finish] {
+        bool thrown = false;
+        try {
+            work();
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            thrown = true;
+        }
+        if (!Py_IsInitialized()) {
+            return;
+        }
+
+        auto state = PyGILState_Ensure();
+        PyObject *result = nullptr;
+        if (thrown) {
+            PyErr_SetString(NoiseReductionError, "noise reduction failed unexpectedly");
+        } else {
+            result = finish();
+        }
+        PyObject *outcome;
+        if (result != nullptr) {
+            outcome = Py_BuildValue("(NO)", result, Py_None);
+        } else {
+            PyObject *type, *value, *traceback;
+            PyErr_Fetch(&type, &value, &traceback);
+            PyErr_NormalizeException(&type, &value, &traceback);
+            if (traceback != nullptr) {
+                PyException_SetTraceback(value, traceback);
+            }
+            outcome = Py_BuildValue("(OO)", Py_None, value);
+            Py_XDECREF(type);
+            Py_XDECREF(value);
+            Py_XDECREF(traceback);
+        }
+        auto returned = outcome != nullptr ? PyObject_CallObject(callback, outcome) : nullptr;
+        if (returned == nullptr) {
+            PyErr_WriteUnraisable(callback);
+        }
+        Py_XDECREF(returned);
+        Py_XDECREF(outcome);
+        Py_DECREF(callback);
+        PyGILState_Release(state);
+    });
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+pyaudacity_noisered_submit(PyObject *self, PyObject *args) {
+    PyObject *callback;
+    PyObject *call_args;
+    if (!PyArg_ParseTuple(args, "OO!", &callback, &PyTuple_Type, &call_args)) {
+        return nullptr;
+    }
+
+    auto job = std::make_shared<PyAudacityNoiseredJob>();
+    if (!PyAudacity_ParseNoisered(call_args, *job)) {
+        return nullptr;
+    }
+    auto success = std::make_shared<bool>(false);
+    return PyAudacity_Submit(
+            callback,
+            [job, success] { *success = job->run(); },
+            [job, success]() -> PyObject * {
+                if (!*success) {
+                    return PyAudacity_Raise(job->result);
+                }
+                Py_RETURN_TRUE;
+            });
+}
+
+static PyObject *
+pyaudacity_noisered_streaming_submit(PyObject *self, PyObject *args) {
+    PyObject *callback;
+    PyObject *call_args;
+    if (!PyArg_ParseTuple(args, "OO!", &callback, &PyTuple_Type, &call_args)) {
+        return nullptr;
+    }
+
+    const char *profile_path;
+    double profile_start;
+    double profile_end;
+    const char *src_path;
+    double noise_gain;
+    double sensitivity;
+    double smoothing;
+    const char *dst_path;
+    PyAudacityAdvanced advanced;
+    PyObject *cancel = Py_None;
+    std::shared_ptr<Progress> progress{};
+    if (!PyArg_ParseTuple(call_args, "sddsddds|IIiidpOpO&O&O&",
+                          &profile_path, &profile_start, &profile_end,
+                          &src_path, &noise_gain, &sensitivity, &smoothing,
+                          &dst_path, &advanced.window_size, &advanced.steps_per_window,
+                          &advanced.window_types, &advanced.method,
+                          &advanced.adapt_time, &advanced.resample, &cancel,
+                          &advanced.compact_history,
+                          PyAudacity_GetChannelLink, &advanced.channel_link,
+                          PyAudacity_GetFrequency, &advanced.f0, PyAudacity_GetFrequency, &advanced.f1) ||
+        !PyAudacity_GetProgress(cancel, progress)) {
+        return nullptr;
+    }
+
+    // the paths outlive the arguments
+    const std::string profile{profile_path}, src{src_path}, dst{dst_path};
+    auto success = std::make_shared<bool>(false);
+    return PyAudacity_Submit(
+            callback,
+            [=] {
+                *success = PyAudacity_NoiseredStreaming(profile.c_str(), profile_start, profile_end,
+                                                        src.c_str(), noise_gain, sensitivity, smoothing,
+                                                        dst.c_str(), advanced, progress.get());
+            },
+            [success] { return PyBool_FromLong(*success); });
+}
+
+// Noise profile shared by reduce() calls.  Only the Statistics of the wrapped
+// effect outlive build_profile(); step 2 parameters are given to each reduce(),
+// which reduces through Profile_share().
+typedef struct {
+    PyObject_HEAD
+    EffectNoiseReduction *effect;
+} PyAudacityProfile;
+
+static PyTypeObject *ProfileType;
+
+static void
+Profile_dealloc(PyAudacityProfile *self) {
+    auto type = Py_TYPE(self);
+    delete self->effect;
+    PyObject_Del(self);
+    // instances of heap types own a reference to their type
+    Py_DECREF(type);
+}
+
+static PyObject *
+Profile_save(PyAudacityProfile *self, PyObject *args) {
+    const char *path;
+    if (!PyArg_ParseTuple(args, "s", &path)) {
+        return nullptr;
+    }
+
+    if (self->effect->SaveProfile(path)) {
+        Py_RETURN_TRUE;
+    } else {
+        Py_RETURN_FALSE;
+    }
+}
+
+static PyObject *
+Profile_merge(PyAudacityProfile *self, PyObject *args) {
+    PyObject *other;
+    if (!PyArg_ParseTuple(args, "O!", ProfileType, &other)) {
+        return nullptr;
+    }
+
+    if (self->effect->MergeProfile(*((PyAudacityProfile *) other)->effect)) {
+        Py_RETURN_TRUE;
     } else {
-        return Py_False;
+        Py_RETURN_FALSE;
+    }
+}
+
+static PyMethodDef ProfileMethods[] = {
+        {"save",  (PyCFunction) Profile_save,  METH_VARARGS, "save the noise profile to a binary file."},
+        {"merge", (PyCFunction) Profile_merge, METH_VARARGS, "add the noise of another profile to this one."},
+        {nullptr, nullptr, 0, nullptr}        /* Sentinel */
+};
+
+static PyType_Slot ProfileSlots[] = {
+        {Py_tp_dealloc, (void *) Profile_dealloc},
+        {Py_tp_methods, (void *) ProfileMethods},
+        {Py_tp_doc,     (void *) "noise profile statistics."},
+        {0,             nullptr}
+};
+
+static PyType_Spec ProfileSpec = {
+        "cmodule.Profile",
+        sizeof(PyAudacityProfile),
+        0,
+        Py_TPFLAGS_DEFAULT,
+        ProfileSlots
+};
+
+static PyObject *
+Profile_wrap(std::unique_ptr<EffectNoiseReduction> effect) {
+    auto self = PyObject_New(PyAudacityProfile, ProfileType);
+    if (self == nullptr) {
+        return nullptr;
+    }
+    self->effect = effect.release();
+    return (PyObject *) self;
+}
+
+// Each call reduces with an effect of its own that shares the profile, so
+// that the settings of one call don't reach another and the profile is only
+// read while the GIL is released
+static std::unique_ptr<EffectNoiseReduction>
+Profile_share(PyObject *profile) {
+    auto effect = std::make_unique<EffectNoiseReduction>();
+    effect->UseProfile(((PyAudacityProfile *) profile)->effect->ShareProfile());
+    return effect;
+}
+
+static PyObject *
+pyaudacity_build_profile(PyObject *self, PyObject *args) {
+    const char *profile_path;
+    double profile_start;
+    double profile_end;
+    PyAudacityAdvanced advanced;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "sdd|IIiiO&O&", &profile_path, &profile_start, &profile_end,
+                          &advanced.window_size, &advanced.steps_per_window,
+                          &advanced.window_types, &advanced.method,
+                          PyAudacity_GetFrequency, &advanced.f0, PyAudacity_GetFrequency, &advanced.f1)) {
+        return nullptr;
     }
+
+    // the statistics do not depend on the step 2 parameters, but do on the
+    // advanced ones
+    auto effect = std::make_unique<EffectNoiseReduction>();
+    if (!advanced.apply(*effect) ||
+        !effect->GetProfileCached(profile_path, profile_start, profile_end, 12.0, 6.0, 3.0)) {
+        Py_RETURN_NONE;
+    }
+    return Profile_wrap(std::move(effect));
 }
 
+static PyObject *
+pyaudacity_build_profile_segments(PyObject *self, PyObject *args) {
+    PyObject *segment_list;
+    unsigned int threads = 0;
+    PyAudacityAdvanced advanced;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "O|IIIiiO&O&", &segment_list, &threads,
+                          &advanced.window_size, &advanced.steps_per_window,
+                          &advanced.window_types, &advanced.method,
+                          PyAudacity_GetFrequency, &advanced.f0, PyAudacity_GetFrequency, &advanced.f1)) {
+        return nullptr;
+    }
+
+    // copy the (path, start, end) segments out while the GIL is held
+    std::vector<EffectNoiseReduction::ProfileSegment> segments{};
+    auto sequence = PySequence_Fast(segment_list, "segments must be a sequence of (path, start, end).");
+    if (sequence == nullptr) {
+        return nullptr;
+    }
+    for (Py_ssize_t i = 0, n = PySequence_Fast_GET_SIZE(sequence); i < n; ++i) {
+        const char *path;
+        double start;
+        double end;
+        if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(sequence, i), "sdd", &path, &start, &end)) {
+            Py_DECREF(sequence);
+            return nullptr;
+        }
+        segments.push_back({path, start, end});
+    }
+    Py_DECREF(sequence);
+
+    auto effect = std::make_unique<EffectNoiseReduction>();
+    bool success = advanced.apply(*effect);
+    if (success) {
+        Py_BEGIN_ALLOW_THREADS
+        success = effect->GetProfileSegments(segments, threads);
+        Py_END_ALLOW_THREADS
+    }
+    if (!success) {
+        Py_RETURN_NONE;
+    }
+    return Profile_wrap(std::move(effect));
+}
+
+static PyObject *
+pyaudacity_load_profile(PyObject *self, PyObject *args) {
+    const char *path;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "s", &path)) {
+        return nullptr;
+    }
+
+    auto effect = std::make_unique<EffectNoiseReduction>();
+    if (!effect->LoadProfile(path)) {
+        Py_RETURN_NONE;
+    }
+    return Profile_wrap(std::move(effect));
+}
+
+static PyObject *
+pyaudacity_reduce(PyObject *self, PyObject *args) {
+    PyObject *profile;
+    const char *src_path;
+    double noise_gain;
+    double sensitivity;
+    double smoothing;
+    const char *dst_path;
+    PyAudacityAdvanced advanced;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "O!sddds|IIiidppO&O&O&",
+                          ProfileType, &profile,
+                          &src_path, &noise_gain, &sensitivity, &smoothing,
+                          &dst_path, &advanced.window_size, &advanced.steps_per_window,
+                          &advanced.window_types, &advanced.method,
+                          &advanced.adapt_time, &advanced.resample,
+                          &advanced.compact_history,
+                          PyAudacity_GetChannelLink, &advanced.channel_link,
+                          PyAudacity_GetFrequency, &advanced.f0, PyAudacity_GetFrequency, &advanced.f1)) {
+        return nullptr;
+    }
+
+    auto effect = Profile_share(profile);
+    if (advanced.apply(*effect) &&
+        effect->ReduceNoiseStreaming(src_path, dst_path, noise_gain, sensitivity, smoothing)) {
+        Py_RETURN_TRUE;
+    } else {
+        Py_RETURN_FALSE;
+    }
+}
+
+static PyObject *
+pyaudacity_noisered_batch(PyObject *self, PyObject *args) {
+    PyObject *profile;
+    PyObject *file_list;
+    double noise_gain;
+    double sensitivity;
+    double smoothing;
+    unsigned int threads;
+    PyAudacityAdvanced advanced;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "O!OdddI|IIiidppO&O&O&",
+                          ProfileType, &profile, &file_list,
+                          &noise_gain, &sensitivity, &smoothing, &threads,
+                          &advanced.window_size, &advanced.steps_per_window,
+                          &advanced.window_types, &advanced.method,
+                          &advanced.adapt_time, &advanced.resample,
+                          &advanced.compact_history,
+                          PyAudacity_GetChannelLink, &advanced.channel_link,
+                          PyAudacity_GetFrequency, &advanced.f0, PyAudacity_GetFrequency, &advanced.f1)) {
+        return nullptr;
+    }
+
+    // copy the (src, dst) pairs out while the GIL is held
+    std::vector<std::pair<std::string, std::string>> files{};
+    auto sequence = PySequence_Fast(file_list, "files must be a sequence of (src, dst) pairs.");
+    if (sequence == nullptr) {
+        return nullptr;
+    }
+    for (Py_ssize_t i = 0, n = PySequence_Fast_GET_SIZE(sequence); i < n; ++i) {
+        const char *src_path;
+        const char *dst_path;
+        if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(sequence, i), "ss", &src_path, &dst_path)) {
+            Py_DECREF(sequence);
+            return nullptr;
+        }
+        files.emplace_back(src_path, dst_path);
+    }
+    Py_DECREF(sequence);
+
+    auto effect = Profile_share(profile);
+    auto admission = PyAudacityAdmission;
+    std::vector<EffectNoiseReduction::BatchResult> results{};
+    if (advanced.apply(*effect)) {
+        Py_BEGIN_ALLOW_THREADS
+        effect->ReduceNoiseBatch(files, noise_gain, sensitivity, smoothing, results, threads, 0,
+                                 admission.get());
+        Py_END_ALLOW_THREADS
+    } else {
+        results.assign(files.size(), EffectNoiseReduction::BatchResult{false, 0.0});
+    }
+
+    // one (success, seconds) tuple per pair
+    auto list = PyList_New(results.size());
+    if (list == nullptr) {
+        return nullptr;
+    }
+    for (size_t i = 0; i < results.size(); ++i) {
+        PyList_SET_ITEM(list, i, Py_BuildValue("(Nd)", PyBool_FromLong(results[i].success),
+                                               results[i].seconds));
+    }
+    return list;
+}
+
+static PyObject *
+pyaudacity_sweep(PyObject *self, PyObject *args) {
+    PyObject *profile;
+    const char *src_path;
+    PyObject *setting_list;
+    double sensitivity = 6.0;
+    PyAudacityAdvanced advanced;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "O!sO|dIIiidppO&O&O&",
+                          ProfileType, &profile, &src_path, &setting_list, &sensitivity,
+                          &advanced.window_size, &advanced.steps_per_window,
+                          &advanced.window_types, &advanced.method,
+                          &advanced.adapt_time, &advanced.resample,
+                          &advanced.compact_history,
+                          PyAudacity_GetChannelLink, &advanced.channel_link,
+                          PyAudacity_GetFrequency, &advanced.f0, PyAudacity_GetFrequency, &advanced.f1)) {
+        return nullptr;
+    }
+
+    // copy the (noise_gain, smoothing, dst_path) settings out while the GIL is held
+    std::vector<EffectNoiseReduction::SweepSetting> settings{};
+    auto sequence = PySequence_Fast(setting_list, "settings must be a sequence of (noise_gain, smoothing, dst_path).");
+    if (sequence == nullptr) {
+        return nullptr;
+    }
+    for (Py_ssize_t i = 0, n = PySequence_Fast_GET_SIZE(sequence); i < n; ++i) {
+        double noise_gain;
+        double smoothing;
+        const char *dst_path;
+        if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(sequence, i), "dds", &noise_gain, &smoothing, &dst_path)) {
+            Py_DECREF(sequence);
+            return nullptr;
+        }
+        settings.push_back({noise_gain, smoothing, dst_path});
+    }
+    Py_DECREF(sequence);
+
+    auto effect = Profile_share(profile);
+    bool success = advanced.apply(*effect);
+    if (success) {
+        Py_BEGIN_ALLOW_THREADS
+        success = effect->ReduceNoiseSweep(src_path, sensitivity, settings);
+        Py_END_ALLOW_THREADS
+    }
+    if (success) {
+        Py_RETURN_TRUE;
+    } else {
+        Py_RETURN_FALSE;
+    }
+}
+
+static PyObject *
+pyaudacity_preview(PyObject *self, PyObject *args) {
+    PyObject *profile;
+    const char *src_path;
+    unsigned int decimation = 4;
+    double sensitivity = 6.0;
+    PyAudacityAdvanced advanced;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "O!s|IdIIiipO&O&",
+                          ProfileType, &profile, &src_path, &decimation, &sensitivity,
+                          &advanced.window_size, &advanced.steps_per_window,
+                          &advanced.window_types, &advanced.method, &advanced.resample,
+                          PyAudacity_GetFrequency, &advanced.f0, PyAudacity_GetFrequency, &advanced.f1)) {
+        return nullptr;
+    }
+
+    auto effect = Profile_share(profile);
+    EffectNoiseReduction::NoisePreview preview{};
+    bool success = false;
+    if (advanced.apply(*effect)) {
+        Py_BEGIN_ALLOW_THREADS
+        success = effect->PreviewNoise(src_path, decimation, sensitivity, preview);
+        Py_END_ALLOW_THREADS
+    }
+    if (!success) {
+        Py_RETURN_NONE;
+    }
+
+    // (fraction, [[fraction of each step] per channel])
+    auto channels = PyList_New(preview.stepFractions.size());
+    if (channels == nullptr) {
+        return nullptr;
+    }
+    for (size_t i = 0; i < preview.stepFractions.size(); ++i) {
+        const auto &fractions = preview.stepFractions[i];
+        auto steps = PyList_New(fractions.size());
+        if (steps == nullptr) {
+            Py_DECREF(channels);
+            return nullptr;
+        }
+        for (size_t j = 0; j < fractions.size(); ++j) {
+            PyList_SET_ITEM(steps, j, PyFloat_FromDouble(fractions[j]));
+        }
+        PyList_SET_ITEM(channels, i, steps);
+    }
+    return Py_BuildValue("(dN)", preview.noiseFraction, channels);
+}
+
+// A read-only memoryview of the len items of format in bytes, which it takes,
+// in rows of columns if that is not 0, for numpy.asarray() to take without
+// copying
+static PyObject *
+Shaped_view(PyObject *bytes, size_t len, const char *format, size_t columns) {
+    if (bytes == nullptr) {
+        return nullptr;
+    }
+    auto view = PyMemoryView_FromObject(bytes);
+    Py_DECREF(bytes);
+    if (view == nullptr) {
+        return nullptr;
+    }
+    auto shaped = columns > 0
+                  ? PyObject_CallMethod(view, "cast", "s(nn)", format,
+                                        (Py_ssize_t) (len / columns), (Py_ssize_t) columns)
+                  : PyObject_CallMethod(view, "cast", "s", format);
+    Py_DECREF(view);
+    return shaped;
+}
+
+// The same of a copy of len items at data
+static PyObject *
+Array_view(const void *data, size_t len, const char *format, size_t item_size, size_t columns) {
+    return Shaped_view(PyBytes_FromStringAndSize((const char *) data, len * item_size),
+                       len, format, columns);
+}
+
+// Gets a C contiguous float32 buffer of frames, or of frames by channels, as
+// from numpy, in place
+static bool
+Samples_get(PyObject *object, Py_buffer &view, size_t &channels, size_t &frames, bool writable) {
+    if (PyObject_GetBuffer(object, &view,
+                           PyBUF_C_CONTIGUOUS | PyBUF_FORMAT | (writable ? PyBUF_WRITABLE : 0)) < 0) {
+        return false;
+    }
+    if (view.format == nullptr || strcmp(view.format, "f") != 0 || view.ndim < 1 || view.ndim > 2 ||
+        (view.ndim == 2 && view.shape[1] < 1)) {
+        PyBuffer_Release(&view);
+        PyErr_SetString(PyExc_ValueError, "samples must be float32, of frames or of frames by channels.");
+        return false;
+    }
+    frames = (size_t) view.shape[0];
+    channels = view.ndim == 2 ? (size_t) view.shape[1] : 1;
+    return true;
+}
+
+// Reduces signal against the profile of effect, into out if given, else into a
+// new view shaped like signal.  The GIL is released while reducing.
+static PyObject *
+PyAudacity_ReduceArray(EffectNoiseReduction &effect, PyObject *signal, double rate,
+                       double noise_gain, double sensitivity, double smoothing, PyObject *out) {
+    Py_buffer in;
+    size_t channels;
+    size_t frames;
+    if (!Samples_get(signal, in, channels, frames, false)) {
+        return nullptr;
+    }
+
+    Py_buffer target;
+    PyObject *result;
+    float *buffer;
+    if (out != nullptr && out != Py_None) {
+        size_t out_channels;
+        size_t out_frames;
+        if (!Samples_get(out, target, out_channels, out_frames, true)) {
+            PyBuffer_Release(&in);
+            return nullptr;
+        }
+        if (out_channels != channels || out_frames != frames) {
+            PyBuffer_Release(&target);
+            PyBuffer_Release(&in);
+            PyErr_SetString(PyExc_ValueError, "out must have the shape of signal.");
+            return nullptr;
+        }
+        buffer = (float *) target.buf;
+        result = out;
+        Py_INCREF(result);
+    } else {
+        result = PyBytes_FromStringAndSize(nullptr, in.len);
+        if (result == nullptr) {
+            PyBuffer_Release(&in);
+            return nullptr;
+        }
+        buffer = (float *) PyBytes_AS_STRING(result);
+    }
+
+    bool success;
+    Py_BEGIN_ALLOW_THREADS
+    success = effect.ReduceNoiseBuffer((const float *) in.buf, buffer, channels, frames, rate,
+                                       noise_gain, sensitivity, smoothing);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&in);
+    if (result == out) {
+        PyBuffer_Release(&target);
+    }
+
+    if (!success) {
+        Py_DECREF(result);
+        Py_RETURN_NONE;
+    }
+    if (result == out) {
+        return result;
+    }
+    return Shaped_view(result, frames * channels, "f", channels > 1 ? channels : 0);
+}
+
+static PyObject *
+pyaudacity_build_profile_array(PyObject *self, PyObject *args) {
+    PyObject *samples;
+    double rate;
+    PyAudacityAdvanced advanced;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "Od|IIiiO&O&", &samples, &rate,
+                          &advanced.window_size, &advanced.steps_per_window,
+                          &advanced.window_types, &advanced.method,
+                          PyAudacity_GetFrequency, &advanced.f0, PyAudacity_GetFrequency, &advanced.f1)) {
+        return nullptr;
+    }
+
+    Py_buffer view;
+    size_t channels;
+    size_t frames;
+    if (!Samples_get(samples, view, channels, frames, false)) {
+        return nullptr;
+    }
+    auto effect = std::make_unique<EffectNoiseReduction>();
+    bool success = advanced.apply(*effect);
+    if (success) {
+        Py_BEGIN_ALLOW_THREADS
+        success = effect->GetProfileBuffer((const float *) view.buf, channels, frames, rate, 12.0, 6.0, 3.0);
+        Py_END_ALLOW_THREADS
+    }
+    PyBuffer_Release(&view);
+    if (!success) {
+        Py_RETURN_NONE;
+    }
+    return Profile_wrap(std::move(effect));
+}
+
+static PyObject *
+pyaudacity_reduce_array(PyObject *self, PyObject *args) {
+    PyObject *profile;
+    PyObject *signal;
+    double rate;
+    double noise_gain;
+    double sensitivity;
+    double smoothing;
+    PyObject *out;
+    PyAudacityAdvanced advanced;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "O!OddddO|IIiidpO&O&O&",
+                          ProfileType, &profile, &signal, &rate,
+                          &noise_gain, &sensitivity, &smoothing, &out,
+                          &advanced.window_size, &advanced.steps_per_window,
+                          &advanced.window_types, &advanced.method,
+                          &advanced.adapt_time,
+                          &advanced.compact_history,
+                          PyAudacity_GetChannelLink, &advanced.channel_link,
+                          PyAudacity_GetFrequency, &advanced.f0, PyAudacity_GetFrequency, &advanced.f1)) {
+        return nullptr;
+    }
+
+    auto effect = Profile_share(profile);
+    if (!advanced.apply(*effect)) {
+        Py_RETURN_NONE;
+    }
+    return PyAudacity_ReduceArray(*effect, signal, rate, noise_gain, sensitivity, smoothing, out);
+}
+
+static PyObject *
+pyaudacity_noisered_array(PyObject *self, PyObject *args) {
+    PyObject *profile_samples;
+    PyObject *signal;
+    double rate;
+    double noise_gain;
+    double sensitivity;
+    double smoothing;
+    PyObject *out;
+    PyAudacityAdvanced advanced;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "OOddddO|IIiidpO&O&O&",
+                          &profile_samples, &signal, &rate,
+                          &noise_gain, &sensitivity, &smoothing, &out,
+                          &advanced.window_size, &advanced.steps_per_window,
+                          &advanced.window_types, &advanced.method,
+                          &advanced.adapt_time,
+                          &advanced.compact_history,
+                          PyAudacity_GetChannelLink, &advanced.channel_link,
+                          PyAudacity_GetFrequency, &advanced.f0, PyAudacity_GetFrequency, &advanced.f1)) {
+        return nullptr;
+    }
+
+    // the whole of profile_samples is the noise
+    Py_buffer view;
+    size_t channels;
+    size_t frames;
+    if (!Samples_get(profile_samples, view, channels, frames, false)) {
+        return nullptr;
+    }
+    EffectNoiseReduction effect;
+    bool success = advanced.apply(effect);
+    if (success) {
+        Py_BEGIN_ALLOW_THREADS
+        success = effect.GetProfileBuffer((const float *) view.buf, channels, frames, rate,
+                                          noise_gain, sensitivity, smoothing);
+        Py_END_ALLOW_THREADS
+    }
+    PyBuffer_Release(&view);
+    if (!success) {
+        Py_RETURN_NONE;
+    }
+    return PyAudacity_ReduceArray(effect, signal, rate, noise_gain, sensitivity, smoothing, out);
+}
+
+static PyObject *
+pyaudacity_build_profile_bytes(PyObject *self, PyObject *args) {
+    Py_buffer data;
+    double profile_start;
+    double profile_end;
+    PyAudacityAdvanced advanced;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "y*dd|IIiiO&O&", &data, &profile_start, &profile_end,
+                          &advanced.window_size, &advanced.steps_per_window,
+                          &advanced.window_types, &advanced.method,
+                          PyAudacity_GetFrequency, &advanced.f0, PyAudacity_GetFrequency, &advanced.f1)) {
+        return nullptr;
+    }
+
+    auto effect = std::make_unique<EffectNoiseReduction>();
+    bool success = advanced.apply(*effect);
+    if (success) {
+        Py_BEGIN_ALLOW_THREADS
+        success = effect->GetProfileMemory(data.buf, (size_t) data.len, profile_start, profile_end,
+                                           12.0, 6.0, 3.0);
+        Py_END_ALLOW_THREADS
+    }
+    PyBuffer_Release(&data);
+    if (!success) {
+        Py_RETURN_NONE;
+    }
+    return Profile_wrap(std::move(effect));
+}
+
+static PyObject *
+pyaudacity_reduce_bytes(PyObject *self, PyObject *args) {
+    PyObject *profile;
+    Py_buffer data;
+    double noise_gain;
+    double sensitivity;
+    double smoothing;
+    int subformat = 0;
+    PyAudacityAdvanced advanced;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "O!y*ddd|iIIiidppO&O&O&",
+                          ProfileType, &profile, &data,
+                          &noise_gain, &sensitivity, &smoothing, &subformat,
+                          &advanced.window_size, &advanced.steps_per_window,
+                          &advanced.window_types, &advanced.method,
+                          &advanced.adapt_time, &advanced.resample,
+                          &advanced.compact_history,
+                          PyAudacity_GetChannelLink, &advanced.channel_link,
+                          PyAudacity_GetFrequency, &advanced.f0, PyAudacity_GetFrequency, &advanced.f1)) {
+        return nullptr;
+    }
+
+    auto effect = Profile_share(profile);
+    std::vector<char> out;
+    bool success = advanced.apply(*effect);
+    if (success) {
+        Py_BEGIN_ALLOW_THREADS
+        success = effect->ReduceNoiseMemory(data.buf, (size_t) data.len, out,
+                                            noise_gain, sensitivity, smoothing, subformat);
+        Py_END_ALLOW_THREADS
+    }
+    PyBuffer_Release(&data);
+    if (!success) {
+        Py_RETURN_NONE;
+    }
+    return PyBytes_FromStringAndSize(out.data(), (Py_ssize_t) out.size());
+}
+
+static PyObject *
+pyaudacity_analyze(PyObject *self, PyObject *args) {
+    PyObject *profile;
+    const char *src_path;
+    double sensitivity = 6.0;
+    int masks = false;
+    PyAudacityAdvanced advanced;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "O!s|dpIIiipO&O&",
+                          ProfileType, &profile, &src_path, &sensitivity, &masks,
+                          &advanced.window_size, &advanced.steps_per_window,
+                          &advanced.window_types, &advanced.method, &advanced.resample,
+                          PyAudacity_GetFrequency, &advanced.f0, PyAudacity_GetFrequency, &advanced.f1)) {
+        return nullptr;
+    }
+
+    auto effect = Profile_share(profile);
+    EffectNoiseReduction::NoisePreview preview{};
+    bool success = false;
+    if (advanced.apply(*effect)) {
+        Py_BEGIN_ALLOW_THREADS
+        success = effect->PreviewNoise(src_path, 1, sensitivity, preview, masks);
+        Py_END_ALLOW_THREADS
+    }
+    if (!success) {
+        Py_RETURN_NONE;
+    }
+
+    // one view per channel: float32 fractions of each step, or uint8 masks
+    // of steps by bands
+    auto channels = PyList_New(preview.stepFractions.size());
+    if (channels == nullptr) {
+        return nullptr;
+    }
+    for (size_t i = 0; i < preview.stepFractions.size(); ++i) {
+        auto view = masks
+                    ? Array_view(preview.stepMasks[i].data(), preview.stepMasks[i].size(),
+                                 "B", 1, preview.bands)
+                    : Array_view(preview.stepFractions[i].data(), preview.stepFractions[i].size(),
+                                 "f", sizeof(float), 0);
+        if (view == nullptr) {
+            Py_DECREF(channels);
+            return nullptr;
+        }
+        PyList_SET_ITEM(channels, i, view);
+    }
+    return channels;
+}
+
+static PyObject *
+pyaudacity_window_types(PyObject *self, PyObject *args) {
+    const auto names = EffectNoiseReduction::GetWindowTypesNames();
+    auto list = PyList_New(names.size());
+    if (list == nullptr) {
+        return nullptr;
+    }
+    for (size_t i = 0; i < names.size(); ++i) {
+        PyList_SET_ITEM(list, i, PyUnicode_FromString(names[i].c_str()));
+    }
+    return list;
+}
+
+static PyObject *
+pyaudacity_stats_json(PyObject *self, PyObject *args) {
+    int reset = 0;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "|p", &reset)) {
+        return nullptr;
+    }
+
+    const auto json = Instrumentation::ToJSON();
+    if (reset) {
+        Instrumentation::Reset();
+    }
+    return PyUnicode_FromString(json.c_str());
+}
+
+static PyObject *
+pyaudacity_reset_stats(PyObject *self, PyObject *args) {
+    Instrumentation::Reset();
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+pyaudacity_set_profile_cache(PyObject *self, PyObject *args) {
+    int enable;
+    const char *directory = nullptr;
+    if (!PyArg_ParseTuple(args, "p|z", &enable, &directory)) {
+        return nullptr;
+    }
+
+    if (!EffectNoiseReduction::SetProfileCache(enable, directory ? directory : "")) {
+        PyErr_Format(PyExc_OSError, "cannot make the profile cache directory %s", directory);
+        return nullptr;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+pyaudacity_clear_profile_cache(PyObject *self, PyObject *args) {
+    EffectNoiseReduction::ClearProfileCache();
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+pyaudacity_set_memory_budget(PyObject *self, PyObject *args) {
+    unsigned long long bytes;
+    if (!PyArg_ParseTuple(args, "K", &bytes)) {
+        return nullptr;
+    }
+
+    // calls already admitted keep the budget they started with
+    PyAudacityAdmission = bytes ? std::make_shared<MemoryAdmission>((size_t) bytes) : nullptr;
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+pyaudacity_set_validation(PyObject *self, PyObject *args) {
+    int level;
+    if (!PyArg_ParseTuple(args, "i", &level)) {
+        return nullptr;
+    }
+    if (level < 0 || level > (int) Sequence::Validation::Full) {
+        PyErr_SetString(PyExc_ValueError, "level must be 0 (off), 1 (new blocks) or 2 (full).");
+        return nullptr;
+    }
+
+    Sequence::SetValidation((Sequence::Validation) level);
+    Py_RETURN_NONE;
+}
+
+// Reducer of one channel of live audio, fed buffers of native float32
+// samples.  Owns a copy of the profile it was made from.
+typedef struct {
+    PyObject_HEAD
+    NoiseReducer *reducer;
+} PyAudacityReducer;
+
+static PyTypeObject *ReducerType;
+
+static PyObject *
+Reducer_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+    static const char *keywords[] = {"profile", "rate", "noise_gain", "sensitivity", "smoothing",
+                                     "window_size", "steps_per_window", "window_types", "method", "adapt_time",
+                                     "compact_history", "f0", "f1", nullptr};
+    PyObject *profile;
+    double rate;
+    double noise_gain = 12.0;
+    double sensitivity = 6.0;
+    double smoothing = 3.0;
+    PyAudacityAdvanced advanced;
+
+    // parse args
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!d|dddIIiidpO&O&", (char **) keywords,
+                                     ProfileType, &profile, &rate,
+                                     &noise_gain, &sensitivity, &smoothing,
+                                     &advanced.window_size, &advanced.steps_per_window,
+                                     &advanced.window_types, &advanced.method,
+                                     &advanced.adapt_time,
+                                     &advanced.compact_history,
+                                     PyAudacity_GetFrequency, &advanced.f0, PyAudacity_GetFrequency, &advanced.f1)) {
+        return nullptr;
+    }
+
+    auto effect = Profile_share(profile);
+    if (!advanced.apply(*effect)) {
+        PyErr_SetString(PyExc_ValueError, "invalid advanced settings.");
+        return nullptr;
+    }
+    auto reducer = NoiseReducer::Create(*effect, rate,
+                                        noise_gain, sensitivity, smoothing);
+    if (!reducer) {
+        PyErr_SetString(PyExc_ValueError,
+                        "the profile cannot reduce audio at this rate, window size or frequency range.");
+        return nullptr;
+    }
+
+    auto self = (PyAudacityReducer *) type->tp_alloc(type, 0);
+    if (self == nullptr) {
+        return nullptr;
+    }
+    self->reducer = reducer.release();
+    return (PyObject *) self;
+}
+
+static void
+Reducer_dealloc(PyAudacityReducer *self) {
+    auto type = Py_TYPE(self);
+    delete self->reducer;
+    type->tp_free(self);
+    // instances of heap types own a reference to their type
+    Py_DECREF(type);
+}
+
+static PyObject *
+Reducer_process(PyAudacityReducer *self, PyObject *args) {
+    Py_buffer block;
+    PyObject *out = nullptr;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "y*|O", &block, &out)) {
+        return nullptr;
+    }
+    if (block.len % sizeof(float) != 0) {
+        PyBuffer_Release(&block);
+        PyErr_SetString(PyExc_ValueError, "block must hold whole float32 samples.");
+        return nullptr;
+    }
+    const auto len = (size_t) block.len / sizeof(float);
+
+    // into out, if given, else a new bytes object
+    Py_buffer target;
+    if (out != nullptr && out != Py_None) {
+        if (PyObject_GetBuffer(out, &target, PyBUF_WRITABLE) < 0) {
+            PyBuffer_Release(&block);
+            return nullptr;
+        }
+        if (target.len != block.len) {
+            PyBuffer_Release(&target);
+            PyBuffer_Release(&block);
+            PyErr_SetString(PyExc_ValueError, "out must be as long as block.");
+            return nullptr;
+        }
+        self->reducer->Process((const float *) block.buf, (float *) target.buf, len);
+        PyBuffer_Release(&target);
+        Py_INCREF(out);
+    } else {
+        out = PyBytes_FromStringAndSize(nullptr, block.len);
+        if (out != nullptr) {
+            self->reducer->Process((const float *) block.buf, (float *) PyBytes_AS_STRING(out), len);
+        }
+    }
+    PyBuffer_Release(&block);
+    return out;
+}
+
+static PyObject *
+Reducer_flush(PyAudacityReducer *self, PyObject *args) {
+    auto out = PyBytes_FromStringAndSize(nullptr, self->reducer->GetLatency() * sizeof(float));
+    if (out == nullptr) {
+        return nullptr;
+    }
+    self->reducer->Flush((float *) PyBytes_AS_STRING(out));
+    return out;
+}
+
+static PyObject *
+Reducer_get_latency(PyAudacityReducer *self, void *closure) {
+    return PyLong_FromSize_t(self->reducer->GetLatency());
+}
+
+static PyMethodDef ReducerMethods[] = {
+        {"process", (PyCFunction) Reducer_process, METH_VARARGS,
+                "reduce a block of samples, into out if given; as many come back, latency samples late."},
+        {"flush",   (PyCFunction) Reducer_flush,   METH_NOARGS,
+                "the last latency samples, after which the reducer starts over."},
+        {nullptr, nullptr, 0, nullptr}        /* Sentinel */
+};
+
+static PyGetSetDef ReducerGetSet[] = {
+        {(char *) "latency", (getter) Reducer_get_latency, nullptr,
+                (char *) "samples by which the output lags the input.", nullptr},
+        {nullptr, nullptr, nullptr, nullptr, nullptr}        /* Sentinel */
+};
+
+static PyType_Slot ReducerSlots[] = {
+        {Py_tp_new,     (void *) Reducer_new},
+        {Py_tp_dealloc, (void *) Reducer_dealloc},
+        {Py_tp_methods, (void *) ReducerMethods},
+        {Py_tp_getset,  (void *) ReducerGetSet},
+        {Py_tp_doc,     (void *) "noise reduction of live audio, a block at a time."},
+        {0,             nullptr}
+};
+
+static PyType_Spec ReducerSpec = {
+        "cmodule.NoiseReducer",
+        sizeof(PyAudacityReducer),
+        0,
+        Py_TPFLAGS_DEFAULT,
+        ReducerSlots
+};
+
 static PyMethodDef NoiseredMethods[] = {
-        {"noisered", pyaudacity_noisered, METH_VARARGS, "noise reduction."},
-        {nullptr,    nullptr, 0,                        nullptr}        /* Sentinel */
+        {"noisered",           pyaudacity_noisered,           METH_VARARGS,
+                "noise reduction, releasing the GIL; raises NoiseReductionError on failure."},
+        {"noisered_streaming", pyaudacity_noisered_streaming, METH_VARARGS,
+                "noise reduction streamed from file to file with constant memory."},
+        {"build_profile",      pyaudacity_build_profile,      METH_VARARGS, "take a noise profile from a file."},
+        {"build_profile_segments", pyaudacity_build_profile_segments, METH_VARARGS,
+                "take one noise profile from many segments of files on a thread pool, releasing the GIL."},
+        {"load_profile",       pyaudacity_load_profile,       METH_VARARGS, "load a saved noise profile."},
+        {"reduce",             pyaudacity_reduce,             METH_VARARGS,
+                "streamed noise reduction against a noise profile."},
+        {"noisered_batch",     pyaudacity_noisered_batch,     METH_VARARGS,
+                "streamed noise reduction of many files on a thread pool, releasing the GIL."},
+        {"sweep",              pyaudacity_sweep,              METH_VARARGS,
+                "streamed noise reduction of one file with each of many settings, classifying once, releasing the GIL."},
+        {"preview",            pyaudacity_preview,            METH_VARARGS,
+                "fraction of the bands that are noise, overall and per step, from decimated audio."},
+        {"build_profile_array", pyaudacity_build_profile_array, METH_VARARGS,
+                "take a noise profile from float32 samples."},
+        {"reduce_array",       pyaudacity_reduce_array,       METH_VARARGS,
+                "noise reduction of float32 samples against a noise profile, releasing the GIL."},
+        {"noisered_array",     pyaudacity_noisered_array,     METH_VARARGS,
+                "noise reduction of float32 samples against float32 samples of noise, releasing the GIL."},
+        {"build_profile_bytes", pyaudacity_build_profile_bytes, METH_VARARGS,
+                "take a noise profile from the bytes of a sound file, releasing the GIL."},
+        {"reduce_bytes",       pyaudacity_reduce_bytes,       METH_VARARGS,
+                "noise reduction of the bytes of a sound file into those of a new one, releasing the GIL."},
+        {"analyze",            pyaudacity_analyze,            METH_VARARGS,
+                "noise fractions or masks of each step, from classification alone."},
+        {"window_types",       pyaudacity_window_types,       METH_NOARGS,
+                "names of the analysis and synthesis windows of each window_types choice."},
+        {"stats_json",         pyaudacity_stats_json,         METH_VARARGS,
+                "the time and bytes of each stage so far, as JSON; optionally starting over."},
+        {"reset_stats",        pyaudacity_reset_stats,        METH_NOARGS,
+                "start the time and bytes of each stage over."},
+        {"set_profile_cache",  pyaudacity_set_profile_cache,  METH_VARARGS,
+                "keep the profiles taken from files by their contents, in memory and optionally a directory."},
+        {"clear_profile_cache", pyaudacity_clear_profile_cache, METH_NOARGS,
+                "forget the profiles cached in memory."},
+        {"set_memory_budget",  pyaudacity_set_memory_budget,  METH_VARARGS,
+                "admit noisered and noisered_batch files only while their memory fits this many bytes (0: none)."},
+        {"noisered_submit",    pyaudacity_noisered_submit,    METH_VARARGS,
+                "run noisered(*args) on the library's threads, then call callback(result, error)."},
+        {"noisered_streaming_submit", pyaudacity_noisered_streaming_submit, METH_VARARGS,
+                "run noisered_streaming(*args) on the library's threads, then call callback(result, error)."},
+        {"set_validation",     pyaudacity_set_validation,     METH_VARARGS,
+                "how much of the intermediate tracks' blocks edits check: 0 (off), 1 (new blocks) or 2 (full)."},
+        {nullptr,              nullptr, 0,                                  nullptr}        /* Sentinel */
 };
 
 static struct PyModuleDef noiseredmodule = {
@@ -117,5 +1755,59 @@ static struct PyModuleDef noiseredmodule = {
 
 PyMODINIT_FUNC
 PyInit_cmodule(void) {
-    return PyModule_Create(&noiseredmodule);
+    ProfileType = (PyTypeObject *) PyType_FromSpec(&ProfileSpec);
+    if (ProfileType == nullptr)
+        return nullptr;
+    ReducerType = (PyTypeObject *) PyType_FromSpec(&ReducerSpec);
+    if (ReducerType == nullptr)
+        return nullptr;
+    CancelTokenType = (PyTypeObject *) PyType_FromSpec(&CancelTokenSpec);
+    if (CancelTokenType == nullptr)
+        return nullptr;
+
+    auto module = PyModule_Create(&noiseredmodule);
+    if (module == nullptr)
+        return nullptr;
+
+    // the base, and one subclass per kind of failure, each also under the
+    // builtin exception it is a case of
+    NoiseReductionError = PyErr_NewException("cmodule.NoiseReductionError", PyExc_RuntimeError, nullptr);
+    if (NoiseReductionError == nullptr)
+        return nullptr;
+    auto make_error = [&](const char *name, PyObject *builtin) -> PyObject * {
+        auto bases = PyTuple_Pack(2, NoiseReductionError, builtin);
+        if (bases == nullptr)
+            return nullptr;
+        auto error = PyErr_NewException(name, bases, nullptr);
+        Py_DECREF(bases);
+        return error;
+    };
+    AudioFileError = make_error("cmodule.AudioFileError", PyExc_OSError);
+    SampleRateError = make_error("cmodule.SampleRateError", PyExc_ValueError);
+    ProfileTooShortError = make_error("cmodule.ProfileTooShortError", PyExc_ValueError);
+    SettingsError = make_error("cmodule.SettingsError", PyExc_ValueError);
+    CancelledError = PyErr_NewException("cmodule.CancelledError", NoiseReductionError, nullptr);
+    if (AudioFileError == nullptr || SampleRateError == nullptr ||
+        ProfileTooShortError == nullptr || SettingsError == nullptr || CancelledError == nullptr)
+        return nullptr;
+    const std::pair<const char *, PyObject *> errors[] = {
+            {"NoiseReductionError",  NoiseReductionError},
+            {"AudioFileError",       AudioFileError},
+            {"SampleRateError",      SampleRateError},
+            {"ProfileTooShortError", ProfileTooShortError},
+            {"SettingsError",        SettingsError},
+            {"CancelledError",       CancelledError},
+    };
+    for (const auto &error : errors) {
+        Py_INCREF(error.second);
+        PyModule_AddObject(module, error.first, error.second);
+    }
+
+    Py_INCREF(ProfileType);
+    PyModule_AddObject(module, "Profile", (PyObject *) ProfileType);
+    Py_INCREF(ReducerType);
+    PyModule_AddObject(module, "NoiseReducer", (PyObject *) ReducerType);
+    Py_INCREF(CancelTokenType);
+    PyModule_AddObject(module, "CancelToken", (PyObject *) CancelTokenType);
+    return module;
 }
@@ -1,3 +1,6 @@
+import asyncio
+import os
+import shutil
 import unittest
 import pyaudacity
 import numpy as np
@@ -38,6 +41,459 @@ class TestSpectrogram(unittest.TestCase):
         # np.testing.assert_almost_equal(expected, actual, decimal=5)
         # yep.stop()
 
+    def test_block_size(self):
+        input = '/var/tmp/keyword_recognizer/input.wav'
+        prof = '/var/tmp/keyword_recognizer/bg_input.wav'
+        output = '/var/tmp/keyword_recognizer/noisered.wav'
+        blocks = '/var/tmp/keyword_recognizer/noisered_blocks.wav'
+
+        self.assertEqual(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, output), True)
+        self.assertEqual(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, blocks,
+                                             block_size=64 * 1024), True)
+        np.testing.assert_array_equal(wavfile.read(blocks)[1], wavfile.read(output)[1])
+        with self.assertRaises(ValueError):
+            pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, blocks, block_size=100)
+
+    def test_storage(self):
+        input = '/var/tmp/keyword_recognizer/input.wav'
+        prof = '/var/tmp/keyword_recognizer/bg_input.wav'
+        output = '/var/tmp/keyword_recognizer/noisered.wav'
+        stored = '/var/tmp/keyword_recognizer/noisered_storage.wav'
+
+        # an unwritable root is passed over, and the roots are removed after
+        self.assertEqual(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, output), True)
+        roots = ['/proc/noisered', '/var/tmp/keyword_recognizer/storage']
+        self.assertEqual(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, stored,
+                                             storage=roots, memory_limit=1 << 20), True)
+        np.testing.assert_array_equal(wavfile.read(stored)[1], wavfile.read(output)[1])
+        self.assertFalse(os.path.exists(roots[1]))
+        with self.assertRaises(ValueError):
+            pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, stored, storage=['relative'])
+
+    def test_compression(self):
+        input = '/var/tmp/keyword_recognizer/input.wav'
+        prof = '/var/tmp/keyword_recognizer/bg_input.wav'
+        output = '/var/tmp/keyword_recognizer/noisered.wav'
+        compressed = '/var/tmp/keyword_recognizer/noisered_compressed.wav'
+
+        self.assertEqual(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, output), True)
+        for level in (1, 3):
+            self.assertEqual(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, compressed,
+                                                 compression=level), True)
+            np.testing.assert_array_equal(wavfile.read(compressed)[1], wavfile.read(output)[1])
+        with self.assertRaises(ValueError):
+            pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, compressed, compression=4)
+
+    def test_profile_cache(self):
+        input = '/var/tmp/keyword_recognizer/input.wav'
+        prof = '/var/tmp/keyword_recognizer/bg_input.wav'
+        output = '/var/tmp/keyword_recognizer/noisered.wav'
+        cached = '/var/tmp/keyword_recognizer/noisered_cached.wav'
+        directory = '/var/tmp/keyword_recognizer/profile_cache'
+
+        self.assertEqual(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, output), True)
+        shutil.rmtree(directory, ignore_errors=True)
+        pyaudacity.set_profile_cache(True, directory)
+        try:
+            # taken, then from memory, then from the directory
+            for clear in (False, False, True):
+                if clear:
+                    pyaudacity.clear_profile_cache()
+                self.assertEqual(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, cached), True)
+                np.testing.assert_array_equal(wavfile.read(cached)[1], wavfile.read(output)[1])
+            self.assertEqual(len(os.listdir(directory)), 1)
+        finally:
+            pyaudacity.set_profile_cache(False)
+            pyaudacity.clear_profile_cache()
+            shutil.rmtree(directory, ignore_errors=True)
+
+    def test_memory_budget(self):
+        input = '/var/tmp/keyword_recognizer/input.wav'
+        prof = '/var/tmp/keyword_recognizer/bg_input.wav'
+        output = '/var/tmp/keyword_recognizer/noisered.wav'
+        budgeted = '/var/tmp/keyword_recognizer/noisered_budget.wav'
+        batched = '/var/tmp/keyword_recognizer/noisered_budget_batch.wav'
+
+        self.assertEqual(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, output), True)
+        profile = pyaudacity.build_profile(prof, 0.000, 0.500)
+        try:
+            # room for the tracks, then for nothing: the file is streamed instead
+            for budget in (1 << 30, 1):
+                pyaudacity.set_memory_budget(budget)
+                self.assertEqual(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, budgeted), True)
+                np.testing.assert_array_equal(wavfile.read(budgeted)[1], wavfile.read(output)[1])
+                results = pyaudacity.noisered_batch(profile, [(input, budgeted), (input, batched)], threads=2)
+                self.assertTrue(all(success for success, seconds in results))
+                np.testing.assert_array_equal(wavfile.read(batched)[1], wavfile.read(budgeted)[1])
+        finally:
+            pyaudacity.set_memory_budget(0)
+
+    def test_validation(self):
+        input = '/var/tmp/keyword_recognizer/input.wav'
+        prof = '/var/tmp/keyword_recognizer/bg_input.wav'
+        output = '/var/tmp/keyword_recognizer/noisered.wav'
+        validated = '/var/tmp/keyword_recognizer/noisered_validated.wav'
+
+        self.assertEqual(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, output), True)
+        try:
+            for level in (0, 2):
+                pyaudacity.set_validation(level)
+                self.assertEqual(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, validated), True)
+                np.testing.assert_array_equal(wavfile.read(validated)[1], wavfile.read(output)[1])
+        finally:
+            pyaudacity.set_validation(0)
+        with self.assertRaises(ValueError):
+            pyaudacity.set_validation(3)
+
+    def test_compact_history(self):
+        input = '/var/tmp/keyword_recognizer/input.wav'
+        prof = '/var/tmp/keyword_recognizer/bg_input.wav'
+        exact_output = '/var/tmp/keyword_recognizer/noisered_exact_history.wav'
+        compact_output = '/var/tmp/keyword_recognizer/noisered_compact_history.wav'
+
+        profile = pyaudacity.build_profile(prof, 0.000, 0.500)
+        self.assertEqual(pyaudacity.reduce(profile, input, 12.0, 6.0, 3.0, exact_output), True)
+        self.assertEqual(pyaudacity.reduce(profile, input, 12.0, 6.0, 3.0, compact_output, compact_history=True), True)
+
+        exact = wavfile.read(exact_output)[1].astype(np.int32)
+        compact = wavfile.read(compact_output)[1].astype(np.int32)
+        self.assertLessEqual(np.max(np.abs(exact - compact)), 1e-3 * np.max(np.abs(exact)) + 1)
+
+    def test_channel_link(self):
+        input = '/var/tmp/keyword_recognizer/input.wav'
+        prof = '/var/tmp/keyword_recognizer/bg_input.wav'
+        output = '/var/tmp/keyword_recognizer/noisered_unlinked.wav'
+        stereo_input = '/var/tmp/keyword_recognizer/stereo_input.wav'
+        stereo_output = '/var/tmp/keyword_recognizer/noisered_linked.wav'
+
+        rate, samples = wavfile.read(input)
+        wavfile.write(stereo_input, rate, np.stack([samples, samples], axis=1))
+        profile = pyaudacity.build_profile(prof, 0.000, 0.500)
+        self.assertEqual(pyaudacity.reduce(profile, input, 12.0, 6.0, 3.0, output), True)
+        self.assertRaises(ValueError, pyaudacity.reduce, profile, stereo_input, 12.0, 6.0, 3.0, stereo_output,
+                          channel_link='side')
+        # the same in both channels reduces as it does alone
+        for link in ('max', 'mean'):
+            self.assertEqual(pyaudacity.reduce(profile, stereo_input, 12.0, 6.0, 3.0, stereo_output,
+                                               channel_link=link), True)
+            reduced = wavfile.read(stereo_output)[1]
+            mono = wavfile.read(output)[1]
+            self.assertTrue(np.array_equal(reduced[:, 0], mono))
+            self.assertTrue(np.array_equal(reduced[:, 1], mono))
+
+    def test_frequency_range(self):
+        input = '/var/tmp/keyword_recognizer/input.wav'
+        prof = '/var/tmp/keyword_recognizer/bg_input.wav'
+        output = '/var/tmp/keyword_recognizer/noisered_band.wav'
+
+        self.assertRaises(pyaudacity.SettingsError, pyaudacity.noisered, prof, 0.000, 0.500, input, 12.0, 6.0, 3.0,
+                          output, f0=1000.0, f1=100.0)
+        profile = pyaudacity.build_profile(prof, 0.000, 0.500)
+        # a range above all the bands passes the input through
+        self.assertEqual(pyaudacity.reduce(profile, input, 12.0, 6.0, 3.0, output, f0=1e6), True)
+        samples = wavfile.read(input)[1].astype(np.int32)
+        passed = wavfile.read(output)[1].astype(np.int32)
+        self.assertLessEqual(np.max(np.abs(samples - passed)), 4)
+
+        # a profile of some bands reduces only within them, and the next call is of the whole spectrum again
+        band = pyaudacity.build_profile(prof, 0.000, 0.500, f0=100.0, f1=1000.0)
+        self.assertEqual(pyaudacity.reduce(band, input, 12.0, 6.0, 3.0, output, f0=100.0, f1=1000.0), True)
+        self.assertEqual(pyaudacity.reduce(band, input, 12.0, 6.0, 3.0, output), False)
+        self.assertEqual(pyaudacity.reduce(profile, input, 12.0, 6.0, 3.0, output), True)
+
+    def test_async(self):
+        input = '/var/tmp/keyword_recognizer/input.wav'
+        prof = '/var/tmp/keyword_recognizer/bg_input.wav'
+        output = '/var/tmp/keyword_recognizer/noisered.wav'
+        outputs = ['/var/tmp/keyword_recognizer/noisered_async%d.wav' % ii for ii in range(3)]
+        streamed = '/var/tmp/keyword_recognizer/noisered_async_streaming.wav'
+
+        self.assertEqual(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, output), True)
+
+        async def main():
+            # the loop runs on while they do
+            ticks = 0
+
+            async def tick():
+                nonlocal ticks
+                while True:
+                    ticks += 1
+                    await asyncio.sleep(0.001)
+            ticker = asyncio.ensure_future(tick())
+            results = await asyncio.gather(
+                *[pyaudacity.noisered_async(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, path) for path in outputs],
+                pyaudacity.noisered_streaming_async(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, streamed))
+            with self.assertRaises(pyaudacity.AudioFileError):
+                await pyaudacity.noisered_async(prof, 0.000, 0.500, 'missing.wav', 12.0, 6.0, 3.0, streamed)
+            ticker.cancel()
+            return results, ticks
+
+        results, ticks = asyncio.run(main())
+        self.assertEqual(results, [True] * 4)
+        self.assertGreater(ticks, 1)
+        for path in outputs + [streamed]:
+            np.testing.assert_array_equal(wavfile.read(path)[1], wavfile.read(output)[1])
+
+    def test_cancel(self):
+        input = '/var/tmp/keyword_recognizer/input.wav'
+        prof = '/var/tmp/keyword_recognizer/bg_input.wav'
+        output = '/var/tmp/keyword_recognizer/noisered_cancelled.wav'
+
+        fractions = []
+        token = pyaudacity.CancelToken(fractions.append)
+        self.assertEqual(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, output, cancel=token), True)
+        self.assertEqual(fractions[0], 0.0)
+        self.assertEqual(fractions[-1], 1.0)
+        self.assertFalse(token.cancelled)
+
+        token.cancel()
+        self.assertTrue(token.cancelled)
+        with self.assertRaises(pyaudacity.CancelledError):
+            pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, output, cancel=token)
+        self.assertEqual(pyaudacity.noisered_streaming(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, output,
+                                                       cancel=token), False)
+
+        # the callback cancels too
+        token = pyaudacity.CancelToken(lambda fraction: fraction < 0.5)
+        with self.assertRaises(pyaudacity.NoiseReductionError):
+            pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, output, cancel=token)
+        self.assertTrue(token.cancelled)
+
+        async def main():
+            token = pyaudacity.CancelToken()
+            task = asyncio.ensure_future(
+                pyaudacity.noisered_async(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, output, cancel=token))
+            await asyncio.sleep(0)
+            task.cancel()
+            with self.assertRaises(asyncio.CancelledError):
+                await task
+            return token.cancelled
+
+        self.assertTrue(asyncio.run(main()))
+
+    def test_ranges(self):
+        input = '/var/tmp/keyword_recognizer/input.wav'
+        prof = '/var/tmp/keyword_recognizer/bg_input.wav'
+        output = '/var/tmp/keyword_recognizer/noisered.wav'
+        ranged = '/var/tmp/keyword_recognizer/noisered_ranges.wav'
+
+        # each range as in the whole reduction, and the rest as it was
+        rate, original = wavfile.read(input)
+        seconds = len(original) / rate
+        ranges = [(seconds * 0.6, seconds * 0.7), (seconds * 0.1, seconds * 0.3), (seconds * 0.25, seconds * 0.4)]
+        self.assertEqual(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, output), True)
+        self.assertEqual(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, ranged,
+                                             ranges=ranges), True)
+        reduced = wavfile.read(output)[1]
+        actual = wavfile.read(ranged)[1]
+        self.assertEqual(len(actual), len(original))
+        inside = np.zeros(len(original), dtype=bool)
+        for start, end in ranges:
+            inside[int(round(start * rate)):int(round(end * rate))] = True
+        np.testing.assert_array_equal(actual[inside], reduced[inside])
+        np.testing.assert_array_equal(actual[~inside], original[~inside])
+        with self.assertRaises(TypeError):
+            pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, ranged, ranges=[1.0])
+
+    def test_profile(self):
+        input = '/var/tmp/keyword_recognizer/input.wav'
+        prof = '/var/tmp/keyword_recognizer/bg_input.wav'
+        output = '/var/tmp/keyword_recognizer/noisered_profile.wav'
+        saved = '/var/tmp/keyword_recognizer/bg_input.profile'
+
+        profile = pyaudacity.build_profile(prof, 0.000, 0.500)
+        self.assertIsNotNone(profile)
+        self.assertEqual(profile.save(saved), True)
+        loaded = pyaudacity.load_profile(saved)
+        self.assertIsNotNone(loaded)
+        self.assertEqual(pyaudacity.reduce(loaded, input, 12.0, 6.0, 3.0, output), True)
+
+    def test_merged_profile(self):
+        input = '/var/tmp/keyword_recognizer/input.wav'
+        prof = '/var/tmp/keyword_recognizer/bg_input.wav'
+        serial = '/var/tmp/keyword_recognizer/noisered_serial.wav'
+        parallel = '/var/tmp/keyword_recognizer/noisered_parallel.wav'
+
+        # the same profile whatever the threads, and one that takes further noise
+        segments = [(prof, 0.000, 0.200), (prof, 0.200, 0.500), (prof, 0.500, 0.700)]
+        profile = pyaudacity.build_profile_segments(segments, 1)
+        self.assertIsNotNone(profile)
+        self.assertEqual(pyaudacity.reduce(profile, input, 12.0, 6.0, 3.0, serial), True)
+        self.assertEqual(pyaudacity.reduce(pyaudacity.build_profile_segments(segments, 3),
+                                           input, 12.0, 6.0, 3.0, parallel), True)
+        np.testing.assert_array_equal(wavfile.read(parallel)[1], wavfile.read(serial)[1])
+        self.assertEqual(profile.merge(pyaudacity.build_profile(prof, 0.700, 0.900)), True)
+        self.assertEqual(profile.merge(pyaudacity.build_profile(prof, 0.000, 0.500, window_size=1024)), False)
+
+    def test_adaptive_profile(self):
+        input = '/var/tmp/keyword_recognizer/input.wav'
+        prof = '/var/tmp/keyword_recognizer/bg_input.wav'
+        fixed = '/var/tmp/keyword_recognizer/noisered_fixed.wav'
+        adapted = '/var/tmp/keyword_recognizer/noisered_adapted.wav'
+
+        # the profile itself is left as it was taken
+        profile = pyaudacity.build_profile(prof, 0.000, 0.500)
+        self.assertEqual(pyaudacity.reduce(profile, input, 12.0, 6.0, 3.0, adapted, adapt_time=1.0), True)
+        self.assertEqual(pyaudacity.reduce(profile, input, 12.0, 6.0, 3.0, fixed), True)
+        self.assertFalse(np.array_equal(wavfile.read(adapted)[1], wavfile.read(fixed)[1]))
+        self.assertEqual(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, fixed, adapt_time=1.0), True)
+        np.testing.assert_array_equal(wavfile.read(fixed)[1], wavfile.read(adapted)[1])
+        with self.assertRaises(pyaudacity.SettingsError):
+            pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, fixed, adapt_time=-1.0)
+
+    def test_sweep(self):
+        input = '/var/tmp/keyword_recognizer/input.wav'
+        prof = '/var/tmp/keyword_recognizer/bg_input.wav'
+        single = '/var/tmp/keyword_recognizer/noisered_single.wav'
+        outputs = ['/var/tmp/keyword_recognizer/noisered_sweep%d.wav' % i for i in range(3)]
+
+        # each output as from reduce() with its own setting
+        profile = pyaudacity.build_profile(prof, 0.000, 0.500)
+        settings = [(12.0, 3.0, outputs[0]), (6.0, 0.0, outputs[1]), (24.0, 6.0, outputs[2])]
+        self.assertEqual(pyaudacity.sweep(profile, input, settings), True)
+        for noise_gain, smoothing, output in settings:
+            self.assertEqual(pyaudacity.reduce(profile, input, noise_gain, 6.0, smoothing, single), True)
+            np.testing.assert_array_equal(wavfile.read(output)[1], wavfile.read(single)[1])
+
+    def test_live_reducer(self):
+        input = '/var/tmp/keyword_recognizer/input.wav'
+        prof = '/var/tmp/keyword_recognizer/bg_input.wav'
+
+        profile = pyaudacity.build_profile(prof, 0.000, 0.500)
+        rate, data = wavfile.read(input)
+        samples = (data / 32768.0).astype(np.float32)
+        reducer = pyaudacity.NoiseReducer(profile, rate, 12.0, 6.0, 3.0)
+        with self.assertRaises(ValueError):
+            pyaudacity.NoiseReducer(profile, rate / 2)
+
+        # blocks of 10 ms, as from a live feed, the output sample for sample late
+        out = np.empty(len(samples) + reducer.latency, dtype=np.float32)
+        block = rate // 100
+        for pos in range(0, len(samples), block):
+            reducer.process(samples[pos:pos + block], out[pos:pos + block])
+        out[len(samples):] = np.frombuffer(reducer.flush(), dtype=np.float32)
+        self.assertTrue(np.all(out[:reducer.latency] == 0))
+
+    def test_preview(self):
+        input = '/var/tmp/keyword_recognizer/input.wav'
+        prof = '/var/tmp/keyword_recognizer/bg_input.wav'
+
+        profile = pyaudacity.build_profile(prof, 0.000, 0.500)
+        fraction, channels = pyaudacity.preview(profile, input, 4)
+        self.assertEqual(len(channels), 1)
+        self.assertTrue(0.0 <= fraction <= 1.0)
+        self.assertAlmostEqual(fraction, np.mean(channels[0]), places=5)
+        self.assertIsNone(pyaudacity.preview(profile, input, 3))
+
+    def test_analyze(self):
+        input = '/var/tmp/keyword_recognizer/input.wav'
+        prof = '/var/tmp/keyword_recognizer/bg_input.wav'
+
+        profile = pyaudacity.build_profile(prof, 0.000, 0.500)
+        fractions = np.asarray(pyaudacity.analyze(profile, input)[0])
+        masks = np.asarray(pyaudacity.analyze(profile, input, masks=True)[0])
+        self.assertEqual(fractions.dtype, np.float32)
+        self.assertEqual(masks.shape, (len(fractions), 1025))
+        np.testing.assert_allclose(masks.mean(axis=1), fractions, atol=1e-6)
+
+    def test_arrays(self):
+        input = '/var/tmp/keyword_recognizer/input.wav'
+        prof = '/var/tmp/keyword_recognizer/bg_input.wav'
+        output = '/var/tmp/keyword_recognizer/noisered_array.wav'
+
+        rate, noise = wavfile.read(prof)
+        rate, data = wavfile.read(input)
+        noise = (noise[:rate // 2] / 32768.0).astype(np.float32)
+        samples = (data / 32768.0).astype(np.float32)
+
+        # the same as from the files, but for their 16 bit rounding
+        profile = pyaudacity.build_profile(prof, 0.000, 0.500)
+        self.assertEqual(pyaudacity.reduce(profile, input, 12.0, 6.0, 3.0, output), True)
+        expected = wavfile.read(output)[1] / 32768.0
+        reduced = np.asarray(pyaudacity.noisered_array(noise, samples, rate))
+        np.testing.assert_allclose(reduced, expected, atol=1.0 / 32768)
+
+        # into a buffer of the caller's, here the input itself
+        array_profile = pyaudacity.build_profile_array(noise, rate)
+        self.assertIs(pyaudacity.reduce_array(array_profile, samples, rate, out=samples), samples)
+        np.testing.assert_array_equal(samples, reduced)
+        with self.assertRaises(ValueError):
+            pyaudacity.reduce_array(array_profile, data, rate)
+
+    def test_bytes(self):
+        input = '/var/tmp/keyword_recognizer/input.wav'
+        prof = '/var/tmp/keyword_recognizer/bg_input.wav'
+        output = '/var/tmp/keyword_recognizer/noisered_bytes.wav'
+
+        profile = pyaudacity.build_profile(prof, 0.000, 0.500)
+        self.assertEqual(pyaudacity.reduce(profile, input, 12.0, 6.0, 3.0, output), True)
+        with open(output, 'rb') as f:
+            expected = f.read()
+
+        # the same bytes as the files, from bytes and a memoryview of them
+        with open(prof, 'rb') as f:
+            bytes_profile = pyaudacity.build_profile_bytes(f.read(), 0.000, 0.500)
+        self.assertIsNotNone(bytes_profile)
+        with open(input, 'rb') as f:
+            data = f.read()
+        self.assertEqual(pyaudacity.reduce_bytes(bytes_profile, data, 12.0, 6.0, 3.0), expected)
+        self.assertEqual(pyaudacity.reduce_bytes(bytes_profile, memoryview(data), 12.0, 6.0, 3.0), expected)
+        self.assertIsNone(pyaudacity.reduce_bytes(bytes_profile, data[:16], 12.0, 6.0, 3.0))
+
+    def test_errors(self):
+        input = '/var/tmp/keyword_recognizer/input.wav'
+        prof = '/var/tmp/keyword_recognizer/bg_input.wav'
+        missing = '/var/tmp/keyword_recognizer/missing.wav'
+        slower = '/var/tmp/keyword_recognizer/bg_input_8k.wav'
+        output = '/var/tmp/keyword_recognizer/noisered_error.wav'
+
+        rate, data = wavfile.read(prof)
+        wavfile.write(slower, rate // 2, data[::2])
+        with self.assertRaises(pyaudacity.AudioFileError):
+            pyaudacity.noisered(missing, 0.000, 0.500, input, 12.0, 6.0, 3.0, output)
+        with self.assertRaises(OSError):
+            pyaudacity.noisered(prof, 0.000, 0.500, missing, 12.0, 6.0, 3.0, output)
+        with self.assertRaises(pyaudacity.ProfileTooShortError):
+            pyaudacity.noisered(prof, 0.000, 0.010, input, 12.0, 6.0, 3.0, output)
+        with self.assertRaises(pyaudacity.SampleRateError):
+            pyaudacity.noisered(slower, 0.000, 0.500, input, 12.0, 6.0, 3.0, output)
+        with self.assertRaises(ValueError):
+            pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, output, window_size=1000)
+
+    def test_threads(self):
+        import threading
+        input = '/var/tmp/keyword_recognizer/input.wav'
+        prof = '/var/tmp/keyword_recognizer/bg_input.wav'
+        outputs = ['/var/tmp/keyword_recognizer/noisered_thread%d.wav' % i for i in range(4)]
+
+        # the GIL is released, and the results are the same
+        threads = [threading.Thread(target=pyaudacity.noisered,
+                                    args=(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, output))
+                   for output in outputs]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        expected = wavfile.read(outputs[0])[1]
+        for output in outputs[1:]:
+            np.testing.assert_array_equal(wavfile.read(output)[1], expected)
+
+
+    def test_stats(self):
+        input = '/var/tmp/keyword_recognizer/input.wav'
+        prof = '/var/tmp/keyword_recognizer/bg_input.wav'
+        output = '/var/tmp/keyword_recognizer/noisered_stats.wav'
+
+        pyaudacity.reset_stats()
+        self.assertEqual(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, output), True)
+        stats = pyaudacity.stats(reset=True)
+        if not stats['enabled']:
+            self.assertEqual(stats, {'enabled': False})
+            return
+        for stage in ('import', 'profile', 'reduce', 'forward_fft', 'inverse_fft', 'export'):
+            self.assertGreater(stats['stages'][stage]['calls'], 0)
+        self.assertGreater(stats['counters']['block_files'], 0)
+        self.assertEqual(pyaudacity.stats()['counters']['bytes_read'], 0)
 
 if __name__ == '__main__':
     unittest.main()
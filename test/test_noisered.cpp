@@ -1,21 +1,67 @@
 #include "catch.hpp"
 
 // A simple program that computes the square root of a number
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cmath>
 #include <cstring>
+#include <atomic>
+#include <new>
 #include <fstream>
 #include <sstream>
 #include <iomanip>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <csignal>
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <openssl/md5.h>
 
 #include "ExportPCM.h"
+#include "Mix.h"
 #include "Audacity.h"
 #include "WaveTrack.h"
+#include "WaveClip.h"
+#include "Envelope.h"
+#include "Sequence.h"
+#include "SilentBlockFile.h"
+#include "SimpleBlockFile.h"
+#include "BlockCodec.h"
+#include "CompressedBlockFile.h"
 #include "NoiseReduction.h"
+#include "Parallel.h"
+#include "Progress.h"
 #include "ImportPCM.h"
+#include "Instrumentation.h"
+#include "RealFFTf.h"
+#include "FFTBackend.h"
+#include "FastMath.h"
+#include "Dither.h"
+
+// Heap allocations made while countAllocations is set
+static std::atomic<bool> countAllocations{false};
+static std::atomic<size_t> allocations{0};
+
+void *operator new(std::size_t size) {
+    if (countAllocations)
+        ++allocations;
+    if (void *p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    free(p);
+}
 
 namespace {
 
@@ -60,6 +106,949 @@ TEST_CASE("import and export") {
         remove("test_out.wav");
         delete factory;
     }
+    SECTION("direct export matches the mixer's, with or without write-behind.") {
+        const auto dir_manager = std::make_shared<DirManager>();
+        TrackFactory factory(dir_manager);
+        auto handler = PCMImportFileHandle::Open("input.wav");
+        REQUIRE(handler != nullptr);
+        TrackHolders holders{};
+        REQUIRE(handler->Import(&factory, holders) == ProgressResult::Success);
+        auto audioArray = WaveTrackConstArray();
+        audioArray.emplace_back(std::move(holders.at(0)));
+
+        for (int subformat : {0, 2}) {
+            auto exporter = ExportPCM();
+            // A mixer spec, even the identity one, means mixing
+            MixerSpec identity(1, 1);
+            REQUIRE(exporter.Export(audioArray, "mixed_out.wav", &identity, subformat)
+                    == ProgressResult::Success);
+            REQUIRE(exporter.Export(audioArray, "direct_out.wav", nullptr, subformat)
+                    == ProgressResult::Success);
+            exporter.SetWriteBehind(true);
+            REQUIRE(exporter.Export(audioArray, "behind_out.wav", nullptr, subformat)
+                    == ProgressResult::Success);
+
+            CHECK(calc_file_hash("direct_out.wav") == calc_file_hash("mixed_out.wav"));
+            CHECK(calc_file_hash("behind_out.wav") == calc_file_hash("mixed_out.wav"));
+        }
+        remove("mixed_out.wav");
+        remove("direct_out.wav");
+        remove("behind_out.wav");
+    }
+    SECTION("24 bit samples go from file to track and back as they are.") {
+        const auto dir_manager = std::make_shared<DirManager>();
+        TrackFactory factory(dir_manager);
+        TrackHolders holders{};
+        REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(&factory, holders)
+                == ProgressResult::Success);
+        auto audioArray = WaveTrackConstArray();
+        audioArray.emplace_back(std::move(holders.at(0)));
+        auto exporter = ExportPCM();
+        MixerSpec identity(1, 1);
+        REQUIRE(exporter.Export(audioArray, "int24_in.wav", &identity, 1) == ProgressResult::Success);
+
+        TrackHolders int24Holders{};
+        REQUIRE(PCMImportFileHandle::Open("int24_in.wav", true)->Import(&factory, int24Holders)
+                == ProgressResult::Success);
+        CHECK(int24Holders.at(0)->GetSampleFormat() == int24Sample);
+        audioArray.clear();
+        audioArray.emplace_back(std::move(int24Holders.at(0)));
+        REQUIRE(exporter.Export(audioArray, "int24_out.wav", nullptr, 1) == ProgressResult::Success);
+        CHECK(calc_file_hash("int24_out.wav") == calc_file_hash("int24_in.wav"));
+        remove("int24_in.wav");
+        remove("int24_out.wav");
+
+        std::vector<int> samples{0, 1, -1, 8388607, -8388608, 0x123456, -0x123456};
+        std::vector<char> packed(3 * samples.size());
+        PackInt24(samples.data(), packed.data(), samples.size());
+        std::vector<int> unpacked(samples.size());
+        UnpackInt24(packed.data(), unpacked.data(), samples.size());
+        CHECK(unpacked == samples);
+    }
+    SECTION("de-interleaving matches the scalar loop for every layout.") {
+        const size_t frames = 1003;
+        for (unsigned channels = 1; channels <= 8; ++channels) {
+            std::vector<float> interleaved(frames * channels);
+            for (size_t ii = 0; ii < interleaved.size(); ++ii)
+                interleaved[ii] = ii;
+            std::vector<std::vector<float>> planar(channels, std::vector<float>(frames));
+            std::vector<float *> pointers;
+            for (auto &channel : planar)
+                pointers.push_back(channel.data());
+
+            DeinterleaveSamples(interleaved.data(), channels, pointers.data(), frames);
+            bool same = true;
+            for (unsigned c = 0; c < channels; ++c)
+                for (size_t j = 0; j < frames; ++j)
+                    same = same && planar[c][j] == interleaved[channels * j + c];
+            CHECK(same);
+        }
+    }
+    SECTION("mixing matches the scalar loop for every layout.") {
+        const int frames = 1003;
+        std::vector<float> src(frames);
+        srand(5);
+        for (auto &sample : src)
+            sample = (float) rand() / RAND_MAX - 0.5f;
+        float gains[3] = {0.7f, -1.3f, 0.1f};
+        for (unsigned channels = 1; channels <= 3; ++channels)
+            for (bool interleaved : {false, true})
+                for (int skipped = -1; skipped < (int) channels; ++skipped) {
+                    int flags[3];
+                    for (unsigned c = 0; c < channels; ++c)
+                        flags[c] = (int) c != skipped;
+                    const size_t length = interleaved ? frames * channels : frames;
+                    ArrayOf<SampleBuffer> dests{interleaved ? 1 : channels};
+                    std::vector<std::vector<float>> expected;
+                    for (unsigned b = 0; b < (interleaved ? 1 : channels); ++b) {
+                        dests[b].Allocate(length, floatSample);
+                        std::vector<float> start(length);
+                        for (auto &sample : start)
+                            sample = (float) rand() / RAND_MAX;
+                        memcpy(dests[b].ptr(), start.data(), length * sizeof(float));
+                        expected.push_back(start);
+                    }
+                    for (unsigned c = 0; c < channels; ++c) {
+                        if (!flags[c])
+                            continue;
+                        auto &dest = expected[interleaved ? 0 : c];
+                        for (int j = 0; j < frames; ++j)
+                            dest[interleaved ? j * channels + c : j] += src[j] * gains[c];
+                    }
+
+                    MixBuffers(channels, flags, gains, (samplePtr) src.data(),
+                               dests.get(), frames, interleaved);
+                    for (unsigned b = 0; b < expected.size(); ++b)
+                        CHECK(memcmp(dests[b].ptr(), expected[b].data(), length * sizeof(float)) == 0);
+                }
+    }
+    SECTION("the mixer applies an envelope, and skips one that is all ones.") {
+        const auto dir_manager = std::make_shared<DirManager>();
+        TrackFactory factory(dir_manager);
+        TrackHolders holders{};
+        REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(&factory, holders)
+                == ProgressResult::Success);
+        std::shared_ptr<WaveTrack> track = std::move(holders.at(0));
+        const auto end = track->GetEndTime();
+        CHECK(track->EnvelopeIsUnity(1000, 0.0));
+
+        auto audioArray = WaveTrackConstArray();
+        audioArray.emplace_back(track);
+        auto exporter = ExportPCM();
+        MixerSpec identity(1, 1);
+        REQUIRE(exporter.Export(audioArray, "flat_out.wav", &identity) == ProgressResult::Success);
+
+        // A fade over the second half
+        auto envelope = track->GetClipByIndex(0)->GetEnvelope();
+        envelope->InsertOrReplaceRelative(end / 2, 1.0);
+        envelope->InsertOrReplaceRelative(end, 0.0);
+        CHECK_FALSE(track->EnvelopeIsUnity(1000, 0.0));
+        REQUIRE(exporter.Export(audioArray, "faded_out.wav", &identity) == ProgressResult::Success);
+        CHECK(calc_file_hash("faded_out.wav") != calc_file_hash("flat_out.wav"));
+        remove("flat_out.wav");
+        remove("faded_out.wav");
+    }
+    SECTION("envelope cursors give the envelope's values, chunk by chunk.") {
+        const double tstep = 1.0 / 8000;
+        for (const bool exponential : {false, true}) {
+            Envelope envelope(exponential, 0.01, 2.0, 1.0);
+            envelope.SetTrackLen(2.0);
+            // ramps, a plateau and a jump, with two points at one time
+            envelope.AddPointAtEnd(0.1, 0.5);
+            envelope.AddPointAtEnd(0.4, 1.5);
+            envelope.AddPointAtEnd(0.7, 1.5);
+            envelope.AddPointAtEnd(1.0, 0.2);
+            envelope.AddPointAtEnd(1.0, 0.8);
+            envelope.AddPointAtEnd(1.6, 0.1);
+
+            EnvelopeCursor cursor(envelope);
+            const size_t chunk = 97;
+            std::vector<double> expected(chunk), actual(chunk);
+            // forward through all of it, then a step back
+            std::vector<double> starts;
+            for (size_t ii = 0; ii * chunk * tstep < 2.0; ++ii)
+                starts.push_back(ii * chunk * tstep);
+            starts.push_back(0.35);
+            for (const auto t0 : starts) {
+                envelope.GetValues(expected.data(), chunk, t0, tstep);
+                cursor.GetValues(actual.data(), chunk, t0, tstep);
+                CHECK(memcmp(expected.data(), actual.data(), chunk * sizeof(double)) == 0);
+            }
+
+            double value = 0;
+            CHECK(cursor.IsConstant(0.0, 0.09, value));
+            CHECK(value == 0.5);
+            CHECK(cursor.IsConstant(0.45, 0.65, value));
+            CHECK(value == 1.5);
+            CHECK(cursor.IsConstant(1.6, 1.9, value));
+            CHECK(value == 0.1);
+            CHECK_FALSE(cursor.IsConstant(0.05, 0.15, value));
+            CHECK_FALSE(cursor.IsConstant(0.2, 0.3, value));
+            CHECK_FALSE(cursor.IsConstant(0.9, 1.1, value));
+        }
+
+        Envelope flat(false, 0.0, 2.0, 0.75);
+        EnvelopeCursor cursor(flat);
+        double value = 0;
+        CHECK(cursor.IsConstant(0.0, 100.0, value));
+        CHECK(value == 0.75);
+        std::vector<double> values(10);
+        cursor.GetValues(values.data(), values.size(), 0.0, tstep);
+        CHECK(std::all_of(values.begin(), values.end(), [](double v) { return v == 0.75; }));
+    }
+    SECTION("the mixer scales by an envelope that is flat.") {
+        const auto dir_manager = std::make_shared<DirManager>();
+        TrackFactory factory(dir_manager);
+        TrackHolders holders{};
+        REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(&factory, holders)
+                == ProgressResult::Success);
+        std::shared_ptr<WaveTrack> track = std::move(holders.at(0));
+        const auto len = track->TimeToLongSamples(track->GetEndTime()).as_size_t();
+        std::vector<float> samples(len);
+        track->Get((samplePtr) samples.data(), floatSample, 0, len);
+
+        // One point: half over all of the track
+        track->GetClipByIndex(0)->GetEnvelope()->InsertOrReplaceRelative(0.0, 0.5);
+        double value = 0;
+        EnvelopeCursors cursors;
+        CHECK(track->EnvelopeIsConstant(1000, 0.0, value, cursors));
+        CHECK(value == 0.5);
+        // Past the end of the clip, the gain is 1
+        CHECK_FALSE(track->EnvelopeIsConstant(1000, track->GetEndTime() - 0.01, value, cursors));
+
+        Mixer mixer(WaveTrackConstArray{track}, true, 0.0, track->GetEndTime(),
+                    1, len, false, track->GetRate(), floatSample, false);
+        REQUIRE(mixer.Process(len) == len);
+        const auto mixed = (const float *) mixer.GetBuffer();
+        size_t bad = 0;
+        for (size_t ii = 0; ii < len; ++ii)
+            bad += mixed[ii] != (float) (samples[ii] * 0.5);
+        CHECK(bad == 0);
+    }
+    SECTION("tracks hand out their blocks' samples in place.") {
+        const auto dir_manager = std::make_shared<DirManager>();
+        TrackFactory factory(dir_manager);
+        auto handler = PCMImportFileHandle::Open("test.wav");
+        REQUIRE(handler != nullptr);
+        TrackHolders holders{};
+        REQUIRE(handler->Import(&factory, holders) == ProgressResult::Success);
+
+        const auto &track = *holders.at(0);
+        const auto len = track.GetBestBlockSize(0);
+        auto span = (const float *) track.GetSpan(floatSample, 0, len);
+        REQUIRE(span != nullptr);
+        std::vector<float> read(len);
+        track.Get((samplePtr) read.data(), floatSample, 0, len);
+        CHECK(std::equal(read.begin(), read.end(), span));
+
+        // Not in one block
+        CHECK(track.GetSpan(floatSample, len - 1, 2) == nullptr);
+    }
+
+    SECTION("reading ahead gives the samples that reading on demand does.") {
+        const auto dir_manager = std::make_shared<DirManager>();
+        TrackFactory factory(dir_manager);
+        // Not floats, so that no block is read in place
+        std::shared_ptr<WaveTrack> track = factory.NewWaveTrack(int16Sample, 44100);
+        std::vector<float> samples(3000000);
+        for (size_t ii = 0; ii < samples.size(); ++ii)
+            samples[ii] = (float) sin(ii * 0.001) * 0.5f;
+        track->Append((samplePtr) samples.data(), floatSample, samples.size());
+        track->Flush();
+        const auto total = track->TimeToLongSamples(track->GetEndTime());
+        std::vector<float> expected(total.as_size_t());
+        track->Get((samplePtr) expected.data(), floatSample, 0, expected.size());
+
+        for (size_t depth : {0, 1, 3}) {
+            WaveTrackCache cache(track);
+            cache.SetReadAhead(depth);
+            const size_t piece = 10007;
+            bool same = true;
+            auto check = [&](sampleCount start, size_t len) {
+                const auto got = (const float *) cache.Get(floatSample, start, len, true);
+                REQUIRE(got != nullptr);
+                same = same && std::equal(got, got + len, expected.begin() + start.as_size_t());
+            };
+            // Forwards, backwards and jumping about
+            for (sampleCount pos = 0; pos + piece <= total; pos += piece)
+                check(pos, piece);
+            for (sampleCount pos = total - piece; pos >= 0; pos -= piece)
+                check(pos, piece);
+            srand(6);
+            for (int ii = 0; ii < 200; ++ii)
+                check(rand() % (total - piece).as_long_long(), piece);
+            CHECK(same);
+        }
+    }
+
+    SECTION("block lookups agree whichever way a sequence is read.") {
+        const auto dir_manager = std::make_shared<DirManager>();
+        Sequence sequence(dir_manager, floatSample);
+        std::vector<float> samples(1500000);
+        for (size_t ii = 0; ii < samples.size(); ++ii)
+            samples[ii] = (float) (ii % 1000) / 1000;
+        sequence.Append((samplePtr) samples.data(), floatSample, samples.size());
+        REQUIRE(sequence.GetBlockStart(samples.size() - 1) > 0);
+
+        // Forward, as the readers go, then backward and by leaps
+        const size_t chunk = 4099;
+        std::vector<float> read(samples.size());
+        for (size_t pos = 0; pos < samples.size(); pos += chunk)
+            sequence.Get((samplePtr) &read[pos], floatSample, pos,
+                         std::min(chunk, samples.size() - pos), true);
+        CHECK(read == samples);
+        std::fill(read.begin(), read.end(), -1.0f);
+        for (size_t end = samples.size(); end > 0; end -= std::min(chunk, end))
+            sequence.Get((samplePtr) &read[end - std::min(chunk, end)], floatSample,
+                         end - std::min(chunk, end), std::min(chunk, end), true);
+        CHECK(read == samples);
+        for (size_t step = 0, pos = 0; step < 50; ++step, pos = (pos + 736357) % samples.size()) {
+            const auto start = sequence.GetBlockStart(pos);
+            CHECK(start <= pos);
+            CHECK(sequence.FindBlock(start) == sequence.FindBlock(pos));
+        }
+    }
+
+    SECTION("pieces appended one after another read back as they were.") {
+        const auto dir_manager = std::make_shared<DirManager>();
+        std::vector<float> samples(700000);
+        for (size_t ii = 0; ii < samples.size(); ++ii)
+            samples[ii] = (float) ((ii * 7919) % 20000) / 20000 - 0.5f;
+        for (const auto format : {floatSample, int16Sample}) {
+            Sequence sequence(dir_manager, format);
+            // Short pieces, some straddling blocks, then one longer than a block
+            size_t pos = 0;
+            for (size_t piece = 512; pos + piece < 400000; piece = piece * 3 % 5003 + 1) {
+                sequence.Append((samplePtr) &samples[pos], floatSample, piece);
+                pos += piece;
+            }
+            sequence.Append((samplePtr) &samples[pos], floatSample, samples.size() - pos);
+
+            std::vector<float> read(samples.size());
+            REQUIRE(sequence.GetNumSamples() == samples.size());
+            sequence.Get((samplePtr) read.data(), floatSample, 0, read.size(), true);
+            if (format == floatSample)
+                CHECK((read == samples));
+            else {
+                float error = 0;
+                for (size_t ii = 0; ii < samples.size(); ++ii)
+                    error = std::max(error, std::abs(read[ii] - samples[ii]));
+                CHECK(error < 2.0f / 32768);
+            }
+        }
+    }
+
+    SECTION("every validation level edits sequences alike.") {
+        const auto previous = Sequence::GetValidation();
+        const auto dir_manager = std::make_shared<DirManager>();
+        std::vector<float> samples(300000);
+        for (size_t ii = 0; ii < samples.size(); ++ii)
+            samples[ii] = (float) ((ii * 7919) % 20000) / 20000 - 0.5f;
+        std::vector<std::vector<float>> results;
+        for (const auto level : {Sequence::Validation::Off, Sequence::Validation::NewBlocks,
+                                 Sequence::Validation::Full}) {
+            Sequence::SetValidation(level);
+            CHECK(Sequence::GetValidation() == level);
+            Sequence sequence(dir_manager, floatSample);
+            for (size_t pos = 0; pos < samples.size(); pos += 1000)
+                sequence.Append((samplePtr) &samples[pos], floatSample,
+                                std::min<size_t>(1000, samples.size() - pos));
+            const auto copy = sequence.Copy(1000, 90000);
+            sequence.Paste(150000, copy.get());
+            sequence.Delete(5000, 20000);
+            sequence.ConsistencyCheck("validation test");
+
+            results.emplace_back(sequence.GetNumSamples().as_size_t());
+            sequence.Get((samplePtr) results.back().data(), floatSample, 0, results.back().size(), true);
+        }
+        Sequence::SetValidation(previous);
+        REQUIRE(results[0].size() == samples.size() + 89000 - 20000);
+        CHECK((results[0] == results[1]));
+        CHECK((results[0] == results[2]));
+    }
+
+    SECTION("step-sized appends and resampling write each block once.") {
+        const auto dir_manager = std::make_shared<DirManager>();
+        WaveClip clip(dir_manager, floatSample, 44100);
+        const auto block_size = clip.GetSequence()->GetMaxBlockSize();
+        std::vector<float> step(512);
+        for (size_t ii = 0; ii < step.size(); ++ii)
+            step[ii] = (float) sin(ii * 0.1);
+
+        Instrumentation::Reset();
+        const size_t steps = 5000;
+        for (size_t ii = 0; ii < steps; ++ii)
+            clip.Append((samplePtr) step.data(), floatSample, step.size());
+        clip.Flush();
+        REQUIRE(clip.GetNumSamples() == steps * step.size());
+        const auto blocks = [&](sampleCount len) {
+            return "\"block_files\": " + std::to_string((len.as_size_t() + block_size - 1) / block_size) + ",";
+        };
+        if (Instrumentation::Enabled())
+            CHECK(Instrumentation::ToJSON().find(blocks(clip.GetNumSamples())) != std::string::npos);
+
+        Instrumentation::Reset();
+        clip.Resample(22050);
+        CHECK(std::abs((clip.GetNumSamples() - steps * step.size() / 2).as_double()) <= 1);
+        if (Instrumentation::Enabled())
+            CHECK(Instrumentation::ToJSON().find(blocks(clip.GetNumSamples())) != std::string::npos);
+    }
+
+    SECTION("clips resample alike on any number of threads, and faster methods differ.") {
+        const auto dir_manager = std::make_shared<DirManager>();
+        TrackFactory factory(dir_manager);
+        std::vector<float> samples(100000);
+        for (size_t ii = 0; ii < samples.size(); ++ii)
+            samples[ii] = (float) sin(ii * 0.01) * 0.5f;
+        auto make_track = [&] {
+            auto track = factory.NewWaveTrack(floatSample, 44100);
+            for (int cc = 0; cc < 5; ++cc) {
+                auto clip = track->CreateClip();
+                clip->SetOffset(cc * 3.0);
+                clip->Append((samplePtr) samples.data(), floatSample, samples.size() - cc * 1000);
+                clip->Flush();
+            }
+            return track;
+        };
+        auto clip_samples = [](const WaveTrack &track) {
+            std::vector<std::vector<float>> result;
+            for (const auto &clip : track.GetClips()) {
+                result.emplace_back(clip->GetNumSamples().as_size_t());
+                clip->GetSequence()->Get((samplePtr) result.back().data(), floatSample, 0,
+                                         result.back().size(), true);
+            }
+            return result;
+        };
+
+        auto serial = make_track(), parallel = make_track(), fast = make_track();
+        serial->Resample(22050);
+        ResampleOptions options;
+        options.threads = 0;
+        parallel->Resample(22050, options);
+        options.method = 0;
+        fast->Resample(22050, options);
+        CHECK(serial->GetRate() == 22050);
+        CHECK(parallel->GetRate() == 22050);
+
+        const auto expected = clip_samples(*serial);
+        CHECK(clip_samples(*parallel) == expected);
+        const auto faster = clip_samples(*fast);
+        REQUIRE(faster.size() == expected.size());
+        for (size_t ii = 0; ii < expected.size(); ++ii)
+            CHECK(std::abs((double) faster[ii].size() - (double) expected[ii].size()) <= 1);
+        CHECK(faster != expected);
+    }
+
+    SECTION("a whole clip swaps in new samples just as ClearAndPaste puts them.") {
+        const auto dir_manager = std::make_shared<DirManager>();
+        TrackFactory factory(dir_manager);
+        TrackHolders holders{}, other_holders{};
+        REQUIRE(PCMImportFileHandle::Open("test.wav")->Import(&factory, holders) ==
+                ProgressResult::Success);
+        REQUIRE(PCMImportFileHandle::Open("test.wav")->Import(&factory, other_holders) ==
+                ProgressResult::Success);
+
+        auto &swapped = *holders.at(0);
+        const auto pasted = other_holders.at(0).get();
+        const auto len = swapped.TimeToLongSamples(swapped.GetEndTime());
+        std::vector<float> original(len.as_size_t());
+        swapped.Get((samplePtr) original.data(), floatSample, 0, original.size());
+
+        // The samples reversed, as an effect's output
+        std::vector<float> reversed(original.rbegin(), original.rend());
+        const auto output = factory.NewWaveTrack(swapped.GetSampleFormat(), swapped.GetRate());
+        const auto copy = factory.NewWaveTrack(swapped.GetSampleFormat(), swapped.GetRate());
+        for (const auto track : {output.get(), copy.get()}) {
+            track->Append((samplePtr) reversed.data(), floatSample, reversed.size());
+            track->Flush();
+        }
+
+        CHECK(!swapped.SwapClipSamples(0, len - 1, *output));
+        REQUIRE(swapped.SwapClipSamples(0, len, *output));
+        pasted->ClearAndPaste(0.0, pasted->LongSamplesToTime(len), &*copy, true, false);
+
+        std::vector<float> a(original.size()), b(original.size()), old(original.size());
+        swapped.Get((samplePtr) a.data(), floatSample, 0, a.size());
+        pasted->Get((samplePtr) b.data(), floatSample, 0, b.size());
+        output->Get((samplePtr) old.data(), floatSample, 0, old.size());
+        CHECK(a == b);
+        CHECK(a == reversed);
+        CHECK(old == original);
+        CHECK(swapped.GetNumClips() == 1);
+        CHECK(swapped.GetEndTime() == pasted->GetEndTime());
+    }
+    SECTION("copies of locked blocks are named for their project.") {
+        // A block of its own file that stays locked, as one being saved is
+        struct LockedBlockFile final : SimpleBlockFile {
+            LockedBlockFile(wxFileNameWrapper &&name, std::vector<float> &samples)
+                    : SimpleBlockFile(std::move(name), (samplePtr) samples.data(), samples.size(),
+                                      floatSample) {}
+
+            bool IsLocked() override { return true; }
+
+            BlockFilePtr Copy(wxFileNameWrapper &&newFileName) override {
+                return make_blockfile<SimpleBlockFile>(std::move(newFileName), GetLength(), 0.0f, 0.0f, 0.0f);
+            }
+        };
+
+        const auto dir_manager = std::make_shared<DirManager>();
+        std::vector<float> samples(1000, 0.5f);
+        wxFileNameWrapper name;
+        name.Assign(".", "locked_block");
+        BlockFilePtr block = make_blockfile<LockedBlockFile>(std::move(name), samples);
+        const auto path = block->GetFileName().name.GetFullPath();
+
+        auto copy = dir_manager->CopyBlockFile(block);
+        REQUIRE(copy != block);
+        const std::string dir = dir_manager->GetDataFilesDir();
+        const std::string project = dir.substr(dir.rfind('/') + 1);
+        CHECK(project.compare(0, 7, "project") == 0);
+        CHECK(copy->GetFileName().name.GetName() == project + "-b00000000");
+        CHECK(dir_manager->CopyBlockFile(block)->GetFileName().name.GetName() == project + "-b00000001");
+        remove(path.c_str());
+    }
+
+    SECTION("blocks share one mapped file and read back what was written.") {
+        DirManager dir_manager;
+        std::vector<float> samples(1000);
+        for (size_t ii = 0; ii < samples.size(); ++ii)
+            samples[ii] = std::sin(ii / 10.0f);
+
+        auto block1 = dir_manager.NewSimpleBlockFile(
+                (samplePtr) samples.data(), samples.size(), floatSample);
+        auto block2 = dir_manager.NewSimpleBlockFile(
+                (samplePtr) samples.data(), samples.size() / 2, floatSample);
+        CHECK(!block1->GetFileName().name.IsOk());
+
+        sampleFormat format;
+        REQUIRE(block2->GetSampleData(format) != nullptr);
+        CHECK(format == floatSample);
+        CHECK(block2->GetSampleData(format) != block1->GetSampleData(format));
+
+        std::vector<float> read(samples.size());
+        CHECK(block1->ReadData((samplePtr) read.data(), floatSample, 0, read.size())
+              == read.size());
+        CHECK(read == samples);
+
+        auto copy = block1->Copy(wxFileNameWrapper{});
+        block1.reset();
+        CHECK(copy->ReadData((samplePtr) read.data(), floatSample, 0, read.size())
+              == read.size());
+        CHECK(read == samples);
+    }
+    SECTION("summaries are worked out only when asked for.") {
+        DirManager dir_manager;
+        std::vector<float> samples{0.25f, -0.5f, 0.75f, 0.0f};
+        auto block = dir_manager.NewSimpleBlockFile(
+                (samplePtr) samples.data(), samples.size(), floatSample);
+        const auto minMaxRMS = block->GetMinMaxRMS();
+        CHECK(minMaxRMS.min == -0.5f);
+        CHECK(minMaxRMS.max == 0.75f);
+        CHECK(minMaxRMS.RMS == Approx(std::sqrt(0.875 / 4)));
+
+        ArrayOf<char> summary;
+        CHECK(block->ReadSummary(summary));
+        CHECK(summary.get() != nullptr);
+
+        dir_manager.SetSummaries(false);
+        auto unsummarized = dir_manager.NewSimpleBlockFile(
+                (samplePtr) samples.data(), samples.size(), floatSample);
+        CHECK(!unsummarized->ReadSummary(summary));
+        CHECK(unsummarized->GetMinMaxRMS().max == 0.75f);
+    }
+    SECTION("memory blocks stay within their limit and share copies.") {
+        DirManager dir_manager;
+        std::vector<float> samples(1000, 0.5f);
+        const auto bytes = samples.size() * sizeof(float);
+        dir_manager.SetMemoryBlocks(true, bytes * 3 / 2);
+
+        auto block1 = dir_manager.NewSimpleBlockFile(
+                (samplePtr) samples.data(), samples.size(), floatSample);
+        CHECK(dir_manager.GetMemoryBlockUsage() == bytes);
+        CHECK(block1->GetSpaceUsage() == 0);
+
+        // Past the limit, so mapped instead
+        auto block2 = dir_manager.NewSimpleBlockFile(
+                (samplePtr) samples.data(), samples.size(), floatSample);
+        CHECK(dir_manager.GetMemoryBlockUsage() == bytes);
+        CHECK(block2->GetSpaceUsage() >= bytes);
+
+        sampleFormat format;
+        auto copy = block1->Copy(wxFileNameWrapper{});
+        CHECK(copy->GetSampleData(format) == block1->GetSampleData(format));
+        CHECK(dir_manager.GetMemoryBlockUsage() == bytes);
+
+        std::vector<float> read(samples.size());
+        block1.reset();
+        CHECK(copy->ReadData((samplePtr) read.data(), floatSample, 0, read.size())
+              == read.size());
+        CHECK(read == samples);
+        copy.reset();
+        CHECK(dir_manager.GetMemoryBlockUsage() == 0);
+    }
+    SECTION("blocks of digital silence are kept as silent blocks.") {
+        const auto dir_manager = std::make_shared<DirManager>();
+        REQUIRE(dir_manager->SetMaxBlockBytes(DirManager::MinBlockBytes));
+        std::vector<float> samples(20000);
+        for (size_t ii = 0; ii < 5000; ++ii)
+            samples[ii] = samples[ii + 15000] = std::sin(ii / 10.0f);
+        for (const auto format : {floatSample, int16Sample}) {
+            Sequence sequence(dir_manager, format);
+            sequence.Append((samplePtr) samples.data(), floatSample, samples.size());
+            size_t silent = 0, silentLen = 0;
+            for (const auto &block : sequence.GetBlockArray())
+                if (dynamic_cast<SilentBlockFile *>(block.f.get())) {
+                    ++silent;
+                    silentLen += block.f->GetLength();
+                    CHECK(block.f->GetSpaceUsage() == 0);
+                }
+            CHECK(silent > 0);
+            CHECK(silentLen > 9000);
+            CHECK(silentLen <= 10000);
+
+            std::vector<float> read(samples.size());
+            sequence.Get((samplePtr) read.data(), floatSample, 0, read.size(), true);
+            if (format == floatSample)
+                CHECK(read == samples);
+            CHECK(std::all_of(read.begin() + 5000, read.begin() + 15000,
+                              [](float sample) { return sample == 0.0f; }));
+        }
+    }
+    SECTION("the block codec gives back every sample bit for bit.") {
+        std::srand(49);
+        const size_t len = 5000;
+        std::vector<int16_t> shorts(len);
+        std::vector<int> ints(len);
+        std::vector<float> scaled(len), floats(len);
+        for (size_t ii = 0; ii < len; ++ii) {
+            const auto tone = std::sin(ii / 20.0) * 0.5 + (std::rand() % 201 - 100) / 32768.0;
+            shorts[ii] = (int16_t) std::lrint(tone * 32767);
+            ints[ii] = (int) std::lrint(tone * 8388607);
+            scaled[ii] = shorts[ii] / 32768.0f;
+            floats[ii] = (float) tone;
+        }
+        // -0 is no integer, so it leaves floats coded bit by bit
+        floats[1] = -0.0f;
+        scaled[2] = -1.0f;
+
+        auto roundTrip = [](const void *samples, sampleFormat format, size_t count, int level) {
+            std::vector<char> coded;
+            BlockCodec::Encode((constSamplePtr) samples, format, count, level, coded);
+            std::vector<char> decoded(count * SAMPLE_SIZE(format));
+            CHECK(BlockCodec::Decode(coded.data(), coded.size(), format, count, decoded.data()));
+            CHECK(memcmp(decoded.data(), samples, decoded.size()) == 0);
+            // Truncated, it is refused rather than read past
+            if (coded.size() > 8)
+                CHECK(!BlockCodec::Decode(coded.data(), coded.size() / 2, format, count,
+                                          decoded.data()));
+            return coded.size();
+        };
+        for (int level = BlockCodec::MinLevel; level <= BlockCodec::MaxLevel; ++level)
+            for (const size_t count : {len, (size_t) 1, (size_t) 3, (size_t) 0}) {
+                const auto shortBytes = roundTrip(shorts.data(), int16Sample, count, level);
+                roundTrip(ints.data(), int24Sample, count, level);
+                const auto scaledBytes = roundTrip(scaled.data(), floatSample, count, level);
+                const auto floatBytes = roundTrip(floats.data(), floatSample, count, level);
+                if (count == len) {
+                    CHECK(shortBytes * 3 < count * sizeof(int16_t) * 2);
+                    CHECK(scaledBytes * 3 < count * sizeof(float));
+                    CHECK(floatBytes < count * sizeof(float));
+                }
+            }
+    }
+    SECTION("compressed blocks read back as they were, in less space.") {
+        std::vector<float> samples(100000);
+        for (size_t ii = 0; ii < samples.size(); ++ii)
+            samples[ii] = (int16_t) std::lrint(std::sin(ii / 30.0) * 16000) / 32768.0f;
+        auto spaceOf = [](Sequence &sequence) {
+            size_t bytes = 0;
+            for (const auto &block : sequence.GetBlockArray())
+                bytes += block.f->GetSpaceUsage();
+            return bytes;
+        };
+
+        const auto plainDir = std::make_shared<DirManager>();
+        REQUIRE(plainDir->SetMaxBlockBytes(64 << 10));
+        Sequence plain(plainDir, floatSample);
+        plain.Append((samplePtr) samples.data(), floatSample, samples.size());
+
+        for (const auto format : {floatSample, int16Sample})
+            for (int level = BlockCodec::MinLevel; level <= BlockCodec::MaxLevel; ++level) {
+                const auto dir_manager = std::make_shared<DirManager>();
+                REQUIRE(dir_manager->SetMaxBlockBytes(64 << 10));
+                REQUIRE(dir_manager->SetCompression(level));
+                // Some blocks in memory and the rest in storage
+                dir_manager->SetMemoryBlocks(true, 32 << 10);
+                Sequence sequence(dir_manager, format);
+                sequence.Append((samplePtr) samples.data(), floatSample, samples.size());
+                CHECK(sequence.GetBlockArray().size() > 2);
+                CHECK(dynamic_cast<CompressedBlockFile *>(sequence.GetBlockArray()[0].f.get()));
+                CHECK(dir_manager->GetMemoryBlockUsage() > 0);
+                CHECK(spaceOf(sequence) * 2 < samples.size() * SAMPLE_SIZE(format));
+
+                std::vector<float> read(samples.size());
+                sequence.Get((samplePtr) read.data(), floatSample, 0, read.size(), true);
+                CHECK(read == samples);
+                std::vector<float> part(1000);
+                sequence.Get((samplePtr) part.data(), floatSample, 12345, part.size(), true);
+                CHECK(std::equal(part.begin(), part.end(), samples.begin() + 12345));
+
+                const auto &block = sequence.GetBlockArray()[1];
+                const auto copy = block.f->Copy(wxFileNameWrapper{});
+                CHECK(copy->GetMinMaxRMS().max == block.f->GetMinMaxRMS().max);
+                ArrayOf<char> summary;
+                CHECK(copy->ReadSummary(summary));
+            }
+        CHECK(!plainDir->SetCompression(BlockCodec::MaxLevel + 1));
+        CHECK(plainDir->GetCompression() == 0);
+    }
+}
+
+TEST_CASE("real fft") {
+    SECTION("every kernel matches the scalar butterflies.") {
+        const size_t size = 2048;
+        std::vector<fft_type> input(size);
+        srand(1);
+        for (auto &sample : input)
+            sample = (fft_type) rand() / RAND_MAX - 0.5f;
+
+        auto hFFT = GetFFT(size);
+        auto transform = [&](FFTKernel kernel, std::vector<fft_type> &forward, std::vector<fft_type> &inverse) {
+            REQUIRE(SetFFTKernel(kernel));
+            forward = input;
+            RealFFTf(forward.data(), hFFT.get());
+            inverse = forward;
+            InverseRealFFTf(inverse.data(), hFFT.get());
+        };
+
+        const auto original = GetFFTKernel();
+        std::vector<fft_type> scalar_forward, scalar_inverse;
+        transform(FFTKernel::Scalar, scalar_forward, scalar_inverse);
+        for (auto kernel : {FFTKernel::SSE2, FFTKernel::AVX, FFTKernel::AVX512, FFTKernel::NEON}) {
+            if (!FFTKernelSupported(kernel))
+                continue;
+            std::vector<fft_type> forward, inverse;
+            transform(kernel, forward, inverse);
+            CHECK(memcmp(forward.data(), scalar_forward.data(), size * sizeof(fft_type)) == 0);
+            CHECK(memcmp(inverse.data(), scalar_inverse.data(), size * sizeof(fft_type)) == 0);
+        }
+        SetFFTKernel(original);
+    }
+
+    SECTION("natural order transforms match the bit-reversed ones.") {
+        for (size_t size : {4, 16, 2048}) {
+            std::vector<fft_type> input(size);
+            srand(3);
+            for (auto &sample : input)
+                sample = (fft_type) rand() / RAND_MAX - 0.5f;
+            auto hFFT = GetFFT(size);
+            std::vector<fft_type> scratch(size);
+
+            auto reversed = input;
+            RealFFTf(reversed.data(), hFFT.get());
+            std::vector<fft_type> expected(size);
+            expected[0] = reversed[0];
+            expected[1] = reversed[1];
+            for (size_t ii = 1; ii < size / 2; ++ii) {
+                expected[2 * ii] = reversed[hFFT->BitReversed[ii]];
+                expected[2 * ii + 1] = reversed[hFFT->BitReversed[ii] + 1];
+            }
+            auto natural = input;
+            RealFFTfNatural(natural.data(), scratch.data(), hFFT.get());
+            CHECK(memcmp(natural.data(), expected.data(), size * sizeof(fft_type)) == 0);
+
+            InverseRealFFTf(expected.data(), hFFT.get());
+            ReorderToTime(hFFT.get(), expected.data(), reversed.data());
+            InverseRealFFTfNatural(natural.data(), scratch.data(), hFFT.get());
+            CHECK(memcmp(natural.data(), reversed.data(), size * sizeof(fft_type)) == 0);
+        }
+    }
+
+    SECTION("batched transforms match one at a time.") {
+        const auto original = GetFFTKernel();
+        for (auto kernel : {FFTKernel::Scalar, FFTKernel::SSE2, FFTKernel::AVX, FFTKernel::AVX512, FFTKernel::NEON}) {
+            if (!FFTKernelSupported(kernel))
+                continue;
+            REQUIRE(SetFFTKernel(kernel));
+            for (size_t size : {4, 16, 2048}) {
+                // More frames than one batch holds, the last batch partly filled
+                const size_t count = FFTBatchFrames + 3;
+                std::vector<std::vector<fft_type>> inputs(count, std::vector<fft_type>(size));
+                srand(4);
+                for (auto &input : inputs)
+                    for (auto &sample : input)
+                        sample = (fft_type) rand() / RAND_MAX - 0.5f;
+                auto hFFT = GetFFT(size);
+                std::vector<fft_type> scratch(size * FFTBatchFrames);
+
+                auto expected = inputs;
+                for (auto &frame : expected)
+                    RealFFTfNatural(frame.data(), scratch.data(), hFFT.get());
+
+                auto batched = inputs;
+                std::vector<fft_type *> frames;
+                for (auto &frame : batched)
+                    frames.push_back(frame.data());
+                RealFFTfNaturalBatch(frames.data(), FFTBatchFrames, scratch.data(), hFFT.get());
+                RealFFTfNaturalBatch(frames.data() + FFTBatchFrames, count - FFTBatchFrames,
+                                     scratch.data(), hFFT.get());
+
+                auto planned = inputs;
+                auto plan = FFTBackends()[0]->MakePlan(size);
+                for (size_t ii = 0; ii < count; ++ii)
+                    frames[ii] = planned[ii].data();
+                plan->ForwardBatch(frames.data(), FFTBatchFrames);
+                plan->ForwardBatch(frames.data() + FFTBatchFrames, count - FFTBatchFrames);
+
+                for (size_t ii = 0; ii < count; ++ii) {
+                    CHECK(memcmp(batched[ii].data(), expected[ii].data(), size * sizeof(fft_type)) == 0);
+                    CHECK(memcmp(planned[ii].data(), expected[ii].data(), size * sizeof(fft_type)) == 0);
+                }
+            }
+        }
+        SetFFTKernel(original);
+    }
+
+    SECTION("tables are made once per size.") {
+        auto first = GetFFT(1024);
+        auto second = GetFFT(1024);
+        CHECK(first.get() == second.get());
+        CHECK(GetFFT(512).get() != first.get());
+    }
+
+    SECTION("every backend gives the natural order spectrum and inverts it.") {
+        const size_t size = 256;
+        std::vector<float> input(size);
+        srand(2);
+        for (auto &sample : input)
+            sample = (float) rand() / RAND_MAX - 0.5f;
+
+        // the packed layout by direct summation
+        std::vector<double> expected(size);
+        for (size_t kk = 0; kk <= size / 2; ++kk) {
+            double re = 0, im = 0;
+            for (size_t ii = 0; ii < size; ++ii) {
+                const double phase = 2 * M_PI * kk * ii / size;
+                re += input[ii] * cos(phase);
+                im -= input[ii] * sin(phase);
+            }
+            if (kk == 0)
+                expected[0] = re;
+            else if (kk == size / 2)
+                expected[1] = re;
+            else
+                expected[2 * kk] = re, expected[2 * kk + 1] = im;
+        }
+
+        for (auto backend : FFTBackends()) {
+            INFO(backend->GetName());
+            auto plan = backend->MakePlan(size);
+            if (!plan) {
+                // Without a CUDA device; MakeFFTPlan() then falls back
+                CHECK(backend->GetName() == "cufft");
+                continue;
+            }
+            auto buffer = input;
+            plan->Forward(buffer.data());
+            double error = 0;
+            for (size_t ii = 0; ii < size; ++ii)
+                error = std::max(error, std::abs(buffer[ii] - expected[ii]));
+            CHECK(error < 1e-3);
+
+            // In batches too, any number at once
+            std::vector<std::vector<float>> frames(FFTBatchFrames * 9 + 3, input);
+            std::vector<float *> pointers;
+            for (auto &frame : frames)
+                pointers.push_back(frame.data());
+            plan->ForwardBatch(pointers.data(), pointers.size());
+            for (const auto &frame : frames) {
+                double frameError = 0;
+                for (size_t ii = 0; ii < size; ++ii)
+                    frameError = std::max(frameError, std::abs(frame[ii] - expected[ii]));
+                CHECK(frameError < 1e-3);
+            }
+            plan->Inverse(buffer.data());
+            error = 0;
+            for (size_t ii = 0; ii < size; ++ii)
+                error = std::max(error, (double) std::abs(buffer[ii] - input[ii]));
+            CHECK(error < 1e-5);
+        }
+    }
+}
+
+TEST_CASE("fast math") {
+    SECTION("log and exp are within their documented error.") {
+        // 1001 arguments take the vector path and then the scalar tail
+        std::vector<float> input(1001), output(input.size());
+        for (size_t ii = 0; ii < input.size(); ++ii)
+            input[ii] = (float) pow(10.0, -30.0 + 60.0 * ii / (input.size() - 1));
+        FastLog(input.data(), output.data(), input.size());
+        double error = 0;
+        for (size_t ii = 0; ii < input.size(); ++ii) {
+            const double expected = log((double) input[ii]);
+            error = std::max(error, std::abs(output[ii] - expected) / std::max(1.0, std::abs(expected)));
+        }
+        CHECK(error <= 2e-7);
+
+        for (size_t ii = 0; ii < input.size(); ++ii)
+            input[ii] = -87.0f + 175.0f * ii / (input.size() - 1);
+        FastExp(input.data(), output.data(), input.size());
+        error = 0;
+        for (size_t ii = 0; ii < input.size(); ++ii) {
+            const double expected = exp((double) input[ii]);
+            error = std::max(error, std::abs(output[ii] - expected) / expected);
+        }
+        CHECK(error <= 2e-7);
+    }
+}
+
+TEST_CASE("sample formats") {
+    SECTION("block conversions match the strided per-sample ones.") {
+        const unsigned len = 1001;
+        std::vector<float> floats(len);
+        for (unsigned ii = 0; ii < len; ++ii)
+            floats[ii] = std::sin(ii * 0.37f) * 1.2f;
+        floats[3] = NAN;
+        floats[5] = 1.0f;
+        floats[7] = -1.0f;
+        floats[11] = 32767.5f / 32768;
+        std::vector<int> ints24(len);
+        for (unsigned ii = 0; ii < len; ++ii)
+            ints24[ii] = (ii * 104729) % (1 << 24) - (1 << 23);
+
+        // Strided buffers take the per-sample loops
+        auto convert = [&](DitherType type, samplePtr src, sampleFormat srcFormat,
+                           sampleFormat dstFormat, unsigned stride) {
+            std::vector<int> src2(len * stride), dst2(len * stride);
+            const auto srcSize = SAMPLE_SIZE(srcFormat), dstSize = SAMPLE_SIZE(dstFormat);
+            for (unsigned ii = 0; ii < len; ++ii)
+                memcpy((char *) src2.data() + ii * stride * srcSize, src + ii * srcSize, srcSize);
+            Dither dither;
+            srand(42);
+            dither.Apply(type, (samplePtr) src2.data(), srcFormat, (samplePtr) dst2.data(), dstFormat,
+                         len, stride, stride);
+            std::vector<int> dst(len);
+            for (unsigned ii = 0; ii < len; ++ii)
+                memcpy((char *) dst.data() + ii * dstSize,
+                       (char *) dst2.data() + ii * stride * dstSize, dstSize);
+            return dst;
+        };
+
+        for (auto type : {DitherType::none, DitherType::rectangle, DitherType::triangle,
+                          DitherType::shaped}) {
+            CHECK(convert(type, (samplePtr) floats.data(), floatSample, int16Sample, 1) ==
+                  convert(type, (samplePtr) floats.data(), floatSample, int16Sample, 2));
+            CHECK(convert(type, (samplePtr) floats.data(), floatSample, int24Sample, 1) ==
+                  convert(type, (samplePtr) floats.data(), floatSample, int24Sample, 2));
+            CHECK(convert(type, (samplePtr) ints24.data(), int24Sample, int16Sample, 1) ==
+                  convert(type, (samplePtr) ints24.data(), int24Sample, int16Sample, 2));
+        }
+        CHECK(convert(DitherType::none, (samplePtr) ints24.data(), int24Sample, floatSample, 1) ==
+              convert(DitherType::none, (samplePtr) ints24.data(), int24Sample, floatSample, 2));
+        const auto shorts = convert(DitherType::none, (samplePtr) floats.data(), floatSample, int16Sample, 1);
+        CHECK(convert(DitherType::none, (samplePtr) shorts.data(), int16Sample, floatSample, 1) ==
+              convert(DitherType::none, (samplePtr) shorts.data(), int16Sample, floatSample, 2));
+    }
 }
 
 TEST_CASE("noise reduction") {
@@ -136,6 +1125,7 @@ TEST_CASE("noise reduction") {
         audioArray.emplace_back(std::move(src_holders.at(0)));
         auto export_result = exporter.Export(audioArray, std::string("output.wav"));
         REQUIRE(export_result == ProgressResult::Success);
+        remove("output.wav");
 
         // results are not same.
         // CHECK(calc_file_hash("test_answer.wav") == calc_file_hash("test_out.wav"));
@@ -144,5 +1134,1404 @@ TEST_CASE("noise reduction") {
         delete factory;
         delete effect;
     }
+
+    SECTION("streaming matches the track path.") {
+        double profile_start = 0.0;
+        double profile_end = 0.5;
+        double noise_gain = 12.0;
+        double sensitivity = 6.0;
+        double smoothing = 3.0;
+
+        // track path
+        const auto dir_manager = std::make_shared<DirManager>();
+        auto factory = new TrackFactory(dir_manager);
+        auto bg_handler = PCMImportFileHandle::Open("bg_input.wav");
+        TrackHolders bg_holders{};
+        REQUIRE(bg_handler->Import(factory, bg_holders) == ProgressResult::Success);
+        auto src_handler = PCMImportFileHandle::Open("input.wav");
+        TrackHolders src_holders{};
+        REQUIRE(src_handler->Import(factory, src_holders) == ProgressResult::Success);
+
+        auto effect = new EffectNoiseReduction();
+        REQUIRE(effect->GetProfile(bg_holders[0].get(), profile_start, profile_end,
+                                   noise_gain, sensitivity, smoothing, factory));
+        REQUIRE(effect->ReduceNoise(src_holders[0].get(),
+                                    noise_gain, sensitivity, smoothing, factory));
+        auto exporter = ExportPCM();
+        auto audioArray = WaveTrackConstArray();
+        audioArray.emplace_back(std::move(src_holders.at(0)));
+        REQUIRE(exporter.Export(audioArray, std::string("track_out.wav")) == ProgressResult::Success);
+
+        // streaming path
+        auto stream_effect = new EffectNoiseReduction();
+        REQUIRE(stream_effect->GetProfileStreaming("bg_input.wav", profile_start, profile_end,
+                                                   noise_gain, sensitivity, smoothing));
+        REQUIRE(stream_effect->ReduceNoiseStreaming("input.wav", "stream_out.wav",
+                                                    noise_gain, sensitivity, smoothing));
+
+        CHECK(calc_file_hash("track_out.wav") == calc_file_hash("stream_out.wav"));
+        remove("track_out.wav");
+        remove("stream_out.wav");
+
+        delete factory;
+        delete effect;
+        delete stream_effect;
+    }
+
+    SECTION("stage pipes keep the order and hold the producer back.") {
+        StagePipe<int> pipe(3);
+        std::atomic<int> pushed{0};
+        std::thread producer([&] {
+            for (int ii = 0; ii < 100; ++ii) {
+                *pipe.Back() = ii;
+                pipe.Push();
+                ++pushed;
+            }
+            pipe.Close();
+        });
+        std::vector<int> received;
+        while (const auto item = pipe.Front()) {
+            CHECK(pushed - (int) received.size() <= 3);
+            received.push_back(*item);
+            pipe.Pop();
+        }
+        producer.join();
+        REQUIRE(received.size() == 100);
+        for (int ii = 0; ii < 100; ++ii)
+            CHECK(received[ii] == ii);
+
+        // A consumer that stops early lets a waiting producer go
+        StagePipe<int> cancelled(1);
+        std::thread waiting([&] {
+            while (cancelled.Back())
+                cancelled.Push();
+        });
+        cancelled.Cancel();
+        waiting.join();
+    }
+
+    SECTION("memory admission keeps to the budget in order.") {
+        MemoryAdmission admission(100);
+        CHECK(admission.Fits(100));
+        CHECK_FALSE(admission.Fits(101));
+
+        std::atomic<int> peak{0}, running{0};
+        std::vector<int> order;
+        std::mutex order_mutex;
+        std::vector<std::thread> jobs;
+        for (int ii = 0; ii < 8; ++ii) {
+            jobs.emplace_back([&, ii] {
+                // one over the budget is admitted alone
+                const auto ticket = admission.Admit(ii == 4 ? 150 : 40);
+                {
+                    std::lock_guard<std::mutex> lock(order_mutex);
+                    order.push_back(ii);
+                }
+                peak = std::max(peak.load(), ++running);
+                CHECK((admission.GetAdmitted() <= 100 || admission.GetAdmitted() == 150));
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                --running;
+            });
+        }
+        for (auto &job : jobs)
+            job.join();
+        CHECK(admission.GetAdmitted() == 0);
+        CHECK(order.size() == 8);
+        CHECK(peak <= 2);
+    }
+
+    SECTION("task pools run every task submitted, in order on one thread.") {
+        std::vector<int> order;
+        std::atomic<int> count{0};
+        {
+            TaskPool single(1);
+            for (int ii = 0; ii < 50; ++ii)
+                single.Submit([&, ii] { order.push_back(ii); });
+            TaskPool pool(4);
+            CHECK(pool.GetThreads() == 4);
+            for (int ii = 0; ii < 200; ++ii)
+                pool.Submit([&] { ++count; });
+            // the destructors finish what was submitted
+        }
+        CHECK(count == 200);
+        REQUIRE(order.size() == 50);
+        for (int ii = 0; ii < 50; ++ii)
+            CHECK(order[ii] == ii);
+    }
+
+    SECTION("block sizes change the blocks and nothing else.") {
+        std::vector<std::string> hashes;
+        for (const size_t bytes : {size_t(0), size_t(64) << 10, size_t(4) << 20}) {
+            const auto dir_manager = std::make_shared<DirManager>();
+            if (bytes)
+                REQUIRE(dir_manager->SetMaxBlockBytes(bytes));
+            TrackFactory factory(dir_manager);
+            TrackHolders bg_holders{}, src_holders{};
+            REQUIRE(PCMImportFileHandle::Open("bg_input.wav")->Import(&factory, bg_holders) ==
+                    ProgressResult::Success);
+            REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(&factory, src_holders) ==
+                    ProgressResult::Success);
+            EffectNoiseReduction effect;
+            REQUIRE(effect.GetProfile(bg_holders[0].get(), 0.0, 0.5, 12.0, 6.0, 3.0, &factory));
+            REQUIRE(effect.ReduceNoise(src_holders[0].get(), 12.0, 6.0, 3.0, &factory));
+            auto tracks = WaveTrackConstArray();
+            tracks.emplace_back(std::move(src_holders.at(0)));
+            REQUIRE(ExportPCM().Export(tracks, std::string("block_out.wav")) == ProgressResult::Success);
+            hashes.push_back(calc_file_hash("block_out.wav"));
+            remove("block_out.wav");
+        }
+        CHECK(hashes[1] == hashes[0]);
+        CHECK(hashes[2] == hashes[0]);
+
+        // Blocks too large for the sequence pasted into are split up
+        const auto dir_manager = std::make_shared<DirManager>();
+        CHECK(!dir_manager->SetMaxBlockBytes(DirManager::MinBlockBytes - 1));
+        CHECK(!dir_manager->SetMaxBlockBytes(DirManager::MaxBlockBytes + 1));
+        std::vector<float> samples(1000000);
+        for (size_t ii = 0; ii < samples.size(); ++ii)
+            samples[ii] = (float) (ii % 777) / 777;
+        Sequence large(dir_manager, floatSample);
+        large.Append((samplePtr) samples.data(), floatSample, samples.size());
+        REQUIRE(dir_manager->SetMaxBlockBytes(DirManager::MinBlockBytes * 16));
+        Sequence small(dir_manager, floatSample);
+        const size_t split = samples.size() / 3;
+        small.Paste(0, &large);
+        small.Paste(split, &large);
+        CHECK(small.GetMaxBlockSize() < large.GetMaxBlockSize());
+        REQUIRE(small.GetNumSamples() == 2 * samples.size());
+        std::vector<float> read(samples.size()), pasted(samples.size());
+        small.Get((samplePtr) read.data(), floatSample, 0, split, true);
+        small.Get((samplePtr) pasted.data(), floatSample, split, pasted.size(), true);
+        small.Get((samplePtr) (read.data() + split), floatSample,
+                  split + samples.size(), read.size() - split, true);
+        CHECK((read == samples));
+        CHECK((pasted == samples));
+    }
+
+    SECTION("projects made and used on several threads keep to themselves.") {
+        const size_t count = 300000;
+        auto fill = [count](size_t seed) {
+            std::vector<float> samples(count);
+            for (size_t ii = 0; ii < count; ++ii)
+                samples[ii] = (float) ((ii + seed) % 991) / 991;
+            return samples;
+        };
+        auto append = [](Sequence &sequence, const std::vector<float> &samples) {
+            for (size_t pos = 0; pos < samples.size(); pos += 10000)
+                sequence.Append((samplePtr) (samples.data() + pos), floatSample,
+                                std::min<size_t>(10000, samples.size() - pos));
+        };
+        auto matches = [](const Sequence &sequence, const std::vector<float> &samples) {
+            std::vector<float> read(samples.size());
+            return sequence.GetNumSamples() == samples.size() &&
+                   sequence.Get((samplePtr) read.data(), floatSample, 0, read.size(), true) &&
+                   read == samples;
+        };
+
+        // A DirManager each, made and dropped at once
+        std::vector<char> own(4, false);
+        {
+            std::vector<std::thread> threads;
+            for (size_t tt = 0; tt < own.size(); ++tt)
+                threads.emplace_back([&, tt] {
+                    const auto dir_manager = std::make_shared<DirManager>();
+                    Sequence sequence(dir_manager, floatSample);
+                    const auto samples = fill(tt);
+                    append(sequence, samples);
+                    own[tt] = matches(sequence, samples);
+                });
+            for (auto &thread : threads)
+                thread.join();
+        }
+        CHECK(std::count(own.begin(), own.end(), true) == (long) own.size());
+
+        // Sequences of their own on one DirManager, which outlives another
+        const auto shared = std::make_shared<DirManager>();
+        std::vector<std::unique_ptr<Sequence>> sequences;
+        for (size_t tt = 0; tt < 4; ++tt)
+            sequences.emplace_back(new Sequence(shared, floatSample));
+        {
+            std::vector<std::thread> threads;
+            for (size_t tt = 0; tt < sequences.size(); ++tt)
+                threads.emplace_back([&, tt] { append(*sequences[tt], fill(tt)); });
+            for (auto &thread : threads)
+                thread.join();
+        }
+        {
+            const auto other = std::make_shared<DirManager>();
+            Sequence sequence(other, floatSample);
+            append(sequence, fill(9));
+            CHECK(matches(sequence, fill(9)));
+        }
+        for (size_t tt = 0; tt < sequences.size(); ++tt)
+            CHECK(matches(*sequences[tt], fill(tt)));
+    }
+
+    SECTION("blocks go to the first storage root that takes them, then the next.") {
+        const std::string temp{DirManager::GetTempDir()};
+        const std::string first{temp + "-first"}, second{temp + "-second"};
+        std::vector<float> samples(4 << 20);
+        for (size_t ii = 0; ii < samples.size(); ++ii)
+            samples[ii] = (float) (ii % 1237) / 1237;
+        auto read = [](const Sequence &sequence) {
+            std::vector<float> read(sequence.GetNumSamples().as_size_t());
+            sequence.Get((samplePtr) read.data(), floatSample, 0, read.size(), true);
+            return read;
+        };
+
+        auto isDir = [](const std::string &path) {
+            struct stat info;
+            return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+        };
+
+        auto dir_manager = std::make_shared<DirManager>();
+        CHECK(!dir_manager->SetStorageRoots({}));
+        CHECK(!dir_manager->SetStorageRoots({first, "relative"}));
+        CHECK(dir_manager->GetStorageRoot().empty());
+        // /proc can't be written, and no file system has room for that much
+        REQUIRE(dir_manager->SetStorageRoots({"/proc/noisered", first, second}, ~size_t(0) / 2));
+        {
+            Sequence sequence(dir_manager, floatSample);
+            sequence.Append((samplePtr) samples.data(), floatSample, samples.size());
+            CHECK(dir_manager->GetStorageRoot() == first);
+            CHECK((read(sequence) == samples));
+        }
+
+        // Files past 64 MB fail as on a full file system, so the second
+        // segment of the store can't be had in the first root
+        struct rlimit limit, saved;
+        REQUIRE(getrlimit(RLIMIT_FSIZE, &saved) == 0);
+        const auto handler = signal(SIGXFSZ, SIG_IGN);
+        limit = saved;
+        limit.rlim_cur = 64 << 20;
+        REQUIRE(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+        std::vector<std::unique_ptr<Sequence>> sequences;
+        for (size_t ii = 0; ii < 5; ++ii) {
+            sequences.emplace_back(new Sequence(dir_manager, floatSample));
+            sequences.back()->Append((samplePtr) samples.data(), floatSample, samples.size());
+        }
+        setrlimit(RLIMIT_FSIZE, &saved);
+        signal(SIGXFSZ, handler);
+        CHECK(dir_manager->GetStorageRoot() == second);
+        for (const auto &sequence : sequences)
+            CHECK((read(*sequence) == samples));
+
+        // Each root's project directory goes with the DirManager, but the
+        // roots themselves, being the caller's, stay; rmdir takes them only
+        // once empty
+        sequences.clear();
+        dir_manager.reset();
+        REQUIRE(isDir(first));
+        REQUIRE(isDir(second));
+        CHECK(rmdir(first.c_str()) == 0);
+        CHECK(rmdir(second.c_str()) == 0);
+    }
+
+    SECTION("the live reducer matches the track path, late by its latency.") {
+        const auto dir_manager = std::make_shared<DirManager>();
+        TrackFactory factory(dir_manager);
+        TrackHolders bg_holders{};
+        REQUIRE(PCMImportFileHandle::Open("bg_input.wav")->Import(&factory, bg_holders) == ProgressResult::Success);
+        TrackHolders src_holders{};
+        REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(&factory, src_holders) == ProgressResult::Success);
+        auto &track = *src_holders[0];
+        const auto len = track.TimeToLongSamples(track.GetEndTime()).as_size_t();
+        std::vector<float> input(len);
+        track.Get((samplePtr) input.data(), floatSample, 0, len);
+
+        EffectNoiseReduction effect;
+        CHECK(NoiseReducer::Create(effect, track.GetRate(), 12.0, 6.0, 3.0) == nullptr);
+        REQUIRE(effect.GetProfile(bg_holders[0].get(), 0.0, 0.5, 12.0, 6.0, 3.0, &factory));
+        CHECK(NoiseReducer::Create(effect, track.GetRate() / 2, 12.0, 6.0, 3.0) == nullptr);
+        auto reducer = NoiseReducer::Create(effect, track.GetRate(), 12.0, 6.0, 3.0);
+        REQUIRE(reducer != nullptr);
+        REQUIRE(effect.ReduceNoise(&track, 12.0, 6.0, 3.0, &factory));
+        std::vector<float> reduced(len);
+        track.Get((samplePtr) reduced.data(), floatSample, 0, len);
+
+        // Twice, to see that Flush() starts the reducer over
+        const auto latency = reducer->GetLatency();
+        for (int pass = 0; pass < 2; ++pass) {
+            std::vector<float> output(len + latency);
+            for (size_t pos = 0, block = 1; pos < len; pos += block, block = block * 7 % 4099) {
+                block = std::min(block, len - pos);
+                std::copy(&input[pos], &input[pos] + block, &output[pos]);
+                reducer->Process(&output[pos], &output[pos], block);
+            }
+            reducer->Flush(&output[len]);
+
+            CHECK(std::all_of(output.begin(), output.begin() + latency, [](float sample) { return sample == 0; }));
+            CHECK(std::equal(reduced.begin(), reduced.end(), output.begin() + latency));
+        }
+    }
+
+    SECTION("advanced settings are checked and kept for later calls.") {
+        EffectNoiseReduction effect;
+        CHECK_FALSE(effect.SetAdvancedSettings(1000, 4, 2, 1));
+        CHECK_FALSE(effect.SetAdvancedSettings(2048, 2, 2, 1));
+        CHECK_FALSE(effect.SetAdvancedSettings(2048, 8, 2, 0));
+        CHECK_FALSE(effect.SetAdvancedSettings(2048, 4, 7, 1));
+        CHECK_FALSE(effect.SetAdvancedSettings(4, 2, 1, 1));
+        CHECK(EffectNoiseReduction::GetWindowTypesNames().at(1) == "Hann, none");
+
+        // A quicker pass: 1024 point windows, two steps, no synthesis window
+        REQUIRE(effect.SetAdvancedSettings(1024, 2, 1, 1));
+        REQUIRE(effect.GetProfileStreaming("bg_input.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        REQUIRE(effect.ReduceNoiseStreaming("input.wav", "quick_out.wav", 12.0, 6.0, 3.0));
+        REQUIRE(effect.SetAdvancedSettings(2048, 4, 2, 1));
+        CHECK_FALSE(effect.ReduceNoiseStreaming("input.wav", "mismatched_out.wav", 12.0, 6.0, 3.0));
+
+        EffectNoiseReduction defaults;
+        REQUIRE(defaults.GetProfileStreaming("bg_input.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        REQUIRE(defaults.ReduceNoiseStreaming("input.wav", "stream_out.wav", 12.0, 6.0, 3.0));
+        CHECK(calc_file_hash("quick_out.wav") != calc_file_hash("stream_out.wav"));
+        remove("quick_out.wav");
+        remove("mismatched_out.wav");
+        remove("stream_out.wav");
+    }
+
+    SECTION("previews measure the noise at full and reduced rates.") {
+        EffectNoiseReduction effect;
+        EffectNoiseReduction::NoisePreview preview;
+        CHECK_FALSE(effect.PreviewNoise("input.wav", 1, 6.0, preview));
+        REQUIRE(effect.GetProfileStreaming("bg_input.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        CHECK_FALSE(effect.PreviewNoise("input.wav", 3, 6.0, preview));
+        CHECK_FALSE(effect.PreviewNoise("input.wav", 1024, 6.0, preview));
+
+        // Steps of the same length whatever the decimation, one per step of
+        // input, give or take the resampler's edges
+        EffectNoiseReduction::NoisePreview full, decimated, background;
+        REQUIRE(effect.PreviewNoise("input.wav", 1, 6.0, full));
+        REQUIRE(effect.PreviewNoise("input.wav", 4, 6.0, decimated));
+        REQUIRE(full.stepFractions.size() == 1);
+        REQUIRE(decimated.stepFractions.size() == 1);
+        SF_INFO info = {};
+        sf_close(sf_open("input.wav", SFM_READ, &info));
+        const auto steps = full.stepFractions[0].size();
+        CHECK(steps == (size_t) (info.frames + 511) / 512);
+        CHECK(decimated.stepFractions[0].size() + 1 >= steps);
+        CHECK(decimated.stepFractions[0].size() <= steps + 1);
+        const auto &fractions = decimated.stepFractions[0];
+        CHECK(std::all_of(fractions.begin(), fractions.end(),
+                          [](float fraction) { return fraction >= 0.0f && fraction <= 1.0f; }));
+
+        // The profile's own noise looks more like noise than speech does
+        REQUIRE(effect.PreviewNoise("bg_input.wav", 1, 6.0, background));
+        CHECK(background.noiseFraction > full.noiseFraction);
+        CHECK(full.noiseFraction > 0.0);
+        CHECK(decimated.noiseFraction > 0.0);
+    }
+
+    SECTION("audio at another rate is resampled to the profile's.") {
+        using Error = EffectNoiseReduction::Error;
+        // input.wav's samples, labelled as twice the rate
+        SF_INFO info = {};
+        SNDFILE *file = sf_open("input.wav", SFM_READ, &info);
+        REQUIRE(file != nullptr);
+        std::vector<float> samples(info.frames);
+        REQUIRE(sf_readf_float(file, samples.data(), info.frames) == info.frames);
+        sf_close(file);
+        const int rate = info.samplerate;
+        info.samplerate *= 2;
+        file = sf_open("input_fast.wav", SFM_WRITE, &info);
+        REQUIRE(file != nullptr);
+        REQUIRE(sf_writef_float(file, samples.data(), info.frames) == info.frames);
+        sf_close(file);
+        auto read_all = [](const char *path, SF_INFO &info) {
+            info = SF_INFO{};
+            SNDFILE *file = sf_open(path, SFM_READ, &info);
+            std::vector<float> samples(file ? info.frames : 0);
+            if (file)
+                sf_readf_float(file, samples.data(), info.frames);
+            sf_close(file);
+            return samples;
+        };
+
+        EffectNoiseReduction effect;
+        REQUIRE(effect.GetProfileStreaming("bg_input.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        CHECK_FALSE(effect.ReduceNoiseStreaming("input_fast.wav", "resampled_out.wav", 12.0, 6.0, 3.0));
+        CHECK(effect.GetLastError() == Error::SampleRate);
+        effect.SetResampling(true);
+        REQUIRE(effect.ReduceNoiseStreaming("input_fast.wav", "resampled_out.wav", 12.0, 6.0, 3.0));
+        SF_INFO outInfo;
+        const auto streamed = read_all("resampled_out.wav", outInfo);
+        CHECK(outInfo.samplerate == rate);
+        CHECK(std::abs((long) outInfo.frames - (long) samples.size() / 2) <= 1);
+
+        // Tracks are resampled in place, to much the same
+        const auto dir_manager = std::make_shared<DirManager>();
+        TrackFactory factory(dir_manager);
+        TrackHolders holders{};
+        REQUIRE(PCMImportFileHandle::Open("input_fast.wav")->Import(&factory, holders) == ProgressResult::Success);
+        REQUIRE(effect.ReduceNoise(holders[0].get(), 12.0, 6.0, 3.0, &factory));
+        CHECK(holders[0]->GetRate() == rate);
+        auto tracks = WaveTrackConstArray();
+        tracks.emplace_back(std::move(holders.at(0)));
+        REQUIRE(ExportPCM().Export(tracks, std::string("resampled_track.wav")) == ProgressResult::Success);
+        const auto tracked = read_all("resampled_track.wav", outInfo);
+        REQUIRE(tracked.size() == streamed.size());
+        float largest = 0;
+        for (size_t ii = 0; ii < tracked.size(); ++ii)
+            largest = std::max(largest, std::abs(tracked[ii] - streamed[ii]));
+        CHECK(largest <= 2.0f / 32768);
+        remove("resampled_out.wav");
+        remove("resampled_track.wav");
+
+        // Previews decimate and resample in one pass
+        EffectNoiseReduction::NoisePreview preview;
+        REQUIRE(effect.PreviewNoise("input_fast.wav", 2, 6.0, preview));
+        CHECK(preview.bands == 1024 / 2 * 9 / 10);
+        CHECK(std::abs((long) preview.stepFractions[0].size() - (long) (samples.size() / 2 + 511) / 512) <= 1);
+        effect.SetResampling(false);
+        CHECK_FALSE(effect.PreviewNoise("input_fast.wav", 2, 6.0, preview));
+        remove("input_fast.wav");
+    }
+
+    SECTION("analysis masks add up to the step fractions.") {
+        EffectNoiseReduction effect;
+        REQUIRE(effect.GetProfileStreaming("bg_input.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        EffectNoiseReduction::NoisePreview analysis;
+        REQUIRE(effect.PreviewNoise("input.wav", 1, 6.0, analysis, true));
+        REQUIRE(analysis.bands == 1025);
+        const auto &fractions = analysis.stepFractions[0];
+        const auto &masks = analysis.stepMasks[0];
+        REQUIRE(masks.size() == fractions.size() * analysis.bands);
+        size_t mismatches = 0;
+        for (size_t ii = 0; ii < fractions.size(); ++ii) {
+            const auto begin = masks.begin() + ii * analysis.bands;
+            const auto noise = std::count(begin, begin + analysis.bands, 1);
+            if (std::abs(noise / 1025.0 - fractions[ii]) > 1e-6)
+                ++mismatches;
+        }
+        CHECK(mismatches == 0);
+    }
+
+    SECTION("failures say why.") {
+        using Error = EffectNoiseReduction::Error;
+        EffectNoiseReduction effect;
+        CHECK_FALSE(effect.ReduceNoiseStreaming("input.wav", "stream_out.wav", 12.0, 6.0, 3.0));
+        CHECK(effect.GetLastError() == Error::NoProfile);
+        CHECK_FALSE(effect.GetProfileStreaming("missing.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        CHECK(effect.GetLastError() == Error::File);
+        CHECK_FALSE(effect.GetProfileStreaming("bg_input.wav", 0.0, 0.01, 12.0, 6.0, 3.0));
+        CHECK(effect.GetLastError() == Error::ProfileTooShort);
+        CHECK_FALSE(effect.SetAdvancedSettings(2048, 8, 2, 0));
+        CHECK(effect.GetLastError() == Error::Settings);
+
+        std::vector<float> noise(8000, 0.01f);
+        REQUIRE(effect.GetProfileBuffer(noise.data(), 1, noise.size(), 8000, 12.0, 6.0, 3.0));
+        CHECK(effect.GetLastError() == Error::None);
+        CHECK_FALSE(effect.ReduceNoiseStreaming("input.wav", "stream_out.wav", 12.0, 6.0, 3.0));
+        CHECK(effect.GetLastError() == Error::SampleRate);
+        remove("stream_out.wav");
+    }
+
+    SECTION("adaptive profiles follow drifting noise.") {
+        // Noise three times as loud as the profile's, which a fixed profile
+        // keeps taking for signal in some bands
+        const double rate = 8000;
+        std::vector<float> noise(16000), louder(80000);
+        unsigned seed = 1;
+        auto next = [&seed] {
+            seed = seed * 1103515245u + 12345u;
+            return (float) ((seed >> 8) & 0xffff) / 0x8000 - 1.0f;
+        };
+        for (auto &sample : noise)
+            sample = 0.01f * next();
+        for (auto &sample : louder)
+            sample = 0.03f * next();
+
+        EffectNoiseReduction effect;
+        CHECK_FALSE(effect.SetAdaptiveProfile(-1.0));
+        CHECK(effect.GetLastError() == EffectNoiseReduction::Error::Settings);
+        REQUIRE(effect.GetProfileBuffer(noise.data(), 1, noise.size(), rate, 12.0, 6.0, 3.0));
+        std::vector<float> fixed(louder.size()), adapted(louder.size());
+        REQUIRE(effect.ReduceNoiseBuffer(louder.data(), fixed.data(), 1, louder.size(), rate, 12.0, 6.0, 3.0));
+        REQUIRE(effect.SetAdaptiveProfile(0.5));
+        REQUIRE(effect.ReduceNoiseBuffer(louder.data(), adapted.data(), 1, louder.size(), rate, 12.0, 6.0, 3.0));
+
+        // Less of the noise gets through once the means have caught up
+        auto energy = [](const std::vector<float> &samples, size_t begin, size_t end) {
+            double sum = 0;
+            for (size_t ii = begin; ii < end; ++ii)
+                sum += samples[ii] * samples[ii];
+            return sum;
+        };
+        CHECK(energy(adapted, 40000, 80000) < 0.5 * energy(fixed, 40000, 80000));
+
+        // Each call starts again from the profile taken
+        std::vector<float> again(louder.size());
+        REQUIRE(effect.ReduceNoiseBuffer(louder.data(), again.data(), 1, louder.size(), rate, 12.0, 6.0, 3.0));
+        CHECK(again == adapted);
+        REQUIRE(effect.SetAdaptiveProfile(0.0));
+        REQUIRE(effect.ReduceNoiseBuffer(louder.data(), again.data(), 1, louder.size(), rate, 12.0, 6.0, 3.0));
+        CHECK(again == fixed);
+    }
+
+    SECTION("long silences are skipped and come out as silence.") {
+        const double rate = 8000;
+        std::vector<float> noise(16000);
+        unsigned seed = 1;
+        auto next = [&seed] {
+            seed = seed * 1103515245u + 12345u;
+            return (float) ((seed >> 8) & 0xffff) / 0x8000 - 1.0f;
+        };
+        for (auto &sample : noise)
+            sample = 0.01f * next();
+        // Speech-like bursts around a long stretch of zeros, each a whole
+        // number of steps long
+        const size_t burst = 16384, gap = 65536;
+        std::vector<float> input(2 * burst + gap);
+        for (size_t ii = 0; ii < burst; ++ii) {
+            input[ii] = 0.3f * std::sin(ii * 0.2f) + 0.01f * next();
+            input[burst + gap + ii] = 0.3f * std::sin(ii * 0.3f) + 0.01f * next();
+        }
+
+        EffectNoiseReduction effect;
+        REQUIRE(effect.GetProfileBuffer(noise.data(), 1, noise.size(), rate, 12.0, 6.0, 3.0));
+        Instrumentation::Reset();
+        std::vector<float> output(input.size());
+        REQUIRE(effect.ReduceNoiseBuffer(input.data(), output.data(), 1, input.size(), rate, 12.0, 6.0, 3.0));
+        if (Instrumentation::Enabled())
+            CHECK(Instrumentation::ToJSON().find("\"silent_steps\": 0") == std::string::npos);
+
+        // Well into the gap nothing is left of the first burst
+        CHECK(std::all_of(output.begin() + burst + gap / 2, output.begin() + burst + gap,
+                          [](float sample) { return sample == 0.0f; }));
+        // After it the Worker is as it started, so the second burst comes
+        // out as it would alone
+        std::vector<float> alone(burst);
+        REQUIRE(effect.ReduceNoiseBuffer(&input[burst + gap], alone.data(), 1, burst, rate, 12.0, 6.0, 3.0));
+        CHECK(std::equal(alone.begin(), alone.end(), output.begin() + burst + gap));
+    }
+
+    SECTION("merged profiles match profiling the pieces together.") {
+        using Error = EffectNoiseReduction::Error;
+        SF_INFO info = {};
+        auto file = sf_open("bg_input.wav", SFM_READ, &info);
+        REQUIRE(file != nullptr);
+        std::vector<float> noise(8000);
+        REQUIRE(sf_readf_float(file, noise.data(), noise.size()) == (sf_count_t) noise.size());
+        sf_close(file);
+
+        // The halves as two channels of one profile, and as profiles merged
+        std::vector<float> channels(noise.size());
+        for (size_t ii = 0; ii < 4000; ++ii) {
+            channels[2 * ii] = noise[ii];
+            channels[2 * ii + 1] = noise[4000 + ii];
+        }
+        EffectNoiseReduction together, first, second, merged;
+        REQUIRE(together.GetProfileBuffer(channels.data(), 2, 4000, info.samplerate, 12.0, 6.0, 3.0));
+        REQUIRE(first.GetProfileBuffer(noise.data(), 1, 4000, info.samplerate, 12.0, 6.0, 3.0));
+        REQUIRE(second.GetProfileBuffer(noise.data() + 4000, 1, 4000, info.samplerate, 12.0, 6.0, 3.0));
+        CHECK_FALSE(merged.MergeProfile(EffectNoiseReduction()));
+        CHECK(merged.GetLastError() == Error::NoProfile);
+        REQUIRE(merged.MergeProfile(second));
+        REQUIRE(merged.MergeProfile(first));
+
+        EffectNoiseReduction::NoisePreview expected, actual;
+        REQUIRE(together.PreviewNoise("input.wav", 1, 6.0, expected));
+        REQUIRE(merged.PreviewNoise("input.wav", 1, 6.0, actual));
+        REQUIRE(actual.stepFractions[0].size() == expected.stepFractions[0].size());
+        for (size_t ii = 0; ii < expected.stepFractions[0].size(); ++ii)
+            CHECK(std::abs(actual.stepFractions[0][ii] - expected.stepFractions[0][ii]) < 0.01);
+
+        // Segments on any number of threads give the same profile
+        const std::vector<EffectNoiseReduction::ProfileSegment> segments{
+                {"bg_input.wav", 0.0, 0.2}, {"bg_input.wav", 0.2, 0.5}, {"bg_input.wav", 0.5, 0.7}};
+        EffectNoiseReduction serial, parallel;
+        REQUIRE(serial.GetProfileSegments(segments, 1));
+        REQUIRE(parallel.GetProfileSegments(segments, 3));
+        REQUIRE(serial.SaveProfile("serial.bin"));
+        REQUIRE(parallel.SaveProfile("parallel.bin"));
+        CHECK(calc_file_hash("serial.bin") == calc_file_hash("parallel.bin"));
+        remove("serial.bin");
+        remove("parallel.bin");
+
+        CHECK_FALSE(parallel.GetProfileSegments({{"bg_input.wav", 0.0, 0.5}, {"missing.wav", 0.0, 0.5}}));
+        CHECK(parallel.GetLastError() == Error::File);
+        CHECK_FALSE(parallel.HasProfile());
+
+        // A segment at another rate fails the merge, with the merge's error
+        info = SF_INFO{};
+        file = sf_open("bg_input.wav", SFM_READ, &info);
+        REQUIRE(file != nullptr);
+        std::vector<float> whole(info.frames * info.channels);
+        REQUIRE(sf_readf_float(file, whole.data(), info.frames) == info.frames);
+        sf_close(file);
+        info.samplerate *= 2;
+        file = sf_open("noise_fast.wav", SFM_WRITE, &info);
+        REQUIRE(file != nullptr);
+        REQUIRE(sf_writef_float(file, whole.data(), info.frames) == info.frames);
+        sf_close(file);
+        CHECK_FALSE(parallel.GetProfileSegments({{"bg_input.wav", 0.0, 0.5}, {"noise_fast.wav", 0.0, 0.2}}, 2));
+        CHECK(parallel.GetLastError() == Error::SampleRate);
+        CHECK_FALSE(parallel.HasProfile());
+        remove("noise_fast.wav");
+        std::vector<float> slower(8000, 0.01f);
+        REQUIRE(parallel.GetProfileBuffer(slower.data(), 1, slower.size(), 8000, 12.0, 6.0, 3.0));
+        CHECK_FALSE(serial.MergeProfile(parallel));
+        CHECK(serial.GetLastError() == Error::SampleRate);
+    }
+
+    SECTION("instrumentation counts the stages when built in.") {
+        Instrumentation::Reset();
+        EffectNoiseReduction effect;
+        REQUIRE(effect.GetProfileStreaming("bg_input.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        REQUIRE(effect.ReduceNoiseStreaming("input.wav", "stream_out.wav", 12.0, 6.0, 3.0));
+        remove("stream_out.wav");
+
+        const auto json = Instrumentation::ToJSON();
+        if (!Instrumentation::Enabled())
+            CHECK(json == "{\"enabled\": false}");
+        else {
+            CHECK(json.find("\"reduce\": {\"seconds\": 0,") == std::string::npos);
+            CHECK(json.find("\"forward_fft\": {\"seconds\": 0,") == std::string::npos);
+            CHECK(json.find("\"bytes_read\": 0,") == std::string::npos);
+            CHECK(json.find("\"bytes_written\": 0,") == std::string::npos);
+            Instrumentation::Reset();
+            CHECK(Instrumentation::ToJSON().find("\"bytes_read\": 0,") != std::string::npos);
+        }
+    }
+
+    SECTION("saved profile reduces like the original.") {
+        auto effect = new EffectNoiseReduction();
+        REQUIRE(effect->GetProfileStreaming("bg_input.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        REQUIRE(effect->SaveProfile("profile.bin"));
+        REQUIRE(effect->ReduceNoiseStreaming("input.wav", "stream_out.wav", 12.0, 6.0, 3.0));
+
+        auto loaded_effect = new EffectNoiseReduction();
+        CHECK_FALSE(loaded_effect->LoadProfile("input.wav"));
+        REQUIRE(loaded_effect->LoadProfile("profile.bin"));
+        REQUIRE(loaded_effect->ReduceNoiseStreaming("input.wav", "loaded_out.wav", 12.0, 6.0, 3.0));
+
+        CHECK(calc_file_hash("stream_out.wav") == calc_file_hash("loaded_out.wav"));
+        remove("profile.bin");
+        remove("stream_out.wav");
+        remove("loaded_out.wav");
+
+        delete effect;
+        delete loaded_effect;
+    }
+
+    SECTION("cached profiles match fresh ones and follow the file's contents.") {
+        auto copyFile = [](const char *from, const char *to) {
+            std::ifstream in(from, std::ios::binary);
+            std::ofstream out(to, std::ios::binary);
+            out << in.rdbuf();
+        };
+        copyFile("bg_input.wav", "cached_noise.wav");
+        mkdir("profile_cache", 0777);
+        REQUIRE(EffectNoiseReduction::SetProfileCache(true, "profile_cache"));
+
+        EffectNoiseReduction fresh;
+        REQUIRE(fresh.GetProfileStreaming("cached_noise.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        REQUIRE(fresh.SaveProfile("fresh.bin"));
+        // Taken, then from memory, then from the directory as another
+        // process would
+        for (int pass = 0; pass < 3; ++pass) {
+            if (pass == 2)
+                EffectNoiseReduction::ClearProfileCache();
+            EffectNoiseReduction cached;
+            REQUIRE(cached.GetProfileCached("cached_noise.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+            REQUIRE(cached.SaveProfile("cached.bin"));
+            CHECK(calc_file_hash("cached.bin") == calc_file_hash("fresh.bin"));
+        }
+
+        // Another range, other settings or other contents are another profile
+        EffectNoiseReduction other;
+        REQUIRE(other.GetProfileCached("cached_noise.wav", 0.0, 0.25, 12.0, 6.0, 3.0));
+        REQUIRE(other.SaveProfile("cached.bin"));
+        CHECK(calc_file_hash("cached.bin") != calc_file_hash("fresh.bin"));
+        REQUIRE(other.SetAdvancedSettings(1024, 4, 2, 1));
+        REQUIRE(other.GetProfileCached("cached_noise.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        REQUIRE(other.SaveProfile("cached.bin"));
+        CHECK(calc_file_hash("cached.bin") != calc_file_hash("fresh.bin"));
+        copyFile("input.wav", "cached_noise.wav");
+        EffectNoiseReduction changed, expected;
+        REQUIRE(changed.GetProfileCached("cached_noise.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        REQUIRE(changed.SaveProfile("cached.bin"));
+        REQUIRE(expected.GetProfileStreaming("input.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        REQUIRE(expected.SaveProfile("fresh.bin"));
+        CHECK(calc_file_hash("cached.bin") == calc_file_hash("fresh.bin"));
+
+        CHECK_FALSE(changed.GetProfileCached("missing.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        CHECK(changed.GetLastError() == EffectNoiseReduction::Error::File);
+
+        REQUIRE(EffectNoiseReduction::SetProfileCache(false));
+        EffectNoiseReduction::ClearProfileCache();
+        DirManager::CleanDir("profile_cache");
+        rmdir("profile_cache");
+        remove("cached_noise.wav");
+        remove("cached.bin");
+        remove("fresh.bin");
+    }
+
+    SECTION("sweeps classify once and match reducing with each setting.") {
+        const std::vector<EffectNoiseReduction::SweepSetting> settings{
+                {12.0, 3.0, "sweep_out0.wav"}, {0.0, 0.0, "sweep_out1.wav"}, {24.0, 6.0, "sweep_out2.wav"}};
+        EffectNoiseReduction effect;
+        REQUIRE(effect.GetProfileStreaming("bg_input.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        REQUIRE(effect.ReduceNoiseSweep("input.wav", 6.0, settings));
+        for (const auto &setting : settings) {
+            REQUIRE(effect.ReduceNoiseStreaming("input.wav", "single_out.wav", setting.noiseGain, 6.0,
+                                                setting.freqSmoothingBands));
+            CHECK(calc_file_hash(setting.dstPath) == calc_file_hash("single_out.wav"));
+            remove(setting.dstPath.c_str());
+        }
+
+        // Adapting, each setting classifies afresh, with the same outcome
+        REQUIRE(effect.SetAdaptiveProfile(1.0));
+        REQUIRE(effect.ReduceNoiseSweep("input.wav", 6.0, {{0.0, 3.0, "sweep_out0.wav"},
+                                                            {12.0, 3.0, "sweep_out1.wav"}}));
+        REQUIRE(effect.ReduceNoiseStreaming("input.wav", "single_out.wav", 12.0, 6.0, 3.0));
+        CHECK(calc_file_hash("sweep_out1.wav") == calc_file_hash("single_out.wav"));
+
+        CHECK_FALSE(effect.ReduceNoiseSweep("missing.wav", 6.0, settings));
+        CHECK(effect.GetLastError() == EffectNoiseReduction::Error::File);
+        remove("sweep_out0.wav");
+        remove("sweep_out1.wav");
+        remove("single_out.wav");
+    }
+
+    SECTION("batch matches single file streaming.") {
+        auto effect = new EffectNoiseReduction();
+        REQUIRE(effect->GetProfileStreaming("bg_input.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        REQUIRE(effect->ReduceNoiseStreaming("input.wav", "stream_out.wav", 12.0, 6.0, 3.0));
+
+        std::vector<EffectNoiseReduction::BatchResult> results;
+        CHECK_FALSE(effect->ReduceNoiseBatch({{"input.wav", "batch_out0.wav"},
+                                              {"missing.wav", "missing_out.wav"},
+                                              {"input.wav", "batch_out1.wav"}},
+                                             12.0, 6.0, 3.0, results, 2));
+        REQUIRE(results.size() == 3);
+        CHECK(results[0].success);
+        CHECK_FALSE(results[1].success);
+        CHECK(results[2].success);
+
+        CHECK(calc_file_hash("stream_out.wav") == calc_file_hash("batch_out0.wav"));
+        CHECK(calc_file_hash("stream_out.wav") == calc_file_hash("batch_out1.wav"));
+        remove("stream_out.wav");
+        remove("batch_out0.wav");
+        remove("batch_out1.wav");
+
+        delete effect;
+    }
+
+    SECTION("shared profiles stay as they were while their effect merges.") {
+        EffectNoiseReduction effect, other, shared;
+        REQUIRE(effect.GetProfileStreaming("bg_input.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        REQUIRE(other.GetProfileStreaming("bg_input.wav", 0.5, 0.7, 12.0, 6.0, 3.0));
+        shared.UseProfile(effect.ShareProfile());
+        REQUIRE(shared.HasProfile());
+        REQUIRE(shared.ReduceNoiseStreaming("input.wav", "shared_out0.wav", 12.0, 6.0, 3.0));
+
+        REQUIRE(effect.MergeProfile(other));
+        std::vector<EffectNoiseReduction::BatchResult> results;
+        REQUIRE(shared.ReduceNoiseBatch({{"input.wav", "shared_out1.wav"}}, 12.0, 6.0, 3.0, results, 1));
+        REQUIRE(effect.ReduceNoiseStreaming("input.wav", "merged_out.wav", 12.0, 6.0, 3.0));
+        CHECK(calc_file_hash("shared_out0.wav") == calc_file_hash("shared_out1.wav"));
+        CHECK(calc_file_hash("shared_out0.wav") != calc_file_hash("merged_out.wav"));
+        remove("shared_out0.wav");
+        remove("shared_out1.wav");
+        remove("merged_out.wav");
+    }
+
+    SECTION("batch outputs hold no file descriptors open.") {
+        auto count_fds = [] {
+            size_t count = 0;
+            DIR *dir = opendir("/proc/self/fd");
+            REQUIRE(dir != nullptr);
+            while (readdir(dir))
+                ++count;
+            closedir(dir);
+            return count;
+        };
+        EffectNoiseReduction effect;
+        REQUIRE(effect.GetProfileStreaming("bg_input.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+
+        // More outputs than the descriptors left under the limit
+        const size_t before = count_fds();
+        struct rlimit limit, saved;
+        REQUIRE(getrlimit(RLIMIT_NOFILE, &saved) == 0);
+        limit = saved;
+        limit.rlim_cur = before + 16;
+        REQUIRE(setrlimit(RLIMIT_NOFILE, &limit) == 0);
+        std::vector<std::pair<std::string, std::string>> files(48, {"input.wav", "nofile_out.wav"});
+        std::vector<EffectNoiseReduction::BatchResult> results;
+        const bool ok = effect.ReduceNoiseBatch(files, 12.0, 6.0, 3.0, results, 1);
+        const size_t after = count_fds();
+        setrlimit(RLIMIT_NOFILE, &saved);
+
+        CHECK(ok);
+        CHECK(std::all_of(results.begin(), results.end(),
+                          [](const EffectNoiseReduction::BatchResult &result) { return result.success; }));
+        CHECK(after == before);
+        remove("nofile_out.wav");
+    }
+
+    SECTION("batch under a memory budget matches one without.") {
+        EffectNoiseReduction effect;
+        EffectNoiseReduction::Footprint footprint{};
+        CHECK_FALSE(effect.EstimateFootprint("input.wav", footprint));
+        CHECK(effect.GetLastError() == EffectNoiseReduction::Error::NoProfile);
+        REQUIRE(effect.GetProfileStreaming("bg_input.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        CHECK_FALSE(effect.EstimateFootprint("missing.wav", footprint));
+        REQUIRE(effect.EstimateFootprint("input.wav", footprint));
+        CHECK(footprint.streamBytes > 0);
+        CHECK(footprint.trackBytes > footprint.streamBytes);
+
+        // room for one file at a time, then none at all: each still runs
+        std::vector<EffectNoiseReduction::BatchResult> results;
+        REQUIRE(effect.ReduceNoiseBatch({{"input.wav", "batch_out0.wav"}},
+                                        12.0, 6.0, 3.0, results, 1));
+        for (const size_t budget : {footprint.streamBytes, size_t(1)}) {
+            MemoryAdmission admission(budget);
+            REQUIRE(effect.ReduceNoiseBatch({{"input.wav", "budget_out0.wav"},
+                                             {"input.wav", "budget_out1.wav"}},
+                                            12.0, 6.0, 3.0, results, 2, 0, &admission));
+            CHECK(admission.GetAdmitted() == 0);
+            CHECK(calc_file_hash("batch_out0.wav") == calc_file_hash("budget_out0.wav"));
+            CHECK(calc_file_hash("batch_out0.wav") == calc_file_hash("budget_out1.wav"));
+        }
+        remove("batch_out0.wav");
+        remove("budget_out0.wav");
+        remove("budget_out1.wav");
+    }
+
+    SECTION("segments in parallel match sequential processing.") {
+        const auto dir_manager = std::make_shared<DirManager>();
+        auto factory = new TrackFactory(dir_manager);
+
+        // make a file long enough to be split
+        {
+            TrackHolders holders{};
+            REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(factory, holders) == ProgressResult::Success);
+            const auto len = holders[0]->TimeToLongSamples(holders[0]->GetEndTime());
+            std::vector<float> samples(len.as_size_t());
+            holders[0]->Get((samplePtr) &samples[0], floatSample, 0, samples.size());
+            auto long_track = factory->NewWaveTrack(floatSample, holders[0]->GetRate());
+            for (int i = 0; i < 8; ++i)
+                long_track->Append((samplePtr) &samples[0], floatSample, samples.size());
+            long_track->Flush();
+            auto exporter = ExportPCM();
+            auto audioArray = WaveTrackConstArray();
+            audioArray.emplace_back(std::move(long_track));
+            REQUIRE(exporter.Export(audioArray, std::string("long_input.wav")) == ProgressResult::Success);
+        }
+
+        auto reduce = [&](unsigned threads, const std::string &dst) {
+            TrackHolders bg_holders{};
+            REQUIRE(PCMImportFileHandle::Open("bg_input.wav")->Import(factory, bg_holders) == ProgressResult::Success);
+            TrackHolders src_holders{};
+            REQUIRE(PCMImportFileHandle::Open("long_input.wav")->Import(factory, src_holders) == ProgressResult::Success);
+
+            EffectNoiseReduction effect;
+            effect.SetThreads(threads);
+            REQUIRE(effect.GetProfile(bg_holders[0].get(), 0.0, 0.5, 12.0, 6.0, 3.0, factory));
+            REQUIRE(effect.ReduceNoise(src_holders[0].get(), 12.0, 6.0, 3.0, factory));
+
+            auto exporter = ExportPCM();
+            auto audioArray = WaveTrackConstArray();
+            audioArray.emplace_back(std::move(src_holders.at(0)));
+            REQUIRE(exporter.Export(audioArray, dst) == ProgressResult::Success);
+        };
+        reduce(1, "sequential_out.wav");
+        reduce(4, "segments_out.wav");
+
+        CHECK(calc_file_hash("sequential_out.wav") == calc_file_hash("segments_out.wav"));
+        remove("long_input.wav");
+        remove("sequential_out.wav");
+        remove("segments_out.wav");
+
+        delete factory;
+    }
+
+    SECTION("ranges come out as from the whole track, and the rest as it was.") {
+        const auto dir_manager = std::make_shared<DirManager>();
+        TrackFactory factory(dir_manager);
+        TrackHolders bg_holders{}, whole_holders{}, ranged_holders{};
+        REQUIRE(PCMImportFileHandle::Open("bg_input.wav")->Import(&factory, bg_holders) == ProgressResult::Success);
+        REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(&factory, whole_holders) == ProgressResult::Success);
+        REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(&factory, ranged_holders) == ProgressResult::Success);
+        auto &whole = *whole_holders.at(0);
+        auto &ranged = *ranged_holders.at(0);
+        const auto len = whole.TimeToLongSamples(whole.GetEndTime()).as_size_t();
+        std::vector<float> original(len), reduced(len), output(len);
+        whole.Get((samplePtr) original.data(), floatSample, 0, len);
+
+        EffectNoiseReduction effect;
+        REQUIRE(effect.GetProfile(bg_holders[0].get(), 0.0, 0.5, 12.0, 6.0, 3.0, &factory));
+        REQUIRE(effect.ReduceNoise(&whole, 12.0, 6.0, 3.0, &factory));
+        const double seconds = whole.GetEndTime();
+        // Out of order, overlapping, and past the end
+        const EffectNoiseReduction::TimeRanges ranges{
+                {seconds * 0.6, seconds * 0.7}, {seconds * 0.1, seconds * 0.3},
+                {seconds * 0.25, seconds * 0.4}, {seconds * 0.95, seconds * 2}};
+        REQUIRE(effect.ReduceNoiseRanges({&ranged}, ranges, 12.0, 6.0, 3.0, &factory));
+        REQUIRE(ranged.TimeToLongSamples(ranged.GetEndTime()).as_size_t() == len);
+
+        whole.Get((samplePtr) reduced.data(), floatSample, 0, len);
+        ranged.Get((samplePtr) output.data(), floatSample, 0, len);
+        std::vector<bool> inside(len, false);
+        for (const auto &range : ranges)
+            for (auto ii = ranged.TimeToLongSamples(range.first).as_size_t();
+                 ii < std::min(len, ranged.TimeToLongSamples(range.second).as_size_t()); ++ii)
+                inside[ii] = true;
+        size_t mismatches = 0;
+        for (size_t ii = 0; ii < len; ++ii)
+            mismatches += output[ii] != (inside[ii] ? reduced[ii] : original[ii]);
+        CHECK(mismatches == 0);
+
+        // No ranges, nothing reduced
+        REQUIRE(effect.ReduceNoiseRanges({&ranged}, {}, 12.0, 6.0, 3.0, &factory));
+        std::vector<float> again(len);
+        ranged.Get((samplePtr) again.data(), floatSample, 0, len);
+        CHECK(again == output);
+    }
+
+    SECTION("multichannel streaming matches the track path.") {
+        double profile_start = 0.0;
+        double profile_end = 0.5;
+        double noise_gain = 12.0;
+        double sensitivity = 6.0;
+        double smoothing = 3.0;
+
+        // make stereo files out of the mono ones
+        const auto dir_manager = std::make_shared<DirManager>();
+        auto factory = new TrackFactory(dir_manager);
+        auto make_stereo = [&](const char *left, const char *right, const std::string &dst) {
+            auto audioArray = WaveTrackConstArray();
+            for (auto path : {left, right}) {
+                TrackHolders holders{};
+                REQUIRE(PCMImportFileHandle::Open(path)->Import(factory, holders) == ProgressResult::Success);
+                audioArray.emplace_back(std::move(holders.at(0)));
+            }
+            auto exporter = ExportPCM();
+            REQUIRE(exporter.Export(audioArray, dst) == ProgressResult::Success);
+        };
+        make_stereo("bg_input.wav", "input.wav", "stereo_bg.wav");
+        make_stereo("input.wav", "bg_input.wav", "stereo_input.wav");
+
+        // track path
+        TrackHolders bg_holders{};
+        REQUIRE(PCMImportFileHandle::Open("stereo_bg.wav")->Import(factory, bg_holders) == ProgressResult::Success);
+        TrackHolders src_holders{};
+        REQUIRE(PCMImportFileHandle::Open("stereo_input.wav")->Import(factory, src_holders) == ProgressResult::Success);
+        REQUIRE(src_holders.size() == 2);
+
+        auto effect = new EffectNoiseReduction();
+        REQUIRE(effect->GetProfile({bg_holders[0].get(), bg_holders[1].get()}, profile_start, profile_end,
+                                   noise_gain, sensitivity, smoothing, factory));
+        REQUIRE(effect->ReduceNoise({src_holders[0].get(), src_holders[1].get()},
+                                    noise_gain, sensitivity, smoothing, factory));
+        auto exporter = ExportPCM();
+        auto audioArray = WaveTrackConstArray();
+        for (auto &holder : src_holders)
+            audioArray.emplace_back(std::move(holder));
+        REQUIRE(exporter.Export(audioArray, std::string("track_out.wav")) == ProgressResult::Success);
+
+        // streaming path
+        auto stream_effect = new EffectNoiseReduction();
+        REQUIRE(stream_effect->GetProfileStreaming("stereo_bg.wav", profile_start, profile_end,
+                                                   noise_gain, sensitivity, smoothing));
+        REQUIRE(stream_effect->ReduceNoiseStreaming("stereo_input.wav", "stream_out.wav",
+                                                    noise_gain, sensitivity, smoothing));
+
+        CHECK(calc_file_hash("track_out.wav") == calc_file_hash("stream_out.wav"));
+        remove("stereo_bg.wav");
+        remove("stereo_input.wav");
+        remove("track_out.wav");
+        remove("stream_out.wav");
+
+        delete factory;
+        delete effect;
+        delete stream_effect;
+    }
+
+    SECTION("buffers in memory reduce like files, and in place.") {
+        auto read_all = [](const char *path, std::vector<float> &samples) {
+            SF_INFO info = {};
+            SNDFILE *file = sf_open(path, SFM_READ, &info);
+            REQUIRE(file != nullptr);
+            samples.resize(info.frames * info.channels);
+            REQUIRE(sf_readf_float(file, samples.data(), info.frames) == info.frames);
+            sf_close(file);
+            return (double) info.samplerate;
+        };
+        std::vector<float> noise, input, reference;
+        const double rate = read_all("bg_input.wav", noise);
+        read_all("input.wav", input);
+        noise.resize(rate / 2);
+
+        EffectNoiseReduction stream_effect;
+        REQUIRE(stream_effect.GetProfileStreaming("bg_input.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        REQUIRE(stream_effect.ReduceNoiseStreaming("input.wav", "stream_out.wav", 12.0, 6.0, 3.0));
+        read_all("stream_out.wav", reference);
+        remove("stream_out.wav");
+
+        // Against the file's 16 bit rounding
+        EffectNoiseReduction effect;
+        CHECK_FALSE(effect.GetProfileBuffer(noise.data(), 1, 0, rate, 12.0, 6.0, 3.0));
+        REQUIRE(effect.GetProfileBuffer(noise.data(), 1, noise.size(), rate, 12.0, 6.0, 3.0));
+        CHECK_FALSE(effect.ReduceNoiseBuffer(input.data(), input.data(), 1, input.size(), rate / 2,
+                                             12.0, 6.0, 3.0));
+        std::vector<float> output(input.size());
+        REQUIRE(effect.ReduceNoiseBuffer(input.data(), output.data(), 1, input.size(), rate, 12.0, 6.0, 3.0));
+        REQUIRE(reference.size() == output.size());
+        float difference = 0;
+        for (size_t ii = 0; ii < output.size(); ++ii)
+            difference = std::max(difference, std::abs(output[ii] - reference[ii]));
+        CHECK(difference <= 1.0f / 32768);
+
+        // The same signal in both channels, reduced where it is
+        std::vector<float> stereo(input.size() * 2);
+        for (size_t ii = 0; ii < input.size(); ++ii)
+            stereo[2 * ii] = stereo[2 * ii + 1] = input[ii];
+        REQUIRE(effect.ReduceNoiseBuffer(stereo.data(), stereo.data(), 2, input.size(), rate, 12.0, 6.0, 3.0));
+        size_t mismatches = 0;
+        for (size_t ii = 0; ii < input.size(); ++ii)
+            mismatches += stereo[2 * ii] != output[ii] || stereo[2 * ii + 1] != output[ii];
+        CHECK(mismatches == 0);
+    }
+
+    SECTION("sound files in memory import, export and reduce as on disk.") {
+        auto read_bytes = [](const char *path) {
+            std::ifstream in(path, std::ios::binary);
+            return std::vector<char>((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        };
+        const auto noise = read_bytes("bg_input.wav");
+        const auto input = read_bytes("input.wav");
+        REQUIRE(!input.empty());
+
+        // Imported from memory and exported to it, as from and to the file
+        const auto dir_manager = std::make_shared<DirManager>();
+        TrackFactory factory(dir_manager);
+        TrackHolders holders{};
+        auto handler = PCMImportFileHandle::OpenMemory(input.data(), input.size());
+        REQUIRE(handler);
+        REQUIRE(handler->Import(&factory, holders) == ProgressResult::Success);
+        CHECK_FALSE(PCMImportFileHandle::OpenMemory(input.data(), 16));
+        WaveTrackConstArray tracks;
+        tracks.emplace_back(std::move(holders.at(0)));
+        std::vector<char> exported;
+        REQUIRE(ExportPCM().Export(tracks, exported) == ProgressResult::Success);
+        REQUIRE(ExportPCM().Export(tracks, std::string("memory_out.wav")) == ProgressResult::Success);
+        CHECK(exported == read_bytes("memory_out.wav"));
+        remove("memory_out.wav");
+
+        EffectNoiseReduction stream_effect;
+        REQUIRE(stream_effect.GetProfileStreaming("bg_input.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        REQUIRE(stream_effect.ReduceNoiseStreaming("input.wav", "stream_out.wav", 12.0, 6.0, 3.0));
+        const auto reference = read_bytes("stream_out.wav");
+        remove("stream_out.wav");
+
+        EffectNoiseReduction effect;
+        REQUIRE(effect.GetProfileMemory(noise.data(), noise.size(), 0.0, 0.5, 12.0, 6.0, 3.0));
+        std::vector<char> output;
+        REQUIRE(effect.ReduceNoiseMemory(input.data(), input.size(), output, 12.0, 6.0, 3.0));
+        CHECK(output == reference);
+        CHECK_FALSE(effect.ReduceNoiseMemory(input.data(), 16, output, 12.0, 6.0, 3.0));
+        CHECK(effect.GetLastError() == EffectNoiseReduction::Error::File);
+    }
+
+    SECTION("compact histories take less memory and reduce within their rounding.") {
+        std::vector<float> noise, input;
+        double rate = 0;
+        for (auto target : {&noise, &input}) {
+            SF_INFO info = {};
+            SNDFILE *file = sf_open(target == &noise ? "bg_input.wav" : "input.wav", SFM_READ, &info);
+            REQUIRE(file != nullptr);
+            target->resize(info.frames * info.channels);
+            REQUIRE(sf_readf_float(file, target->data(), info.frames) == info.frames);
+            sf_close(file);
+            rate = info.samplerate;
+        }
+
+        // Large windows, whose rows are the longest
+        EffectNoiseReduction exact, compact;
+        compact.SetCompactHistory(true);
+        std::vector<float> reference(input.size()), output(input.size());
+        for (auto effect : {&exact, &compact}) {
+            REQUIRE(effect->SetAdvancedSettings(8192, 4, 2, 1));
+            REQUIRE(effect->GetProfileBuffer(noise.data(), 1, noise.size(), rate, 12.0, 6.0, 3.0));
+            REQUIRE(effect->ReduceNoiseBuffer(input.data(), effect == &exact ? reference.data() : output.data(),
+                                              1, input.size(), rate, 12.0, 6.0, 3.0));
+        }
+
+        float peak = 0, difference = 0;
+        for (size_t ii = 0; ii < output.size(); ++ii) {
+            peak = std::max(peak, std::abs(reference[ii]));
+            difference = std::max(difference, std::abs(output[ii] - reference[ii]));
+        }
+        CHECK(peak > 0);
+        CHECK(difference <= 1e-3f * peak);
+
+        EffectNoiseReduction::Footprint exactFootprint, compactFootprint;
+        REQUIRE(exact.EstimateFootprint("input.wav", exactFootprint));
+        REQUIRE(compact.EstimateFootprint("input.wav", compactFootprint));
+        CHECK(compactFootprint.streamBytes < exactFootprint.streamBytes);
+    }
+
+    SECTION("progress reaches the end, and cancelling stops each stage.") {
+        const auto dir_manager = std::make_shared<DirManager>();
+        TrackFactory factory(dir_manager);
+
+        // Reported in order, from 0 to 1
+        std::vector<double> fractions;
+        Progress progress([&](double fraction) {
+            fractions.push_back(fraction);
+            return true;
+        });
+        TrackHolders holders{};
+        auto handler = PCMImportFileHandle::Open("input.wav");
+        handler->SetProgress(&progress);
+        REQUIRE(handler->Import(&factory, holders) == ProgressResult::Success);
+        REQUIRE(fractions.size() >= 2);
+        CHECK(fractions.front() == 0.0);
+        CHECK(fractions.back() == 1.0);
+        CHECK(std::is_sorted(fractions.begin(), fractions.end()));
+        auto &track = *holders.at(0);
+        const auto len = track.TimeToLongSamples(track.GetEndTime()).as_size_t();
+        std::vector<float> before(len), after(len);
+        track.Get((samplePtr) before.data(), floatSample, 0, len);
+
+        // Cancelled before they start, they stop at their first block
+        Progress cancelled;
+        cancelled.Cancel();
+        TrackHolders unused{};
+        handler = PCMImportFileHandle::Open("input.wav");
+        handler->SetProgress(&cancelled);
+        CHECK(handler->Import(&factory, unused) == ProgressResult::Cancelled);
+        {
+            WaveTrackConstArray tracks;
+            tracks.emplace_back(factory.DuplicateWaveTrack(track));
+            auto exporter = ExportPCM();
+            exporter.SetProgress(&cancelled);
+            CHECK(exporter.Export(tracks, std::string("cancelled_out.wav")) == ProgressResult::Cancelled);
+            remove("cancelled_out.wav");
+        }
+
+        // Cancelled halfway through, the track is left as it was
+        EffectNoiseReduction effect;
+        REQUIRE(effect.GetProfileStreaming("bg_input.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        Progress halfway([](double fraction) { return fraction < 0.5; });
+        effect.SetProgress(&halfway);
+        CHECK_FALSE(effect.ReduceNoise(std::vector<WaveTrack *>{&track}, 12.0, 6.0, 3.0, &factory));
+        CHECK(effect.GetLastError() == EffectNoiseReduction::Error::Cancelled);
+        track.Get((samplePtr) after.data(), floatSample, 0, len);
+        CHECK(after == before);
+
+        effect.SetProgress(&cancelled);
+        CHECK_FALSE(effect.ReduceNoiseStreaming("input.wav", "cancelled_out.wav", 12.0, 6.0, 3.0));
+        CHECK(effect.GetLastError() == EffectNoiseReduction::Error::Cancelled);
+        remove("cancelled_out.wav");
+
+        // A batch on two threads is one stage, which a file ending or
+        // starting does not set back
+        fractions.clear();
+        effect.SetProgress(&progress);
+        std::vector<EffectNoiseReduction::BatchResult> results;
+        REQUIRE(effect.ReduceNoiseBatch({{"bg_input.wav", "batch_out0.wav"}, {"input.wav", "batch_out1.wav"},
+                                         {"bg_input.wav", "batch_out2.wav"}}, 12.0, 6.0, 3.0, results, 2));
+        REQUIRE(fractions.size() >= 2);
+        CHECK(fractions.front() == 0.0);
+        CHECK(fractions.back() == 1.0);
+        CHECK(std::is_sorted(fractions.begin(), fractions.end()));
+        remove("batch_out0.wav");
+        remove("batch_out1.wav");
+        remove("batch_out2.wav");
+
+        effect.SetProgress(nullptr);
+        CHECK(effect.ReduceNoise(std::vector<WaveTrack *>{&track}, 12.0, 6.0, 3.0, &factory));
+    }
+
+    SECTION("linked channels share one mask.") {
+        std::vector<float> input;
+        double rate;
+        {
+            SF_INFO info = {};
+            SNDFILE *file = sf_open("input.wav", SFM_READ, &info);
+            REQUIRE(file != nullptr);
+            input.resize(info.frames);
+            REQUIRE(sf_readf_float(file, input.data(), info.frames) == info.frames);
+            sf_close(file);
+            rate = info.samplerate;
+        }
+        EffectNoiseReduction effect;
+        REQUIRE(effect.GetProfileStreaming("bg_input.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        std::vector<float> mono(input.size());
+        REQUIRE(effect.ReduceNoiseBuffer(input.data(), mono.data(), 1, input.size(), rate, 12.0, 6.0, 3.0));
+
+        // The same signal in both channels combines to its own power, by
+        // the mean or the greatest, and so reduces as it does alone
+        std::vector<float> stereo(input.size() * 2), output(stereo.size());
+        for (size_t ii = 0; ii < input.size(); ++ii)
+            stereo[2 * ii] = stereo[2 * ii + 1] = input[ii];
+        for (auto link : {EffectNoiseReduction::ChannelLink::Mean, EffectNoiseReduction::ChannelLink::Max}) {
+            effect.SetChannelLink(link);
+            REQUIRE(effect.ReduceNoiseBuffer(stereo.data(), output.data(), 2, input.size(), rate,
+                                             12.0, 6.0, 3.0));
+            size_t mismatches = 0;
+            for (size_t ii = 0; ii < input.size(); ++ii)
+                mismatches += output[2 * ii] != mono[ii] || output[2 * ii + 1] != mono[ii];
+            CHECK(mismatches == 0);
+        }
+
+        // Mid/side hears the sum, but still applies one mask to both
+        effect.SetChannelLink(EffectNoiseReduction::ChannelLink::MidSide);
+        REQUIRE(effect.ReduceNoiseBuffer(stereo.data(), output.data(), 2, input.size(), rate, 12.0, 6.0, 3.0));
+        size_t mismatches = 0;
+        for (size_t ii = 0; ii < input.size(); ++ii)
+            mismatches += output[2 * ii] != output[2 * ii + 1];
+        CHECK(mismatches == 0);
+        CHECK(output[0] != 0.0f);
+
+        // Only with two channels; one is never linked
+        std::vector<float> three(input.size() * 3);
+        CHECK_FALSE(effect.ReduceNoiseBuffer(three.data(), three.data(), 3, input.size(), rate, 12.0, 6.0, 3.0));
+        CHECK(effect.GetLastError() == EffectNoiseReduction::Error::Settings);
+        std::vector<float> single(input.size());
+        REQUIRE(effect.ReduceNoiseBuffer(input.data(), single.data(), 1, input.size(), rate, 12.0, 6.0, 3.0));
+        CHECK(single == mono);
+
+        // Tracks the same: two linked as one alone
+        const auto dir_manager = std::make_shared<DirManager>();
+        TrackFactory factory(dir_manager);
+        std::vector<WaveTrack::Holder> tracks;
+        for (int cc = 0; cc < 3; ++cc) {
+            TrackHolders holders{};
+            REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(&factory, holders) == ProgressResult::Success);
+            tracks.push_back(std::move(holders.at(0)));
+        }
+        effect.SetChannelLink(EffectNoiseReduction::ChannelLink::None);
+        REQUIRE(effect.ReduceNoise(std::vector<WaveTrack *>{tracks[2].get()}, 12.0, 6.0, 3.0, &factory));
+        effect.SetChannelLink(EffectNoiseReduction::ChannelLink::Mean);
+        REQUIRE(effect.ReduceNoise({tracks[0].get(), tracks[1].get()}, 12.0, 6.0, 3.0, &factory));
+        const auto len = input.size();
+        std::vector<float> alone(len), linked(len);
+        tracks[2]->Get((samplePtr) alone.data(), floatSample, 0, len);
+        for (int cc = 0; cc < 2; ++cc) {
+            REQUIRE(tracks[cc]->TimeToLongSamples(tracks[cc]->GetEndTime()) == sampleCount(len));
+            tracks[cc]->Get((samplePtr) linked.data(), floatSample, 0, len);
+            CHECK(linked == alone);
+        }
+        effect.SetChannelLink(EffectNoiseReduction::ChannelLink::None);
+    }
+
+    SECTION("a frequency range limits the bands reduced.") {
+        std::vector<float> input;
+        double rate;
+        {
+            SF_INFO info = {};
+            SNDFILE *file = sf_open("input.wav", SFM_READ, &info);
+            REQUIRE(file != nullptr);
+            input.resize(info.frames);
+            REQUIRE(sf_readf_float(file, input.data(), info.frames) == info.frames);
+            sf_close(file);
+            rate = info.samplerate;
+        }
+        EffectNoiseReduction effect;
+        REQUIRE(effect.GetProfileStreaming("bg_input.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        std::vector<float> whole(input.size()), output(input.size());
+        REQUIRE(effect.ReduceNoiseBuffer(input.data(), whole.data(), 1, input.size(), rate, 12.0, 6.0, 3.0));
+
+        CHECK_FALSE(effect.SetFrequencyRange(2000.0, 1000.0));
+        CHECK(effect.GetLastError() == EffectNoiseReduction::Error::Settings);
+        CHECK_FALSE(effect.SetFrequencyRange(std::nan(""), -1.0));
+
+        // All of the spectrum, bounded or not, is the same
+        REQUIRE(effect.SetFrequencyRange(0.0, rate));
+        REQUIRE(effect.ReduceNoiseBuffer(input.data(), output.data(), 1, input.size(), rate, 12.0, 6.0, 3.0));
+        CHECK(output == whole);
+
+        // None of it passes the input through
+        REQUIRE(effect.SetFrequencyRange(rate, -1.0));
+        REQUIRE(effect.ReduceNoiseBuffer(input.data(), output.data(), 1, input.size(), rate, 12.0, 6.0, 3.0));
+        float difference = 0;
+        for (size_t ii = 0; ii < input.size(); ++ii)
+            difference = std::max(difference, std::abs(output[ii] - input[ii]));
+        CHECK(difference < 1e-4f);
+
+        // A band is reduced less than the whole, but still reduced
+        REQUIRE(effect.SetFrequencyRange(100.0, 1000.0));
+        REQUIRE(effect.ReduceNoiseBuffer(input.data(), output.data(), 1, input.size(), rate, 12.0, 6.0, 3.0));
+        double inputEnergy = 0, bandEnergy = 0, wholeEnergy = 0;
+        for (size_t ii = 0; ii < input.size(); ++ii) {
+            inputEnergy += input[ii] * input[ii];
+            bandEnergy += output[ii] * output[ii];
+            wholeEnergy += whole[ii] * whole[ii];
+        }
+        CHECK(bandEnergy < inputEnergy);
+        CHECK(bandEnergy > wholeEnergy);
+        REQUIRE(effect.SetFrequencyRange(-1.0, -1.0));
+
+        // A profile of a band is cached, saved and loaded as one, and only
+        // reduces within it
+        REQUIRE(EffectNoiseReduction::SetProfileCache(true));
+        EffectNoiseReduction full, band, loaded;
+        REQUIRE(full.GetProfileCached("bg_input.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        REQUIRE(band.SetFrequencyRange(100.0, 1000.0));
+        REQUIRE(band.GetProfileCached("bg_input.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        REQUIRE(full.SaveProfile("full.bin"));
+        REQUIRE(band.SaveProfile("band.bin"));
+        CHECK(calc_file_hash("full.bin") != calc_file_hash("band.bin"));
+        REQUIRE(band.ReduceNoiseBuffer(input.data(), output.data(), 1, input.size(), rate, 12.0, 6.0, 3.0));
+        REQUIRE(band.SetFrequencyRange(-1.0, -1.0));
+        CHECK_FALSE(band.ReduceNoiseBuffer(input.data(), output.data(), 1, input.size(), rate, 12.0, 6.0, 3.0));
+        CHECK(band.GetLastError() == EffectNoiseReduction::Error::Settings);
+        REQUIRE(band.GetProfileCached("bg_input.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        REQUIRE(band.ReduceNoiseBuffer(input.data(), output.data(), 1, input.size(), rate, 12.0, 6.0, 3.0));
+        CHECK(output == whole);
+
+        REQUIRE(loaded.LoadProfile("band.bin"));
+        CHECK_FALSE(loaded.ReduceNoiseBuffer(input.data(), output.data(), 1, input.size(), rate, 12.0, 6.0, 3.0));
+        CHECK(loaded.GetLastError() == EffectNoiseReduction::Error::Settings);
+        CHECK_FALSE(full.MergeProfile(loaded));
+        CHECK(full.GetLastError() == EffectNoiseReduction::Error::Settings);
+        REQUIRE(EffectNoiseReduction::SetProfileCache(false));
+        EffectNoiseReduction::ClearProfileCache();
+        remove("full.bin");
+        remove("band.bin");
+    }
+
+    SECTION("steady state allocates nothing.") {
+        // make a file eight times as long as the input
+        {
+            const auto dir_manager = std::make_shared<DirManager>();
+            TrackFactory factory(dir_manager);
+            TrackHolders holders{};
+            REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(&factory, holders) == ProgressResult::Success);
+            const auto len = holders[0]->TimeToLongSamples(holders[0]->GetEndTime());
+            std::vector<float> samples(len.as_size_t());
+            holders[0]->Get((samplePtr) &samples[0], floatSample, 0, samples.size());
+            auto long_track = factory.NewWaveTrack(floatSample, holders[0]->GetRate());
+            for (int i = 0; i < 8; ++i)
+                long_track->Append((samplePtr) &samples[0], floatSample, samples.size());
+            long_track->Flush();
+            auto exporter = ExportPCM();
+            auto audioArray = WaveTrackConstArray();
+            audioArray.emplace_back(std::move(long_track));
+            REQUIRE(exporter.Export(audioArray, std::string("long_input.wav")) == ProgressResult::Success);
+        }
+
+        EffectNoiseReduction effect;
+        REQUIRE(effect.GetProfileStreaming("bg_input.wav", 0.0, 0.5, 12.0, 6.0, 3.0));
+        auto count = [&](const char *src) {
+            allocations = 0;
+            countAllocations = true;
+            const bool result = effect.ReduceNoiseStreaming(src, "alloc_out.wav", 12.0, 6.0, 3.0);
+            countAllocations = false;
+            REQUIRE(result);
+            return allocations.load();
+        };
+        // The first run also fills the caches of FFT tables and windows
+        count("input.wav");
+        const auto once = count("input.wav");
+        CHECK(count("long_input.wav") == once);
+
+        remove("long_input.wav");
+        remove("alloc_out.wav");
+    }
 }
 }